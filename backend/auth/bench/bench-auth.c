@@ -0,0 +1,462 @@
+// bench-auth - end-to-end login benchmark for linuxio-auth
+//
+// Serves a private unix socket the way systemd would and drives concurrent
+// logins over the real v3 protocol (linuxio_protocol.h):
+//   -m accept   Accept=yes: one linuxio-auth per connection, conn on stdin/stdout
+//   -m daemon   Accept=no: one `linuxio-auth --daemon` with LISTEN_FDS=1
+//   -m parked   daemon with LINUXIO_AUTH_PARK_BRIDGE=1; a login that fell
+//               back to fork+exec (its timings have a fork phase) fails
+// linuxio-auth inherits our environment, so LINUXIO_AUTH_* knobs apply.
+//
+// Every request asks for the timing trailer; the report has throughput,
+// latency percentiles and a per-phase breakdown. `make bench-auth` builds
+// linuxio-auth against a stub PAM service, sudo and bridge and runs this
+// for each mode. Needs root, like linuxio-auth itself.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../linuxio_protocol.h"
+
+static const char *const phase_names[PROTO_PHASE_COUNT] = {
+    [PROTO_PHASE_REQUEST_READ] = "request_read",
+    [PROTO_PHASE_PAM_AUTH] = "pam_auth",
+    [PROTO_PHASE_PAM_ACCT] = "pam_acct",
+    [PROTO_PHASE_PAM_SETCRED] = "pam_setcred",
+    [PROTO_PHASE_SUDO] = "sudo",
+    [PROTO_PHASE_BRIDGE_VALIDATE] = "bridge_validate",
+    [PROTO_PHASE_PAM_OPEN_SESSION] = "pam_open_session",
+    [PROTO_PHASE_FORK] = "fork",
+    [PROTO_PHASE_EXEC] = "exec",
+    [PROTO_PHASE_SEND_OK] = "send_ok",
+};
+
+struct samples
+{
+  uint32_t *v;
+  size_t n;
+  size_t cap;
+};
+
+struct bench
+{
+  char *auth;
+  const char *mode;
+  int parked; // every login must be a parked handoff
+  const char *user;
+  const char *password;
+  int clients;
+  int logins;
+  int warmup;
+  int hold_ms;
+  struct sockaddr_un addr;
+  atomic_int next;     // login tickets handed out (warmup first)
+  atomic_int failures;
+  atomic_int stop;
+  _Atomic uint64_t measure_start_us; // when the first measured login began
+  pthread_mutex_t lock;
+  struct samples latency;
+  struct samples phase[PROTO_PHASE_COUNT];
+};
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void sleep_ms(int ms)
+{
+  struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L};
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    ;
+}
+
+static void samples_add(struct samples *s, uint32_t v)
+{
+  if (s->n == s->cap)
+  {
+    size_t cap = s->cap ? s->cap * 2 : 1024;
+    uint32_t *grown = realloc(s->v, cap * sizeof(*grown));
+    if (!grown)
+      return;
+    s->v = grown;
+    s->cap = cap;
+  }
+  s->v[s->n++] = v;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples.
+static uint32_t pct(const struct samples *s, double p)
+{
+  if (s->n == 0)
+    return 0;
+  size_t rank = (size_t)(p / 100.0 * (double)s->n + 0.999999);
+  if (rank == 0)
+    rank = 1;
+  if (rank > s->n)
+    rank = s->n;
+  return s->v[rank - 1];
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+  uint8_t *p = buf;
+  while (len > 0)
+  {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+static size_t put_lenstr(uint8_t *dst, const char *s)
+{
+  size_t len = strlen(s);
+  dst[0] = (uint8_t)(len >> 8);
+  dst[1] = (uint8_t)len;
+  memcpy(dst + 2, s, len);
+  return 2 + len;
+}
+
+static int skip_lenstr(int fd)
+{
+  uint8_t lenbuf[2];
+  char buf[PROTO_MAX_ERROR];
+  if (read_full(fd, lenbuf, 2) != 0)
+    return -1;
+  size_t len = ((size_t)lenbuf[0] << 8) | lenbuf[1];
+  while (len > 0)
+  {
+    size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+    if (read_full(fd, buf, chunk) != 0)
+      return -1;
+    len -= chunk;
+  }
+  return 0;
+}
+
+// One login. Returns 0 on an OK response; phases are filled from the
+// trailer (UINT32_MAX where absent).
+static int do_login(struct bench *b, int ticket, uint32_t *latency_us,
+                    uint32_t phases[PROTO_PHASE_COUNT])
+{
+  for (int i = 0; i < PROTO_PHASE_COUNT; i++)
+    phases[i] = UINT32_MAX;
+
+  uint8_t req[PROTO_AUTH_REQ_HEADER_SIZE + 4 * 2 + PROTO_MAX_USERNAME + PROTO_MAX_PASSWORD +
+              PROTO_MAX_SESSION_ID + PROTO_MAX_REMOTE_HOST];
+  char session_id[PROTO_MAX_SESSION_ID];
+  snprintf(session_id, sizeof(session_id), "bench-%d-%d", (int)getpid(), ticket);
+  size_t len = 0;
+  req[len++] = PROTO_MAGIC_0;
+  req[len++] = PROTO_MAGIC_1;
+  req[len++] = PROTO_MAGIC_2;
+  req[len++] = PROTO_VERSION;
+  req[len++] = PROTO_REQ_FLAG_TIMING;
+  req[len++] = 0;
+  req[len++] = 0;
+  req[len++] = 0;
+  len += put_lenstr(req + len, b->user);
+  len += put_lenstr(req + len, b->password);
+  len += put_lenstr(req + len, session_id);
+  len += put_lenstr(req + len, "127.0.0.1");
+
+  uint64_t t0 = now_us();
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  int ok = -1;
+  uint8_t hdr[PROTO_AUTH_RESP_HEADER_SIZE];
+  if (connect(fd, (const struct sockaddr *)&b->addr, sizeof(b->addr)) != 0 ||
+      write(fd, req, len) != (ssize_t)len || read_full(fd, hdr, sizeof(hdr)) != 0 ||
+      hdr[0] != PROTO_MAGIC_0 || hdr[1] != PROTO_MAGIC_1 || hdr[2] != PROTO_MAGIC_2)
+    goto out;
+
+  if (hdr[4] == PROTO_STATUS_OK)
+  {
+    uint8_t ids[8];
+    if (read_full(fd, ids, sizeof(ids)) != 0 || skip_lenstr(fd) != 0)
+      goto out;
+  }
+  else if (skip_lenstr(fd) != 0)
+  {
+    goto out;
+  }
+
+  if (hdr[7] & PROTO_RESP_FLAG_TIMING)
+  {
+    uint8_t count;
+    if (read_full(fd, &count, 1) != 0)
+      goto out;
+    for (int i = 0; i < count; i++)
+    {
+      uint8_t e[5];
+      if (read_full(fd, e, sizeof(e)) != 0)
+        goto out;
+      if (e[0] < PROTO_PHASE_COUNT)
+        phases[e[0]] = ((uint32_t)e[1] << 24) | ((uint32_t)e[2] << 16) | ((uint32_t)e[3] << 8) | e[4];
+    }
+  }
+  uint64_t d = now_us() - t0;
+  *latency_us = d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+  ok = hdr[4] == PROTO_STATUS_OK ? 0 : -1;
+
+  // The connection now belongs to the bridge; holding it holds the session.
+  if (ok == 0 && b->hold_ms > 0)
+    sleep_ms(b->hold_ms);
+out:
+  close(fd);
+  return ok;
+}
+
+static void *client_main(void *p)
+{
+  struct bench *b = p;
+  for (;;)
+  {
+    int ticket = atomic_fetch_add(&b->next, 1);
+    if (ticket >= b->warmup + b->logins)
+      break;
+    if (ticket == b->warmup)
+      atomic_store(&b->measure_start_us, now_us());
+    uint32_t latency = 0;
+    uint32_t phases[PROTO_PHASE_COUNT];
+    int rc = do_login(b, ticket, &latency, phases);
+    if (ticket < b->warmup)
+      continue;
+    if (rc == 0 && b->parked && phases[PROTO_PHASE_FORK] != UINT32_MAX)
+      rc = -1;
+    if (rc != 0)
+    {
+      atomic_fetch_add(&b->failures, 1);
+      continue;
+    }
+    pthread_mutex_lock(&b->lock);
+    samples_add(&b->latency, latency);
+    for (int i = 0; i < PROTO_PHASE_COUNT; i++)
+    {
+      if (phases[i] != UINT32_MAX)
+        samples_add(&b->phase[i], phases[i]);
+    }
+    pthread_mutex_unlock(&b->lock);
+  }
+  return NULL;
+}
+
+// Accept=yes: what systemd does for every connection.
+struct acceptor
+{
+  struct bench *b;
+  int listen_fd;
+};
+
+static void *acceptor_main(void *p)
+{
+  struct acceptor *a = p;
+  while (!atomic_load(&a->b->stop))
+  {
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+      ;
+    struct pollfd pfd = {.fd = a->listen_fd, .events = POLLIN, .revents = 0};
+    if (poll(&pfd, 1, 100) <= 0)
+      continue;
+    int conn = accept4(a->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (conn < 0)
+      continue;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      if (dup2(conn, STDIN_FILENO) < 0 || dup2(conn, STDOUT_FILENO) < 0)
+        _exit(127);
+      char *const argv[] = {a->b->auth, NULL};
+      execv(a->b->auth, argv);
+      _exit(127);
+    }
+    close(conn);
+  }
+  return NULL;
+}
+
+static pid_t start_daemon(struct bench *b, int listen_fd)
+{
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+  // dup2() onto itself keeps FD_CLOEXEC, so clear it explicitly.
+  if (listen_fd == 3 ? fcntl(3, F_SETFD, 0) < 0 : dup2(listen_fd, 3) < 0)
+    _exit(127);
+  char pidbuf[16];
+  snprintf(pidbuf, sizeof(pidbuf), "%d", (int)getpid());
+  setenv("LISTEN_FDS", "1", 1);
+  setenv("LISTEN_PID", pidbuf, 1);
+  if (b->parked)
+    setenv("LINUXIO_AUTH_PARK_BRIDGE", "1", 1);
+  char *const argv[] = {b->auth, "--daemon", NULL};
+  execv(b->auth, argv);
+  _exit(127);
+}
+
+static void report(struct bench *b, double elapsed_s)
+{
+  qsort(b->latency.v, b->latency.n, sizeof(uint32_t), cmp_u32);
+  printf("mode=%s clients=%d logins=%d ok=%zu failed=%d hold_ms=%d elapsed=%.2fs\n",
+         b->mode, b->clients, b->logins, b->latency.n, atomic_load(&b->failures),
+         b->hold_ms, elapsed_s);
+  printf("  throughput %.1f logins/s\n", elapsed_s > 0 ? (double)b->latency.n / elapsed_s : 0.0);
+  printf("  latency us    p50 %8u  p99 %8u  p999 %8u  max %8u\n",
+         pct(&b->latency, 50), pct(&b->latency, 99), pct(&b->latency, 99.9),
+         pct(&b->latency, 100));
+  for (int i = 0; i < PROTO_PHASE_COUNT; i++)
+  {
+    struct samples *s = &b->phase[i];
+    if (s->n == 0)
+      continue;
+    qsort(s->v, s->n, sizeof(uint32_t), cmp_u32);
+    printf("  %-16s p50 %8u  p99 %8u  p999 %8u  max %8u\n", phase_names[i],
+           pct(s, 50), pct(s, 99), pct(s, 99.9), pct(s, 100));
+  }
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s -a linuxio-auth -u user [-m accept|daemon|parked] [-p password]\n"
+          "          [-c clients] [-n logins] [-w warmup] [-H hold_ms]\n",
+          argv0);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  static struct bench b = {
+      .mode = "accept",
+      .password = "bench",
+      .clients = 8,
+      .logins = 1000,
+      .warmup = -1,
+      .lock = PTHREAD_MUTEX_INITIALIZER,
+  };
+  int opt;
+  while ((opt = getopt(argc, argv, "a:m:u:p:c:n:w:H:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'a': b.auth = optarg; break;
+    case 'm': b.mode = optarg; break;
+    case 'u': b.user = optarg; break;
+    case 'p': b.password = optarg; break;
+    case 'c': b.clients = atoi(optarg); break;
+    case 'n': b.logins = atoi(optarg); break;
+    case 'w': b.warmup = atoi(optarg); break;
+    case 'H': b.hold_ms = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  b.parked = b.mode && strcmp(b.mode, "parked") == 0;
+  int daemon_mode = b.parked || (b.mode && strcmp(b.mode, "daemon") == 0);
+  if (!b.auth || !b.user || b.clients < 1 || b.logins < 1 ||
+      (!daemon_mode && strcmp(b.mode, "accept") != 0))
+    usage(argv[0]);
+  if (b.warmup < 0)
+    b.warmup = 2 * b.clients;
+
+  char dir[] = "/tmp/linuxio-bench-sock.XXXXXX";
+  if (!mkdtemp(dir))
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+  b.addr.sun_family = AF_UNIX;
+  snprintf(b.addr.sun_path, sizeof(b.addr.sun_path), "%s/auth.sock", dir);
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0 || bind(listen_fd, (const struct sockaddr *)&b.addr, sizeof(b.addr)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0)
+  {
+    perror("listen");
+    return 1;
+  }
+
+  // Forked before any client thread exists
+  pid_t daemon_pid = -1;
+  pthread_t acceptor_thread;
+  struct acceptor acc = {.b = &b, .listen_fd = listen_fd};
+  if (daemon_mode)
+  {
+    daemon_pid = start_daemon(&b, listen_fd);
+    if (daemon_pid < 0)
+    {
+      perror("fork");
+      return 1;
+    }
+  }
+  else if (pthread_create(&acceptor_thread, NULL, acceptor_main, &acc) != 0)
+  {
+    fprintf(stderr, "failed to start acceptor\n");
+    return 1;
+  }
+
+  pthread_t *threads = calloc((size_t)b.clients, sizeof(*threads));
+  if (!threads)
+    return 1;
+  int started = 0;
+  for (; started < b.clients; started++)
+  {
+    if (pthread_create(&threads[started], NULL, client_main, &b) != 0)
+      break;
+  }
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  // Throughput counts from the first measured login; warmup ones still in
+  // flight at that point overlap it slightly.
+  double elapsed = (double)(now_us() - atomic_load(&b.measure_start_us)) / 1e6;
+
+  atomic_store(&b.stop, 1);
+  if (daemon_mode)
+  {
+    kill(daemon_pid, SIGTERM);
+    (void)waitpid(daemon_pid, NULL, 0);
+  }
+  else
+  {
+    pthread_join(acceptor_thread, NULL);
+  }
+  // Auth instances still finishing their sessions
+  sleep_ms(200);
+  while (waitpid(-1, NULL, WNOHANG) > 0)
+    ;
+
+  close(listen_fd);
+  unlink(b.addr.sun_path);
+  rmdir(dir);
+
+  report(&b, elapsed);
+  return atomic_load(&b.failures) == 0 ? 0 : 1;
+}
@@ -0,0 +1,463 @@
+// microbench-auth - per-function timings of linuxio-auth's login path
+//
+// Compiles linuxio-auth.c into this binary (its main() renamed) and times
+// the functions every login goes through, one at a time:
+//   request parsing     auth_request_size + take_lenstr, and read_auth_request
+//                       of a request queued on a socketpair
+//   validators          valid_session_id, valid_remote_host, valid_locale
+//   journal             journal_send_formatted, formatting only unless -j
+//   responses           send_response and write_bootstrap_binary to /dev/null
+//   group membership    user_in_group for -u, with and without the NSS cache
+//   bridge spawn        spawn_bridge_process up to exec (EOF on exec-status)
+// Cheap functions run in a loop until it takes -t ms; the spawn runs -n
+// times and also reports percentiles. The report is one JSON object on
+// stdout. `make bench-auth-micro` builds this with the stub bridge of
+// bench-auth; the spawn benchmark needs root and is skipped otherwise.
+
+// Keep the journal quiet unless -j: every entry goes through
+// bench_journal_sendv, which only forwards when asked to.
+#define main linuxio_auth_main
+#define sd_journal_sendv bench_journal_sendv
+#include "../linuxio-auth.c"
+#undef sd_journal_sendv
+#undef main
+
+int sd_journal_sendv(const struct iovec *iov, int n);
+
+#define BENCH_TIME_MS_DEFAULT 200
+#define BENCH_SPAWNS_DEFAULT  200
+#define BENCH_MAX_ITERATIONS  (1ull << 32)
+
+static int g_bench_journal;
+static uint64_t g_bench_target_ns = BENCH_TIME_MS_DEFAULT * 1000000ull;
+static int g_bench_spawns = BENCH_SPAWNS_DEFAULT;
+static int g_bench_first = 1;
+static volatile uint64_t g_bench_sink; // keeps results from being optimized out
+
+int bench_journal_sendv(const struct iovec *iov, int n)
+{
+  return g_bench_journal ? sd_journal_sendv(iov, n) : 0;
+}
+
+static uint64_t bench_now_ns(void)
+{
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// -------- report --------
+static void bench_emit_begin(const char *name, uint64_t iterations, double ns_per_op)
+{
+  printf("%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f",
+         g_bench_first ? "" : ",", name, (unsigned long long)iterations, ns_per_op);
+  g_bench_first = 0;
+}
+
+static void bench_emit_end(void)
+{
+  printf("}");
+}
+
+// -------- loop benchmarks --------
+// fn runs its operation n times. n grows until one run takes the target
+// time, predicting the next n from the last run like Go's testing.B.
+typedef void (*bench_loop_fn)(uint64_t n);
+
+static double bench_loop(bench_loop_fn fn, uint64_t *iterations)
+{
+  uint64_t n = 1;
+  for (;;)
+  {
+    uint64_t t0 = bench_now_ns();
+    fn(n);
+    uint64_t ns = bench_now_ns() - t0;
+    if (ns >= g_bench_target_ns || n >= BENCH_MAX_ITERATIONS)
+    {
+      *iterations = n;
+      return (double)ns / (double)n;
+    }
+    uint64_t next = ns ? n * g_bench_target_ns / ns : 100 * n;
+    next += next / 5;
+    if (next > 100 * n)
+      next = 100 * n;
+    if (next <= n)
+      next = n + 1;
+    n = next > BENCH_MAX_ITERATIONS ? BENCH_MAX_ITERATIONS : next;
+  }
+}
+
+static void bench_run_loop(const char *name, bench_loop_fn fn)
+{
+  uint64_t n = 0;
+  double ns = bench_loop(fn, &n);
+  bench_emit_begin(name, n, ns);
+  bench_emit_end();
+  fflush(stdout);
+}
+
+// -------- fixtures --------
+static const char bench_session_id[] = "3f9c2a7d1e8b4c6a9d0e2f4b6a8c1d3e";
+static const char bench_remote_host[] = "2001:db8:85a3::8a2e:370:7334";
+static const char bench_locale[] = "en_US.UTF-8";
+
+static uint8_t g_bench_req[AUTH_REQ_MAX_SIZE];
+static size_t g_bench_req_len;
+static int g_bench_null_fd = -1;
+static int g_bench_req_sv[2] = {-1, -1};
+static struct auth_user g_bench_user;
+
+static void bench_put_lenstr(const char *s)
+{
+  size_t len = strlen(s);
+  write_u16_be(g_bench_req + g_bench_req_len, (uint16_t)len);
+  memcpy(g_bench_req + g_bench_req_len + 2, s, len);
+  g_bench_req_len += 2 + len;
+}
+
+// A v3 login request like the webserver sends: timing, ticket, a deadline.
+static void bench_build_request(const char *user)
+{
+  g_bench_req[0] = PROTO_MAGIC_0;
+  g_bench_req[1] = PROTO_MAGIC_1;
+  g_bench_req[2] = PROTO_MAGIC_2;
+  g_bench_req[3] = PROTO_VERSION;
+  g_bench_req[4] = PROTO_REQ_FLAG_TIMING | PROTO_REQ_FLAG_TICKET;
+  g_bench_req[5] = 0x00;
+  g_bench_req[6] = 0x71; // 29000 ms
+  g_bench_req[7] = 0x48;
+  g_bench_req_len = PROTO_AUTH_REQ_HEADER_SIZE;
+  bench_put_lenstr(user);
+  bench_put_lenstr("correct horse battery staple");
+  bench_put_lenstr(bench_session_id);
+  bench_put_lenstr(bench_remote_host);
+}
+
+// -------- benchmarks --------
+static void bench_parse_request(uint64_t n)
+{
+  char user[PROTO_MAX_USERNAME];
+  char password[PROTO_MAX_PASSWORD];
+  char session_id[PROTO_MAX_SESSION_ID];
+  char remote_host[PROTO_MAX_REMOTE_HOST];
+  for (uint64_t i = 0; i < n; i++)
+  {
+    size_t pos = PROTO_AUTH_REQ_HEADER_SIZE;
+    g_bench_sink += (uint64_t)auth_request_size(g_bench_req, g_bench_req_len);
+    take_lenstr(g_bench_req, &pos, user);
+    take_lenstr(g_bench_req, &pos, password);
+    take_lenstr(g_bench_req, &pos, session_id);
+    take_lenstr(g_bench_req, &pos, remote_host);
+    g_bench_sink += (uint64_t)user[0] + (uint64_t)remote_host[0];
+  }
+  secure_bzero(password, sizeof(password));
+}
+
+static void bench_read_request(uint64_t n)
+{
+  uint8_t buf[AUTH_REQ_MAX_SIZE];
+  const char *err = NULL;
+  for (uint64_t i = 0; i < n; i++)
+  {
+    if (write_all(g_bench_req_sv[0], g_bench_req, g_bench_req_len) != 0)
+      abort();
+    g_bench_sink += (uint64_t)read_auth_request(g_bench_req_sv[1], buf, &err);
+  }
+}
+
+static void bench_valid_session_id(uint64_t n)
+{
+  for (uint64_t i = 0; i < n; i++)
+    g_bench_sink += (uint64_t)valid_session_id(bench_session_id);
+}
+
+static void bench_valid_remote_host(uint64_t n)
+{
+  for (uint64_t i = 0; i < n; i++)
+    g_bench_sink += (uint64_t)valid_remote_host(bench_remote_host);
+}
+
+static void bench_valid_locale(uint64_t n)
+{
+  for (uint64_t i = 0; i < n; i++)
+    g_bench_sink += (uint64_t)valid_locale(bench_locale);
+}
+
+static void bench_journal_send(const struct journal_field *fields, size_t count,
+                               const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  journal_send_formatted(LOG_INFO, fields, count, fmt, ap);
+  va_end(ap);
+}
+
+static void bench_journal(uint64_t n)
+{
+  const struct journal_field fields[] = {
+      {"LINUXIO_USER", g_bench_user.name},
+      {"LINUXIO_REMOTE_HOST", bench_remote_host},
+  };
+  for (uint64_t i = 0; i < n; i++)
+    bench_journal_send(fields, 2, "authenticated user %s (uid=%u) from %s via %s",
+                       g_bench_user.name, (unsigned)g_bench_user.uid, bench_remote_host,
+                       "pam");
+}
+
+static void bench_send_response(uint64_t n)
+{
+  for (uint64_t i = 0; i < n; i++)
+    g_bench_sink += (uint64_t)send_response(g_bench_null_fd, PROTO_STATUS_OK,
+                                            PROTO_MODE_UNPRIVILEGED, PROTO_RESULT_OK, NULL,
+                                            g_bench_user.name, g_bench_user.uid,
+                                            g_bench_user.gid);
+}
+
+static struct bootstrap_ext g_bench_ext;
+
+static void bench_encode_bootstrap(uint64_t n)
+{
+  uint8_t buf[BOOTSTRAP_MAX_SIZE];
+  for (uint64_t i = 0; i < n; i++)
+    g_bench_sink += (uint64_t)encode_bootstrap_binary(
+        buf, sizeof(buf), bench_session_id, g_bench_user.name, g_bench_user.uid,
+        g_bench_user.gid, 0, 0, &g_bench_ext);
+}
+
+static void bench_write_bootstrap(uint64_t n)
+{
+  for (uint64_t i = 0; i < n; i++)
+    g_bench_sink += (uint64_t)write_bootstrap_binary(
+        g_bench_null_fd, bench_session_id, g_bench_user.name, g_bench_user.uid,
+        g_bench_user.gid, 0, 0, &g_bench_ext);
+}
+
+// A gid the user is not in, so every call scans the whole group list
+#define BENCH_ABSENT_GID ((gid_t)0x7ffffffe)
+
+static void bench_user_in_group(uint64_t n)
+{
+  for (uint64_t i = 0; i < n; i++)
+    g_bench_sink += (uint64_t)user_in_group(g_bench_user.uid, BENCH_ABSENT_GID);
+}
+
+static void bench_run_groups(const char *name, int ngroups)
+{
+  uint64_t n = 0;
+  double ns = bench_loop(bench_user_in_group, &n);
+  bench_emit_begin(name, n, ns);
+  printf(", \"groups\": %d", ngroups);
+  bench_emit_end();
+  fflush(stdout);
+}
+
+// One spawn of the stub bridge as the user, timed from the call until its
+// exec closes the exec-status pipe. The bridge is killed afterwards.
+static int bench_spawn_once(int bridge_fd, const struct spawn_cred *cred, uint64_t *ns)
+{
+  int boot[2] = {-1, -1};
+  int status[2] = {-1, -1};
+  int conn[2] = {-1, -1};
+  int rc = -1;
+  if (pipe2(boot, O_CLOEXEC) != 0 || exec_status_pipe_open(status) != 0 ||
+      socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, conn) != 0)
+    goto out;
+  if (write_bootstrap_binary(boot[1], bench_session_id, g_bench_user.name, g_bench_user.uid,
+                             g_bench_user.gid, 0, 0, &g_bench_ext) != 0)
+    goto out;
+  close(boot[1]);
+  boot[1] = -1;
+
+  struct child_proc child = {.pid = -1, .pidfd = -1};
+  uint64_t t0 = bench_now_ns();
+  if (spawn_bridge_process(&g_bench_user, 0, cred, bridge_fd, boot[0], conn[1], status[1], -1,
+                           &child) != 0)
+    goto out;
+  close(status[1]);
+  status[1] = -1;
+
+  char b;
+  ssize_t r;
+  do
+    r = read(status[0], &b, 1);
+  while (r < 0 && errno == EINTR);
+  *ns = bench_now_ns() - t0;
+  child_kill_and_reap(&child);
+  child_release(&child);
+  rc = r == 0 ? 0 : -1;
+
+out:
+  for (int i = 0; i < 2; i++)
+  {
+    if (boot[i] >= 0)
+      close(boot[i]);
+    if (status[i] >= 0)
+      close(status[i]);
+    if (conn[i] >= 0)
+      close(conn[i]);
+  }
+  return rc;
+}
+
+static int bench_cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void bench_run_spawn(void)
+{
+  if (geteuid() != 0)
+  {
+    fprintf(stderr, "microbench-auth: not root, skipping spawn_bridge_process\n");
+    return;
+  }
+  int bridge_fd = -1;
+  if (acquire_bridge_fd(&bridge_fd) != 0)
+  {
+    fprintf(stderr, "microbench-auth: bridge %s not usable, skipping spawn_bridge_process\n",
+            BRIDGE_PATH);
+    return;
+  }
+  struct spawn_cred cred;
+  if (spawn_cred_load(&cred, &g_bench_user) != 0)
+  {
+    fprintf(stderr, "microbench-auth: no group list for %s\n", g_bench_user.name);
+    close(bridge_fd);
+    return;
+  }
+
+  uint64_t *samples = calloc((size_t)g_bench_spawns, sizeof(*samples));
+  if (!samples)
+    abort();
+  uint64_t total = 0;
+  int runs = 0;
+  for (; runs < g_bench_spawns; runs++)
+  {
+    if (bench_spawn_once(bridge_fd, &cred, &samples[runs]) != 0)
+    {
+      fprintf(stderr, "microbench-auth: bridge spawn failed after %d runs\n", runs);
+      break;
+    }
+    total += samples[runs];
+  }
+  spawn_cred_free(&cred);
+  close(bridge_fd);
+
+  if (runs > 0)
+  {
+    qsort(samples, (size_t)runs, sizeof(*samples), bench_cmp_u64);
+    bench_emit_begin("spawn_bridge_process", (uint64_t)runs, (double)total / runs);
+    printf(", \"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu",
+           (unsigned long long)samples[runs / 2],
+           (unsigned long long)samples[(size_t)runs * 99 / 100],
+           (unsigned long long)samples[runs - 1]);
+    bench_emit_end();
+    fflush(stdout);
+  }
+  free(samples);
+}
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "usage: microbench-auth [-u user] [-t ms] [-n spawns] [-j]\n"
+          "  -u  user for group lookups, responses and the spawned bridge (default $SUDO_USER or root)\n"
+          "  -t  minimum time per loop benchmark (default %d ms)\n"
+          "  -n  bridge spawns to time (default %d, 0 to skip)\n"
+          "  -j  really send the journal entries instead of only formatting them\n",
+          BENCH_TIME_MS_DEFAULT, BENCH_SPAWNS_DEFAULT);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *user = getenv("SUDO_USER");
+  if (!user || !*user)
+    user = "root";
+
+  int opt;
+  while ((opt = getopt(argc, argv, "u:t:n:j")) != -1)
+  {
+    switch (opt)
+    {
+    case 'u':
+      user = optarg;
+      break;
+    case 't':
+      g_bench_target_ns = strtoull(optarg, NULL, 10) * 1000000ull;
+      break;
+    case 'n':
+      g_bench_spawns = atoi(optarg);
+      break;
+    case 'j':
+      g_bench_journal = 1;
+      break;
+    default:
+      usage();
+      return 2;
+    }
+  }
+  if (g_bench_target_ns == 0 || g_bench_spawns < 0)
+  {
+    usage();
+    return 2;
+  }
+
+  if (nss_lookup_user(user, &g_bench_user) != 0)
+  {
+    fprintf(stderr, "microbench-auth: unknown user %s\n", user);
+    return 1;
+  }
+  gid_t *groups = NULL;
+  int ngroups = load_user_groups(g_bench_user.name, g_bench_user.gid, &groups);
+  if (ngroups < 0)
+  {
+    fprintf(stderr, "microbench-auth: no group list for %s\n", user);
+    return 1;
+  }
+  g_bench_ext = (struct bootstrap_ext){
+      .home = g_bench_user.dir,
+      .groups = groups,
+      .ngroups = ngroups,
+      .priv_source = "groups",
+      .requested_us = realtime_us(),
+      .authenticated_us = realtime_us(),
+  };
+
+  g_bench_null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (g_bench_null_fd < 0 ||
+      socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, g_bench_req_sv) != 0)
+  {
+    perror("microbench-auth");
+    return 1;
+  }
+  bench_build_request(g_bench_user.name);
+  bridge_policy_init();
+
+  printf("{\n  \"version\": \"%s\",\n  \"user\": \"%s\",\n  \"journal\": %s,\n  \"benchmarks\": [",
+#ifdef LINUXIO_VERSION
+         LINUXIO_VERSION,
+#else
+         "unknown",
+#endif
+         g_bench_user.name, g_bench_journal ? "true" : "false");
+
+  bench_run_loop("parse_request", bench_parse_request);
+  bench_run_loop("read_auth_request", bench_read_request);
+  bench_run_loop("valid_session_id", bench_valid_session_id);
+  bench_run_loop("valid_remote_host", bench_valid_remote_host);
+  bench_run_loop("valid_locale", bench_valid_locale);
+  bench_run_loop("journal_send_formatted", bench_journal);
+  bench_run_loop("send_response", bench_send_response);
+  bench_run_loop("encode_bootstrap_binary", bench_encode_bootstrap);
+  bench_run_loop("write_bootstrap_binary", bench_write_bootstrap);
+  bench_run_groups("user_in_group", ngroups);
+  nss_cache_init();
+  bench_run_groups("user_in_group_nss_cache", ngroups);
+  if (g_bench_spawns > 0)
+    bench_run_spawn();
+
+  printf("\n  ]\n}\n");
+  free(groups);
+  return 0;
+}
@@ -0,0 +1,109 @@
+// pam_linuxio_bench.so - stub PAM module for `make bench-auth`
+//
+// Accepts every user after an optional delay, so the benchmark measures
+// linuxio-auth rather than a password database. It still asks the
+// conversation for the password like pam_unix does.
+//
+// Module arguments (any stack):
+//   delay_ms=N   sleep N milliseconds before returning
+//   fail         return PAM_AUTH_ERR (auth) / PAM_PERM_DENIED (others)
+//
+// Never install this on a real system.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <security/pam_appl.h>
+#include <security/pam_modules.h>
+
+struct bench_args
+{
+  long delay_ms;
+  int fail;
+};
+
+static void parse_args(int argc, const char **argv, struct bench_args *a)
+{
+  a->delay_ms = 0;
+  a->fail = 0;
+  for (int i = 0; i < argc; i++)
+  {
+    if (strncmp(argv[i], "delay_ms=", 9) == 0)
+      a->delay_ms = strtol(argv[i] + 9, NULL, 10);
+    else if (strcmp(argv[i], "fail") == 0)
+      a->fail = 1;
+  }
+}
+
+static void bench_delay(long ms)
+{
+  if (ms <= 0)
+    return;
+  struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L};
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    ;
+}
+
+static int run_stack(int argc, const char **argv, int fail_rc)
+{
+  struct bench_args a;
+  parse_args(argc, argv, &a);
+  bench_delay(a.delay_ms);
+  return a.fail ? fail_rc : PAM_SUCCESS;
+}
+
+PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+  (void)flags;
+  const void *item = NULL;
+  if (pam_get_item(pamh, PAM_CONV, &item) == PAM_SUCCESS && item)
+  {
+    const struct pam_conv *conv = item;
+    struct pam_message msg = {.msg_style = PAM_PROMPT_ECHO_OFF, .msg = "Password: "};
+    const struct pam_message *msgp = &msg;
+    struct pam_response *resp = NULL;
+    if (conv->conv(1, &msgp, &resp, conv->appdata_ptr) != PAM_SUCCESS)
+      return PAM_CONV_ERR;
+    if (resp)
+    {
+      if (resp->resp)
+      {
+        explicit_bzero(resp->resp, strlen(resp->resp));
+        free(resp->resp);
+      }
+      free(resp);
+    }
+  }
+  return run_stack(argc, argv, PAM_AUTH_ERR);
+}
+
+PAM_EXTERN int pam_sm_setcred(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+  (void)pamh;
+  (void)flags;
+  return run_stack(argc, argv, PAM_CRED_ERR);
+}
+
+PAM_EXTERN int pam_sm_acct_mgmt(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+  (void)pamh;
+  (void)flags;
+  return run_stack(argc, argv, PAM_PERM_DENIED);
+}
+
+PAM_EXTERN int pam_sm_open_session(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+  (void)pamh;
+  (void)flags;
+  return run_stack(argc, argv, PAM_PERM_DENIED);
+}
+
+PAM_EXTERN int pam_sm_close_session(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+  (void)pamh;
+  (void)flags;
+  return run_stack(argc, argv, PAM_PERM_DENIED);
+}
@@ -0,0 +1,269 @@
+// stub-bridge - stand-in for linuxio-bridge in `make bench-auth`
+//
+// Reads the bootstrap from stdin and then holds the client connection on
+// FD 3 until the benchmark client closes it, so the client decides whether
+// a login "exits" at once or holds a session. With LINUXIO_BRIDGE_PARKED=1
+// it speaks the parked handoff instead. With LINUXIO_BRIDGE_REATTACH set it
+// takes re-attached connections, and with LINUXIO_BRIDGE_SHARED attached
+// sessions (see linuxio_protocol.h).
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "../linuxio_protocol.h"
+
+#define CLIENT_CONN_FD 3
+#define STUB_MAX_ATTACHED 64
+
+static uint32_t get_u32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// Skip a [len:2][data] string; returns -1 if it runs past len.
+static int skip_lenstr(const uint8_t *buf, size_t len, size_t *pos)
+{
+  if (*pos + 2 > len)
+    return -1;
+  size_t n = get_u16(buf + *pos);
+  if (*pos + 2 + n > len)
+    return -1;
+  *pos += 2 + n;
+  return 0;
+}
+
+struct held_conns
+{
+  int grace_ms;   // > 0 while a re-attach may still come
+  int sock_open;  // the re-attach socket is still open
+  int connected;  // the first connection (FD 3) is open
+  int attached[STUB_MAX_ATTACHED];
+  int attached_reply[STUB_MAX_ATTACHED]; // closed once the session ended
+  int nattached;
+};
+
+// Take one message from the re-attach socket (see linuxio_protocol.h).
+static void take_attach_message(struct held_conns *h)
+{
+  uint8_t msg[1 + 2 + PROTO_MAX_SESSION_ID];
+  union
+  {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } ctrl;
+  struct iovec iov = {.iov_base = msg, .iov_len = sizeof(msg)};
+  struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1,
+                      .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)};
+  ssize_t n = recvmsg(PROTO_REATTACH_FD, &mh, MSG_CMSG_CLOEXEC);
+  if (n < 0 && errno == EINTR)
+    return;
+  if (n <= 0)
+  {
+    h->sock_open = 0;
+    h->grace_ms = 0;
+    return;
+  }
+  int fds[2] = {-1, -1};
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+  if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+  {
+    size_t len = cm->cmsg_len - CMSG_LEN(0);
+    memcpy(fds, CMSG_DATA(cm), len < sizeof(fds) ? len : sizeof(fds));
+  }
+
+  uint8_t status = PROTO_REATTACH_STATUS_FAILED;
+  switch (msg[0])
+  {
+  case PROTO_ATTACH_REATTACH:
+    if (h->grace_ms > 0 && fds[0] >= 0 && dup2(fds[0], CLIENT_CONN_FD) >= 0)
+    {
+      status = PROTO_REATTACH_STATUS_OK;
+      h->connected = 1;
+    }
+    (void)send(PROTO_REATTACH_FD, &status, 1, MSG_NOSIGNAL);
+    break;
+  case PROTO_ATTACH_SESSION:
+    if (fds[0] >= 0 && fds[1] >= 0 && h->nattached < STUB_MAX_ATTACHED)
+      status = PROTO_REATTACH_STATUS_OK;
+    if (fds[1] >= 0)
+      (void)send(fds[1], &status, 1, MSG_NOSIGNAL);
+    if (status == PROTO_REATTACH_STATUS_OK)
+    {
+      h->attached[h->nattached] = fds[0];
+      h->attached_reply[h->nattached++] = fds[1];
+      fds[0] = fds[1] = -1;
+    }
+    break;
+  case PROTO_ATTACH_RELEASE:
+    h->grace_ms = 0;
+    break;
+  default:
+    break;
+  }
+  for (int i = 0; i < 2; i++)
+  {
+    if (fds[i] >= 0)
+      close(fds[i]);
+  }
+}
+
+// Hold the client connection, and the sessions attached to a shared
+// bridge, until they close. With re-attach, a closed first connection
+// waits up to the grace period for a replacement.
+static void hold_connection(void)
+{
+  const char *grace_env = getenv(PROTO_REATTACH_ENV);
+  struct held_conns h = {.grace_ms = grace_env ? atoi(grace_env) : 0, .connected = 1};
+  h.sock_open = (h.grace_ms > 0 || getenv(PROTO_SHARED_ENV)) &&
+                fcntl(PROTO_REATTACH_FD, F_GETFD) >= 0;
+  if (!h.sock_open)
+    h.grace_ms = 0;
+  char buf[4096];
+  while (h.connected || h.grace_ms > 0 || h.nattached > 0)
+  {
+    struct pollfd pfds[2 + STUB_MAX_ATTACHED] = {
+        {.fd = h.connected ? CLIENT_CONN_FD : -1, .events = POLLIN, .revents = 0},
+        {.fd = h.sock_open ? PROTO_REATTACH_FD : -1, .events = POLLIN, .revents = 0},
+    };
+    for (int i = 0; i < h.nattached; i++)
+      pfds[2 + i] = (struct pollfd){.fd = h.attached[i], .events = POLLIN, .revents = 0};
+    int timeout = !h.connected && h.grace_ms > 0 ? h.grace_ms : -1;
+    int pr = poll(pfds, 2 + (nfds_t)h.nattached, timeout);
+    if (pr < 0 && errno == EINTR)
+      continue;
+    if (pr < 0)
+      return;
+    if (pr == 0)
+    {
+      h.grace_ms = 0; // grace period over
+      continue;
+    }
+    for (int i = h.nattached - 1; i >= 0; i--)
+    {
+      if (!pfds[2 + i].revents)
+        continue;
+      ssize_t n = read(h.attached[i], buf, sizeof(buf));
+      if (n == 0 || (n < 0 && errno != EINTR))
+      {
+        close(h.attached[i]);
+        close(h.attached_reply[i]);
+        h.nattached--;
+        h.attached[i] = h.attached[h.nattached];
+        h.attached_reply[i] = h.attached_reply[h.nattached];
+      }
+    }
+    if (pfds[0].revents)
+    {
+      ssize_t n = read(CLIENT_CONN_FD, buf, sizeof(buf));
+      if (n == 0 || (n < 0 && errno != EINTR))
+        h.connected = 0;
+    }
+    if (pfds[1].revents)
+      take_attach_message(&h);
+  }
+}
+
+static int parked_main(void)
+{
+  static uint8_t msg[PROTO_HEADER_SIZE + 2 * (2 + PROTO_MAX_USERNAME) + 2 + 4096 + 4 + 2 +
+                     4 * PROTO_PARKED_MAX_GROUPS + 2 + 4 * PROTO_BOOT_ENTRY_HEADER + 4096 + 16 +
+                     16];
+  union
+  {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } ctrl;
+  struct iovec iov = {.iov_base = msg, .iov_len = sizeof(msg)};
+  struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1,
+                      .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)};
+  ssize_t n;
+  do
+  {
+    n = recvmsg(STDIN_FILENO, &mh, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0)
+    return 0; // the auth worker went away without a login
+
+  uint8_t status = PROTO_PARKED_STATUS_FAILED;
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+  int conn = -1;
+  int reattach_fd = -1;
+  if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+  {
+    memcpy(&conn, CMSG_DATA(cm), sizeof(int));
+    if (cm->cmsg_len >= CMSG_LEN(2 * sizeof(int)))
+      memcpy(&reattach_fd, CMSG_DATA(cm) + sizeof(int), sizeof(int));
+  }
+  if (reattach_fd >= 0 && dup2(reattach_fd, PROTO_REATTACH_FD) < 0)
+    reattach_fd = -1;
+
+  size_t len = (size_t)n;
+  size_t pos = PROTO_HEADER_SIZE;
+  gid_t groups[PROTO_PARKED_MAX_GROUPS];
+  size_t ngroups = 0;
+  int ok = conn >= 0 && len >= PROTO_HEADER_SIZE &&
+           skip_lenstr(msg, len, &pos) == 0 &&  // session_id
+           skip_lenstr(msg, len, &pos) == 0 &&  // username
+           (!(msg[12] & PROTO_FLAG_EXTENDED) ||
+            skip_lenstr(msg, len, &pos) == 0) && // bootstrap extension
+           skip_lenstr(msg, len, &pos) == 0 &&  // home
+           pos + 4 + 2 <= len;
+  if (ok)
+  {
+    pos += 4; // loginuid
+    ngroups = get_u16(msg + pos);
+    pos += 2;
+    ok = ngroups <= PROTO_PARKED_MAX_GROUPS && pos + 4 * ngroups <= len;
+    for (size_t i = 0; ok && i < ngroups; i++)
+      groups[i] = (gid_t)get_u32(msg + pos + 4 * i);
+  }
+  if (ok && dup2(conn, CLIENT_CONN_FD) < 0)
+    ok = 0;
+  if (ok && !(msg[12] & PROTO_FLAG_PRIVILEGED))
+  {
+    uid_t uid = (uid_t)get_u32(msg + 4);
+    gid_t gid = (gid_t)get_u32(msg + 8);
+    ok = setgroups(ngroups, groups) == 0 && setresgid(gid, gid, gid) == 0 &&
+         setresuid(uid, uid, uid) == 0;
+  }
+  if (ok)
+    status = PROTO_PARKED_STATUS_OK;
+  (void)send(STDIN_FILENO, &status, 1, MSG_NOSIGNAL);
+  if (!ok)
+    return 1;
+  close(STDIN_FILENO);
+  hold_connection();
+  return 0;
+}
+
+int main(void)
+{
+  if (getenv(PROTO_PARKED_ENV))
+    return parked_main();
+
+  char buf[4096];
+  for (;;)
+  {
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n == 0)
+      break;
+    if (n < 0 && errno != EINTR)
+      return 1;
+  }
+  hold_connection();
+  return 0;
+}
@@ -0,0 +1,43 @@
+// stub-sudo - stand-in for /usr/bin/sudo in `make bench-auth`
+//
+// `sudo -S -v` drains the password from stdin, waits STUB_SUDO_DELAY_MS and
+// exits STUB_SUDO_EXIT (0 = privileged login, 1 = unprivileged). Anything
+// else (`sudo -k`) succeeds at once.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef STUB_SUDO_EXIT
+#define STUB_SUDO_EXIT 1
+#endif
+#ifndef STUB_SUDO_DELAY_MS
+#define STUB_SUDO_DELAY_MS 0
+#endif
+
+int main(int argc, char *argv[])
+{
+  int validate = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-v") == 0)
+      validate = 1;
+  }
+  if (!validate)
+    return 0;
+
+  char buf[4096];
+  for (;;)
+  {
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n == 0 || (n < 0 && errno != EINTR))
+      break;
+  }
+  struct timespec ts = {.tv_sec = STUB_SUDO_DELAY_MS / 1000,
+                        .tv_nsec = (STUB_SUDO_DELAY_MS % 1000) * 1000000L};
+  while (STUB_SUDO_DELAY_MS > 0 && nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    ;
+  return STUB_SUDO_EXIT;
+}
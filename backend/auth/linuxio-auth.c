@@ -1,5 +1,6 @@
 // /usr/local/bin/linuxio-auth  (install 0755 root:root, runs via systemd)
-// Single-shot mode: read one JSON auth request from stdin (socket-activated)
+// Single-shot mode: serve one binary auth request on stdin (Accept=yes socket activation)
+// Daemon mode (--daemon): pre-forked worker pool on an Accept=no listening socket
 #define __STDC_WANT_LIB_EXT1__ 1
 #define _GNU_SOURCE
 #include <security/pam_appl.h>
@@ -21,6 +22,8 @@
 #include <sys/resource.h>
 #include <sys/syscall.h>
 #include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/uio.h>
 #include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -35,6 +38,7 @@
 #include <sys/mount.h>
 #include <sched.h>
 #include <ctype.h>
+#include <dirent.h>
 // Safe argv shim for exec* (drops const only at the API boundary)
 #define ARGV_UNCONST(a) \
   ((union { const char *const *in; char *const *out; }){.in = (a)}.out)
@@ -42,7 +46,12 @@
 #define PR_SET_NO_NEW_PRIVS 38
 #endif
 
+#include <systemd/sd-daemon.h>
 #include <systemd/sd-journal.h>
+#include <systemd/sd-bus.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <link.h>
 
 // Protocol constants
 #include "linuxio_protocol.h"
@@ -51,6 +60,7 @@
 #define SOCKET_READ_TIMEOUT 30
 #define SOCKET_WRITE_TIMEOUT 10
 #define BRIDGE_START_TIMEOUT_MS 5000
+#define BRIDGE_STOP_TIMEOUT_MS 5000
 #define LINUXIO_WEB_TTY "web console"
 
 #ifndef AT_EMPTY_PATH
@@ -68,11 +78,38 @@
 #ifndef _PATH_WTMP
 #define _PATH_WTMP "/var/log/wtmp"
 #endif
+
+// Build-time overrides, used by `make bench-auth` to run against a scratch
+// tree (stub PAM service, sudo and bridge) without touching the system.
+#ifndef LINUXIO_PAM_SERVICE
+#define LINUXIO_PAM_SERVICE "linuxio"
+#endif
+#ifndef LINUXIO_SUDO_PATH
+#define LINUXIO_SUDO_PATH "/usr/bin/sudo"
+#endif
+#ifndef LINUXIO_AUTH_PATH
+#define LINUXIO_AUTH_PATH "/usr/local/bin/linuxio-auth"
+#endif
+#ifndef LINUXIO_BTMP_PATH
+#define LINUXIO_BTMP_PATH _PATH_BTMP
+#endif
+#ifndef LINUXIO_LASTLOG_PATH
+#define LINUXIO_LASTLOG_PATH _PATH_LASTLOG
+#endif
+#ifndef LINUXIO_UTMP_PATH
+#define LINUXIO_UTMP_PATH _PATH_UTMP
+#endif
+#ifndef LINUXIO_WTMP_PATH
+#define LINUXIO_WTMP_PATH _PATH_WTMP
+#endif
 extern char **environ;
 
 // ---- forward decls ----
 static int write_all(int fd, const void *buf, size_t len);
+static int writev_all(int fd, struct iovec *iov, int iovcnt);
 static int env_get_int(const char *name, int defval, int minv, int maxv);
+static uint64_t monotonic_ms(void);
+static int send_with_fd(int sock, const void *buf, size_t len, int fd);
 
 // Max lengths (use PROTO_MAX_* from linuxio_protocol.h, these are local convenience)
 #define MAX_PATH_LEN 4096
@@ -117,47 +154,154 @@ static int safe_snprintf(char *dst, size_t dstsz, const char *fmt, ...)
 }
 
 // -------- minimal logging  --------
+// Every entry is MESSAGE=, PRIORITY= and SYSLOG_IDENTIFIER=, then the fields
+// of the per-request context and the fields passed with the call. Only
+// MESSAGE= is formatted per entry: the identifier and priorities are static
+// strings, context fields are formatted once when they are set, and call
+// fields are copied as "NAME=value" into one shared scratch buffer. A call
+// field replaces a context field of the same name. Nothing is allocated.
+#define JOURNAL_MESSAGE_MAX 512
+#define JOURNAL_CTX_FIELDS  8
+#define JOURNAL_CTX_BUF     512
+#define JOURNAL_FIELDS_BUF  2048 // "NAME=value" text of one call's fields
+#define JOURNAL_MAX_IOV     64
+
+#define JOURNAL_IDENTIFIER     "SYSLOG_IDENTIFIER=linuxio-auth"
+#define JOURNAL_MESSAGE_PREFIX "MESSAGE="
+
 struct journal_field {
   const char *name;
   const char *value;
 };
 
-static void journal_send_formatted(int priority, const struct journal_field *fields,
-                                   size_t field_count, const char *fmt, va_list ap)
+// Fields and the held-back entry of the request this process is serving.
+// Forked children inherit the fields; only the owner sends the held entry.
+struct journal_ctx
 {
-  char buf[512];
-  char priority_buf[32];
-  char message_buf[sizeof(buf) + 16];
-  char field_bufs[8][256];
-  struct iovec iov[3 + 8];
-  size_t iov_count = 0;
+  struct iovec fields[JOURNAL_CTX_FIELDS];
+  size_t count;
+  char buf[JOURNAL_CTX_BUF];
+  size_t used;
+  pid_t deferred_pid; // 0 = nothing held back
+  int deferred_priority;
+  size_t deferred_len;
+  char deferred[sizeof(JOURNAL_MESSAGE_PREFIX) + JOURNAL_MESSAGE_MAX];
+};
 
-  (void)safe_vsnprintf(buf, sizeof(buf), fmt, ap);
-  (void)safe_snprintf(priority_buf, sizeof(priority_buf), "PRIORITY=%i", priority);
-  (void)safe_snprintf(message_buf, sizeof(message_buf), "MESSAGE=%s", buf);
+static struct journal_ctx g_journal;
+
+static const struct iovec journal_priorities[] = {
+#define JOURNAL_PRIORITY(n) {.iov_base = "PRIORITY=" #n, .iov_len = sizeof("PRIORITY=" #n) - 1}
+    JOURNAL_PRIORITY(0), JOURNAL_PRIORITY(1), JOURNAL_PRIORITY(2), JOURNAL_PRIORITY(3),
+    JOURNAL_PRIORITY(4), JOURNAL_PRIORITY(5), JOURNAL_PRIORITY(6), JOURNAL_PRIORITY(7),
+#undef JOURNAL_PRIORITY
+};
 
-  iov[iov_count++] = (struct iovec){.iov_base = message_buf, .iov_len = strlen(message_buf)};
-  iov[iov_count++] = (struct iovec){.iov_base = priority_buf, .iov_len = strlen(priority_buf)};
-  iov[iov_count++] = (struct iovec){.iov_base = "SYSLOG_IDENTIFIER=linuxio-auth",
-                                    .iov_len = strlen("SYSLOG_IDENTIFIER=linuxio-auth")};
+// Append "name=value" to buf, truncating the value to what fits.
+static size_t journal_put_field(char *buf, size_t size, const char *name, const char *value)
+{
+  size_t nlen = strlen(name);
+  if (nlen + 2 > size)
+    return 0;
+  memcpy(buf, name, nlen);
+  buf[nlen] = '=';
+  size_t vlen = strnlen(value, size - nlen - 1);
+  memcpy(buf + nlen + 1, value, vlen);
+  return nlen + 1 + vlen;
+}
+
+static int journal_field_named(const struct iovec *iov, const char *name, size_t nlen)
+{
+  return iov->iov_len > nlen && ((const char *)iov->iov_base)[nlen] == '=' &&
+         memcmp(iov->iov_base, name, nlen) == 0;
+}
+
+// Format "MESSAGE=..." into dst (JOURNAL_MESSAGE_MAX + prefix bytes).
+static size_t journal_format_message(char *dst, const char *fmt, va_list ap)
+{
+  const size_t plen = sizeof(JOURNAL_MESSAGE_PREFIX) - 1;
+  memcpy(dst, JOURNAL_MESSAGE_PREFIX, plen);
+  (void)safe_vsnprintf(dst + plen, JOURNAL_MESSAGE_MAX + 1, fmt, ap);
+  return plen + strlen(dst + plen);
+}
+
+static void journal_sendv_entry(int priority, char *message, size_t message_len,
+                                const struct journal_field *fields, size_t field_count)
+{
+  char text[JOURNAL_FIELDS_BUF];
+  size_t used = 0;
+  struct iovec iov[JOURNAL_MAX_IOV];
+  size_t iov_count = 0;
 
-  if (field_count > 8)
-    field_count = 8;
+  if (priority < 0 || priority > LOG_DEBUG)
+    priority = LOG_ERR;
+  iov[iov_count++] = (struct iovec){.iov_base = message, .iov_len = message_len};
+  iov[iov_count++] = journal_priorities[priority];
+  iov[iov_count++] = (struct iovec){.iov_base = JOURNAL_IDENTIFIER,
+                                    .iov_len = sizeof(JOURNAL_IDENTIFIER) - 1};
 
-  for (size_t i = 0; i < field_count; i++)
+  for (size_t i = 0; i < field_count && iov_count < JOURNAL_MAX_IOV - g_journal.count; i++)
   {
     if (!fields[i].name || !fields[i].value || fields[i].name[0] == '\0')
       continue;
     if (strcmp(fields[i].name, LINUXIO_JOURNAL_FIELD_SESSION_ID) == 0)
       continue;
-    (void)safe_snprintf(field_bufs[i], sizeof(field_bufs[i]), "%s=%s",
-                        fields[i].name, fields[i].value);
-    iov[iov_count++] = (struct iovec){.iov_base = field_bufs[i], .iov_len = strlen(field_bufs[i])};
+    size_t n = journal_put_field(text + used, sizeof(text) - used, fields[i].name, fields[i].value);
+    if (n == 0)
+      break;
+    iov[iov_count++] = (struct iovec){.iov_base = text + used, .iov_len = n};
+    used += n;
+  }
+
+  for (size_t c = 0; c < g_journal.count; c++)
+  {
+    int replaced = 0;
+    for (size_t i = 0; i < field_count && !replaced; i++)
+    {
+      if (fields[i].name && fields[i].value)
+        replaced = journal_field_named(&g_journal.fields[c], fields[i].name, strlen(fields[i].name));
+    }
+    if (!replaced)
+      iov[iov_count++] = g_journal.fields[c];
   }
 
   (void)sd_journal_sendv(iov, (int)iov_count);
 }
 
+// Send the entry held back by journal_info_deferf(), if this process owns it.
+static void journal_flush_deferred(void)
+{
+  if (g_journal.deferred_pid == 0 || g_journal.deferred_pid != getpid())
+    return;
+  g_journal.deferred_pid = 0;
+  journal_sendv_entry(g_journal.deferred_priority, g_journal.deferred, g_journal.deferred_len,
+                      NULL, 0);
+}
+
+static void journal_send_formatted(int priority, const struct journal_field *fields,
+                                   size_t field_count, const char *fmt, va_list ap)
+{
+  char message[sizeof(JOURNAL_MESSAGE_PREFIX) + JOURNAL_MESSAGE_MAX];
+  size_t message_len = journal_format_message(message, fmt, ap);
+  // Keep the journal in order: a held-back entry goes out first
+  journal_flush_deferred();
+  journal_sendv_entry(priority, message, message_len, fields, field_count);
+}
+
+// Add a field to every later entry of this request. Values are copied.
+static void journal_ctx_set(const char *name, const char *value)
+{
+  if (g_journal.count >= JOURNAL_CTX_FIELDS)
+    return;
+  size_t n = journal_put_field(g_journal.buf + g_journal.used,
+                               sizeof(g_journal.buf) - g_journal.used, name, value);
+  if (n == 0)
+    return;
+  g_journal.fields[g_journal.count++] =
+      (struct iovec){.iov_base = g_journal.buf + g_journal.used, .iov_len = n};
+  g_journal.used += n;
+}
+
 static void journal_errorf(const char *fmt, ...)
 {
   va_list ap;
@@ -184,6 +328,21 @@ static void journal_error_fieldsf(const struct journal_field *fields, size_t fie
   va_end(ap);
 }
 
+// Like journal_info_fieldsf() with only the context fields, but held back
+// until journal_flush_deferred() (after the response has been sent) or the
+// next entry, whichever comes first, so the login path does not wait on
+// journald for routine entries.
+static void journal_info_deferf(const char *fmt, ...)
+{
+  journal_flush_deferred();
+  va_list ap;
+  va_start(ap, fmt);
+  g_journal.deferred_len = journal_format_message(g_journal.deferred, fmt, ap);
+  va_end(ap);
+  g_journal.deferred_priority = LOG_INFO;
+  g_journal.deferred_pid = getpid();
+}
+
 static void log_stderrf(const char *fmt, ...)
 {
   char buf[1024];
@@ -212,6 +371,78 @@ static void secure_bzero(void *p, size_t n)
 }
 #endif
 
+// -------- secret arena --------
+// Passwords and the raw request that carries them live in one small
+// anonymous mapping, set up once per process: mlock()ed so they never reach
+// swap, excluded from core dumps and zeroed in any fork() child. Allocation
+// is a bump pointer released in LIFO order, and the whole arena is wiped
+// in one pass when the connection is done. Strings handed to PAM must stay
+// on the malloc heap, since PAM free()s them; those are wiped by
+// free_pam_responses().
+#define SECRET_ARENA_SIZE  (16 * 1024)
+#define SECRET_ARENA_ALIGN 16
+
+#ifndef MADV_WIPEONFORK
+#define MADV_WIPEONFORK 18
+#endif
+
+struct secret_arena
+{
+  uint8_t *base; // NULL until secret_arena_init() succeeds
+  size_t used;
+};
+
+static struct secret_arena g_secrets;
+
+static void secret_arena_wipe(void)
+{
+  if (g_secrets.base)
+    secure_bzero(g_secrets.base, SECRET_ARENA_SIZE);
+  g_secrets.used = 0;
+}
+
+static void secret_arena_init(void)
+{
+  if (g_secrets.base)
+    return;
+  void *p = mmap(NULL, SECRET_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+  {
+    journal_errorf("secret arena mmap failed: %m");
+    return;
+  }
+  if (mlock(p, SECRET_ARENA_SIZE) != 0)
+    journal_errorf("secret arena mlock failed: %m");
+  (void)madvise(p, SECRET_ARENA_SIZE, MADV_DONTDUMP);
+  (void)madvise(p, SECRET_ARENA_SIZE, MADV_WIPEONFORK);
+  g_secrets.base = p;
+  g_secrets.used = 0;
+  (void)atexit(secret_arena_wipe);
+}
+
+// n zeroed bytes from the arena, or NULL if it is not set up or full.
+static void *secret_alloc(size_t n)
+{
+  size_t sz = (n + SECRET_ARENA_ALIGN - 1) & ~(size_t)(SECRET_ARENA_ALIGN - 1);
+  if (!g_secrets.base || sz > SECRET_ARENA_SIZE - g_secrets.used)
+    return NULL;
+  void *p = g_secrets.base + g_secrets.used;
+  g_secrets.used += sz;
+  return p;
+}
+
+// Wipe an allocation; its space is reclaimed if it is the most recent one.
+static void secret_free(void *p, size_t n)
+{
+  if (!p)
+    return;
+  size_t sz = (n + SECRET_ARENA_ALIGN - 1) & ~(size_t)(SECRET_ARENA_ALIGN - 1);
+  secure_bzero(p, sz);
+  if ((uint8_t *)p + sz == g_secrets.base + g_secrets.used)
+    g_secrets.used -= sz;
+}
+
 // -------- Binary protocol read helpers --------
 static int read_all(int fd, void *buf, size_t len)
 {
@@ -238,49 +469,89 @@ static uint16_t read_u16_be(const uint8_t *buf)
   return ((uint16_t)buf[0] << 8) | ((uint16_t)buf[1]);
 }
 
-// Read a length-prefixed string from fd into buf (max bufsz-1 chars + null).
-// Returns 0 on success, -1 on error (oversized fields are rejected).
-// Uses a temporary buffer for the read to minimize sensitive data exposure -
-// the temp buffer is securely cleared immediately after copying to the caller's buffer.
-static int read_lenstr(int fd, char *buf, size_t bufsz)
+static uint32_t read_u32_be(const uint8_t *buf)
 {
-  if (!buf || bufsz == 0)
-    return -1;
-  buf[0] = '\0';
-
-  uint8_t lenbuf[2];
-  if (read_all(fd, lenbuf, 2) != 0)
-    return -1;
-
-  uint16_t len = read_u16_be(lenbuf);
-  if (len == 0)
-    return 0;
-
-  // Reject oversized input to avoid truncation and protocol ambiguity.
-  if (len >= bufsz)
-    return -1;
-
-  // Read into a temporary buffer first so we can securely wipe it afterwards.
-  unsigned char *tmp = (unsigned char *)malloc(len);
-  if (!tmp)
-    return -1;
+  return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) |
+         (uint32_t)buf[3];
+}
 
-  if (read_all(fd, tmp, len) != 0)
+// -------- auth request framing --------
+// The client sends the whole request in one write and it is bounded by the
+// PROTO_MAX_* limits, so it normally arrives with a single read into a fixed
+// buffer (SO_RCVTIMEO bounds each read) and is parsed there.
+#define AUTH_REQ_FIELDS 4
+#define AUTH_REQ_MAX_SIZE                                                      \
+  (PROTO_AUTH_REQ_HEADER_SIZE + AUTH_REQ_FIELDS * 2 + PROTO_MAX_USERNAME +     \
+   PROTO_MAX_PASSWORD + PROTO_MAX_SESSION_ID + PROTO_MAX_REMOTE_HOST)
+
+// Destination buffer size of each field, in wire order. A field must be
+// shorter than its buffer: oversized input is rejected, not truncated.
+static const size_t auth_req_field_max[AUTH_REQ_FIELDS] = {
+    PROTO_MAX_USERNAME, PROTO_MAX_PASSWORD, PROTO_MAX_SESSION_ID, PROTO_MAX_REMOTE_HOST};
+
+// Size of the request at the start of buf once `have` bytes cover all of it,
+// 0 while more bytes are needed, -1 if a field is oversized.
+static ssize_t auth_request_size(const uint8_t *buf, size_t have)
+{
+  size_t pos = PROTO_AUTH_REQ_HEADER_SIZE;
+  for (size_t i = 0; i < AUTH_REQ_FIELDS; i++)
   {
-    secure_bzero(tmp, len);
-    free(tmp);
-    return -1;
+    if (have < pos + 2)
+      return 0;
+    uint16_t len = read_u16_be(buf + pos);
+    if (len >= auth_req_field_max[i])
+      return -1;
+    pos += 2 + (size_t)len;
   }
+  return have < pos ? 0 : (ssize_t)pos;
+}
+
+// Read one request into buf (AUTH_REQ_MAX_SIZE bytes). Returns its size, or
+// -1 with *err set on EOF, timeout, bad magic, an oversized field or bytes
+// past the end of the request.
+static ssize_t read_auth_request(int fd, uint8_t *buf, const char **err)
+{
+  size_t have = 0;
+  for (;;)
+  {
+    ssize_t n = read(fd, buf + have, AUTH_REQ_MAX_SIZE - have);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      *err = have < PROTO_AUTH_REQ_HEADER_SIZE ? "failed to read request header"
+                                               : "failed to read request fields";
+      return -1;
+    }
+    have += (size_t)n;
 
-  // Copy to caller's buffer and null-terminate.
-  memcpy(buf, tmp, len);
-  buf[len] = '\0';
+    if (have >= PROTO_AUTH_REQ_HEADER_SIZE &&
+        (buf[0] != PROTO_MAGIC_0 || buf[1] != PROTO_MAGIC_1 ||
+         buf[2] != PROTO_MAGIC_2 || buf[3] != PROTO_VERSION))
+    {
+      *err = "invalid request magic";
+      return -1;
+    }
 
-  // Wipe and free the temporary buffer to avoid leaving sensitive data in memory.
-  secure_bzero(tmp, len);
-  free(tmp);
+    ssize_t size = have < PROTO_AUTH_REQ_HEADER_SIZE ? 0 : auth_request_size(buf, have);
+    if (size < 0 || (size > 0 && (size_t)size != have))
+    {
+      *err = "failed to read request fields";
+      return -1;
+    }
+    if (size > 0)
+      return size;
+  }
+}
 
-  return 0;
+// Copy the length-prefixed string at *pos into dst. Lengths were checked
+// against auth_req_field_max by auth_request_size().
+static void take_lenstr(const uint8_t *buf, size_t *pos, char *dst)
+{
+  uint16_t len = read_u16_be(buf + *pos);
+  memcpy(dst, buf + *pos + 2, len);
+  dst[len] = '\0';
+  *pos += 2 + (size_t)len;
 }
 
 // -------- PAM conversation ----
@@ -403,224 +674,607 @@ static int32_t clamp_suseconds_to_i32(suseconds_t value)
   return (int32_t)value;
 }
 
-static int update_lastlog(uid_t uid, const struct timeval *tv, const char *remote_host)
+// -------- login accounting --------
+// The utmp/wtmp/lastlog/btmp updates of a login are queued and written by
+// acct_flush() once the client has its response, so a login never waits on
+// another one's file locks. A daemon worker hands its queue to the daemon's
+// accounting writer (see acct_writer_main()), which keeps the files open,
+// applies each drained batch under one lock per file and finds utmp slots
+// through an ut_id index instead of rescanning the file for every record.
+// Everywhere else, or when the handoff fails, the process writes its queue
+// itself through a short-lived writer.
+enum acct_kind
 {
-  struct lastlog entry;
-  off_t offset;
-  ssize_t nwritten;
-  int fd;
-  int locked = 0;
-  int ret = -1;
+  ACCT_LOGIN = 1,
+  ACCT_LOGOUT,
+  ACCT_FAILED,
+};
 
-  fd = open(_PATH_LASTLOG, O_RDWR | O_CLOEXEC);
-  if (fd < 0)
-  {
-    if (errno != ENOENT)
-      journal_errorf("failed to open %s: %m", _PATH_LASTLOG);
-    return -1;
-  }
+struct acct_event
+{
+  int kind;
+  uid_t uid;
+  pid_t login_pid; // utmp ut_id/ut_pid: the process that answered the login
+  struct timeval tv;
+  char user[PROTO_MAX_USERNAME];
+  char remote_host[PROTO_MAX_REMOTE_HOST];
+};
 
-  if (flock(fd, LOCK_EX) != 0)
-  {
-    journal_errorf("failed to lock %s for uid=%u: %m", _PATH_LASTLOG, (unsigned)uid);
-    goto out;
-  }
-  locked = 1;
+#define ACCT_QUEUE_MAX 4  // events one process queues between flushes
+#define ACCT_BATCH_MAX 32 // events the writer applies at once
+#define UTMP_ID_LEN    sizeof(((struct utmp *)0)->ut_id)
+
+static struct acct_event g_acct_queue[ACCT_QUEUE_MAX];
+static int g_acct_nqueued;
+static int g_acct_fd = -1; // daemon: sending end of the accounting writer's socket
 
-  offset = (off_t)uid * (off_t)sizeof(entry);
-  memset(&entry, 0, sizeof(entry));
-  entry.ll_time = clamp_time_to_u32(tv->tv_sec);
-  copy_fixed_field(entry.ll_host, sizeof(entry.ll_host), remote_host);
-  copy_fixed_field(entry.ll_line, sizeof(entry.ll_line), LINUXIO_WEB_TTY);
+struct utmp_slot
+{
+  char id[UTMP_ID_LEN];
+  uint32_t slot;
+  int used;
+};
+
+struct acct_writer
+{
+  int utmp_fd; // each -1 if the file does not exist
+  int wtmp_fd;
+  int btmp_fd;
+  int lastlog_fd;
+  struct stat utmp_st; // identity of the open files, to follow rotation
+  struct stat wtmp_st;
+  struct stat btmp_st;
+  struct stat lastlog_st;
+  struct utmp_slot *index; // open addressing on ut_id
+  size_t index_cap;
+  size_t index_used;
+  size_t utmp_records; // file size in records when the index was built
+  int index_valid;
+};
 
-  nwritten = pwrite(fd, &entry, sizeof(entry), offset);
-  if (nwritten != (ssize_t)sizeof(entry))
+static void acct_open_file(int *fd, struct stat *st, const char *path, int flags)
+{
+  *fd = open(path, flags | O_CLOEXEC, 0660);
+  if (*fd < 0)
   {
-    if (nwritten < 0)
-      journal_errorf("failed to write %s for uid=%u: %m", _PATH_LASTLOG, (unsigned)uid);
-    else
-      journal_errorf("partial write to %s for uid=%u", _PATH_LASTLOG, (unsigned)uid);
-    goto out;
+    if (errno != ENOENT)
+      journal_errorf("failed to open %s: %m", path);
+    return;
   }
+  if (fstat(*fd, st) != 0)
+    memset(st, 0, sizeof(*st));
+}
 
-  ret = 0;
-
-out:
-  if (locked)
-    (void)flock(fd, LOCK_UN);
-  close(fd);
-  return ret;
+// Reopen a file that was rotated, removed or created since we opened it.
+static int acct_follow_file(int *fd, struct stat *st, const char *path, int flags)
+{
+  struct stat now;
+  int exists = stat(path, &now) == 0;
+  if (*fd >= 0 && exists && now.st_dev == st->st_dev && now.st_ino == st->st_ino)
+    return 0;
+  if (*fd < 0 && !exists && !(flags & O_CREAT))
+    return 0;
+  if (*fd >= 0)
+    close(*fd);
+  acct_open_file(fd, st, path, flags);
+  return 1;
 }
 
-static int utmp_file_exists(void)
+static void acct_writer_open(struct acct_writer *w)
 {
-  struct stat st;
-  return stat(_PATH_UTMP, &st) == 0;
+  memset(w, 0, sizeof(*w));
+  acct_open_file(&w->utmp_fd, &w->utmp_st, LINUXIO_UTMP_PATH, O_RDWR);
+  acct_open_file(&w->wtmp_fd, &w->wtmp_st, LINUXIO_WTMP_PATH, O_WRONLY | O_APPEND);
+  acct_open_file(&w->btmp_fd, &w->btmp_st, LINUXIO_BTMP_PATH, O_WRONLY | O_APPEND);
+  acct_open_file(&w->lastlog_fd, &w->lastlog_st, LINUXIO_LASTLOG_PATH, O_RDWR);
 }
 
-static void btmp_log(const char *username, const char *remote_host)
+static void acct_writer_close(struct acct_writer *w)
 {
-  struct timeval tv;
-  struct utmp entry;
-  int fd;
-  ssize_t nwritten;
-
-  gettimeofday(&tv, NULL);
-  memset(&entry, 0, sizeof(entry));
-  copy_fixed_field(entry.ut_line, sizeof(entry.ut_line), LINUXIO_WEB_TTY);
-  copy_fixed_field(entry.ut_host, sizeof(entry.ut_host), remote_host);
-  copy_fixed_field(entry.ut_user, sizeof(entry.ut_user), username);
-  entry.ut_pid = getpid();
-  entry.ut_tv.tv_sec = clamp_time_to_u32(tv.tv_sec);
-  entry.ut_tv.tv_usec = clamp_suseconds_to_i32(tv.tv_usec);
-  entry.ut_type = LOGIN_PROCESS;
-
-  fd = open(_PATH_BTMP, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0660);
-  if (fd < 0)
+  int *fds[] = {&w->utmp_fd, &w->wtmp_fd, &w->btmp_fd, &w->lastlog_fd};
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
   {
-    if (errno != ENOENT)
-      journal_errorf("failed to open %s: %m", _PATH_BTMP);
-    return;
+    if (*fds[i] >= 0)
+      close(*fds[i]);
+    *fds[i] = -1;
   }
+  free(w->index);
+  w->index = NULL;
+  w->index_cap = 0;
+  w->index_valid = 0;
+}
 
-  nwritten = write(fd, &entry, sizeof(entry));
-  if (nwritten != (ssize_t)sizeof(entry))
+// POSIX record lock on the whole file, the lock glibc's utmp functions take.
+static int acct_lock(int fd, short type)
+{
+  struct flock fl;
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+  int rc;
+  do
   {
-    if (nwritten < 0)
-      journal_errorf("failed to write %s: %m", _PATH_BTMP);
-    else
-      journal_errorf("partial write to %s", _PATH_BTMP);
-  }
-
-  close(fd);
+    rc = fcntl(fd, F_SETLKW, &fl);
+  } while (rc != 0 && errno == EINTR);
+  return rc;
 }
 
-static void record_login_start(const struct auth_user *auth_user, const char *remote_host)
+// The record types getutid() matches by ut_id for USER_PROCESS/DEAD_PROCESS.
+static int utmp_type_has_id(short type)
 {
-  struct timeval tv;
-  struct utmp ut;
-  char id[32];
-
-  gettimeofday(&tv, NULL);
-  (void)safe_snprintf(id, sizeof(id), "%ld", (long)getpid());
-
-  utmpname(_PATH_UTMP);
-
-  memset(&ut, 0, sizeof(ut));
-  copy_fixed_field(ut.ut_id, sizeof(ut.ut_id), id);
-  copy_fixed_field(ut.ut_line, sizeof(ut.ut_line), LINUXIO_WEB_TTY);
-  copy_fixed_field(ut.ut_user, sizeof(ut.ut_user), auth_user->name);
-  copy_fixed_field(ut.ut_host, sizeof(ut.ut_host), remote_host);
-  ut.ut_pid = getpid();
-  ut.ut_tv.tv_sec = clamp_time_to_u32(tv.tv_sec);
-  ut.ut_tv.tv_usec = clamp_suseconds_to_i32(tv.tv_usec);
-  ut.ut_type = USER_PROCESS;
+  return type == INIT_PROCESS || type == LOGIN_PROCESS || type == USER_PROCESS ||
+         type == DEAD_PROCESS;
+}
 
-  if (utmp_file_exists())
+static struct utmp_slot *utmp_index_find(const struct acct_writer *w, const char *id)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < UTMP_ID_LEN; i++)
+    h = (h ^ (uint8_t)id[i]) * 16777619u;
+  size_t mask = w->index_cap - 1;
+  for (size_t i = h & mask;; i = (i + 1) & mask)
   {
-    setutent();
-    if (!pututline(&ut))
-      journal_errorf("failed to write %s: %m", _PATH_UTMP);
-    endutent();
+    struct utmp_slot *s = &w->index[i];
+    if (!s->used || memcmp(s->id, id, UTMP_ID_LEN) == 0)
+      return s;
   }
-  updwtmp(_PATH_WTMP, &ut);
-
-  (void)update_lastlog(auth_user->uid, &tv, remote_host);
 }
 
-static void record_login_end(void)
+static void utmp_index_put(struct acct_writer *w, const char *id, uint32_t slot)
 {
-  struct timeval tv;
-  struct utmp ut;
-  char id[32];
-
-  gettimeofday(&tv, NULL);
-  (void)safe_snprintf(id, sizeof(id), "%ld", (long)getpid());
-
-  utmpname(_PATH_UTMP);
+  struct utmp_slot *s = utmp_index_find(w, id);
+  if (s->used)
+    return; // first match wins, like a scan from setutent()
+  memcpy(s->id, id, UTMP_ID_LEN);
+  s->slot = slot;
+  s->used = 1;
+  w->index_used++;
+}
 
-  memset(&ut, 0, sizeof(ut));
-  copy_fixed_field(ut.ut_id, sizeof(ut.ut_id), id);
-  copy_fixed_field(ut.ut_line, sizeof(ut.ut_line), LINUXIO_WEB_TTY);
-  ut.ut_pid = getpid();
-  ut.ut_tv.tv_sec = clamp_time_to_u32(tv.tv_sec);
-  ut.ut_tv.tv_usec = clamp_suseconds_to_i32(tv.tv_usec);
-  ut.ut_type = DEAD_PROCESS;
+// Scan utmp once (the caller holds its lock) and map ut_id -> record slot.
+static int utmp_index_rebuild(struct acct_writer *w)
+{
+  struct stat st;
+  if (fstat(w->utmp_fd, &st) != 0)
+    return -1;
+  size_t records = (size_t)st.st_size / sizeof(struct utmp);
+  size_t cap = 64;
+  while (cap < 2 * (records + ACCT_BATCH_MAX))
+    cap <<= 1;
+  if (cap != w->index_cap)
+  {
+    struct utmp_slot *grown = realloc(w->index, cap * sizeof(*grown));
+    if (!grown)
+      return -1;
+    w->index = grown;
+    w->index_cap = cap;
+  }
+  memset(w->index, 0, w->index_cap * sizeof(*w->index));
+  w->index_used = 0;
 
-  if (utmp_file_exists())
+  struct utmp chunk[64];
+  for (size_t base = 0; base < records;)
   {
-    setutent();
-    if (!pututline(&ut))
-      journal_errorf("failed to update %s: %m", _PATH_UTMP);
-    endutent();
+    size_t want = records - base < 64 ? records - base : 64;
+    ssize_t n = pread(w->utmp_fd, chunk, want * sizeof(chunk[0]),
+                      (off_t)(base * sizeof(chunk[0])));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    size_t got = (size_t)n / sizeof(chunk[0]);
+    for (size_t i = 0; i < got; i++)
+    {
+      if (utmp_type_has_id(chunk[i].ut_type))
+        utmp_index_put(w, chunk[i].ut_id, (uint32_t)(base + i));
+    }
+    if (got == 0)
+      break;
+    base += got;
   }
-  updwtmp(_PATH_WTMP, &ut);
+  w->utmp_records = records;
+  w->index_valid = 1;
+  return 0;
 }
 
-static int pam_conv_func(int n, const struct pam_message **msg, struct pam_response **resp, const void *appdata_ptr)
+// pututline() for one record: overwrite the slot holding its ut_id, or
+// append. Other programs write utmp too, so the slot is re-read before it
+// is reused and any mismatch rebuilds the index.
+static int utmp_write(struct acct_writer *w, const struct utmp *ut)
 {
-  const struct pam_appdata *appdata = (const struct pam_appdata *)appdata_ptr;
-  if (n <= 0 || n > 32)
-    return PAM_CONV_ERR;
-  struct pam_response *r = calloc((size_t)n, sizeof(*r));
-  if (!r)
-    return PAM_CONV_ERR;
-
-  for (int i = 0; i < n; i++)
+  for (int attempt = 0; attempt < 2; attempt++)
   {
-    switch (msg[i]->msg_style)
+    if ((!w->index_valid || w->index_used + 1 > w->index_cap / 2) && utmp_index_rebuild(w) != 0)
+      return -1;
+    struct utmp_slot *s = utmp_index_find(w, ut->ut_id);
+    size_t slot = w->utmp_records;
+    if (s->used)
     {
-    case PAM_PROMPT_ECHO_OFF:
-      if (appdata && appdata->password)
+      struct utmp cur;
+      slot = s->slot;
+      if (pread(w->utmp_fd, &cur, sizeof(cur), (off_t)(slot * sizeof(cur))) != (ssize_t)sizeof(cur) ||
+          !utmp_type_has_id(cur.ut_type) || memcmp(cur.ut_id, ut->ut_id, UTMP_ID_LEN) != 0)
       {
-        r[i].resp = dup_pam_string(appdata->password);
-        if (!r[i].resp)
-        {
-          free_pam_responses(r, i);
-          return PAM_CONV_ERR;
-        }
+        w->index_valid = 0;
+        continue;
       }
-      break;
-
-    case PAM_PROMPT_ECHO_ON:
-      if (appdata && appdata->username)
+    }
+    else
+    {
+      struct stat st;
+      if (fstat(w->utmp_fd, &st) != 0)
+        return -1;
+      if ((size_t)st.st_size / sizeof(*ut) != w->utmp_records)
       {
-        r[i].resp = dup_pam_string(appdata->username);
-        if (!r[i].resp)
-        {
-          free_pam_responses(r, i);
-          return PAM_CONV_ERR;
-        }
+        w->index_valid = 0; // someone appended since the scan
+        continue;
       }
-      break;
-
-    case PAM_TEXT_INFO:
-    case PAM_ERROR_MSG:
-      // Ignore informational messages
-      break;
+    }
 
-    default:
-      // Ignore other message types
-      break;
+    if (pwrite(w->utmp_fd, ut, sizeof(*ut), (off_t)(slot * sizeof(*ut))) != (ssize_t)sizeof(*ut))
+      return -1;
+    if (!s->used)
+    {
+      memcpy(s->id, ut->ut_id, UTMP_ID_LEN);
+      s->slot = (uint32_t)slot;
+      s->used = 1;
+      w->index_used++;
+      w->utmp_records++;
     }
+    return 0;
   }
-  *resp = r;
-  return PAM_SUCCESS;
+  return -1;
 }
 
-// -------- privilege drop -------
-
+static void acct_fill_utmp(struct utmp *ut, const struct acct_event *ev)
+{
+  char id[32];
+  (void)safe_snprintf(id, sizeof(id), "%ld", (long)ev->login_pid);
+  memset(ut, 0, sizeof(*ut));
+  copy_fixed_field(ut->ut_line, sizeof(ut->ut_line), LINUXIO_WEB_TTY);
+  ut->ut_pid = ev->login_pid;
+  ut->ut_tv.tv_sec = clamp_time_to_u32(ev->tv.tv_sec);
+  ut->ut_tv.tv_usec = clamp_suseconds_to_i32(ev->tv.tv_usec);
+  switch (ev->kind)
+  {
+  case ACCT_LOGIN:
+    ut->ut_type = USER_PROCESS;
+    copy_fixed_field(ut->ut_id, sizeof(ut->ut_id), id);
+    copy_fixed_field(ut->ut_user, sizeof(ut->ut_user), ev->user);
+    copy_fixed_field(ut->ut_host, sizeof(ut->ut_host), ev->remote_host);
+    break;
+  case ACCT_LOGOUT:
+    ut->ut_type = DEAD_PROCESS;
+    copy_fixed_field(ut->ut_id, sizeof(ut->ut_id), id);
+    break;
+  default: // ACCT_FAILED: btmp, like login(1)'s bad-login records
+    ut->ut_type = LOGIN_PROCESS;
+    copy_fixed_field(ut->ut_user, sizeof(ut->ut_user), ev->user);
+    copy_fixed_field(ut->ut_host, sizeof(ut->ut_host), ev->remote_host);
+    break;
+  }
+}
 
-static int env_get_int(const char *name, int defval, int minv, int maxv)
+// Append records to wtmp/btmp in one write under the file's lock.
+static void acct_append(int fd, const char *path, const struct utmp *recs, size_t n)
 {
-  const char *s = getenv(name);
-  if (!s || !*s)
-    return defval;
-  char *end = NULL;
-  long v = strtol(s, &end, 10);
-  if (!end || *end)
-    return defval;
-  if (v < minv)
+  if (fd < 0 || n == 0)
+    return;
+  if (acct_lock(fd, F_WRLCK) != 0)
+  {
+    journal_errorf("failed to lock %s: %m", path);
+    return;
+  }
+  ssize_t nwritten = write(fd, recs, n * sizeof(*recs));
+  if (nwritten != (ssize_t)(n * sizeof(*recs)))
+  {
+    if (nwritten < 0)
+      journal_errorf("failed to write %s: %m", path);
+    else
+      journal_errorf("partial write to %s", path);
+  }
+  (void)acct_lock(fd, F_UNLCK);
+}
+
+static void acct_update_lastlog(struct acct_writer *w, const struct acct_event *ev, size_t n)
+{
+  if (w->lastlog_fd < 0)
+    return;
+  int locked = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (ev[i].kind != ACCT_LOGIN)
+      continue;
+    if (!locked)
+    {
+      if (flock(w->lastlog_fd, LOCK_EX) != 0)
+      {
+        journal_errorf("failed to lock %s: %m", LINUXIO_LASTLOG_PATH);
+        return;
+      }
+      locked = 1;
+    }
+    struct lastlog entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.ll_time = clamp_time_to_u32(ev[i].tv.tv_sec);
+    copy_fixed_field(entry.ll_host, sizeof(entry.ll_host), ev[i].remote_host);
+    copy_fixed_field(entry.ll_line, sizeof(entry.ll_line), LINUXIO_WEB_TTY);
+    off_t offset = (off_t)ev[i].uid * (off_t)sizeof(entry);
+    ssize_t nwritten = pwrite(w->lastlog_fd, &entry, sizeof(entry), offset);
+    if (nwritten != (ssize_t)sizeof(entry))
+    {
+      if (nwritten < 0)
+        journal_errorf("failed to write %s for uid=%u: %m", LINUXIO_LASTLOG_PATH,
+                       (unsigned)ev[i].uid);
+      else
+        journal_errorf("partial write to %s for uid=%u", LINUXIO_LASTLOG_PATH,
+                       (unsigned)ev[i].uid);
+    }
+  }
+  if (locked)
+    (void)flock(w->lastlog_fd, LOCK_UN);
+}
+
+// Write up to ACCT_BATCH_MAX events. With coalesce, repeated failures from
+// the same user and host collapse into one btmp record (the latest) and the
+// count goes to the journal instead.
+static void acct_apply(struct acct_writer *w, const struct acct_event *ev, size_t n, int coalesce)
+{
+  struct utmp wtmp[ACCT_BATCH_MAX];
+  struct utmp btmp[ACCT_BATCH_MAX];
+  unsigned btmp_count[ACCT_BATCH_MAX];
+  size_t nwtmp = 0;
+  size_t nbtmp = 0;
+
+  if (n > ACCT_BATCH_MAX)
+    n = ACCT_BATCH_MAX;
+  if (acct_follow_file(&w->utmp_fd, &w->utmp_st, LINUXIO_UTMP_PATH, O_RDWR))
+    w->index_valid = 0;
+  (void)acct_follow_file(&w->wtmp_fd, &w->wtmp_st, LINUXIO_WTMP_PATH, O_WRONLY | O_APPEND);
+  (void)acct_follow_file(&w->lastlog_fd, &w->lastlog_st, LINUXIO_LASTLOG_PATH, O_RDWR);
+
+  for (size_t i = 0; i < n; i++)
+  {
+    struct utmp ut;
+    acct_fill_utmp(&ut, &ev[i]);
+    if (ev[i].kind != ACCT_FAILED)
+    {
+      wtmp[nwtmp++] = ut;
+      continue;
+    }
+    size_t j = 0;
+    while (coalesce && j < nbtmp &&
+           (strncmp(btmp[j].ut_user, ut.ut_user, sizeof(ut.ut_user)) != 0 ||
+            strncmp(btmp[j].ut_host, ut.ut_host, sizeof(ut.ut_host)) != 0))
+      j++;
+    if (!coalesce || j == nbtmp)
+    {
+      j = nbtmp++;
+      btmp_count[j] = 0;
+    }
+    btmp[j] = ut;
+    btmp_count[j]++;
+  }
+
+  if (w->utmp_fd >= 0 && nwtmp > 0)
+  {
+    if (acct_lock(w->utmp_fd, F_WRLCK) != 0)
+    {
+      journal_errorf("failed to lock %s: %m", LINUXIO_UTMP_PATH);
+    }
+    else
+    {
+      for (size_t i = 0; i < nwtmp; i++)
+      {
+        if (utmp_write(w, &wtmp[i]) != 0)
+          journal_errorf("failed to write %s: %m", LINUXIO_UTMP_PATH);
+      }
+      (void)acct_lock(w->utmp_fd, F_UNLCK);
+    }
+  }
+  acct_append(w->wtmp_fd, LINUXIO_WTMP_PATH, wtmp, nwtmp);
+  acct_update_lastlog(w, ev, n);
+  // btmp is created on the first failure, as login(1) does
+  if (nbtmp > 0)
+    (void)acct_follow_file(&w->btmp_fd, &w->btmp_st, LINUXIO_BTMP_PATH,
+                           O_WRONLY | O_APPEND | O_CREAT);
+  acct_append(w->btmp_fd, LINUXIO_BTMP_PATH, btmp, nbtmp);
+
+  for (size_t j = 0; j < nbtmp; j++)
+  {
+    if (btmp_count[j] < 2)
+      continue;
+    char user[sizeof(btmp[j].ut_user) + 1];
+    char host[sizeof(btmp[j].ut_host) + 1];
+    char count_buf[16];
+    memcpy(user, btmp[j].ut_user, sizeof(btmp[j].ut_user));
+    user[sizeof(user) - 1] = '\0';
+    memcpy(host, btmp[j].ut_host, sizeof(btmp[j].ut_host));
+    host[sizeof(host) - 1] = '\0';
+    (void)safe_snprintf(count_buf, sizeof(count_buf), "%u", btmp_count[j]);
+    const struct journal_field fields[] = {
+        {"LINUXIO_USER", user},
+        {"LINUXIO_REMOTE_HOST", host},
+        {"LINUXIO_COUNT", count_buf},
+    };
+    journal_info_fieldsf(fields, 3, "coalesced %u failed logins into one btmp record",
+                         btmp_count[j]);
+  }
+}
+
+// Write out the queued events. Call once the client has its response.
+static void acct_flush(void)
+{
+  if (g_acct_nqueued == 0)
+    return;
+  size_t len = (size_t)g_acct_nqueued * sizeof(g_acct_queue[0]);
+  if (g_acct_fd >= 0)
+  {
+    ssize_t sent;
+    do
+    {
+      sent = send(g_acct_fd, g_acct_queue, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent == (ssize_t)len)
+    {
+      g_acct_nqueued = 0;
+      return;
+    }
+    // Writer gone or backlogged: write them ourselves
+  }
+  struct acct_writer w;
+  acct_writer_open(&w);
+  acct_apply(&w, g_acct_queue, (size_t)g_acct_nqueued, 0);
+  acct_writer_close(&w);
+  g_acct_nqueued = 0;
+}
+
+static void acct_queue(int kind, uid_t uid, const char *user, const char *remote_host,
+                       pid_t login_pid)
+{
+  if (g_acct_nqueued == ACCT_QUEUE_MAX)
+    acct_flush();
+  struct acct_event *ev = &g_acct_queue[g_acct_nqueued++];
+  memset(ev, 0, sizeof(*ev));
+  ev->kind = kind;
+  ev->uid = uid;
+  ev->login_pid = login_pid;
+  gettimeofday(&ev->tv, NULL);
+  if (user)
+    (void)safe_snprintf(ev->user, sizeof(ev->user), "%s", user);
+  if (remote_host)
+    (void)safe_snprintf(ev->remote_host, sizeof(ev->remote_host), "%s", remote_host);
+}
+
+static void btmp_log(const char *username, const char *remote_host)
+{
+  acct_queue(ACCT_FAILED, 0, username, remote_host, getpid());
+}
+
+static void record_login_start(const struct auth_user *auth_user, const char *remote_host)
+{
+  acct_queue(ACCT_LOGIN, auth_user->uid, auth_user->name, remote_host, getpid());
+}
+
+// login_pid is the process that called record_login_start()
+static void record_login_end(pid_t login_pid)
+{
+  acct_queue(ACCT_LOGOUT, 0, NULL, NULL, login_pid);
+}
+
+static int pam_conv_func(int n, const struct pam_message **msg, struct pam_response **resp, const void *appdata_ptr)
+{
+  const struct pam_appdata *appdata = (const struct pam_appdata *)appdata_ptr;
+  if (n <= 0 || n > 32)
+    return PAM_CONV_ERR;
+  struct pam_response *r = calloc((size_t)n, sizeof(*r));
+  if (!r)
+    return PAM_CONV_ERR;
+
+  for (int i = 0; i < n; i++)
+  {
+    switch (msg[i]->msg_style)
+    {
+    case PAM_PROMPT_ECHO_OFF:
+      if (appdata && appdata->password)
+      {
+        r[i].resp = dup_pam_string(appdata->password);
+        if (!r[i].resp)
+        {
+          free_pam_responses(r, i);
+          return PAM_CONV_ERR;
+        }
+      }
+      break;
+
+    case PAM_PROMPT_ECHO_ON:
+      if (appdata && appdata->username)
+      {
+        r[i].resp = dup_pam_string(appdata->username);
+        if (!r[i].resp)
+        {
+          free_pam_responses(r, i);
+          return PAM_CONV_ERR;
+        }
+      }
+      break;
+
+    case PAM_TEXT_INFO:
+    case PAM_ERROR_MSG:
+      // Ignore informational messages
+      break;
+
+    default:
+      // Ignore other message types
+      break;
+    }
+  }
+  *resp = r;
+  return PAM_SUCCESS;
+}
+
+static int auth_pam_start(const char *user, const struct pam_conv *conv, pam_handle_t **pamh)
+{
+#ifdef LINUXIO_PAM_CONFDIR
+  return pam_start_confdir(LINUXIO_PAM_SERVICE, user, conv, LINUXIO_PAM_CONFDIR, pamh);
+#else
+  return pam_start(LINUXIO_PAM_SERVICE, user, conv, pamh);
+#endif
+}
+
+// -------- PAM stack preload (daemon mode) --------
+// pam_start() parses the service file and dlopen()s every module of the
+// stack. The daemon keeps one handle of its own, never used for a
+// transaction, so the modules stay mapped and relocated in it and in every
+// worker forked afterwards: a worker's pam_start() still reads the service
+// file, but dlopen() of an already loaded module only takes a reference.
+
+static pam_handle_t *g_pam_preload;
+
+static int pam_preload_conv(int n, const struct pam_message **msg, struct pam_response **resp,
+                            void *appdata_ptr)
+{
+  (void)n;
+  (void)msg;
+  (void)resp;
+  (void)appdata_ptr;
+  return PAM_CONV_ERR;
+}
+
+// (Re)load the stack. The new handle is started before the old one ends, so
+// modules that are still configured are never unloaded in between. On
+// failure the previous handle, if any, is kept.
+static int pam_preload(void)
+{
+  static const struct pam_conv conv = {pam_preload_conv, NULL};
+  pam_handle_t *pamh = NULL;
+  int rc = auth_pam_start(NULL, &conv, &pamh);
+  if (rc != PAM_SUCCESS)
+  {
+    journal_errorf("PAM stack preload failed: %s", pam_strerror(pamh, rc));
+    if (pamh)
+      (void)pam_end(pamh, rc);
+    return -1;
+  }
+  if (g_pam_preload)
+    (void)pam_end(g_pam_preload, PAM_SUCCESS);
+  g_pam_preload = pamh;
+  return 0;
+}
+
+// -------- privilege drop -------
+
+
+static int env_get_int(const char *name, int defval, int minv, int maxv)
+{
+  const char *s = getenv(name);
+  if (!s || !*s)
+    return defval;
+  char *end = NULL;
+  long v = strtol(s, &end, 10);
+  if (!end || *end)
+    return defval;
+  if (v < minv)
     v = minv;
   if (v > maxv)
     v = maxv;
@@ -680,7 +1334,10 @@ static int validate_parent_dir_via_fd(int dfd, uid_t file_owner, uid_t user_uid)
   return validate_parent_dir_policy(&ds, file_owner, user_uid);
 }
 
-static int open_and_validate_bridge(const char *bridge_path, uid_t required_owner, int *out_fd)
+// On success *out_fd is the validated O_PATH fd. If out_dfd is non-NULL it
+// receives the O_PATH fd of the validated parent directory as well.
+static int open_and_validate_bridge(const char *bridge_path, uid_t required_owner, int *out_fd,
+                                    int *out_dfd)
 {
   int fd = open(bridge_path, O_PATH | O_CLOEXEC | O_NOFOLLOW);
   if (fd < 0)
@@ -724,7 +1381,8 @@ static int open_and_validate_bridge(const char *bridge_path, uid_t required_owne
     return -1;
   }
   int dir_ok = validate_parent_dir_via_fd(dfd, st.st_uid, required_owner);
-  close(dfd);
+  if (dir_ok != 0 || !out_dfd)
+    close(dfd);
   if (dir_ok != 0)
   {
     close(fd);
@@ -732,9 +1390,117 @@ static int open_and_validate_bridge(const char *bridge_path, uid_t required_owne
   }
 
   *out_fd = fd;
+  if (out_dfd)
+    *out_dfd = dfd;
+  return 0;
+}
+
+// ---- cached bridge validation (daemon mode) ----
+// The daemon parent validates the bridge once and keeps the O_PATH fds of the
+// binary and its directory together with their stat tuples; workers inherit
+// them across fork(). A login then only re-stats: the cached inode must still
+// pass validate_bridge_via_fd() with an unchanged tuple, and the path and
+// directory must still name the same inodes. Any difference falls back to the
+// full open_and_validate_bridge(). The fd handed to spawn_bridge_process() is
+// always one that passed these checks, so execveat(AT_EMPTY_PATH) keeps its
+// TOCTOU guarantee. The parent refreshes the cache when inotify reports a
+// change in the bridge directory.
+#ifndef BRIDGE_PATH
+#define BRIDGE_PATH     "/usr/local/bin/linuxio-bridge"
+#define BRIDGE_DIR      "/usr/local/bin"
+#endif
+#define BRIDGE_BASENAME "linuxio-bridge"
+
+struct bridge_cache
+{
+  int fd;  // O_PATH fd of the validated binary, -1 when empty
+  int dfd; // O_PATH fd of its directory
+  struct stat st;
+  struct stat dst;
+};
+
+static struct bridge_cache g_bridge_cache = {.fd = -1, .dfd = -1};
+
+static int stat_same(const struct stat *a, const struct stat *b)
+{
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+         a->st_mode == b->st_mode && a->st_uid == b->st_uid &&
+         a->st_gid == b->st_gid && a->st_size == b->st_size &&
+         a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+         a->st_ctim.tv_sec == b->st_ctim.tv_sec && a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+static void bridge_cache_clear(void)
+{
+  if (g_bridge_cache.fd >= 0)
+    close(g_bridge_cache.fd);
+  if (g_bridge_cache.dfd >= 0)
+    close(g_bridge_cache.dfd);
+  g_bridge_cache.fd = -1;
+  g_bridge_cache.dfd = -1;
+}
+
+// Full validation into the cache. Returns 0 on success; the cache is empty
+// on failure.
+static int bridge_cache_refresh(void)
+{
+  bridge_cache_clear();
+
+  int fd = -1;
+  int dfd = -1;
+  if (open_and_validate_bridge(BRIDGE_PATH, 0, &fd, &dfd) != 0)
+    return -1;
+  if (fstat(fd, &g_bridge_cache.st) != 0 || fstat(dfd, &g_bridge_cache.dst) != 0)
+  {
+    close(fd);
+    close(dfd);
+    return -1;
+  }
+  g_bridge_cache.fd = fd;
+  g_bridge_cache.dfd = dfd;
+  return 0;
+}
+
+// Cheap revalidation of the cached fds. Returns 0 if they may still be used.
+static int bridge_cache_check(void)
+{
+  if (g_bridge_cache.fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(g_bridge_cache.fd, &st) != 0 || !stat_same(&st, &g_bridge_cache.st))
+    return -1;
+  if (validate_bridge_via_fd(g_bridge_cache.fd, 0) != 0)
+    return -1;
+  if (lstat(BRIDGE_PATH, &st) != 0 ||
+      st.st_dev != g_bridge_cache.st.st_dev || st.st_ino != g_bridge_cache.st.st_ino)
+    return -1;
+
+  if (fstat(g_bridge_cache.dfd, &st) != 0 || !stat_same(&st, &g_bridge_cache.dst))
+    return -1;
+  if (validate_parent_dir_policy(&st, g_bridge_cache.st.st_uid, 0) != 0)
+    return -1;
+  if (stat(BRIDGE_DIR, &st) != 0 ||
+      st.st_dev != g_bridge_cache.dst.st_dev || st.st_ino != g_bridge_cache.dst.st_ino)
+    return -1;
   return 0;
 }
 
+// Validated O_PATH fd of the bridge for one login; the caller closes it.
+static int acquire_bridge_fd(int *out_fd)
+{
+  if (bridge_cache_check() == 0)
+  {
+    int fd = fcntl(g_bridge_cache.fd, F_DUPFD_CLOEXEC, 0);
+    if (fd >= 0)
+    {
+      *out_fd = fd;
+      return 0;
+    }
+  }
+  return open_and_validate_bridge(BRIDGE_PATH, 0, out_fd, NULL);
+}
+
 // -------- Binary bootstrap helpers --------
 static void write_u32_be(uint8_t *buf, uint32_t v)
 {
@@ -744,59 +1510,133 @@ static void write_u32_be(uint8_t *buf, uint32_t v)
   buf[3] = (uint8_t)(v);
 }
 
+static void write_u64_be(uint8_t *buf, uint64_t v)
+{
+  write_u32_be(buf, (uint32_t)(v >> 32));
+  write_u32_be(buf + 4, (uint32_t)v);
+}
+
 static void write_u16_be(uint8_t *buf, uint16_t v)
 {
   buf[0] = (uint8_t)(v >> 8);
   buf[1] = (uint8_t)(v);
 }
 
-// Write a length-prefixed string (2-byte length + data)
-static int write_lenstr(int fd, const char *s)
+// Append a length-prefixed string to buf. Returns 0, or -1 if it doesn't fit.
+static int put_lenstr(uint8_t *buf, size_t cap, size_t *pos, const char *s)
+{
+  size_t len = s ? strlen(s) : 0;
+  if (len > 0xFFFF || *pos + 2 + len > cap)
+    return -1;
+  write_u16_be(buf + *pos, (uint16_t)len);
+  if (len > 0)
+    memcpy(buf + *pos + 2, s, len);
+  *pos += 2 + len;
+  return 0;
+}
+
+// What linuxio-auth resolved during the login, for the bootstrap extension.
+// Fields left NULL (ngroups < 0, times 0) are not sent.
+struct bootstrap_ext
+{
+  const char *home;
+  const gid_t *groups;
+  int ngroups;
+  const char *priv_source;
+  uint64_t requested_us;     // wall clock, see PROTO_BOOT_LOGIN_TIME
+  uint64_t authenticated_us;
+};
+
+// Append one [type:1][len:2][value] extension entry. Returns 0, or -1 if it
+// doesn't fit.
+static int put_boot_entry(uint8_t *buf, size_t cap, size_t *pos, uint8_t type, size_t len)
+{
+  if (len > 0xFFFF || *pos + PROTO_BOOT_ENTRY_HEADER + len > cap)
+    return -1;
+  buf[*pos] = type;
+  write_u16_be(buf + *pos + 1, (uint16_t)len);
+  *pos += PROTO_BOOT_ENTRY_HEADER;
+  return 0;
+}
+
+static int encode_bootstrap_ext(uint8_t *buf, size_t cap, size_t *pos,
+                                const struct bootstrap_ext *ext)
 {
-  uint16_t len = 0;
-  if (s)
+  size_t start = *pos;
+  if (start + 2 > cap)
+    return -1;
+  *pos += 2;
+
+  if (ext->home)
+  {
+    size_t len = strlen(ext->home);
+    if (put_boot_entry(buf, cap, pos, PROTO_BOOT_HOME, len) != 0)
+      return -1;
+    memcpy(buf + *pos, ext->home, len);
+    *pos += len;
+  }
+  // A list too long to send is left for the bridge to look up
+  if (ext->ngroups >= 0 && ext->ngroups <= PROTO_BOOT_MAX_GROUPS)
+  {
+    if (put_boot_entry(buf, cap, pos, PROTO_BOOT_GROUPS, 4 * (size_t)ext->ngroups) != 0)
+      return -1;
+    for (int i = 0; i < ext->ngroups; i++, *pos += 4)
+      write_u32_be(buf + *pos, (uint32_t)ext->groups[i]);
+  }
+  if (ext->priv_source)
+  {
+    size_t len = strlen(ext->priv_source);
+    if (put_boot_entry(buf, cap, pos, PROTO_BOOT_PRIV_SOURCE, len) != 0)
+      return -1;
+    memcpy(buf + *pos, ext->priv_source, len);
+    *pos += len;
+  }
+  if (ext->requested_us || ext->authenticated_us)
   {
-    size_t slen = strlen(s);
-    if (slen > 0xFFFF)
-      slen = 0xFFFF; // Cap at max uint16
-    len = (uint16_t)slen;
+    if (put_boot_entry(buf, cap, pos, PROTO_BOOT_LOGIN_TIME, 16) != 0)
+      return -1;
+    write_u64_be(buf + *pos, ext->requested_us);
+    write_u64_be(buf + *pos + 8, ext->authenticated_us);
+    *pos += 16;
   }
 
-  uint8_t lenbuf[2];
-  write_u16_be(lenbuf, len);
-  if (write_all(fd, lenbuf, 2) != 0)
-    return -1;
-  if (len > 0 && write_all(fd, s, len) != 0)
+  size_t len = *pos - start - 2;
+  if (len > 0xFFFF)
     return -1;
+  write_u16_be(buf + start, (uint16_t)len);
   return 0;
 }
 
-// Write binary bootstrap to a file descriptor
-// Returns 0 on success, -1 on error
-static int write_bootstrap_binary(
-    int fd,
+// Encode the binary bootstrap into buf, with the extension unless ext is
+// NULL. Returns its length, or -1 if it doesn't fit.
+static ssize_t encode_bootstrap_binary(
+    uint8_t *buf,
+    size_t cap,
     const char *session_id,
     const char *username,
     uid_t uid,
     gid_t gid,
     int verbose,
-    int privileged)
+    int privileged,
+    const struct bootstrap_ext *ext)
 {
-  uint8_t header[PROTO_HEADER_SIZE];
-  int pos = 0;
+  if (cap < PROTO_HEADER_SIZE)
+    return -1;
+
+  size_t pos = 0;
 
   // Magic + version (4 bytes)
-  header[pos++] = PROTO_MAGIC_0;
-  header[pos++] = PROTO_MAGIC_1;
-  header[pos++] = PROTO_MAGIC_2;
-  header[pos++] = PROTO_VERSION;
+  buf[pos++] = PROTO_MAGIC_0;
+  buf[pos++] = PROTO_MAGIC_1;
+  buf[pos++] = PROTO_MAGIC_2;
+  buf[pos++] = PROTO_VERSION;
 
   // UID (4 bytes)
-  write_u32_be(header + pos, (uint32_t)uid);
+  write_u32_be(buf + pos, (uint32_t)uid);
   pos += 4;
 
   // GID (4 bytes)
-  write_u32_be(header + pos, (uint32_t)gid);
+  write_u32_be(buf + pos, (uint32_t)gid);
   pos += 4;
 
   // Flags (1 byte)
@@ -805,1136 +1645,7278 @@ static int write_bootstrap_binary(
     flags |= PROTO_FLAG_VERBOSE;
   if (privileged)
     flags |= PROTO_FLAG_PRIVILEGED;
-  header[pos] = flags;
+  if (ext)
+    flags |= PROTO_FLAG_EXTENDED;
+  buf[pos++] = flags;
 
-  // Write fixed header
-  if (write_all(fd, header, PROTO_HEADER_SIZE) != 0)
+  // Variable-length fields (length-prefixed)
+  if (put_lenstr(buf, cap, &pos, session_id) != 0)
     return -1;
-
-  // Write variable-length fields (length-prefixed)
-  if (write_lenstr(fd, session_id) != 0)
+  if (put_lenstr(buf, cap, &pos, username) != 0)
     return -1;
-  if (write_lenstr(fd, username) != 0)
+  if (ext && encode_bootstrap_ext(buf, cap, &pos, ext) != 0)
     return -1;
 
-  return 0;
+  return (ssize_t)pos;
 }
 
-// sudo probing
-static int run_cmd_as_user_with_input(const struct passwd *pw, const char *const argv[],
-                                      const char *stdin_data, int timeout_sec)
+// Home, group list, privilege source ("groups" is the longest) and login time
+#define BOOTSTRAP_EXT_MAX_SIZE                                                           \
+  (2 + PROTO_BOOT_ENTRY_HEADER + MAX_PATH_LEN + PROTO_BOOT_ENTRY_HEADER +                \
+   4 * PROTO_BOOT_MAX_GROUPS + PROTO_BOOT_ENTRY_HEADER + 16 + PROTO_BOOT_ENTRY_HEADER + 16)
+
+#define BOOTSTRAP_MAX_SIZE \
+  (PROTO_HEADER_SIZE + 2 + PROTO_MAX_SESSION_ID + 2 + PROTO_MAX_USERNAME + BOOTSTRAP_EXT_MAX_SIZE)
+
+// Write binary bootstrap to a file descriptor
+// Returns 0 on success, -1 on error
+static int write_bootstrap_binary(
+    int fd,
+    const char *session_id,
+    const char *username,
+    uid_t uid,
+    gid_t gid,
+    int verbose,
+    int privileged,
+    const struct bootstrap_ext *ext)
 {
-  int inpipe[2] = {-1, -1};
-#if defined(HAVE_PIPE2) || (defined(__linux__) && defined(O_CLOEXEC))
-  if (pipe2(inpipe, O_CLOEXEC) != 0)
-    return -1;
-#else
-  if (pipe(inpipe) != 0)
+  uint8_t buf[BOOTSTRAP_MAX_SIZE];
+  ssize_t n = encode_bootstrap_binary(buf, sizeof(buf), session_id, username, uid, gid,
+                                      verbose, privileged, ext);
+  if (n < 0)
     return -1;
-  {
-    int fdflags = fcntl(inpipe[0], F_GETFD);
-    if (fdflags >= 0)
-      (void)fcntl(inpipe[0], F_SETFD, fdflags | FD_CLOEXEC);
-    fdflags = fcntl(inpipe[1], F_GETFD);
-    if (fdflags >= 0)
-      (void)fcntl(inpipe[1], F_SETFD, fdflags | FD_CLOEXEC);
-  }
-#endif
+  return write_all(fd, buf, (size_t)n);
+}
 
-  pid_t pid = fork();
-  if (pid < 0)
+// -------- shared tables (daemon mode) --------
+// The tables the daemon shares with its workers (NSS cache, metrics,
+// failed-login throttle, admission) are MAP_SHARED views of memfds rather
+// than anonymous memory. A hot upgrade (daemon_reexec()) passes the memfds
+// to the new image, which maps the same pages: warm cache entries, counters
+// and throttle state survive, and workers forked by the old image keep
+// updating tables the new one reads.
+enum shared_table
+{
+  SHARED_NSS,
+  SHARED_METRICS,
+  SHARED_FAIL,
+  SHARED_ADMISSION,
+  SHARED_TABLES,
+};
+
+static const char *const shared_table_names[SHARED_TABLES] = {
+    [SHARED_NSS] = "linuxio-auth-nss",
+    [SHARED_METRICS] = "linuxio-auth-metrics",
+    [SHARED_FAIL] = "linuxio-auth-fail",
+    [SHARED_ADMISSION] = "linuxio-auth-admission",
+};
+
+struct shared_table_fd
+{
+  int fd;     // backing memfd, -1 if the table is not mapped
+  int mapped; // mapped by this image; an inherited fd stays 0 until then
+};
+
+static struct shared_table_fd g_shared[SHARED_TABLES] = {
+    {-1, 0}, {-1, 0}, {-1, 0}, {-1, 0},
+};
+
+// Map table t, zero-filled, or the one inherited across a hot upgrade if it
+// has the same size. Returns MAP_FAILED with errno set on failure.
+static void *shared_table_map(enum shared_table t, size_t size)
+{
+  struct shared_table_fd *s = &g_shared[t];
+  struct stat st;
+  if (s->fd >= 0 && (fstat(s->fd, &st) != 0 || st.st_size != (off_t)size))
   {
-    close(inpipe[0]);
-    close(inpipe[1]);
-    return -1;
+    close(s->fd);
+    s->fd = -1;
   }
-  if (pid == 0)
+  if (s->fd < 0)
   {
-    if (setgroups(0, NULL) != 0)
-      _exit(127);
-    if (initgroups(pw->pw_name, pw->pw_gid) != 0)
-      _exit(127);
-    if (setgid(pw->pw_gid) != 0)
-      _exit(127);
-    if (setuid(pw->pw_uid) != 0)
-      _exit(127);
-
-    if (dup2(inpipe[0], STDIN_FILENO) < 0)
-      _exit(127);
-    close(inpipe[0]);
-    close(inpipe[1]);
-
-    clearenv();
-    setenv("PATH", "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin", 1);
-    setenv("LANG", "C", 1);
-    execv("/usr/bin/sudo", ARGV_UNCONST(argv));
-
-    _exit(127);
+    s->fd = memfd_create(shared_table_names[t], MFD_CLOEXEC);
+    if (s->fd < 0)
+      return MAP_FAILED;
+    if (ftruncate(s->fd, (off_t)size) != 0)
+    {
+      int saved = errno;
+      close(s->fd);
+      s->fd = -1;
+      errno = saved;
+      return MAP_FAILED;
+    }
   }
-  close(inpipe[0]);
-  if (stdin_data && *stdin_data)
-    (void)write_all(inpipe[1], stdin_data, strlen(stdin_data));
-  close(inpipe[1]);
-
-  int status = 0;
-  int elapsed_ms = 0;
-  while (elapsed_ms < timeout_sec * 1000)
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+  if (p == MAP_FAILED)
   {
-    pid_t r = waitpid(pid, &status, WNOHANG);
-    if (r == pid)
-      break;
-    if (r < 0 && errno != EINTR)
-      break;
-    usleep(100 * 1000);
-    elapsed_ms += 100;
+    int saved = errno;
+    close(s->fd);
+    s->fd = -1;
+    errno = saved;
+    return MAP_FAILED;
   }
-  if (elapsed_ms >= timeout_sec * 1000)
+  s->mapped = 1;
+  return p;
+}
+
+// Close inherited tables this image did not map (their feature is now off).
+static void shared_tables_drop_unmapped(void)
+{
+  for (int t = 0; t < SHARED_TABLES; t++)
   {
-    kill(pid, SIGKILL);
-    waitpid(pid, &status, 0);
-    return -1;
+    if (g_shared[t].fd >= 0 && !g_shared[t].mapped)
+    {
+      close(g_shared[t].fd);
+      g_shared[t].fd = -1;
+    }
   }
-
-  if (WIFEXITED(status))
-    return WEXITSTATUS(status);
-  if (WIFSIGNALED(status))
-    return 128 + WTERMSIG(status);
-  return -1;
 }
 
-static int user_has_sudo(const struct passwd *pw, const char *password, int *out_nopasswd)
+// -------- NSS lookup cache (daemon mode) --------
+// On hosts joined to an identity service every getpwnam()/getgrouplist()
+// may be a round trip to sssd or LDAP, and a login used to make several of
+// them before PAM even started (the peer check) and after it (passwd entry,
+// the sudo probe's and the bridge's group lists). In daemon mode passwd
+// entries and group lists are kept in a table the daemon maps MAP_SHARED
+// before forking workers, for LINUXIO_AUTH_NSS_CACHE_TTL seconds at most.
+// An entry is also dropped once /etc/passwd, /etc/group or the sssd/nscd
+// caches behind them change (their stat fingerprint, mtime and ctime
+// included, differs) and when the daemon gets SIGHUP, which bumps the table
+// generation folded into that fingerprint. Slots are placed by name; a uid
+// index of hints, each checked against the slot it names, makes the peer
+// check's uid lookup a short probe too. Each slot is a seqlock: a writer
+// makes seq odd with a CAS, so a slot has one writer at a time and readers
+// retry into a plain lookup whenever they see it change. Only successful
+// lookups are cached. g_nss.table stays NULL in Accept=yes mode and every
+// lookup goes to NSS.
+#define NSS_CACHE_SLOTS       64 // power of two
+#define NSS_CACHE_PROBE_LIMIT 8
+#define NSS_CACHE_MAX_GROUPS  64
+#define NSS_CACHE_DIR_MAX     256
+#define NSS_CACHE_TTL_DEFAULT 60
+#define NSS_CACHE_TTL_MAX     3600
+#define NSS_NO_GROUPS         UINT32_MAX // passwd entry without its group list yet
+
+struct nss_slot
 {
-  // We don't currently differentiate NOPASSWD vs PASSWD in the rest of the code,
-  // so just clear this and treat "has sudo" as a boolean.
-  if (out_nopasswd)
-    *out_nopasswd = 0;
+  uint32_t seq;       // odd while a writer fills the slot
+  uint32_t ngroups;   // NSS_NO_GROUPS until the group list is known
+  uint64_t fp;        // nss_fingerprint() when filled, 0 if the slot is empty
+  uint64_t expires_ms;
+  uint32_t uid;
+  uint32_t gid;
+  char name[PROTO_MAX_USERNAME];
+  char dir[NSS_CACHE_DIR_MAX];
+  uint32_t groups[NSS_CACHE_MAX_GROUPS];
+};
 
-  // How long we wait for sudo -S -v to complete
-  int to_pw = env_get_int("LINUXIO_SUDO_TIMEOUT_PASSWORD", 4, 1, 30);
+struct nss_table
+{
+  uint64_t generation;                 // bumped to invalidate every entry
+  uint32_t uid_index[NSS_CACHE_SLOTS]; // uid hash -> slot + 1, 0 if empty
+  struct nss_slot slots[NSS_CACHE_SLOTS];
+};
 
-  // If we don't have a password, don't even try
-  if (!password || !*password)
-    return 0;
+struct nss_cache
+{
+  struct nss_table *table;
+  struct nss_slot *slots; // table->slots
+  int ttl_ms;
+  gid_t socket_gid; // AUTH_SOCKET_GROUP, resolved by the daemon at startup
+  int socket_gid_ok;
+};
 
-  // Validate sudo using the same password we used for PAM
-  const char *argv_pw[] = {"/usr/bin/sudo", "-S", "-p", "", "-v", NULL};
+static struct nss_cache g_nss;
 
-  // Buffer must accommodate password + newline + null terminator
-  char buf[PROTO_MAX_PASSWORD + 2];
-  (void)safe_snprintf(buf, sizeof(buf), "%s\n", password);
+// Also the building blocks of the privilege cache fingerprints.
+static uint64_t fnv1a64(uint64_t h, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  for (size_t i = 0; i < len; i++)
+  {
+    h ^= p[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
 
-  int rc = run_cmd_as_user_with_input(pw, argv_pw, buf, to_pw);
+#define FNV1A64_INIT 0xcbf29ce484222325ull
 
-  // Wipe the temporary buffer
-  secure_bzero(buf, sizeof(buf));
+static uint64_t stat_fingerprint(uint64_t h, const struct stat *st)
+{
+  const uint64_t parts[] = {
+      (uint64_t)st->st_dev, (uint64_t)st->st_ino, (uint64_t)st->st_mode,
+      (uint64_t)st->st_uid, (uint64_t)st->st_size,
+      (uint64_t)st->st_mtim.tv_sec, (uint64_t)st->st_mtim.tv_nsec,
+      (uint64_t)st->st_ctim.tv_sec, (uint64_t)st->st_ctim.tv_nsec};
+  return fnv1a64(h, parts, sizeof(parts));
+}
 
-  if (rc == 0)
+// The files that change when users or groups do: the local databases, the
+// sssd memory caches (rewritten or replaced when sssd's view changes) and
+// nscd's persistent caches. Missing ones count as such.
+static const char *const nss_watched_paths[] = {
+    "/etc/passwd",
+    "/etc/group",
+    "/var/lib/sss/mc/passwd",
+    "/var/lib/sss/mc/group",
+    "/var/lib/sss/mc/initgroups",
+    "/var/cache/nscd/passwd",
+    "/var/cache/nscd/group",
+};
+
+static uint64_t nss_fingerprint(void)
+{
+  uint64_t h = FNV1A64_INIT;
+  for (size_t i = 0; i < sizeof(nss_watched_paths) / sizeof(nss_watched_paths[0]); i++)
   {
-    // Drop any cached sudo credentials immediately; we just wanted to know
-    // whether sudo works, not to keep a ticket open.
-    const char *argv_k[] = {"/usr/bin/sudo", "-k", NULL};
-    (void)run_cmd_as_user_with_input(pw, argv_k, NULL, 2);
-    return 1;
+    struct stat st;
+    if (stat(nss_watched_paths[i], &st) == 0)
+      h = stat_fingerprint(h, &st);
+    else
+      h = fnv1a64(h, "missing", 7);
+  }
+  if (g_nss.table)
+  {
+    uint64_t gen = __atomic_load_n(&g_nss.table->generation, __ATOMIC_ACQUIRE);
+    h = fnv1a64(h, &gen, sizeof(gen));
   }
+  return h == 0 ? 1 : h;
+}
 
-  return 0;
+// Drop every cached entry (SIGHUP): none matches the new fingerprint.
+static void nss_cache_flush(void)
+{
+  if (g_nss.table)
+    __atomic_fetch_add(&g_nss.table->generation, 1, __ATOMIC_RELEASE);
 }
 
-static void drop_to_user(const struct auth_user *auth_user)
+static int nss_slot_valid(const struct nss_slot *s, uint64_t fp, uint64_t now)
 {
-  if (!auth_user)
-    _exit(127);
-  if (setgroups(0, NULL) != 0)
-    _exit(127);
-  if (initgroups(auth_user->name, auth_user->gid) != 0)
-    _exit(127);
-  if (setgid(auth_user->gid) != 0)
-    _exit(127);
-  if (setuid(auth_user->uid) != 0)
-    _exit(127);
-  if (setuid(0) == 0)
-    _exit(127);
+  return s->fp == fp && s->expires_ms > now;
 }
-// Locale validation - only allow safe locale strings
-static int valid_locale(const char *s)
+
+// Copy slot i into *out if it is stable and current. Returns 0 on success.
+static int nss_slot_read(size_t i, struct nss_slot *out, uint64_t fp, uint64_t now)
 {
-  if (!s || !*s)
-    return 0;
+  struct nss_slot *s = &g_nss.slots[i];
+  uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+  if (seq & 1)
+    return -1;
+  memcpy(out, s, sizeof(*out));
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq || !nss_slot_valid(out, fp, now))
+    return -1;
+  out->name[sizeof(out->name) - 1] = '\0';
+  out->dir[sizeof(out->dir) - 1] = '\0';
+  return 0;
+}
 
-  size_t len = strlen(s);
-  if (len > 64)  // Reasonable max for locale strings
-    return 0;
+static size_t nss_hash(const char *name)
+{
+  return (size_t)fnv1a64(FNV1A64_INIT, name, strlen(name)) & (NSS_CACHE_SLOTS - 1);
+}
 
-  // Allow [A-Za-z0-9_.-@] for locale strings like "en_US.UTF-8" or "C.UTF-8"
-  for (size_t i = 0; i < len; i++)
+static size_t nss_uid_hash(uid_t uid)
+{
+  uint32_t v = (uint32_t)uid;
+  return (size_t)fnv1a64(FNV1A64_INIT, &v, sizeof(v)) & (NSS_CACHE_SLOTS - 1);
+}
+
+// Current entry for name, or for uid when name is NULL. Returns 0 if found.
+static int nss_cache_find(const char *name, uid_t uid, struct nss_slot *out)
+{
+  if (!g_nss.slots)
+    return -1;
+  uint64_t fp = nss_fingerprint();
+  uint64_t now = monotonic_ms();
+  size_t start = name ? nss_hash(name) : nss_uid_hash(uid);
+  for (size_t n = 0; n < NSS_CACHE_PROBE_LIMIT; n++)
   {
-    char c = s[i];
-    if (!((c >= 'A' && c <= 'Z') ||
-          (c >= 'a' && c <= 'z') ||
-          (c >= '0' && c <= '9') ||
-          c == '_' || c == '-' || c == '.' || c == '@'))
+    size_t i = (start + n) & (NSS_CACHE_SLOTS - 1);
+    if (!name)
+    {
+      // A hint: the slot it names is only used if it holds this uid
+      uint32_t hint = __atomic_load_n(&g_nss.table->uid_index[i], __ATOMIC_RELAXED);
+      if (hint == 0 || hint > NSS_CACHE_SLOTS)
+        continue;
+      i = hint - 1;
+    }
+    if (nss_slot_read(i, out, fp, now) != 0)
+      continue;
+    if (name ? strcmp(out->name, name) == 0 : out->uid == (uint32_t)uid)
       return 0;
   }
+  return -1;
+}
 
-  return 1;
+// Point the uid index at slot. Takes the uid's own hint, else an empty one or
+// one whose slot went stale, else the first; racing writers can only cost a
+// hint, never a wrong entry.
+static void nss_uid_index_set(uid_t uid, const struct nss_slot *slot, uint64_t fp, uint64_t now)
+{
+  uint32_t want = (uint32_t)(slot - g_nss.slots) + 1;
+  size_t start = nss_uid_hash(uid);
+  uint32_t *victim = NULL;
+  for (size_t n = 0; n < NSS_CACHE_PROBE_LIMIT; n++)
+  {
+    uint32_t *hp = &g_nss.table->uid_index[(start + n) & (NSS_CACHE_SLOTS - 1)];
+    uint32_t hint = __atomic_load_n(hp, __ATOMIC_RELAXED);
+    if (hint == want)
+      return;
+    // Unlocked peek, as in nss_slot_lock()
+    const struct nss_slot *s = hint && hint <= NSS_CACHE_SLOTS ? &g_nss.slots[hint - 1] : NULL;
+    if (s && s->uid == (uint32_t)uid)
+    {
+      victim = hp;
+      break;
+    }
+    if (!victim && (!s || !nss_slot_valid(s, fp, now)))
+      victim = hp;
+  }
+  __atomic_store_n(victim ? victim : &g_nss.table->uid_index[start], want, __ATOMIC_RELAXED);
 }
 
-// Session ID validation - only allow safe characters
-static int valid_session_id(const char *s)
+// Take the slot for name (its own, else an empty or stale one, else the one
+// expiring first) for writing. NULL if another writer holds it.
+static struct nss_slot *nss_slot_lock(const char *name, uint64_t fp, uint64_t now)
 {
-  if (!s || !*s)
-    return 0;
+  struct nss_slot *victim = NULL;
+  size_t start = nss_hash(name);
+  for (size_t n = 0; n < NSS_CACHE_PROBE_LIMIT; n++)
+  {
+    struct nss_slot *s = &g_nss.slots[(start + n) & (NSS_CACHE_SLOTS - 1)];
+    // Unlocked peek: a torn read only picks a worse victim
+    if (strncmp(s->name, name, sizeof(s->name)) == 0)
+    {
+      victim = s;
+      break;
+    }
+    if (!victim || !nss_slot_valid(s, fp, now) ||
+        (nss_slot_valid(victim, fp, now) && s->expires_ms < victim->expires_ms))
+      victim = s;
+  }
+  uint32_t seq = __atomic_load_n(&victim->seq, __ATOMIC_RELAXED);
+  if ((seq & 1) ||
+      !__atomic_compare_exchange_n(&victim->seq, &seq, seq + 1, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return NULL;
+  return victim;
+}
 
-  size_t len = strlen(s);
-  if (len == 0 || len > 64)  // Max 64 chars
-    return 0;
+static void nss_slot_unlock(struct nss_slot *s)
+{
+  __atomic_fetch_add(&s->seq, 1, __ATOMIC_RELEASE);
+}
 
-  // Only allow [A-Za-z0-9_-]
-  for (size_t i = 0; i < len; i++)
+static void nss_cache_store_user(const struct auth_user *user)
+{
+  if (!g_nss.slots || strlen(user->dir) >= NSS_CACHE_DIR_MAX)
+    return;
+  uint64_t fp = nss_fingerprint();
+  uint64_t now = monotonic_ms();
+  struct nss_slot *s = nss_slot_lock(user->name, fp, now);
+  if (!s)
+    return;
+  int same = nss_slot_valid(s, fp, now) && s->uid == (uint32_t)user->uid && s->gid == (uint32_t)user->gid &&
+             strcmp(s->name, user->name) == 0;
+  if (!same)
   {
-    char c = s[i];
-    if (!((c >= 'A' && c <= 'Z') ||
-          (c >= 'a' && c <= 'z') ||
-          (c >= '0' && c <= '9') ||
-          c == '_' || c == '-'))
-      return 0;
+    s->ngroups = NSS_NO_GROUPS;
+    s->uid = (uint32_t)user->uid;
+    s->gid = (uint32_t)user->gid;
+    copy_fixed_field(s->name, sizeof(s->name), user->name);
   }
+  copy_fixed_field(s->dir, sizeof(s->dir), user->dir);
+  s->fp = fp;
+  s->expires_ms = now + (uint64_t)g_nss.ttl_ms;
+  nss_slot_unlock(s);
+  nss_uid_index_set(user->uid, s, fp, now);
+}
 
-  return 1;
+// Attach a group list to the cached passwd entry it was computed for.
+static void nss_cache_store_groups(const char *name, gid_t gid, const gid_t *groups, int ngroups)
+{
+  if (!g_nss.slots || ngroups > NSS_CACHE_MAX_GROUPS)
+    return;
+  uint64_t fp = nss_fingerprint();
+  uint64_t now = monotonic_ms();
+  struct nss_slot *s = nss_slot_lock(name, fp, now);
+  if (!s)
+    return;
+  if (nss_slot_valid(s, fp, now) && s->gid == (uint32_t)gid &&
+      strncmp(s->name, name, sizeof(s->name)) == 0)
+  {
+    for (int i = 0; i < ngroups; i++)
+      s->groups[i] = (uint32_t)groups[i];
+    s->ngroups = (uint32_t)ngroups;
+  }
+  nss_slot_unlock(s);
 }
 
-// -------- Peer credential check (defense-in-depth) --------
-// Verify the connecting process is authorized (root or linuxio-bridge-socket group)
-// This mirrors the systemd socket policy but is kernel-enforced.
-#define AUTH_SOCKET_GROUP "linuxio-bridge-socket"
+static void nss_entry_user(const struct nss_slot *e, struct auth_user *out)
+{
+  memset(out, 0, sizeof(*out));
+  out->uid = (uid_t)e->uid;
+  out->gid = (gid_t)e->gid;
+  copy_fixed_field(out->name, sizeof(out->name), e->name);
+  copy_fixed_field(out->dir, sizeof(out->dir), e->dir);
+}
 
-// Returns 1 if uid is in target_gid (by configured groups), 0 if not, -1 on error.
-static int user_in_group(uid_t uid, gid_t target_gid)
+// getpwnam() into *out through the cache. Returns 0 on success, -1 if there
+// is no such user (or the lookup failed), -2 if the entry does not fit.
+static int nss_lookup_user(const char *name, struct auth_user *out)
+{
+  struct nss_slot e;
+  if (nss_cache_find(name, 0, &e) == 0)
+  {
+    nss_entry_user(&e, out);
+    return 0;
+  }
+  const struct passwd *pw = getpwnam(name);
+  if (!pw)
+    return -1;
+  // Copy libc-owned passwd data before PAM session hooks can overwrite NSS static storage.
+  if (copy_auth_user(pw, out) != 0)
+    return -2;
+  nss_cache_store_user(out);
+  return 0;
+}
+
+// getpwuid() for the peer check, cached like nss_lookup_user().
+static int nss_lookup_uid(uid_t uid, struct auth_user *out)
 {
+  struct nss_slot e;
+  if (nss_cache_find(NULL, uid, &e) == 0)
+  {
+    nss_entry_user(&e, out);
+    return 0;
+  }
+
   long buflen = sysconf(_SC_GETPW_R_SIZE_MAX);
   if (buflen < 0)
     buflen = 16384;
   char *buf = calloc(1, (size_t)buflen);
   if (!buf)
     return -1;
-
   struct passwd pw;
   struct passwd *pw_out = NULL;
   int rc = getpwuid_r(uid, &pw, buf, (size_t)buflen, &pw_out);
-  if (rc != 0 || !pw_out)
+  rc = rc != 0 || !pw_out || copy_auth_user(pw_out, out) != 0 ? -1 : 0;
+  free(buf);
+  if (rc == 0)
+    nss_cache_store_user(out);
+  return rc;
+}
+
+// Called by the daemon before it forks anything.
+static void nss_cache_init(void)
+{
+  g_nss.ttl_ms = env_get_int("LINUXIO_AUTH_NSS_CACHE_TTL", NSS_CACHE_TTL_DEFAULT, 0,
+                             NSS_CACHE_TTL_MAX) * 1000;
+  if (g_nss.ttl_ms > 0)
   {
-    free(buf);
-    return -1;
+    void *p = shared_table_map(SHARED_NSS, sizeof(struct nss_table));
+    if (p == MAP_FAILED)
+    {
+      journal_errorf("failed to map NSS lookup cache: %m");
+    }
+    else
+    {
+      g_nss.table = p;
+      g_nss.slots = g_nss.table->slots;
+    }
+  }
+}
+
+// -------- group membership --------
+// Configured group list of a user (getgrouplist, primary gid included),
+// through the NSS lookup cache. On success *out is a malloc'd array the
+// caller frees; returns its length, or -1 on error.
+static int load_user_groups(const char *name, gid_t gid, gid_t **out)
+{
+  *out = NULL;
+  struct nss_slot e;
+  if (nss_cache_find(name, 0, &e) == 0 && e.gid == (uint32_t)gid && e.ngroups != NSS_NO_GROUPS)
+  {
+    gid_t *cached = calloc(e.ngroups ? e.ngroups : 1, sizeof(gid_t));
+    if (!cached)
+      return -1;
+    for (uint32_t i = 0; i < e.ngroups; i++)
+      cached[i] = (gid_t)e.groups[i];
+    *out = cached;
+    return (int)e.ngroups;
   }
 
   int ngroups = 16;
   gid_t *groups = calloc((size_t)ngroups, sizeof(gid_t));
   if (!groups)
-  {
-    free(buf);
     return -1;
-  }
 
-  int gret = getgrouplist(pw_out->pw_name, pw_out->pw_gid, groups, &ngroups);
+  int gret = getgrouplist(name, gid, groups, &ngroups);
   if (gret == -1)
   {
     gid_t *tmp = realloc(groups, (size_t)ngroups * sizeof(gid_t));
     if (!tmp)
     {
       free(groups);
-      free(buf);
       return -1;
     }
     groups = tmp;
-    gret = getgrouplist(pw_out->pw_name, pw_out->pw_gid, groups, &ngroups);
+    gret = getgrouplist(name, gid, groups, &ngroups);
   }
-
-  int found = 0;
-  if (gret != -1)
+  if (gret == -1)
   {
-    for (int i = 0; i < ngroups; i++)
-    {
-      if (groups[i] == target_gid)
-      {
-        found = 1;
-        break;
-      }
-    }
+    free(groups);
+    return -1;
   }
 
-  free(groups);
-  free(buf);
-  return gret == -1 ? -1 : found;
+  nss_cache_store_groups(name, gid, groups, ngroups);
+  *out = groups;
+  return ngroups;
 }
 
-static int check_peer_creds(int fd)
+// -------- child supervision --------
+// Children are watched through a pidfd where the kernel has one (5.3+), so
+// every wait is a single poll() that wakes the moment the child exits or the
+// deadline passes. Without pidfds we fall back to WNOHANG polling with a
+// short exponential backoff rather than a fixed sleep.
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+
+#define CHILD_POLL_MIN_MS 1
+#define CHILD_POLL_MAX_MS 50
+
+struct child_proc
 {
-  struct ucred cred;
-  socklen_t len = sizeof(cred);
+  pid_t pid;
+  int pidfd; // -1 when pidfd_open is unavailable
+};
 
-  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
-  {
-    journal_errorf("getsockopt(SO_PEERCRED) failed: %m");
-    return -1;
-  }
+static uint64_t monotonic_ms(void)
+{
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+  return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
 
-  // Allow root
-  if (cred.uid == 0)
+static uint64_t monotonic_us(void)
+{
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
     return 0;
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
 
-  // Allow if peer's primary GID matches linuxio-bridge-socket.
-  // Edge case: supplementary group membership won't match here. We use
-  // getgrouplist() to check the user's configured groups. Caveat: this reflects
-  // the user's configured groups, not necessarily the process's current group
-  // set. For strict "current groups," parse /proc/<pid>/status Groups: instead.
-  struct group *gr = getgrnam(AUTH_SOCKET_GROUP);
-  if (!gr)
-  {
-    journal_errorf("group '%s' not found", AUTH_SOCKET_GROUP);
-    return -1;
+static uint64_t realtime_us(void)
+{
+  struct timespec ts;
+  if (clock_gettime(CLOCK_REALTIME, &ts) != 0)
+    return 0;
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void child_watch(struct child_proc *c, pid_t pid)
+{
+  c->pid = pid;
+  c->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+  if (c->pidfd >= 0)
+  {
+    int fdflags = fcntl(c->pidfd, F_GETFD);
+    if (fdflags >= 0)
+      (void)fcntl(c->pidfd, F_SETFD, fdflags | FD_CLOEXEC);
   }
+}
 
-  if (cred.gid == gr->gr_gid)
-    return 0;
+static void child_release(struct child_proc *c)
+{
+  if (c->pidfd >= 0)
+    close(c->pidfd);
+  c->pidfd = -1;
+  c->pid = -1;
+}
 
-  int in_group = user_in_group(cred.uid, gr->gr_gid);
-  if (in_group > 0)
-    return 0;
-  if (in_group < 0)
-    journal_errorf("failed to resolve supplementary groups for uid=%u", (unsigned)cred.uid);
+static void child_kill(const struct child_proc *c, int sig)
+{
+  if (c->pid <= 0)
+    return;
+  if (c->pidfd >= 0 && syscall(SYS_pidfd_send_signal, c->pidfd, sig, NULL, 0) == 0)
+    return;
+  (void)kill(c->pid, sig);
+}
 
-  journal_errorf("peer not authorized: uid=%u gid=%u (expected root or gid=%u)",
-                 (unsigned)cred.uid, (unsigned)cred.gid, (unsigned)gr->gr_gid);
-  return -1;
+// Milliseconds left until deadline_ms, or -1 (infinite) when deadline_ms is 0.
+static int deadline_remaining_ms(uint64_t deadline_ms)
+{
+  if (deadline_ms == 0)
+    return -1;
+  uint64_t now = monotonic_ms();
+  if (now >= deadline_ms)
+    return 0;
+  uint64_t left = deadline_ms - now;
+  return left > INT_MAX ? INT_MAX : (int)left;
 }
 
+// Reap the child, waiting at most until deadline_ms (0 = no deadline).
+// Returns 0 once reaped (status filled in), 1 on timeout, -1 on error.
+static int child_wait_until(struct child_proc *c, int *status, uint64_t deadline_ms)
+{
+  int poll_ms = CHILD_POLL_MIN_MS;
+  for (;;)
+  {
+    pid_t r = waitpid(c->pid, status, WNOHANG);
+    if (r == c->pid)
+    {
+      c->pid = -1;
+      return 0;
+    }
+    if (r < 0 && errno != EINTR)
+      return -1;
+
+    int left = deadline_remaining_ms(deadline_ms);
+    if (left == 0)
+      return 1;
 
-// ============================================================================
-// Single-shot mode - socket-activated worker
-// ============================================================================
+    if (c->pidfd >= 0)
+    {
+      struct pollfd pfd = {.fd = c->pidfd, .events = POLLIN, .revents = 0};
+      if (poll(&pfd, 1, left) < 0 && errno != EINTR)
+        return -1;
+      continue;
+    }
 
-// Send binary response to client.
-// Success format:
-//   [magic:4][status:1][mode:1][result:1][reserved:1][uid:4][gid:4][len:2][username]
-// Error format:
-//   [magic:4][status:1][mode:1][result:1][reserved:1][len:2][error]
-static void send_response(int fd, uint8_t status, uint8_t mode, uint8_t result_code,
-                          const char *error, const char *username, uid_t uid, gid_t gid)
+    if (left < 0 || left > poll_ms)
+      left = poll_ms;
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = (long)left * 1000000L};
+    (void)nanosleep(&ts, NULL);
+    if (poll_ms < CHILD_POLL_MAX_MS)
+      poll_ms *= 2;
+  }
+}
+
+// SIGKILL the child and reap it unconditionally.
+static void child_kill_and_reap(struct child_proc *c)
 {
-  uint8_t header[PROTO_AUTH_RESP_HEADER_SIZE];
+  int status = 0;
+  child_kill(c, SIGKILL);
+  (void)child_wait_until(c, &status, 0);
+}
 
-  // Magic + version
-  header[0] = PROTO_MAGIC_0;
-  header[1] = PROTO_MAGIC_1;
-  header[2] = PROTO_MAGIC_2;
-  header[3] = PROTO_VERSION;
+// -------- child spawning --------
+// Children that only arrange fds and credentials before exec are started
+// with clone(CLONE_VM|CLONE_VFORK|CLONE_PIDFD): the child runs on a private
+// stack inside our address space until it execs, so a spawn no longer copies
+// the page tables of libpam and every loaded PAM module, and the pidfd comes
+// back together with the pid. Since the memory is shared, the child may only
+// make plain system calls; its environment and group list are prepared here
+// beforehand. fork() remains the fallback if clone() is refused.
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
 
-  // Status and mode
-  header[4] = status;
-  header[5] = mode;
+// The 32-bit uid/gid variants where the plain ones are 16-bit
+#if defined(SYS_setresuid32)
+#define SPAWN_SYS_SETRESUID SYS_setresuid32
+#define SPAWN_SYS_SETRESGID SYS_setresgid32
+#define SPAWN_SYS_SETGROUPS SYS_setgroups32
+#else
+#define SPAWN_SYS_SETRESUID SYS_setresuid
+#define SPAWN_SYS_SETRESGID SYS_setresgid
+#define SPAWN_SYS_SETGROUPS SYS_setgroups
+#endif
 
-  // Structured result code + reserved
-  header[6] = result_code;
-  header[7] = 0;
+#define SPAWN_STACK_SIZE (64 * 1024)
+#define SPAWN_ENV_MAX    16
+#define SPAWN_ENV_BUF    (2 * MAX_PATH_LEN + 1024)
 
-  if (write_all(fd, header, PROTO_AUTH_RESP_HEADER_SIZE) != 0)
-    return;
+// Environment handed to execve(); built by the parent.
+struct spawn_env
+{
+  char *vars[SPAWN_ENV_MAX + 1];
+  size_t count;
+  size_t used;
+  char buf[SPAWN_ENV_BUF];
+};
 
-  if (status == PROTO_STATUS_OK)
-  {
-    uint8_t ids[8];
-    write_u32_be(ids, (uint32_t)uid);
-    write_u32_be(ids + 4, (uint32_t)gid);
-    if (write_all(fd, ids, sizeof(ids)) != 0)
-      return;
-    if (write_lenstr(fd, username) != 0)
-      return;
-    return;
-  }
+// Identity the child switches to; groups are resolved by the parent.
+struct spawn_cred
+{
+  uid_t uid;
+  gid_t gid;
+  gid_t *groups;
+  int ngroups;
+};
 
-  // Write error string if present
-  if (status == PROTO_STATUS_ERROR && error)
-  {
-    (void)write_lenstr(fd, error);
-  }
+static void spawn_env_init(struct spawn_env *env)
+{
+  env->count = 0;
+  env->used = 0;
+  env->vars[0] = NULL;
 }
 
-static void send_error_response(int fd, uint8_t result_code, const char *error)
+// Append NAME=value. Returns -1 if the table or buffer is full.
+static int spawn_env_set(struct spawn_env *env, const char *name, const char *value)
 {
-  send_response(fd, PROTO_STATUS_ERROR, 0, result_code, error, NULL, 0, 0);
+  size_t room = sizeof(env->buf) - env->used;
+  if (env->count >= SPAWN_ENV_MAX)
+    return -1;
+  int n = safe_snprintf(env->buf + env->used, room, "%s=%s", name, value);
+  if (n < 0 || (size_t)n >= room)
+    return -1;
+  env->vars[env->count++] = env->buf + env->used;
+  env->vars[env->count] = NULL;
+  env->used += (size_t)n + 1;
+  return 0;
 }
 
-static void send_ok_response(int fd, uint8_t mode, const char *username, uid_t uid, gid_t gid)
+static int spawn_cred_load(struct spawn_cred *cred, const struct auth_user *auth_user)
 {
-  send_response(fd, PROTO_STATUS_OK, mode, PROTO_RESULT_OK, NULL, username, uid, gid);
+  cred->uid = auth_user->uid;
+  cred->gid = auth_user->gid;
+  cred->ngroups = load_user_groups(auth_user->name, auth_user->gid, &cred->groups);
+  return cred->ngroups < 0 ? -1 : 0;
 }
 
-static uint8_t classify_pam_result(int rc)
+static void spawn_cred_root(struct spawn_cred *cred)
 {
-  switch (rc)
-  {
-  case PAM_SUCCESS:
-    return PROTO_RESULT_OK;
-  case PAM_AUTH_ERR:
-  case PAM_USER_UNKNOWN:
-  case PAM_MAXTRIES:
-  case PAM_CRED_ERR:
-  case PAM_AUTHTOK_ERR:
-    return PROTO_RESULT_AUTH_FAILED;
-  case PAM_NEW_AUTHTOK_REQD:
-    return PROTO_RESULT_PASSWORD_EXPIRED;
-  case PAM_PERM_DENIED:
-  case PAM_ACCT_EXPIRED:
-  case PAM_CRED_INSUFFICIENT:
-    return PROTO_RESULT_ACCESS_DENIED;
-  default:
-    return PROTO_RESULT_INTERNAL_ERROR;
-  }
+  cred->uid = 0;
+  cred->gid = 0;
+  cred->groups = NULL;
+  cred->ngroups = 0;
 }
 
-// Fixed FD layout for child process:
-// 0 = stdin (bootstrap pipe)
-// 1 = stdout (dup from stderr)
-// 2 = stderr
-// 3 = client connection (CLIENT_CONN_FD)
-// 4 = exec_status_fd (CLOEXEC - closed by exec on success)
-// 5 = bridge_fd (for execveat)
-// Everything >= 6 is closed
-#define CLIENT_CONN_FD 3
-#define EXEC_STATUS_FD 4
-#define BRIDGE_FD      5
+static void spawn_cred_free(struct spawn_cred *cred)
+{
+  free(cred->groups);
+  cred->groups = NULL;
+  cred->ngroups = 0;
+}
 
-static pid_t spawn_bridge_process(
-    const struct auth_user *auth_user,
-    int want_privileged,
-    int bridge_fd,
-    int bootstrap_pipe_read,  // Pipe read end for bootstrap binary (will be stdin)
-    int client_fd,            // Client connection FD (will be dup'd to FD 3 for Yamux)
-    int exec_status_fd)       // Write end of exec-status pipe (CLOEXEC) - write on exec failure
+// Child side: switch to cred. Raw system calls, because glibc's set*id()
+// wrappers signal every thread they know of, and here those are ours.
+// A non-root identity must not be able to regain root afterwards.
+static int drop_to_user(const struct spawn_cred *cred)
 {
-  pid_t pid = fork();
-  if (pid < 0)
+  if (!cred)
+  {
+    errno = EINVAL;
     return -1;
-  if (pid > 0)
-    return pid;
-
-  // =========================================================================
-  // Child: Set up fixed FD layout before closing everything else
-  // Order matters to avoid overwriting FDs we still need
-  // =========================================================================
+  }
+  if (syscall(SPAWN_SYS_SETGROUPS, (size_t)cred->ngroups, cred->groups) != 0 ||
+      syscall(SPAWN_SYS_SETRESGID, cred->gid, cred->gid, cred->gid) != 0 ||
+      syscall(SPAWN_SYS_SETRESUID, cred->uid, cred->uid, cred->uid) != 0)
+    return -1;
+  if (cred->uid != 0 && syscall(SPAWN_SYS_SETRESUID, 0, 0, 0) == 0)
+  {
+    errno = EPERM;
+    return -1;
+  }
+  return 0;
+}
 
-  // Step 1: Move FDs to their fixed positions
-  // Use dup2 which is atomic and handles fd == newfd correctly
+struct spawn_call
+{
+  int (*fn)(void *);
+  void *arg;
+  sigset_t mask; // the caller's signal mask, restored in the child
+};
 
-  // Save the original FDs we need (they might be at any position)
-  int orig_client = client_fd;
-  int orig_bootstrap = bootstrap_pipe_read;
-  int orig_exec_status = exec_status_fd;
-  int orig_bridge = bridge_fd;
+static int spawn_trampoline(void *p)
+{
+  const struct spawn_call *call = p;
+  (void)sigprocmask(SIG_SETMASK, &call->mask, NULL);
+  (void)call->fn(call->arg);
+  _exit(127);
+}
 
-  // First, move exec_status_fd and bridge_fd to high positions to avoid conflicts
-  // (in case any of them is already at 0-5)
-  int tmp_exec_status = -1, tmp_bridge = -1;
+// Run fn(arg) in a new child; fn must end in exec or _exit(). We resume once
+// the child has exec'd (or died). Returns 0 with the child in *out, -1 if no
+// child could be created.
+static int spawn_child(int (*fn)(void *), void *arg, struct child_proc *out)
+{
+  struct spawn_call call = {.fn = fn, .arg = arg};
+  sigset_t all;
+  sigfillset(&all);
+  // Nothing may run a signal handler on the stack we share with the child
+  if (sigprocmask(SIG_BLOCK, &all, &call.mask) != 0)
+    return -1;
 
-  if (orig_exec_status >= 0 && orig_exec_status <= BRIDGE_FD)
+  pid_t pid = -1;
+  int pidfd = -1;
+  void *stack = mmap(NULL, SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (stack != MAP_FAILED)
   {
-    tmp_exec_status = dup(orig_exec_status);
-    if (tmp_exec_status < 0) _exit(127);
-    // Preserve CLOEXEC on the new FD
-    {
-      int fdflags = fcntl(tmp_exec_status, F_GETFD);
-      if (fdflags >= 0)
-        (void)fcntl(tmp_exec_status, F_SETFD, fdflags | FD_CLOEXEC);
-    }
-    // Close original to avoid leaking extra copy of pipe write-end
-    close(orig_exec_status);
+    pid = clone(spawn_trampoline, (char *)stack + SPAWN_STACK_SIZE,
+                CLONE_VM | CLONE_VFORK | CLONE_PIDFD | SIGCHLD, &call, &pidfd);
+    (void)munmap(stack, SPAWN_STACK_SIZE);
   }
-  else
+  if (pid < 0)
   {
-    tmp_exec_status = orig_exec_status;
+    pid = fork();
+    if (pid == 0)
+      (void)spawn_trampoline(&call);
   }
 
-  if (orig_bridge >= 0 && orig_bridge <= BRIDGE_FD)
+  int saved_errno = errno;
+  (void)sigprocmask(SIG_SETMASK, &call.mask, NULL);
+  if (pid < 0)
   {
-    tmp_bridge = dup(orig_bridge);
-    if (tmp_bridge < 0) _exit(127);
-    // Close original to avoid leaking extra FD
-    close(orig_bridge);
+    errno = saved_errno;
+    return -1;
   }
-  else
+
+  // Kernels before 5.2 ignore CLONE_PIDFD and leave pidfd untouched
+  if (pidfd >= 0)
   {
-    tmp_bridge = orig_bridge;
+    out->pid = pid;
+    out->pidfd = pidfd;
   }
-
-  // Step 2: Set up stdin (FD 0) from bootstrap pipe
-  // IMPORTANT: Do this before dup2'ing to FD 3, in case client_fd == 0
-  if (orig_client == STDIN_FILENO)
+  else
   {
-    // client_fd is stdin - need to save it first
-    int saved_client = dup(orig_client);
-    if (saved_client < 0) _exit(127);
-    orig_client = saved_client;
+    child_watch(out, pid);
   }
+  return 0;
+}
 
-  if (orig_bootstrap >= 0)
+// -------- service metrics --------
+// Counters and latency histograms for the daemon's metrics socket. The
+// daemon maps them MAP_SHARED before forking workers, and every process
+// bumps them with relaxed atomics, so nothing on the login path takes a
+// lock. g_metrics stays NULL in Accept=yes mode and the updates are no-ops.
+#define METRICS_RESULT_SLOTS 16 // PROTO_RESULT_* codes
+#define METRICS_BUCKETS      16 // the last one is +Inf
+
+enum metrics_priv_source
+{
+  METRICS_PRIV_SUDO,
+  METRICS_PRIV_GROUPS,
+  METRICS_PRIV_CACHE,
+  METRICS_PRIV_SOURCES,
+};
+
+struct metrics_histogram
+{
+  uint64_t buckets[METRICS_BUCKETS]; // per bucket, not cumulative
+  uint64_t sum_us;
+  uint64_t count;
+};
+
+struct auth_metrics
+{
+  uint64_t results[METRICS_RESULT_SLOTS];
+  uint64_t logins_privileged;
+  uint64_t logins_unprivileged;
+  uint64_t priv_decisions[METRICS_PRIV_SOURCES];
+  uint64_t sudo_probe_timeouts;
+  uint64_t bridge_exec_failures;
+  uint64_t bridge_start_timeouts;
+  uint64_t shared_bridge_logins;
+  uint64_t privilege_upgrades;
+  struct metrics_histogram sudo_probe;
+  struct metrics_histogram phases[PROTO_PHASE_COUNT];
+};
+
+static struct auth_metrics *g_metrics;
+
+static const uint32_t metrics_bucket_us[METRICS_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000,
+};
+
+#define METRICS_ADD(field, n) \
+  do { if (g_metrics) __atomic_fetch_add(&g_metrics->field, (n), __ATOMIC_RELAXED); } while (0)
+
+static void metrics_observe(struct metrics_histogram *h, uint64_t us)
+{
+  size_t b = 0;
+  while (b < METRICS_BUCKETS - 1 && us > metrics_bucket_us[b])
+    b++;
+  __atomic_fetch_add(&h->buckets[b], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->sum_us, us, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+}
+
+// Called by the daemon before it forks anything.
+static void metrics_init(void)
+{
+  void *p = shared_table_map(SHARED_METRICS, sizeof(struct auth_metrics));
+  if (p == MAP_FAILED)
   {
-    if (dup2(orig_bootstrap, STDIN_FILENO) < 0) _exit(127);
-    if (orig_bootstrap != STDIN_FILENO) close(orig_bootstrap);
+    journal_errorf("failed to map metrics: %m");
+    return;
   }
+  g_metrics = p;
+}
 
-  // Step 3: Set up stdout (FD 1) as dup of stderr
-  if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0) _exit(127);
+// -------- failed-login throttle --------
+// Recent authentication failures per remote host + user, and per remote host
+// across all users, so a password spray is turned away before pam_start()
+// instead of holding a worker through pam_authenticate() and pam_faildelay.
+// The table is a fixed array of open-addressed slots that the daemon maps
+// MAP_SHARED before forking workers; a lookup probes at most FAIL_PROBE_LIMIT
+// slots and never allocates. Slots are claimed with a CAS on the key and the
+// counters are bumped with relaxed atomics, so two workers racing on one host
+// may lose a count but never corrupt a slot. Slots are never emptied again
+// (that would cut probe chains); a cleared or quiet slot is reused in place.
+// g_fail.slots stays NULL in Accept=yes mode and every call is a no-op.
+#define FAIL_TABLE_SLOTS            2048 // power of two
+#define FAIL_PROBE_LIMIT            16
+#define FAIL_FORGET_MS              (15 * 60 * 1000) // failures older than this are forgotten
+#define FAIL_BACKOFF_MAX_MS         (5 * 60 * 1000)
+#define FAIL_THRESHOLD_DEFAULT      5
+#define FAIL_HOST_THRESHOLD_DEFAULT 20
+#define FAIL_BACKOFF_DEFAULT_MS     1000
+#define FAIL_KEY_EMPTY              0
+#define FAIL_KEY_BUSY               UINT64_MAX // slot is being claimed
+
+struct fail_slot
+{
+  uint64_t key;
+  uint64_t last_ms;          // monotonic time of the last failure
+  uint64_t blocked_until_ms; // logins are rejected until then
+  uint32_t failures;
+  uint32_t pad;
+};
 
-  // Step 4: Set up client connection at FD 3
-  if (orig_client >= 0 && orig_client != CLIENT_CONN_FD)
+struct fail_table
+{
+  struct fail_slot *slots;
+  int threshold;      // host + user failures before backoff starts
+  int host_threshold; // failures from one host before backoff starts, 0 = off
+  int backoff_ms;     // first backoff, doubled per further failure
+};
+
+static struct fail_table g_fail;
+
+// FNV-1a over "host\0user"; user "" is the host-wide key (usernames are
+// never empty by the time we get here).
+static uint64_t fail_key(const char *remote_host, const char *user)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (const unsigned char *p = (const unsigned char *)remote_host; *p; p++)
+    h = (h ^ *p) * 1099511628211ULL;
+  h *= 1099511628211ULL; // the separator byte
+  for (const unsigned char *p = (const unsigned char *)user; *p; p++)
+    h = (h ^ *p) * 1099511628211ULL;
+  if (h == FAIL_KEY_EMPTY || h == FAIL_KEY_BUSY)
+    h = 1;
+  return h;
+}
+
+static struct fail_slot *fail_find(uint64_t key)
+{
+  size_t i = key & (FAIL_TABLE_SLOTS - 1);
+  for (int n = 0; n < FAIL_PROBE_LIMIT; n++, i = (i + 1) & (FAIL_TABLE_SLOTS - 1))
   {
-    if (dup2(orig_client, CLIENT_CONN_FD) < 0) _exit(127);
-    close(orig_client);
+    uint64_t k = __atomic_load_n(&g_fail.slots[i].key, __ATOMIC_ACQUIRE);
+    if (k == key)
+      return &g_fail.slots[i];
+    if (k == FAIL_KEY_EMPTY)
+      break;
   }
+  return NULL;
+}
 
-  // Step 5: Set up exec_status_fd at FD 4 (keep CLOEXEC)
-  if (tmp_exec_status >= 0 && tmp_exec_status != EXEC_STATUS_FD)
+// Finds the slot for key or takes over the first empty slot, else the one
+// with the oldest failure, within the probe window. NULL if another worker
+// won the race for it; the failure then goes uncounted.
+static struct fail_slot *fail_claim(uint64_t key)
+{
+  struct fail_slot *victim = NULL;
+  uint64_t victim_ms = UINT64_MAX;
+  size_t i = key & (FAIL_TABLE_SLOTS - 1);
+  for (int n = 0; n < FAIL_PROBE_LIMIT; n++, i = (i + 1) & (FAIL_TABLE_SLOTS - 1))
   {
-    if (dup2(tmp_exec_status, EXEC_STATUS_FD) < 0) _exit(127);
-    close(tmp_exec_status);
-    // Restore CLOEXEC on the new FD
+    struct fail_slot *s = &g_fail.slots[i];
+    uint64_t k = __atomic_load_n(&s->key, __ATOMIC_ACQUIRE);
+    if (k == key)
+      return s;
+    if (k == FAIL_KEY_EMPTY)
     {
-      int fdflags = fcntl(EXEC_STATUS_FD, F_GETFD);
-      if (fdflags >= 0)
-        (void)fcntl(EXEC_STATUS_FD, F_SETFD, fdflags | FD_CLOEXEC);
+      victim = s;
+      break;
     }
-  }
-  else if (tmp_exec_status == EXEC_STATUS_FD)
-  {
-    // Already at right position, just ensure CLOEXEC
+    if (k == FAIL_KEY_BUSY)
+      continue;
+    uint64_t last = __atomic_load_n(&s->last_ms, __ATOMIC_RELAXED);
+    if (last < victim_ms)
     {
-      int fdflags = fcntl(EXEC_STATUS_FD, F_GETFD);
-      if (fdflags >= 0)
-        (void)fcntl(EXEC_STATUS_FD, F_SETFD, fdflags | FD_CLOEXEC);
+      victim = s;
+      victim_ms = last;
     }
   }
+  if (!victim)
+    return NULL;
 
-  // Step 6: Set up bridge_fd at FD 5
-  if (tmp_bridge >= 0 && tmp_bridge != BRIDGE_FD)
-  {
-    if (dup2(tmp_bridge, BRIDGE_FD) < 0) _exit(127);
-    close(tmp_bridge);
-  }
-
-  // Now we have:
-  // 0 = stdin (bootstrap)
-  // 1 = stdout (-> stderr)
-  // 2 = stderr
-  // 3 = client connection
-  // 4 = exec_status_fd (CLOEXEC)
-  // 5 = bridge_fd
+  uint64_t old = __atomic_load_n(&victim->key, __ATOMIC_ACQUIRE);
+  if (old == FAIL_KEY_BUSY ||
+      !__atomic_compare_exchange_n(&victim->key, &old, FAIL_KEY_BUSY, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return NULL;
+  __atomic_store_n(&victim->failures, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&victim->last_ms, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&victim->blocked_until_ms, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&victim->key, key, __ATOMIC_RELEASE);
+  return victim;
+}
 
-  // Clear socket timeouts on the client connection (FD 3)
-  // These were set for the auth request phase but would cause problems
-  // for the long-lived Yamux connection (idle timeouts, EAGAIN, etc.)
-  {
-    struct timeval tv_zero = {.tv_sec = 0, .tv_usec = 0};
-    (void)setsockopt(CLIENT_CONN_FD, SOL_SOCKET, SO_RCVTIMEO, &tv_zero, sizeof(tv_zero));
-    (void)setsockopt(CLIENT_CONN_FD, SOL_SOCKET, SO_SNDTIMEO, &tv_zero, sizeof(tv_zero));
-  }
+static void fail_bump(uint64_t key, int threshold, uint64_t now)
+{
+  struct fail_slot *s = fail_claim(key);
+  if (!s)
+    return;
+  if (now - __atomic_load_n(&s->last_ms, __ATOMIC_RELAXED) > FAIL_FORGET_MS)
+    __atomic_store_n(&s->failures, 0, __ATOMIC_RELAXED);
+  uint32_t failures = __atomic_add_fetch(&s->failures, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->last_ms, now, __ATOMIC_RELAXED);
+  if (failures < (uint32_t)threshold)
+    return;
 
-  umask(077);
+  uint32_t shift = failures - (uint32_t)threshold;
+  uint64_t backoff = FAIL_BACKOFF_MAX_MS;
+  if (shift < 32 && ((uint64_t)g_fail.backoff_ms << shift) < FAIL_BACKOFF_MAX_MS)
+    backoff = (uint64_t)g_fail.backoff_ms << shift;
+  __atomic_store_n(&s->blocked_until_ms, now + backoff, __ATOMIC_RELAXED);
+}
 
-  // Preserve and validate environment variables before clearenv()
-  const char *preserve_lang = getenv("LANG");
+// Called for every PROTO_RESULT_AUTH_FAILED login.
+static void fail_record(const char *remote_host, const char *user)
+{
+  if (!g_fail.slots)
+    return;
+  uint64_t now = monotonic_ms();
+  fail_bump(fail_key(remote_host, user), g_fail.threshold, now);
+  if (remote_host[0] && g_fail.host_threshold > 0)
+    fail_bump(fail_key(remote_host, ""), g_fail.host_threshold, now);
+}
+
+// Forgets the host + user failures after a good password. The host-wide
+// count is left to expire so one valid account cannot launder a spray.
+static void fail_clear(const char *remote_host, const char *user)
+{
+  if (!g_fail.slots)
+    return;
+  struct fail_slot *s = fail_find(fail_key(remote_host, user));
+  if (!s)
+    return;
+  __atomic_store_n(&s->blocked_until_ms, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->failures, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->last_ms, 0, __ATOMIC_RELAXED);
+}
+
+// Returns how many milliseconds this login has to wait, 0 if it may go on.
+static uint64_t fail_blocked_ms(const char *remote_host, const char *user)
+{
+  if (!g_fail.slots)
+    return 0;
+  uint64_t now = monotonic_ms();
+  uint64_t wait = 0;
+  struct fail_slot *slots[2] = {fail_find(fail_key(remote_host, user)), NULL};
+  if (remote_host[0] && g_fail.host_threshold > 0)
+    slots[1] = fail_find(fail_key(remote_host, ""));
+  for (size_t i = 0; i < 2; i++)
+  {
+    if (!slots[i])
+      continue;
+    uint64_t until = __atomic_load_n(&slots[i]->blocked_until_ms, __ATOMIC_RELAXED);
+    if (until > now && until - now > wait)
+      wait = until - now;
+  }
+  return wait;
+}
+
+// Called by the daemon before it forks anything.
+static void fail_table_init(void)
+{
+  g_fail.threshold = env_get_int("LINUXIO_AUTH_FAIL_THRESHOLD", FAIL_THRESHOLD_DEFAULT, 0, 1000);
+  g_fail.host_threshold = env_get_int("LINUXIO_AUTH_FAIL_HOST_THRESHOLD",
+                                      FAIL_HOST_THRESHOLD_DEFAULT, 0, 100000);
+  g_fail.backoff_ms = env_get_int("LINUXIO_AUTH_FAIL_BACKOFF_MS", FAIL_BACKOFF_DEFAULT_MS,
+                                  1, FAIL_BACKOFF_MAX_MS);
+  if (g_fail.threshold == 0)
+    return;
+  void *p = shared_table_map(SHARED_FAIL, FAIL_TABLE_SLOTS * sizeof(struct fail_slot));
+  if (p == MAP_FAILED)
+  {
+    journal_errorf("failed to map login failure table: %m");
+    return;
+  }
+  g_fail.slots = p;
+}
+
+// -------- privilege cache --------
+// The privileged/unprivileged decision for a uid is cached in a root-only
+// directory under /run, so a reconnect within LINUXIO_PRIV_CACHE_TTL seconds
+// skips both sudo forks. Entries carry a fingerprint of the sudoers files and
+// of the user's group list and are ignored as soon as either changes. The
+// password is still checked by PAM on every login; only the redundant sudo
+// credential check is skipped. Sudoers sources outside /etc (LDAP/sssd
+// rules, other @includedir paths) are only bounded by the TTL, so the cache
+// is off unless LINUXIO_PRIV_CACHE_TTL turns it on.
+#ifndef PRIV_CACHE_DIR
+#define PRIV_CACHE_DIR          "/run/linuxio/privcache"
+#endif
+#define PRIV_CACHE_MAGIC        0x4c494f50u // "LIOP"
+#define PRIV_CACHE_VERSION      1u
+#define PRIV_CACHE_TTL_DEFAULT  0
+#define PRIV_CACHE_TTL_MAX      86400
+#define SUDOERS_PATH            "/etc/sudoers"
+#define SUDOERS_DIR             "/etc/sudoers.d"
+
+struct priv_cache_entry
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t uid;
+  uint32_t privileged;
+  uint64_t created_ms; // CLOCK_MONOTONIC; /run does not survive a reboot
+  uint64_t sudoers_fp;
+  uint64_t groups_fp;
+};
+
+// Fingerprint of /etc/sudoers and /etc/sudoers.d/* (the directory itself
+// covers added/removed entries; each entry covers in-place edits).
+static uint64_t sudoers_fingerprint(void)
+{
+  uint64_t h = FNV1A64_INIT;
+  struct stat st;
+
+  if (stat(SUDOERS_PATH, &st) == 0)
+    h = stat_fingerprint(h, &st);
+  else
+    h = fnv1a64(h, "no-sudoers", 10);
+
+  DIR *dir = opendir(SUDOERS_DIR);
+  if (!dir)
+    return fnv1a64(h, "no-sudoers.d", 12);
+
+  if (fstat(dirfd(dir), &st) == 0)
+    h = stat_fingerprint(h, &st);
+
+  // Sum per-entry hashes so readdir order doesn't matter.
+  uint64_t entries = 0;
+  const struct dirent *de;
+  while ((de = readdir(dir)) != NULL)
+  {
+    if (de->d_name[0] == '.')
+      continue;
+    uint64_t eh = fnv1a64(FNV1A64_INIT, de->d_name, strlen(de->d_name));
+    if (fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+      eh = stat_fingerprint(eh, &st);
+    entries += eh;
+  }
+  closedir(dir);
+  return fnv1a64(h, &entries, sizeof(entries));
+}
+
+static int gid_compare(const void *a, const void *b)
+{
+  gid_t x = *(const gid_t *)a;
+  gid_t y = *(const gid_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Fingerprint of the user's name and group list (sorted in place); never 0.
+static uint64_t groups_fingerprint(const struct auth_user *auth_user, gid_t *groups, int ngroups)
+{
+  qsort(groups, (size_t)ngroups, sizeof(gid_t), gid_compare);
+  uint64_t h = fnv1a64(FNV1A64_INIT, auth_user->name, strlen(auth_user->name));
+  h = fnv1a64(h, groups, (size_t)ngroups * sizeof(gid_t));
+  return h ? h : 1;
+}
+
+// Open (creating if needed) the cache directory. Refuses anything that is
+// not a root-owned, root-only directory.
+static int priv_cache_open_dir(void)
+{
+  if (mkdir(PRIV_CACHE_DIR, 0700) != 0 && errno != EEXIST)
+    return -1;
+
+  int dfd = open(PRIV_CACHE_DIR, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (dfd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(dfd, &st) != 0 || st.st_uid != 0 || (st.st_mode & 0077) != 0)
+  {
+    close(dfd);
+    return -1;
+  }
+  return dfd;
+}
+
+// Returns 1/0 for a valid cached decision, -1 on miss.
+static int priv_cache_lookup(const struct auth_user *auth_user, int ttl_sec,
+                             uint64_t sudoers_fp, uint64_t groups_fp)
+{
+  int dfd = priv_cache_open_dir();
+  if (dfd < 0)
+    return -1;
+
+  char name[16];
+  (void)safe_snprintf(name, sizeof(name), "%u", (unsigned)auth_user->uid);
+  int fd = openat(dfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  close(dfd);
+  if (fd < 0)
+    return -1;
+
+  struct priv_cache_entry e;
+  struct stat st;
+  int ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == 0 &&
+           st.st_size == (off_t)sizeof(e) && read_all(fd, &e, sizeof(e)) == 0;
+  close(fd);
+  if (!ok)
+    return -1;
+
+  uint64_t now = monotonic_ms();
+  if (e.magic != PRIV_CACHE_MAGIC || e.version != PRIV_CACHE_VERSION ||
+      e.uid != (uint32_t)auth_user->uid || e.sudoers_fp != sudoers_fp ||
+      e.groups_fp != groups_fp || e.created_ms > now ||
+      now - e.created_ms >= (uint64_t)ttl_sec * 1000u)
+    return -1;
+
+  return e.privileged ? 1 : 0;
+}
+
+static void priv_cache_store(const struct auth_user *auth_user, int privileged,
+                             uint64_t sudoers_fp, uint64_t groups_fp)
+{
+  int dfd = priv_cache_open_dir();
+  if (dfd < 0)
+    return;
+
+  char name[16];
+  char tmp[48];
+  (void)safe_snprintf(name, sizeof(name), "%u", (unsigned)auth_user->uid);
+  (void)safe_snprintf(tmp, sizeof(tmp), ".%u.%ld", (unsigned)auth_user->uid, (long)getpid());
+
+  struct priv_cache_entry e = {
+      .magic = PRIV_CACHE_MAGIC,
+      .version = PRIV_CACHE_VERSION,
+      .uid = (uint32_t)auth_user->uid,
+      .privileged = privileged ? 1u : 0u,
+      .created_ms = monotonic_ms(),
+      .sudoers_fp = sudoers_fp,
+      .groups_fp = groups_fp};
+
+  (void)unlinkat(dfd, tmp, 0);
+  int fd = openat(dfd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd >= 0)
+  {
+    int ok = write_all(fd, &e, sizeof(e)) == 0;
+    close(fd);
+    if (!ok || renameat(dfd, tmp, dfd, name) != 0)
+      (void)unlinkat(dfd, tmp, 0);
+  }
+  close(dfd);
+}
+
+// -------- privilege policy --------
+// LINUXIO_PRIV_POLICY selects how the privileged/unprivileged decision is made:
+//   sudo        - always ask sudo (default)
+//   groups      - members of LINUXIO_ADMIN_GROUPS are privileged; everyone
+//                 else still goes through the sudo probe
+//   groups-only - decide from LINUXIO_ADMIN_GROUPS alone; sudo is only used
+//                 when none of the configured groups exist on this host
+enum priv_policy
+{
+  PRIV_POLICY_SUDO,
+  PRIV_POLICY_GROUPS,
+  PRIV_POLICY_GROUPS_ONLY,
+};
+
+#define ADMIN_GROUPS_DEFAULT "sudo,wheel"
+#define ADMIN_GROUPS_MAX_LEN 512
+
+static enum priv_policy priv_policy_from_env(void)
+{
+  const char *s = getenv("LINUXIO_PRIV_POLICY");
+  if (!s || !*s || strcmp(s, "sudo") == 0)
+    return PRIV_POLICY_SUDO;
+  if (strcmp(s, "groups") == 0)
+    return PRIV_POLICY_GROUPS;
+  if (strcmp(s, "groups-only") == 0)
+    return PRIV_POLICY_GROUPS_ONLY;
+  journal_errorf("unknown LINUXIO_PRIV_POLICY '%s', using sudo", s);
+  return PRIV_POLICY_SUDO;
+}
+
+// Returns 1 if groups[] contains a configured admin group, 0 if not, and -1
+// if none of the configured admin groups exist (the policy can't decide).
+static int groups_grant_admin(const gid_t *groups, int ngroups)
+{
+  const char *list = getenv("LINUXIO_ADMIN_GROUPS");
+  if (!list || !*list)
+    list = ADMIN_GROUPS_DEFAULT;
+
+  char copy[ADMIN_GROUPS_MAX_LEN];
+  int n = safe_snprintf(copy, sizeof(copy), "%s", list);
+  if (n < 0 || (size_t)n >= sizeof(copy))
+    return -1;
+
+  int resolved = 0;
+  char *save = NULL;
+  for (char *name = strtok_r(copy, ", ", &save); name; name = strtok_r(NULL, ", ", &save))
+  {
+    char buf[4096];
+    struct group gr;
+    struct group *gr_out = NULL;
+    if (getgrnam_r(name, &gr, buf, sizeof(buf), &gr_out) != 0 || !gr_out)
+      continue;
+    resolved = 1;
+    for (int i = 0; i < ngroups; i++)
+    {
+      if (groups[i] == gr_out->gr_gid)
+        return 1;
+    }
+  }
+  return resolved ? 0 : -1;
+}
+
+// sudo probing
+// The probe is split into start/finish so handle_client() can run it in the
+// background while it validates the bridge and opens the PAM session.
+struct sudo_probe
+{
+  struct child_proc validate; // sudo -S -v
+  struct child_proc reset;    // sudo -k, reaped after the login response
+  uint64_t validate_deadline_ms;
+  uint64_t validate_started_us;
+  uint64_t reset_deadline_ms;
+  int decided;                // decision made without sudo, -1 if none
+  int cache_ttl;              // LINUXIO_PRIV_CACHE_TTL, 0 = cache disabled
+  uint64_t sudoers_fp;
+  uint64_t groups_fp;
+  const char *source;         // what decided: "sudo", "groups" or "cache"
+};
+
+static void sudo_probe_init(struct sudo_probe *probe)
+{
+  memset(probe, 0, sizeof(*probe));
+  probe->validate.pid = -1;
+  probe->validate.pidfd = -1;
+  probe->reset.pid = -1;
+  probe->reset.pidfd = -1;
+  probe->decided = -1;
+  probe->source = "sudo";
+}
+
+struct run_cmd_spawn
+{
+  const struct spawn_cred *cred;
+  int stdin_fd;
+  const char *const *argv;
+};
+
+static int run_cmd_child(void *p)
+{
+  const struct run_cmd_spawn *sp = p;
+  static char env_path[] = "PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin";
+  static char env_lang[] = "LANG=C";
+  char *const envp[] = {env_path, env_lang, NULL};
+
+  if (drop_to_user(sp->cred) != 0)
+    _exit(127);
+
+  if (dup2(sp->stdin_fd, STDIN_FILENO) < 0)
+    _exit(127);
+  close(sp->stdin_fd);
+
+  execve(LINUXIO_SUDO_PATH, ARGV_UNCONST(sp->argv), envp);
+  _exit(127);
+}
+
+// Spawn argv as the target user with stdin_data on its stdin. The child is
+// returned in *out and must be collected with run_cmd_finish().
+static int run_cmd_start(const struct auth_user *auth_user, const char *const argv[],
+                         const char *stdin_data, struct child_proc *out)
+{
+  struct spawn_cred cred;
+  if (spawn_cred_load(&cred, auth_user) != 0)
+    return -1;
+
+  int inpipe[2] = {-1, -1};
+#if defined(HAVE_PIPE2) || (defined(__linux__) && defined(O_CLOEXEC))
+  if (pipe2(inpipe, O_CLOEXEC) != 0)
+  {
+    spawn_cred_free(&cred);
+    return -1;
+  }
+#else
+  if (pipe(inpipe) != 0)
+  {
+    spawn_cred_free(&cred);
+    return -1;
+  }
+  {
+    int fdflags = fcntl(inpipe[0], F_GETFD);
+    if (fdflags >= 0)
+      (void)fcntl(inpipe[0], F_SETFD, fdflags | FD_CLOEXEC);
+    fdflags = fcntl(inpipe[1], F_GETFD);
+    if (fdflags >= 0)
+      (void)fcntl(inpipe[1], F_SETFD, fdflags | FD_CLOEXEC);
+  }
+#endif
+
+  // Fill the pipe before spawning: the password line is far below the pipe
+  // capacity, so this never blocks, and a child that exits early can't
+  // SIGPIPE us.
+  int rc = 0;
+  if (stdin_data && *stdin_data &&
+      write_all(inpipe[1], stdin_data, strlen(stdin_data)) != 0)
+    rc = -1;
+  close(inpipe[1]);
+
+  if (rc == 0)
+  {
+    struct run_cmd_spawn sp = {.cred = &cred, .stdin_fd = inpipe[0], .argv = argv};
+    rc = spawn_child(run_cmd_child, &sp, out);
+  }
+  close(inpipe[0]);
+  spawn_cred_free(&cred);
+  return rc;
+}
+
+// Collect a child started by run_cmd_start(). Returns its exit code, or -1
+// if it had to be killed at the deadline.
+static int run_cmd_finish(struct child_proc *child, uint64_t deadline_ms)
+{
+  int status = 0;
+  int rc = child_wait_until(child, &status, deadline_ms);
+  if (rc != 0)
+  {
+    child_kill_and_reap(child);
+    child_release(child);
+    return -1;
+  }
+  child_release(child);
+
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return -1;
+}
+
+// Start `sudo -S -v` with the same password we used for PAM. The caller may
+// wipe the password as soon as this returns.
+static void sudo_probe_start(struct sudo_probe *probe, const struct auth_user *auth_user,
+                             const char *password)
+{
+  sudo_probe_init(probe);
+
+  // If we don't have a password, don't even try
+  if (!password || !*password)
+    return;
+
+  enum priv_policy policy = priv_policy_from_env();
+  probe->cache_ttl = env_get_int("LINUXIO_PRIV_CACHE_TTL", PRIV_CACHE_TTL_DEFAULT, 0,
+                                 PRIV_CACHE_TTL_MAX);
+
+  gid_t *groups = NULL;
+  int ngroups = -1;
+  if (policy != PRIV_POLICY_SUDO || probe->cache_ttl > 0)
+    ngroups = load_user_groups(auth_user->name, auth_user->gid, &groups);
+
+  if (policy != PRIV_POLICY_SUDO && ngroups >= 0)
+  {
+    int admin = groups_grant_admin(groups, ngroups);
+    if (admin == 1 || (admin == 0 && policy == PRIV_POLICY_GROUPS_ONLY))
+    {
+      probe->decided = admin;
+      probe->source = "groups";
+      METRICS_ADD(priv_decisions[METRICS_PRIV_GROUPS], 1);
+      free(groups);
+      return;
+    }
+  }
+
+  if (probe->cache_ttl > 0 && ngroups >= 0)
+  {
+    probe->sudoers_fp = sudoers_fingerprint();
+    probe->groups_fp = groups_fingerprint(auth_user, groups, ngroups);
+    probe->decided = priv_cache_lookup(auth_user, probe->cache_ttl,
+                                       probe->sudoers_fp, probe->groups_fp);
+  }
+  free(groups);
+  if (probe->decided >= 0)
+  {
+    probe->source = "cache";
+    METRICS_ADD(priv_decisions[METRICS_PRIV_CACHE], 1);
+    return;
+  }
+
+  // How long we wait for sudo -S -v to complete
+  int to_pw = env_get_int("LINUXIO_SUDO_TIMEOUT_PASSWORD", 4, 1, 30);
+
+  // Validate sudo using the same password we used for PAM
+  const char *argv_pw[] = {LINUXIO_SUDO_PATH, "-S", "-p", "", "-v", NULL};
+
+  // Buffer must accommodate password + newline + null terminator
+  char *buf = secret_alloc(PROTO_MAX_PASSWORD + 2);
+  if (!buf)
+  {
+    journal_errorf("no secure memory for sudo probe");
+    return;
+  }
+  (void)safe_snprintf(buf, PROTO_MAX_PASSWORD + 2, "%s\n", password);
+
+  probe->validate_deadline_ms = monotonic_ms() + (uint64_t)to_pw * 1000u;
+  probe->validate_started_us = monotonic_us();
+  METRICS_ADD(priv_decisions[METRICS_PRIV_SUDO], 1);
+  if (run_cmd_start(auth_user, argv_pw, buf, &probe->validate) != 0)
+    journal_errorf("failed to start sudo probe: %m");
+
+  // Wipe the temporary buffer
+  secret_free(buf, PROTO_MAX_PASSWORD + 2);
+}
+
+// Join the probe started by sudo_probe_start(); returns 1 if the user has sudo.
+static int sudo_probe_finish(struct sudo_probe *probe, const struct auth_user *auth_user,
+                             int *out_nopasswd)
+{
+  // We don't currently differentiate NOPASSWD vs PASSWD in the rest of the code,
+  // so just clear this and treat "has sudo" as a boolean.
+  if (out_nopasswd)
+    *out_nopasswd = 0;
+
+  if (probe->decided >= 0)
+    return probe->decided;
+
+  if (probe->validate.pid <= 0)
+    return 0;
+
+  int rc = run_cmd_finish(&probe->validate, probe->validate_deadline_ms);
+  if (g_metrics)
+    metrics_observe(&g_metrics->sudo_probe, monotonic_us() - probe->validate_started_us);
+  if (rc < 0)
+    METRICS_ADD(sudo_probe_timeouts, 1);
+
+  // Only cache definitive answers: 0 = allowed, 1 = sudo refused. Timeouts,
+  // exec failures (127) and signals are retried on the next login.
+  if ((rc == 0 || rc == 1) && probe->cache_ttl > 0 && probe->groups_fp != 0)
+    priv_cache_store(auth_user, rc == 0, probe->sudoers_fp, probe->groups_fp);
+
+  if (rc != 0)
+    return 0;
+
+  // Drop any cached sudo credentials immediately; we just wanted to know
+  // whether sudo works, not to keep a ticket open. Nothing downstream
+  // depends on it, so it is only reaped once the login has been answered.
+  const char *argv_k[] = {LINUXIO_SUDO_PATH, "-k", NULL};
+  probe->reset_deadline_ms = monotonic_ms() + 2000u;
+  (void)run_cmd_start(auth_user, argv_k, NULL, &probe->reset);
+  return 1;
+}
+
+// Reap (or kill) whatever the probe still has running.
+static void sudo_probe_cleanup(struct sudo_probe *probe)
+{
+  if (probe->validate.pid > 0)
+  {
+    child_kill_and_reap(&probe->validate);
+    child_release(&probe->validate);
+  }
+  if (probe->reset.pid > 0)
+    (void)run_cmd_finish(&probe->reset, probe->reset_deadline_ms);
+}
+
+// Locale validation - only allow safe locale strings
+static int valid_locale(const char *s)
+{
+  if (!s || !*s)
+    return 0;
+
+  size_t len = strlen(s);
+  if (len > 64)  // Reasonable max for locale strings
+    return 0;
+
+  // Allow [A-Za-z0-9_.-@] for locale strings like "en_US.UTF-8" or "C.UTF-8"
+  for (size_t i = 0; i < len; i++)
+  {
+    char c = s[i];
+    if (!((c >= 'A' && c <= 'Z') ||
+          (c >= 'a' && c <= 'z') ||
+          (c >= '0' && c <= '9') ||
+          c == '_' || c == '-' || c == '.' || c == '@'))
+      return 0;
+  }
+
+  return 1;
+}
+
+// Session ID validation - only allow safe characters
+static int valid_session_id(const char *s)
+{
+  if (!s || !*s)
+    return 0;
+
+  size_t len = strlen(s);
+  if (len == 0 || len > 64)  // Max 64 chars
+    return 0;
+
+  // Only allow [A-Za-z0-9_-]
+  for (size_t i = 0; i < len; i++)
+  {
+    char c = s[i];
+    if (!((c >= 'A' && c <= 'Z') ||
+          (c >= 'a' && c <= 'z') ||
+          (c >= '0' && c <= '9') ||
+          c == '_' || c == '-'))
+      return 0;
+  }
+
+  return 1;
+}
+
+// -------- Peer credential check (defense-in-depth) --------
+// Verify the connecting process is authorized (root or linuxio-bridge-socket group)
+// This mirrors the systemd socket policy but is kernel-enforced.
+#define AUTH_SOCKET_GROUP "linuxio-bridge-socket"
+
+// The gid of AUTH_SOCKET_GROUP: the daemon's copy unless fresh is set or it
+// has none. Returns 0 on success.
+static int auth_socket_gid(int fresh, gid_t *gid)
+{
+  if (!fresh && g_nss.socket_gid_ok)
+  {
+    *gid = g_nss.socket_gid;
+    return 0;
+  }
+  const struct group *gr = getgrnam(AUTH_SOCKET_GROUP);
+  if (!gr)
+    return -1;
+  *gid = gr->gr_gid;
+  return 0;
+}
+
+// Called by the daemon before it forks anything.
+static void auth_socket_gid_init(void)
+{
+  g_nss.socket_gid_ok = auth_socket_gid(1, &g_nss.socket_gid) == 0;
+}
+
+// Returns 1 if uid is in target_gid (by configured groups), 0 if not, -1 on error.
+static int user_in_group(uid_t uid, gid_t target_gid)
+{
+  struct auth_user peer;
+  if (nss_lookup_uid(uid, &peer) != 0)
+    return -1;
+
+  gid_t *groups = NULL;
+  int ngroups = load_user_groups(peer.name, peer.gid, &groups);
+  if (ngroups < 0)
+    return -1;
+
+  int found = 0;
+  for (int i = 0; i < ngroups; i++)
+  {
+    if (groups[i] == target_gid)
+    {
+      found = 1;
+      break;
+    }
+  }
+
+  free(groups);
+  return found;
+}
+
+static int check_peer_creds(int fd)
+{
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+  {
+    journal_errorf("getsockopt(SO_PEERCRED) failed: %m");
+    return -1;
+  }
+
+  // Allow root
+  if (cred.uid == 0)
+    return 0;
+
+  // Allow if peer's primary GID matches linuxio-bridge-socket.
+  // Edge case: supplementary group membership won't match here. We use
+  // getgrouplist() to check the user's configured groups. Caveat: this reflects
+  // the user's configured groups, not necessarily the process's current group
+  // set. For strict "current groups," parse /proc/<pid>/status Groups: instead.
+  // A daemon resolved the group at startup; if that gid does not match, it
+  // is looked up again in case the group was recreated since.
+  gid_t gid = 0;
+  int in_group = 0;
+  for (int fresh = 0; fresh <= 1; fresh++)
+  {
+    gid_t prev = gid;
+    if (fresh && !g_nss.socket_gid_ok)
+      break;
+    if (auth_socket_gid(fresh, &gid) != 0)
+    {
+      journal_errorf("group '%s' not found", AUTH_SOCKET_GROUP);
+      return -1;
+    }
+    if (fresh && gid == prev)
+      break;
+    if (cred.gid == gid)
+      return 0;
+    in_group = user_in_group(cred.uid, gid);
+    if (in_group > 0)
+      return 0;
+  }
+  if (in_group < 0)
+    journal_errorf("failed to resolve supplementary groups for uid=%u", (unsigned)cred.uid);
+
+  journal_errorf("peer not authorized: uid=%u gid=%u (expected root or gid=%u)",
+                 (unsigned)cred.uid, (unsigned)cred.gid, (unsigned)gid);
+  return -1;
+}
+
+
+// ============================================================================
+// Single-shot mode - socket-activated worker
+// ============================================================================
+
+// -------- live session table --------
+// One slot per live session in LINUXIO_AUTH_SESSION_TABLE (empty disables
+// it; see "Live session table" in linuxio_protocol.h), so the webserver and
+// the CLI can list sessions without reading utmp or asking each bridge.
+// The login that starts a session claims its slot and whoever records its
+// logout frees it: the worker, or the daemon for a supervised session. The
+// daemon maps the table once and its workers inherit the mapping; an
+// Accept=yes instance maps it once it has a session to add. A slot whose
+// bridge died without its logout being recorded is taken over once the
+// table is full. The size is fixed when the file is created
+// (LINUXIO_AUTH_SESSION_TABLE_SLOTS); an existing table keeps its own.
+#ifndef SESSION_TABLE_DEFAULT
+#define SESSION_TABLE_DEFAULT       "/run/linuxio/sessions.shm"
+#endif
+#define SESSION_TABLE_SLOTS_DEFAULT 4096
+#define SESSION_TABLE_SLOTS_MAX     65536
+
+struct session_table_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slots;
+  uint32_t slot_size;
+  uint8_t reserved[PROTO_SESSION_TABLE_HEADER_SIZE - 16];
+};
+
+struct session_table_slot
+{
+  uint32_t seq;  // odd while a writer is in the slot
+  int32_t owner; // pid that claimed it, 0 if free
+  uint32_t uid;
+  uint8_t mode;
+  uint8_t pad[3];
+  int32_t bridge_pid;
+  uint32_t pad2;
+  uint64_t started_us;
+  uint64_t last_activity_us;
+  char session_id[PROTO_MAX_SESSION_ID];
+  uint8_t reserved[PROTO_SESSION_TABLE_SLOT_SIZE - 40 - PROTO_MAX_SESSION_ID];
+};
+
+_Static_assert(sizeof(struct session_table_header) == PROTO_SESSION_TABLE_HEADER_SIZE,
+               "session table header size");
+_Static_assert(sizeof(struct session_table_slot) == PROTO_SESSION_TABLE_SLOT_SIZE,
+               "session table slot size");
+
+struct session_table
+{
+  int opened; // tried already, whether or not it worked
+  struct session_table_slot *slots;
+  uint32_t nslots;
+};
+
+static struct session_table g_session_table;
+static int g_session_slot = -1; // the slot of this process's login
+
+static void session_table_open(void)
+{
+  if (g_session_table.opened)
+    return;
+  g_session_table.opened = 1;
+  const char *path = getenv("LINUXIO_AUTH_SESSION_TABLE");
+  if (!path)
+    path = SESSION_TABLE_DEFAULT;
+  if (!path[0])
+    return;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0640);
+  if (fd < 0)
+  {
+    journal_errorf("failed to open session table %s: %m", path);
+    return;
+  }
+  // Another instance may be creating it right now
+  struct stat st;
+  if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0)
+  {
+    journal_errorf("failed to lock session table %s: %m", path);
+    close(fd);
+    return;
+  }
+
+  struct session_table_header h;
+  uint32_t slots = (uint32_t)env_get_int("LINUXIO_AUTH_SESSION_TABLE_SLOTS",
+                                         SESSION_TABLE_SLOTS_DEFAULT, 1, SESSION_TABLE_SLOTS_MAX);
+  int fresh = 1;
+  if (pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) && h.magic == PROTO_SESSION_TABLE_MAGIC &&
+      h.version == PROTO_SESSION_TABLE_VERSION && h.slot_size == PROTO_SESSION_TABLE_SLOT_SIZE &&
+      h.slots > 0 && h.slots <= SESSION_TABLE_SLOTS_MAX &&
+      st.st_size == (off_t)(sizeof(h) + (size_t)h.slots * PROTO_SESSION_TABLE_SLOT_SIZE))
+  {
+    slots = h.slots;
+    fresh = 0;
+  }
+  size_t len = sizeof(h) + (size_t)slots * PROTO_SESSION_TABLE_SLOT_SIZE;
+  gid_t gid;
+  void *map = MAP_FAILED;
+  if (!fresh || (ftruncate(fd, 0) == 0 && ftruncate(fd, (off_t)len) == 0 &&
+                 (auth_socket_gid(0, &gid) != 0 || fchown(fd, 0, gid) == 0) &&
+                 fchmod(fd, 0640) == 0))
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    journal_errorf("failed to map session table %s: %m", path);
+  }
+  else
+  {
+    struct session_table_header *hdr = map;
+    if (fresh)
+    {
+      hdr->version = PROTO_SESSION_TABLE_VERSION;
+      hdr->slots = slots;
+      hdr->slot_size = PROTO_SESSION_TABLE_SLOT_SIZE;
+      __atomic_store_n(&hdr->magic, PROTO_SESSION_TABLE_MAGIC, __ATOMIC_RELEASE);
+    }
+    g_session_table.slots = (struct session_table_slot *)(hdr + 1);
+    g_session_table.nslots = slots;
+  }
+  (void)flock(fd, LOCK_UN);
+  close(fd);
+}
+
+static void session_slot_begin(struct session_table_slot *s)
+{
+  __atomic_store_n(&s->seq, __atomic_load_n(&s->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void session_slot_end(struct session_table_slot *s)
+{
+  __atomic_store_n(&s->seq, __atomic_load_n(&s->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+// A claimed slot whose bridge is gone without its logout being recorded
+static int session_slot_stale(const struct session_table_slot *s)
+{
+  pid_t pid = __atomic_load_n(&s->bridge_pid, __ATOMIC_RELAXED);
+  return pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+}
+
+// List a session that just started. Returns its slot, -1 if it is not listed.
+static int session_table_add(const char *session_id, uid_t uid, uint8_t mode, pid_t bridge_pid)
+{
+  session_table_open();
+  uint32_t n = g_session_table.nslots;
+  if (!g_session_table.slots)
+    return -1;
+
+  // Start where the session id hashes to, so concurrent logins rarely race
+  // for the same free slot
+  uint32_t start = (uint32_t)(fnv1a64(FNV1A64_INIT, session_id, strlen(session_id)) % n);
+  int32_t self = (int32_t)getpid();
+  struct session_table_slot *s = NULL;
+  for (int pass = 0; !s && pass < 2; pass++)
+  {
+    for (uint32_t i = 0; !s && i < n; i++)
+    {
+      struct session_table_slot *c = &g_session_table.slots[(start + i) % n];
+      int32_t owner = __atomic_load_n(&c->owner, __ATOMIC_ACQUIRE);
+      if (owner != 0 && (pass == 0 || !session_slot_stale(c)))
+        continue;
+      if (__atomic_compare_exchange_n(&c->owner, &owner, self, 0, __ATOMIC_ACQ_REL,
+                                      __ATOMIC_RELAXED))
+        s = c;
+    }
+  }
+  if (!s)
+  {
+    journal_errorf("session table full; session %s is not listed", session_id);
+    return -1;
+  }
+
+  uint64_t now = realtime_us();
+  session_slot_begin(s);
+  s->uid = (uint32_t)uid;
+  s->mode = mode;
+  s->bridge_pid = (int32_t)bridge_pid;
+  s->started_us = now;
+  s->last_activity_us = now;
+  copy_fixed_field(s->session_id, sizeof(s->session_id), session_id);
+  session_slot_end(s);
+  return (int)(s - g_session_table.slots);
+}
+
+static struct session_table_slot *session_table_slot(int slot)
+{
+  if (!g_session_table.slots || slot < 0 || (uint32_t)slot >= g_session_table.nslots)
+    return NULL;
+  return &g_session_table.slots[slot];
+}
+
+// Whether slot still lists session_id
+static int session_table_holds(int slot, const char *session_id)
+{
+  const struct session_table_slot *s = session_table_slot(slot);
+  return s && __atomic_load_n(&s->owner, __ATOMIC_ACQUIRE) != 0 &&
+         strncmp(s->session_id, session_id, sizeof(s->session_id)) == 0;
+}
+
+// A lazy login's bridge was replaced by a privileged one.
+static void session_table_update(int slot, uint8_t mode, pid_t bridge_pid)
+{
+  struct session_table_slot *s = session_table_slot(slot);
+  if (!s)
+    return;
+  session_slot_begin(s);
+  s->mode = mode;
+  s->bridge_pid = (int32_t)bridge_pid;
+  s->last_activity_us = realtime_us();
+  session_slot_end(s);
+}
+
+static void session_table_touch(int slot)
+{
+  struct session_table_slot *s = session_table_slot(slot);
+  if (!s)
+    return;
+  session_slot_begin(s);
+  s->last_activity_us = realtime_us();
+  session_slot_end(s);
+}
+
+static void session_table_remove(int slot)
+{
+  struct session_table_slot *s = session_table_slot(slot);
+  if (!s)
+    return;
+  session_slot_begin(s);
+  s->uid = 0;
+  s->mode = 0;
+  s->bridge_pid = 0;
+  s->started_us = 0;
+  s->last_activity_us = 0;
+  memset(s->session_id, 0, sizeof(s->session_id));
+  session_slot_end(s);
+  __atomic_store_n(&s->owner, 0, __ATOMIC_RELEASE);
+}
+
+// -------- login phase timings --------
+// How long each phase of this login took, for the "login timings" journal
+// entry and, if the client set PROTO_REQ_FLAG_TIMING, the response trailer.
+// Phases that did not run are left out of both.
+struct login_timing
+{
+  int send_trailer;
+  uint32_t done; // bit per PROTO_PHASE_*
+  uint32_t us[PROTO_PHASE_COUNT];
+  uint64_t requested_us;     // wall clock, for the bootstrap extension
+  uint64_t authenticated_us;
+};
+
+static struct login_timing g_timing;
+
+static const char *const login_phase_fields[PROTO_PHASE_COUNT] = {
+    [PROTO_PHASE_REQUEST_READ] = "LINUXIO_T_REQUEST_READ_US",
+    [PROTO_PHASE_PAM_AUTH] = "LINUXIO_T_PAM_AUTH_US",
+    [PROTO_PHASE_PAM_ACCT] = "LINUXIO_T_PAM_ACCT_US",
+    [PROTO_PHASE_PAM_SETCRED] = "LINUXIO_T_PAM_SETCRED_US",
+    [PROTO_PHASE_SUDO] = "LINUXIO_T_SUDO_US",
+    [PROTO_PHASE_BRIDGE_VALIDATE] = "LINUXIO_T_BRIDGE_VALIDATE_US",
+    [PROTO_PHASE_PAM_OPEN_SESSION] = "LINUXIO_T_PAM_OPEN_SESSION_US",
+    [PROTO_PHASE_FORK] = "LINUXIO_T_FORK_US",
+    [PROTO_PHASE_EXEC] = "LINUXIO_T_EXEC_US",
+    [PROTO_PHASE_SEND_OK] = "LINUXIO_T_SEND_OK_US",
+};
+
+// Charge the time since start_us (from monotonic_us()) to phase.
+static void login_timing_record(int phase, uint64_t start_us)
+{
+  uint64_t d = monotonic_us() - start_us;
+  g_timing.us[phase] = d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+  g_timing.done |= 1u << phase;
+  if (g_metrics)
+    metrics_observe(&g_metrics->phases[phase], d);
+}
+
+// Append [count:1]([phase:1][usec:4])*count; dst holds 1 + 5 * PROTO_PHASE_COUNT.
+static size_t login_timing_encode(uint8_t *dst)
+{
+  size_t len = 1;
+  uint8_t count = 0;
+  for (int i = 0; i < PROTO_PHASE_COUNT; i++)
+  {
+    if (!(g_timing.done & (1u << i)))
+      continue;
+    dst[len] = (uint8_t)i;
+    write_u32_be(dst + len + 1, g_timing.us[i]);
+    len += 5;
+    count++;
+  }
+  dst[0] = count;
+  return len;
+}
+
+static void login_timing_log(const char *user)
+{
+  char bufs[PROTO_PHASE_COUNT][16];
+  struct journal_field fields[1 + PROTO_PHASE_COUNT];
+  size_t n = 0;
+  fields[n++] = (struct journal_field){"LINUXIO_USER", user};
+  for (int i = 0; i < PROTO_PHASE_COUNT; i++)
+  {
+    if (!(g_timing.done & (1u << i)))
+      continue;
+    (void)safe_snprintf(bufs[i], sizeof(bufs[i]), "%u", (unsigned)g_timing.us[i]);
+    fields[n++] = (struct journal_field){login_phase_fields[i], bufs[i]};
+  }
+  journal_info_fieldsf(fields, n, "login timings");
+}
+
+// -------- login deadline --------
+// A request may say how long its client will wait for the response (header
+// bytes 5-7). Every wait of the login is cut to what is left of that, and a
+// login that runs out of it is answered with PROTO_RESULT_DEADLINE_EXCEEDED
+// instead of finishing for nobody. PAM authentication and account checks
+// can't be interrupted, so while they run a timer answers for them and ends
+// the process; nothing that needs undoing exists yet at that point.
+#define LOGIN_DEADLINE_MSG "login deadline exceeded"
+
+struct login_deadline
+{
+  uint64_t at_ms; // monotonic; 0 when the request set none
+  int fd;         // answered by the timer while it is armed
+  uint8_t resp[PROTO_AUTH_RESP_HEADER_SIZE + 2 + sizeof(LOGIN_DEADLINE_MSG) - 1];
+};
+
+static struct login_deadline g_deadline = {.fd = -1};
+
+// The earlier of deadline_ms and the login deadline (0 = none, for both).
+static uint64_t login_deadline_clamp(uint64_t deadline_ms)
+{
+  if (g_deadline.at_ms != 0 && (deadline_ms == 0 || g_deadline.at_ms < deadline_ms))
+    return g_deadline.at_ms;
+  return deadline_ms;
+}
+
+static int login_deadline_passed(void)
+{
+  return g_deadline.at_ms != 0 && monotonic_ms() >= g_deadline.at_ms;
+}
+
+static void login_deadline_expired(int sig)
+{
+  (void)sig;
+  METRICS_ADD(results[PROTO_RESULT_DEADLINE_EXCEEDED], 1);
+  ssize_t wr = write(g_deadline.fd, g_deadline.resp, sizeof(g_deadline.resp));
+  (void)wr; // Best-effort, we're exiting anyway
+  _exit(1);
+}
+
+// Until login_deadline_disarm(), answer fd and exit once the deadline
+// passes. The response is encoded up front (no trailers) so the signal
+// handler only has to write it.
+static void login_deadline_arm(int fd)
+{
+  int left = deadline_remaining_ms(g_deadline.at_ms);
+  if (left < 0)
+    return;
+
+  uint8_t *r = g_deadline.resp;
+  r[0] = PROTO_MAGIC_0;
+  r[1] = PROTO_MAGIC_1;
+  r[2] = PROTO_MAGIC_2;
+  r[3] = PROTO_VERSION;
+  r[4] = PROTO_STATUS_ERROR;
+  r[5] = 0;
+  r[6] = PROTO_RESULT_DEADLINE_EXCEEDED;
+  r[7] = 0;
+  write_u16_be(r + PROTO_AUTH_RESP_HEADER_SIZE, sizeof(LOGIN_DEADLINE_MSG) - 1);
+  memcpy(r + PROTO_AUTH_RESP_HEADER_SIZE + 2, LOGIN_DEADLINE_MSG, sizeof(LOGIN_DEADLINE_MSG) - 1);
+  g_deadline.fd = fd;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = login_deadline_expired;
+  sigfillset(&sa.sa_mask);
+  (void)sigaction(SIGALRM, &sa, NULL);
+
+  // it_value of zero would disarm the timer; an expired deadline fires at once
+  struct itimerval it = {
+      .it_interval = {0, 0},
+      .it_value = {.tv_sec = left / 1000, .tv_usec = left > 0 ? (left % 1000) * 1000 : 1},
+  };
+  (void)setitimer(ITIMER_REAL, &it, NULL);
+}
+
+static void login_deadline_disarm(void)
+{
+  if (g_deadline.fd < 0)
+    return;
+  struct itimerval it;
+  memset(&it, 0, sizeof(it));
+  (void)setitimer(ITIMER_REAL, &it, NULL);
+  (void)signal(SIGALRM, SIG_DFL);
+  g_deadline.fd = -1;
+}
+
+// -------- admission control (daemon mode) --------
+// LINUXIO_AUTH_MAX_INFLIGHT bounds the logins being worked on at once, from
+// when a worker takes one until it is answered. A login over the limit, or
+// one that finds every worker busy, is answered at once with
+// PROTO_RESULT_BUSY and a retry-after hint (LINUXIO_AUTH_BUSY_RETRY_MS)
+// instead of waiting in the accept backlog until its client gives up. The
+// count is shared with the workers: each claims its slot when it takes a
+// login and gives it back with the first response, and the daemon gives
+// back the slot of a worker that died before answering.
+#define ADMISSION_BUSY_MSG         "auth daemon busy"
+#define ADMISSION_RETRY_DEFAULT_MS 1000
+#define ADMISSION_DRAIN_MS         20
+#define ADMISSION_RESPONSE_SIZE    (PROTO_AUTH_RESP_HEADER_SIZE + 2 + sizeof(ADMISSION_BUSY_MSG) - 1 + 4)
+
+struct admission
+{
+  int limit;
+  uint32_t retry_ms;
+  int inflight;
+  uint8_t claimed[]; // by worker slot
+};
+
+static struct admission *g_admission; // NULL outside daemon mode
+static int g_admission_slot = -1;     // a worker's slot in the daemon's table
+
+static void admission_init(int max_workers)
+{
+  void *p = shared_table_map(SHARED_ADMISSION, sizeof(struct admission) + (size_t)max_workers);
+  if (p == MAP_FAILED)
+  {
+    journal_errorf("failed to map admission table, logins in flight are not limited: %m");
+    return;
+  }
+  g_admission = p;
+  g_admission->limit = env_get_int("LINUXIO_AUTH_MAX_INFLIGHT", max_workers, 1, max_workers);
+  g_admission->retry_ms = (uint32_t)env_get_int("LINUXIO_AUTH_BUSY_RETRY_MS",
+                                                ADMISSION_RETRY_DEFAULT_MS, 1, 60000);
+}
+
+static int admission_inflight(void)
+{
+  return g_admission ? __atomic_load_n(&g_admission->inflight, __ATOMIC_ACQUIRE) : 0;
+}
+
+static int admission_full(void)
+{
+  return g_admission && admission_inflight() >= g_admission->limit;
+}
+
+// Worker: count the login just taken. Returns -1 if that is one too many.
+static int admission_claim(void)
+{
+  if (!g_admission || g_admission_slot < 0)
+    return 0;
+  if (__atomic_add_fetch(&g_admission->inflight, 1, __ATOMIC_ACQ_REL) > g_admission->limit)
+  {
+    (void)__atomic_sub_fetch(&g_admission->inflight, 1, __ATOMIC_ACQ_REL);
+    return -1;
+  }
+  __atomic_store_n(&g_admission->claimed[g_admission_slot], 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Give back the claim of a worker slot; only the first call per claim counts.
+static void admission_release(int slot)
+{
+  if (g_admission && slot >= 0 &&
+      __atomic_exchange_n(&g_admission->claimed[slot], 0, __ATOMIC_ACQ_REL))
+    (void)__atomic_sub_fetch(&g_admission->inflight, 1, __ATOMIC_ACQ_REL);
+}
+
+static size_t admission_busy_response(uint8_t *r)
+{
+  r[0] = PROTO_MAGIC_0;
+  r[1] = PROTO_MAGIC_1;
+  r[2] = PROTO_MAGIC_2;
+  r[3] = PROTO_VERSION;
+  r[4] = PROTO_STATUS_ERROR;
+  r[5] = 0;
+  r[6] = PROTO_RESULT_BUSY;
+  r[7] = PROTO_RESP_FLAG_RETRY;
+  size_t n = PROTO_AUTH_RESP_HEADER_SIZE;
+  write_u16_be(r + n, sizeof(ADMISSION_BUSY_MSG) - 1);
+  memcpy(r + n + 2, ADMISSION_BUSY_MSG, sizeof(ADMISSION_BUSY_MSG) - 1);
+  n += 2 + sizeof(ADMISSION_BUSY_MSG) - 1;
+  write_u32_be(r + n, g_admission ? g_admission->retry_ms : ADMISSION_RETRY_DEFAULT_MS);
+  METRICS_ADD(results[PROTO_RESULT_BUSY], 1);
+  return n + 4;
+}
+
+// Drop what arrived of a refused request. Returns 0 if anything (or EOF)
+// did, -1 if nothing is there yet.
+static int admission_drain(int conn)
+{
+  uint8_t buf[512];
+  ssize_t n;
+  int arrived = 0;
+  while ((n = recv(conn, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+    arrived = 1;
+  secure_bzero(buf, sizeof(buf));
+  return arrived || n == 0 || errno != EAGAIN ? 0 : -1;
+}
+
+// Answer a login there is no room for and let it go: on reply if it came
+// from the control socket, on conn otherwise. A client still writing its
+// request when conn closes fails before it reads the answer, so a request
+// that has not arrived yet gets a moment to; what arrived is dropped.
+static void admission_refuse(int conn, int reply)
+{
+  uint8_t resp[ADMISSION_RESPONSE_SIZE];
+  size_t len = admission_busy_response(resp);
+  if (reply >= 0)
+  {
+    (void)write_all(reply, resp, len);
+    close(reply);
+    close(conn);
+    return;
+  }
+
+  (void)write_all(conn, resp, len);
+  struct pollfd pfd = {.fd = conn, .events = POLLIN, .revents = 0};
+  if (poll(&pfd, 1, ADMISSION_DRAIN_MS) > 0)
+    (void)admission_drain(conn);
+  close(conn);
+}
+
+// admission_refuse() for the daemon loop, which must not wait on a client:
+// the answer goes out without blocking. Returns 0 with conn closed, or -1 if
+// the request has not arrived yet and conn should linger (daemon_shed_expire)
+// for up to ADMISSION_DRAIN_MS, for the reason admission_refuse() waits.
+static int admission_shed(int conn)
+{
+  uint8_t resp[ADMISSION_RESPONSE_SIZE];
+  size_t len = admission_busy_response(resp);
+  (void)send(conn, resp, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  (void)shutdown(conn, SHUT_WR);
+  if (admission_drain(conn) != 0)
+    return -1;
+  close(conn);
+  return 0;
+}
+
+// -------- re-attach tickets --------
+// A login handed to a supervising daemon can later be re-attached to its
+// running bridge without PAM (see "Session re-attach" in linuxio_protocol.h).
+// The daemon keeps the current ticket with the session and replaces it on
+// every use, so a ticket is good for one re-attach. The same socket lets
+// a shared bridge take further sessions of its user.
+struct reattach_state
+{
+  int grace_ms;     // LINUXIO_AUTH_REATTACH_GRACE_MS; 0 = never issue tickets
+  int share_bridge; // LINUXIO_AUTH_SHARE_BRIDGE
+  int want_ticket;  // the request set PROTO_REQ_FLAG_TICKET
+  char ticket[PROTO_TICKET_HEX_LEN + 1]; // goes into the OK response if set
+};
+
+static struct reattach_state g_reattach;
+
+// -------- privilege upgrade (daemon mode, control logins) --------
+// With LINUXIO_AUTH_LAZY_PRIVILEGE a control login that set
+// PROTO_REQ_FLAG_UPGRADE does not wait for a sudo probe that is still
+// running: it is answered with an unprivileged bridge right away, and
+// privilege_upgrade() swaps in a privileged one if sudo allows the user.
+struct privilege_upgrade
+{
+  int enabled;   // LINUXIO_AUTH_LAZY_PRIVILEGE, and the login came over the control socket
+  int pending;   // the OK response announces a PROTO_CTL_UPGRADE
+  int attach_fd; // sent along with the response, -1 if none
+};
+
+static struct privilege_upgrade g_upgrade = {.attach_fd = -1};
+
+static int ticket_generate(char out[PROTO_TICKET_HEX_LEN + 1])
+{
+  static const char hex[] = "0123456789abcdef";
+  uint8_t raw[PROTO_TICKET_HEX_LEN / 2];
+  size_t got = 0;
+  while (got < sizeof(raw))
+  {
+    ssize_t n = getrandom(raw + got, sizeof(raw) - got, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      secure_bzero(raw, sizeof(raw));
+      return -1;
+    }
+    got += (size_t)n;
+  }
+  for (size_t i = 0; i < sizeof(raw); i++)
+  {
+    out[2 * i] = hex[raw[i] >> 4];
+    out[2 * i + 1] = hex[raw[i] & 0x0f];
+  }
+  out[PROTO_TICKET_HEX_LEN] = '\0';
+  secure_bzero(raw, sizeof(raw));
+  return 0;
+}
+
+// Constant-time check of a presented ticket against the stored one.
+static int ticket_matches(const char *presented, const char *stored)
+{
+  if (strnlen(presented, PROTO_TICKET_HEX_LEN + 1) != PROTO_TICKET_HEX_LEN ||
+      strnlen(stored, PROTO_TICKET_HEX_LEN + 1) != PROTO_TICKET_HEX_LEN)
+    return 0;
+  uint8_t diff = 0;
+  for (size_t i = 0; i < PROTO_TICKET_HEX_LEN; i++)
+    diff |= (uint8_t)(presented[i] ^ stored[i]);
+  return diff == 0;
+}
+
+// Send binary response to client.
+// Success format:
+//   [magic:4][status:1][mode:1][result:1][flags:1][uid:4][gid:4][len:2][username]
+// Error format:
+//   [magic:4][status:1][mode:1][result:1][flags:1][len:2][error]
+// followed by the timing and ticket trailers when the client asked for
+// them (the ticket only on success). Everything but the strings goes into
+// one buffer; the whole response leaves with a single writev(), or a single
+// sendmsg() when g_upgrade.attach_fd goes with it. Returns 0 if it was sent.
+static int send_response(int fd, uint8_t status, uint8_t mode, uint8_t result_code,
+                          const char *error, const char *username, uid_t uid, gid_t gid)
+{
+  uint8_t header[PROTO_AUTH_RESP_HEADER_SIZE + 8 + 2];
+  size_t header_len = PROTO_AUTH_RESP_HEADER_SIZE;
+  const char *str = NULL;
+  int has_str = 0;
+
+  // Magic + version
+  header[0] = PROTO_MAGIC_0;
+  header[1] = PROTO_MAGIC_1;
+  header[2] = PROTO_MAGIC_2;
+  header[3] = PROTO_VERSION;
+
+  // Status and mode
+  header[4] = status;
+  header[5] = mode;
+
+  // Structured result code + flags
+  header[6] = result_code;
+  int send_ticket = status == PROTO_STATUS_OK && g_reattach.ticket[0];
+  int announce_upgrade = status == PROTO_STATUS_OK && g_upgrade.pending;
+  header[7] = (uint8_t)((g_timing.send_trailer ? PROTO_RESP_FLAG_TIMING : 0) |
+                        (send_ticket ? PROTO_RESP_FLAG_TICKET : 0) |
+                        (announce_upgrade ? PROTO_RESP_FLAG_UPGRADE : 0));
+  // An upgrade answers no request of its own
+  if (result_code < METRICS_RESULT_SLOTS && g_upgrade.attach_fd < 0)
+    METRICS_ADD(results[result_code], 1);
+  admission_release(g_admission_slot);
+
+  if (status == PROTO_STATUS_OK)
+  {
+    write_u32_be(header + header_len, (uint32_t)uid);
+    write_u32_be(header + header_len + 4, (uint32_t)gid);
+    header_len += 8;
+    str = username;
+    has_str = 1;
+  }
+  else if (status == PROTO_STATUS_ERROR && error)
+  {
+    // Error string if present
+    str = error;
+    has_str = 1;
+  }
+
+  // Length-prefixed string (2-byte length + data)
+  size_t str_len = 0;
+  if (has_str)
+  {
+    str_len = str ? strlen(str) : 0;
+    if (str_len > 0xFFFF)
+      str_len = 0xFFFF; // Cap at max uint16
+    write_u16_be(header + header_len, (uint16_t)str_len);
+    header_len += 2;
+  }
+
+  uint8_t trailer[1 + 5 * PROTO_PHASE_COUNT + 2];
+  struct iovec iov[4] = {
+      {.iov_base = header, .iov_len = header_len},
+      {.iov_base = (union { const char *in; void *out; }){.in = str}.out, .iov_len = str_len},
+      {.iov_base = trailer, .iov_len = 0},
+      {.iov_base = g_reattach.ticket, .iov_len = 0},
+  };
+  if (g_timing.send_trailer)
+    iov[2].iov_len = login_timing_encode(trailer);
+  if (send_ticket)
+  {
+    write_u16_be(trailer + iov[2].iov_len, PROTO_TICKET_HEX_LEN);
+    iov[2].iov_len += 2;
+    iov[3].iov_len = PROTO_TICKET_HEX_LEN;
+  }
+  if (g_upgrade.attach_fd < 0)
+    return writev_all(fd, iov, 4);
+
+  // The upgrade goes out as one packet with the bridge connection attached
+  uint8_t msg[sizeof(header) + PROTO_MAX_USERNAME + sizeof(trailer) + PROTO_TICKET_HEX_LEN];
+  size_t msg_len = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    if (iov[i].iov_len == 0)
+      continue;
+    if (iov[i].iov_len > sizeof(msg) - msg_len)
+      return -1;
+    memcpy(msg + msg_len, iov[i].iov_base, iov[i].iov_len);
+    msg_len += iov[i].iov_len;
+  }
+  int rc = send_with_fd(fd, msg, msg_len, g_upgrade.attach_fd);
+  secure_bzero(msg, sizeof(msg));
+  return rc;
+}
+
+static void send_error_response(int fd, uint8_t result_code, const char *error)
+{
+  send_response(fd, PROTO_STATUS_ERROR, 0, result_code, error, NULL, 0, 0);
+}
+
+static void send_ok_response(int fd, uint8_t mode, const char *username, uid_t uid, gid_t gid)
+{
+  if (mode == PROTO_MODE_PRIVILEGED)
+    METRICS_ADD(logins_privileged, 1);
+  else
+    METRICS_ADD(logins_unprivileged, 1);
+  send_response(fd, PROTO_STATUS_OK, mode, PROTO_RESULT_OK, NULL, username, uid, gid);
+}
+
+static void send_deadline_response(int fd)
+{
+  journal_info_fieldsf(NULL, 0, "login deadline exceeded");
+  send_error_response(fd, PROTO_RESULT_DEADLINE_EXCEEDED, LOGIN_DEADLINE_MSG);
+}
+
+static uint8_t classify_pam_result(int rc)
+{
+  switch (rc)
+  {
+  case PAM_SUCCESS:
+    return PROTO_RESULT_OK;
+  case PAM_AUTH_ERR:
+  case PAM_USER_UNKNOWN:
+  case PAM_MAXTRIES:
+  case PAM_CRED_ERR:
+  case PAM_AUTHTOK_ERR:
+    return PROTO_RESULT_AUTH_FAILED;
+  case PAM_NEW_AUTHTOK_REQD:
+    return PROTO_RESULT_PASSWORD_EXPIRED;
+  case PAM_PERM_DENIED:
+  case PAM_ACCT_EXPIRED:
+  case PAM_CRED_INSUFFICIENT:
+    return PROTO_RESULT_ACCESS_DENIED;
+  default:
+    return PROTO_RESULT_INTERNAL_ERROR;
+  }
+}
+
+// Fixed FD layout for child process:
+// 0 = stdin (bootstrap pipe)
+// 1 = stdout (dup from stderr)
+// 2 = stderr
+// 3 = client connection (CLIENT_CONN_FD)
+// 4 = exec_status_fd (CLOEXEC - closed by exec on success)
+// 5 = bridge_fd (for execveat)
+// 6 = re-attach socket (PROTO_REATTACH_FD), only with a ticket or a shared bridge
+// Everything above is closed
+#define CLIENT_CONN_FD 3
+#define EXEC_STATUS_FD 4
+#define BRIDGE_FD      5
+
+// Environment of a bridge child: PATH plus our own locale, TERM and
+// JOURNAL_STREAM, validated. Identity-specific variables are added by
+// bridge_identity_env(). Returns -1 if it does not fit.
+static int bridge_environment(struct spawn_env *env)
+{
+  // Preserve and validate our own environment variables
+  const char *preserve_lang = getenv("LANG");
   const char *preserve_term = getenv("TERM");
   const char *preserve_journal_stream = getenv("JOURNAL_STREAM");
 
-  // Save validated copies
-  char safe_lang[128] = "C.UTF-8";  // Default to UTF-8 instead of plain C
-  char safe_term[128] = "xterm-256color";
-  char safe_journal_stream[128] = "";
+  // Save validated copies
+  char safe_lang[128] = "C.UTF-8";  // Default to UTF-8 instead of plain C
+  char safe_term[128] = "xterm-256color";
+  char safe_journal_stream[128] = "";
+
+  if (preserve_lang && valid_locale(preserve_lang))
+  {
+    safe_snprintf(safe_lang, sizeof(safe_lang), "%s", preserve_lang);
+  }
+
+  if (preserve_term && *preserve_term)
+  {
+    // TERM should be simple and safe - just alphanumeric and dash
+    int valid = 1;
+    for (const char *p = preserve_term; *p && valid; p++)
+    {
+      char c = *p;
+      if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+            (c >= '0' && c <= '9') || c == '-'))
+        valid = 0;
+    }
+    if (valid && strlen(preserve_term) < sizeof(safe_term))
+      safe_snprintf(safe_term, sizeof(safe_term), "%s", preserve_term);
+  }
+
+  if (preserve_journal_stream && *preserve_journal_stream)
+  {
+    int valid = 1;
+    for (const char *p = preserve_journal_stream; *p && valid; p++)
+    {
+      char c = *p;
+      if (!((c >= '0' && c <= '9') || c == ':'))
+        valid = 0;
+    }
+    if (valid && strlen(preserve_journal_stream) < sizeof(safe_journal_stream))
+      safe_snprintf(safe_journal_stream, sizeof(safe_journal_stream), "%s", preserve_journal_stream);
+  }
+
+  int rc = 0;
+  spawn_env_init(env);
+  rc |= spawn_env_set(env, "PATH", "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin");
+  rc |= spawn_env_set(env, "LANG", safe_lang);
+  rc |= spawn_env_set(env, "LC_ALL", safe_lang);
+  rc |= spawn_env_set(env, "TERM", safe_term);
+
+  // Pass JOURNAL_STREAM on if present - child processes may still emit stderr output
+  if (safe_journal_stream[0] != '\0')
+    rc |= spawn_env_set(env, "JOURNAL_STREAM", safe_journal_stream);
+  return rc;
+}
+
+// HOME/USER/LOGNAME matching the session identity of a bridge child (root
+// when privileged, else the credentials launch_bridge() loaded for the
+// user). Returns -1 if env is full.
+static int bridge_identity_env(const struct auth_user *auth_user, int want_privileged,
+                               struct spawn_env *env)
+{
+  int rc = 0;
+  if (want_privileged)
+  {
+    rc |= spawn_env_set(env, "HOME", "/root");
+    rc |= spawn_env_set(env, "USER", "root");
+    rc |= spawn_env_set(env, "LOGNAME", "root");
+    return rc;
+  }
+
+  if (!auth_user)
+    return -1;
+  rc |= spawn_env_set(env, "HOME", auth_user->dir);
+  rc |= spawn_env_set(env, "USER", auth_user->name);
+  rc |= spawn_env_set(env, "LOGNAME", auth_user->name);
+  char xdg[64];
+  safe_snprintf(xdg, sizeof(xdg), "/run/user/%u", (unsigned)auth_user->uid);
+  rc |= spawn_env_set(env, "XDG_RUNTIME_DIR", xdg);
+  return rc;
+}
+
+// -------- bridge placement policy --------
+// Scheduling, CPU, I/O and memory placement for bridge children, set per
+// mode so a busy file-browser bridge does not compete with the services it
+// manages. Each knob is read from LINUXIO_AUTH_PRIV_BRIDGE_<KNOB> or
+// LINUXIO_AUTH_UNPRIV_BRIDGE_<KNOB>, falling back to
+// LINUXIO_AUTH_BRIDGE_<KNOB>; an unset knob leaves the bridge with what it
+// inherits from linuxio-auth. Everything is best effort: a bridge that can't
+// be placed still starts.
+//   SCHED          other, batch or idle
+//   NICE           -20..19
+//   CPUS           CPU affinity list, e.g. 0-3,6
+//   IOPRIO         idle, be:<0-7> or rt:<0-7>
+//   OOM_SCORE_ADJ  -1000..1000
+//   MEMORY_HIGH    bytes (K/M/G/T suffixes); runs each bridge in a transient
+//                  linuxio-bridge-<pid>.scope with that MemoryHigh=
+#define BRIDGE_POLICY_UNSET INT_MIN
+
+#ifndef IOPRIO_CLASS_SHIFT
+  #define IOPRIO_CLASS_SHIFT 13
+#endif
+#define IOPRIO_WHO_PROCESS 1
+
+struct bridge_policy
+{
+  int sched;              // SCHED_OTHER, SCHED_BATCH or SCHED_IDLE; -1 to inherit
+  int nice;               // BRIDGE_POLICY_UNSET to inherit
+  int ioprio;             // ioprio_set() value; -1 to inherit
+  int has_cpus;
+  cpu_set_t cpus;
+  char oom_score_adj[8];  // written to oom_score_adj as is; empty to inherit
+  uint64_t memory_high;   // 0 for no scope of its own
+};
+
+// [0] unprivileged bridges, [1] privileged ones
+static struct bridge_policy g_bridge_policy[2];
+
+// Name of the variable that sets knob for mode: the per-mode one if it is
+// set, else the shared one.
+static const char *bridge_policy_var(char *buf, size_t len, const char *mode, const char *knob)
+{
+  (void)safe_snprintf(buf, len, "LINUXIO_AUTH_%s_BRIDGE_%s", mode, knob);
+  const char *s = getenv(buf);
+  if (!s || !*s)
+    (void)safe_snprintf(buf, len, "LINUXIO_AUTH_BRIDGE_%s", knob);
+  return buf;
+}
+
+static int parse_cpu_list(const char *s, cpu_set_t *set)
+{
+  CPU_ZERO(set);
+  while (*s)
+  {
+    char *end = NULL;
+    unsigned long lo = strtoul(s, &end, 10);
+    unsigned long hi = lo;
+    if (end == s)
+      return -1;
+    if (*end == '-')
+    {
+      s = end + 1;
+      hi = strtoul(s, &end, 10);
+      if (end == s)
+        return -1;
+    }
+    if (lo > hi || hi >= CPU_SETSIZE)
+      return -1;
+    for (unsigned long cpu = lo; cpu <= hi; cpu++)
+      CPU_SET((int)cpu, set);
+    if (*end == ',')
+      end++;
+    else if (*end)
+      return -1;
+    s = end;
+  }
+  return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+static int parse_ioprio(const char *s)
+{
+  if (strcmp(s, "idle") == 0)
+    return 3 << IOPRIO_CLASS_SHIFT;
+  int class = strncmp(s, "rt:", 3) == 0 ? 1 : strncmp(s, "be:", 3) == 0 ? 2 : 0;
+  if (class == 0 || s[3] < '0' || s[3] > '7' || s[4] != '\0')
+    return -1;
+  return (class << IOPRIO_CLASS_SHIFT) | (s[3] - '0');
+}
+
+static uint64_t parse_memory_size(const char *s)
+{
+  char *end = NULL;
+  unsigned long long v = strtoull(s, &end, 10);
+  if (end == s)
+    return 0;
+  int shift = 0;
+  switch (*end)
+  {
+  case 'T': shift = 40; break;
+  case 'G': shift = 30; break;
+  case 'M': shift = 20; break;
+  case 'K': shift = 10; break;
+  case '\0': break;
+  default: return 0;
+  }
+  if (shift && end[1] != '\0')
+    return 0;
+  if (v > (UINT64_MAX >> shift))
+    return 0;
+  return (uint64_t)v << shift;
+}
+
+static void bridge_policy_load(struct bridge_policy *p, const char *mode)
+{
+  char name[64];
+
+  p->sched = -1;
+  const char *s = getenv(bridge_policy_var(name, sizeof(name), mode, "SCHED"));
+  if (s && *s)
+  {
+    if (strcmp(s, "other") == 0)
+      p->sched = SCHED_OTHER;
+    else if (strcmp(s, "batch") == 0)
+      p->sched = SCHED_BATCH;
+    else if (strcmp(s, "idle") == 0)
+      p->sched = SCHED_IDLE;
+    else
+      journal_errorf("unknown %s '%s', ignoring it", name, s);
+  }
+
+  p->nice = env_get_int(bridge_policy_var(name, sizeof(name), mode, "NICE"),
+                        BRIDGE_POLICY_UNSET, -20, 19);
+
+  s = getenv(bridge_policy_var(name, sizeof(name), mode, "CPUS"));
+  if (s && *s)
+  {
+    p->has_cpus = parse_cpu_list(s, &p->cpus) == 0;
+    if (!p->has_cpus)
+      journal_errorf("invalid %s '%s', ignoring it", name, s);
+  }
+
+  p->ioprio = -1;
+  s = getenv(bridge_policy_var(name, sizeof(name), mode, "IOPRIO"));
+  if (s && *s && (p->ioprio = parse_ioprio(s)) < 0)
+    journal_errorf("invalid %s '%s', ignoring it", name, s);
+
+  int oom = env_get_int(bridge_policy_var(name, sizeof(name), mode, "OOM_SCORE_ADJ"),
+                        BRIDGE_POLICY_UNSET, -1000, 1000);
+  if (oom != BRIDGE_POLICY_UNSET)
+    (void)safe_snprintf(p->oom_score_adj, sizeof(p->oom_score_adj), "%d", oom);
+
+  s = getenv(bridge_policy_var(name, sizeof(name), mode, "MEMORY_HIGH"));
+  if (s && *s && (p->memory_high = parse_memory_size(s)) == 0)
+    journal_errorf("invalid %s '%s', ignoring it", name, s);
+}
+
+// Called once at startup, before any bridge is spawned or parked.
+static void bridge_policy_init(void)
+{
+  bridge_policy_load(&g_bridge_policy[0], "UNPRIV");
+  bridge_policy_load(&g_bridge_policy[1], "PRIV");
+}
+
+// Scheduling, affinity and I/O priority of one thread (0: the caller).
+// Returns -1 if any of them could not be set.
+static int bridge_policy_apply_task(const struct bridge_policy *p, pid_t tid)
+{
+  int rc = 0;
+  if (p->sched >= 0)
+  {
+    struct sched_param param = {.sched_priority = 0};
+    if (sched_setscheduler(tid, p->sched, &param) != 0)
+      rc = -1;
+  }
+  if (p->nice != BRIDGE_POLICY_UNSET && setpriority(PRIO_PROCESS, (id_t)tid, p->nice) != 0)
+    rc = -1;
+  if (p->has_cpus && sched_setaffinity(tid, sizeof(p->cpus), &p->cpus) != 0)
+    rc = -1;
+  if (p->ioprio >= 0 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, p->ioprio) != 0)
+    rc = -1;
+  return rc;
+}
+
+static int bridge_policy_write_oom(const struct bridge_policy *p, const char *path)
+{
+  if (!p->oom_score_adj[0])
+    return 0;
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  int rc = write_all(fd, p->oom_score_adj, strlen(p->oom_score_adj));
+  close(fd);
+  return rc;
+}
+
+// Child side, still root and before exec, so threads the bridge starts
+// inherit the policy. Nothing here may allocate: the child shares our memory.
+static void bridge_policy_apply_self(const struct bridge_policy *p)
+{
+  (void)bridge_policy_apply_task(p, 0);
+  (void)bridge_policy_write_oom(p, "/proc/self/oom_score_adj");
+}
+
+// Apply the policy to a bridge that is already running (a parked one): every
+// thread it has gets the per-thread settings.
+static void bridge_policy_apply_pid(const struct bridge_policy *p, pid_t pid)
+{
+  char path[64];
+  int rc = 0;
+  if (p->sched >= 0 || p->nice != BRIDGE_POLICY_UNSET || p->has_cpus || p->ioprio >= 0)
+  {
+    (void)safe_snprintf(path, sizeof(path), "/proc/%ld/task", (long)pid);
+    DIR *dir = opendir(path);
+    struct dirent *de;
+    if (!dir)
+      rc = -1;
+    while (dir && (de = readdir(dir)) != NULL)
+    {
+      char *end = NULL;
+      long tid = strtol(de->d_name, &end, 10);
+      if (end != de->d_name && *end == '\0' && bridge_policy_apply_task(p, (pid_t)tid) != 0)
+        rc = -1;
+    }
+    if (dir)
+      closedir(dir);
+  }
+  (void)safe_snprintf(path, sizeof(path), "/proc/%ld/oom_score_adj", (long)pid);
+  if (bridge_policy_write_oom(p, path) != 0)
+    rc = -1;
+  if (rc != 0)
+    journal_errorf("failed to apply placement policy to parked bridge: %m");
+}
+
+// Run pid in a transient scope of its own with the policy's MemoryHigh=.
+// Returns 0 once systemd accepted the scope, -1 if the policy has none or it
+// could not be created (the bridge then stays where it is).
+static int bridge_scope_start(const struct bridge_policy *p, pid_t pid, const char *session_id,
+                              const char *user)
+{
+  if (p->memory_high == 0)
+    return -1;
+
+  char unit[64];
+  char desc[128];
+  (void)safe_snprintf(unit, sizeof(unit), "linuxio-bridge-%ld.scope", (long)pid);
+  (void)safe_snprintf(desc, sizeof(desc), "LinuxIO bridge of %s (session %s)", user, session_id);
+
+  sd_bus *bus = NULL;
+  sd_bus_error error = SD_BUS_ERROR_NULL;
+  sd_bus_message *reply = NULL;
+  int r = sd_bus_open_system(&bus);
+  if (r >= 0)
+    r = sd_bus_call_method(bus, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+                           "org.freedesktop.systemd1.Manager", "StartTransientUnit", &error, &reply,
+                           "ssa(sv)a(sa(sv))", unit, "fail", 4,
+                           "Description", "s", desc,
+                           "PIDs", "au", 1, (uint32_t)pid,
+                           "MemoryHigh", "t", p->memory_high,
+                           "CollectMode", "s", "inactive-or-failed",
+                           0);
+  if (r < 0)
+  {
+    const struct journal_field fields[] = {
+        {"LINUXIO_USER", user},
+    };
+    journal_error_fieldsf(fields, 1, "failed to start %s: %s", unit,
+                          error.message ? error.message : strerror(-r));
+  }
+  sd_bus_error_free(&error);
+  sd_bus_message_unref(reply);
+  sd_bus_flush_close_unref(bus);
+  return r < 0 ? -1 : 0;
+}
+
+// Everything a bridge child needs, prepared by the parent
+struct bridge_spawn
+{
+  int bootstrap_fd;   // becomes stdin: bootstrap pipe, or handoff socket when parked
+  int client_fd;      // becomes CLIENT_CONN_FD; -1 when parked
+  int exec_status_fd; // becomes EXEC_STATUS_FD; -1 when parked
+  int bridge_fd;      // becomes BRIDGE_FD
+  int reattach_fd;    // becomes PROTO_REATTACH_FD; -1 without one or when parked
+  const struct spawn_cred *cred;
+  const struct bridge_policy *policy; // NULL when parked: applied at handoff
+  const char *home;   // working directory, NULL to keep ours
+  char *const *envp;
+};
+
+// A bridge child failed before exec: send errno down the exec-status pipe
+// (at exec_status_fd, -1 when there is none) and exit. The parent then never
+// reads EOF, which only a successful exec produces, for a child that died in
+// setup.
+static __attribute__((noreturn)) void bridge_child_fail(int exec_status_fd)
+{
+  uint8_t err_byte = errno > 0 && errno <= UINT8_MAX ? (uint8_t)errno : (uint8_t)EIO;
+  if (exec_status_fd >= 0)
+  {
+    ssize_t wr = write(exec_status_fd, &err_byte, 1);
+    (void)wr; // Best-effort, we're exiting anyway
+  }
+  _exit(127);
+}
+
+// Child side of a bridge spawn: apply the placement policy, switch to the
+// session identity, close everything above BRIDGE_FD (PROTO_REATTACH_FD with
+// a re-attach socket) and exec the validated binary through BRIDGE_FD. Never
+// returns.
+static __attribute__((noreturn)) void bridge_child_exec(const struct bridge_spawn *sp)
+{
+  int status_fd = sp->exec_status_fd >= 0 ? EXEC_STATUS_FD : -1;
+  umask(077);
+
+  // While still root: a negative nice or oom_score_adj needs privileges
+  if (sp->policy)
+    bridge_policy_apply_self(sp->policy);
+  if (drop_to_user(sp->cred) != 0)
+    bridge_child_fail(status_fd);
+  if (sp->home && chdir(sp->home) != 0)
+    bridge_child_fail(status_fd);
+
+  // Close all file descriptors above the fixed layout set up above
+  // Uses close_range() syscall (Linux 5.9+) with fallback for older kernels
+#ifndef __NR_close_range
+  #define __NR_close_range 436
+#endif
+
+  int first_closed = sp->reattach_fd >= 0 ? PROTO_REATTACH_FD + 1 : BRIDGE_FD + 1;
+  if (syscall(__NR_close_range, first_closed, ~0U, 0) == -1 && errno == ENOSYS)
+  {
+    // Fallback: manual loop for older kernels without close_range
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    {
+      int max_fd = (rl.rlim_cur < 4096) ? (int)rl.rlim_cur : 4096;
+      for (int fd = first_closed; fd < max_fd; fd++)
+      {
+        (void)close(fd);
+      }
+    }
+  }
+
+  // Application config passed via binary bootstrap on stdin - minimal argv
+  const char *argv_child[] = {"linuxio-bridge", NULL};
+
+  // Mark BRIDGE_FD as close-on-exec so it doesn't leak into the bridge process
+  // (prevents "text file busy" on binary updates and avoids unnecessary FD leak)
+  // CLOEXEC only closes after successful exec, so execveat() still works.
+  {
+    int fdflags = fcntl(BRIDGE_FD, F_GETFD);
+    if (fdflags >= 0)
+      (void)fcntl(BRIDGE_FD, F_SETFD, fdflags | FD_CLOEXEC);
+  }
+
+  // Execute the validated bridge binary via fd (prevents TOCTOU)
+  // Try execveat first (Linux 3.19+); fallback to execv on ENOSYS
+#ifndef __NR_execveat
+  #define __NR_execveat 322
+#endif
+  long ret = syscall(__NR_execveat, BRIDGE_FD, "", ARGV_UNCONST(argv_child), sp->envp, AT_EMPTY_PATH);
+
+  // Fallback for kernels without execveat (< 3.19)
+  if (ret == -1 && errno == ENOSYS)
+  {
+    // Read the real path from /proc/self/fd/BRIDGE_FD
+    char fdpath[64], realpath_buf[PATH_MAX];
+    safe_snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%d", BRIDGE_FD);
+    ssize_t len = readlink(fdpath, realpath_buf, sizeof(realpath_buf) - 1);
+    if (len > 0)
+    {
+      realpath_buf[len] = '\0';
+      // Close bridge_fd before exec (no longer needed)
+      close(BRIDGE_FD);
+      // Use the real path we validated earlier
+      execve(realpath_buf, ARGV_UNCONST(argv_child), sp->envp);
+    }
+  }
+
+  // Exec failed - report it on the status pipe before exiting
+  // (if exec succeeded, CLOEXEC on FD 4 would have closed it)
+  bridge_child_fail(status_fd);
+}
+
+static int bridge_child_main(void *p)
+{
+  const struct bridge_spawn *sp = p;
+
+  // =========================================================================
+  // Child: Set up fixed FD layout before closing everything else
+  // Order matters to avoid overwriting FDs we still need
+  // =========================================================================
+
+  // Step 1: Move FDs to their fixed positions
+  // Use dup2 which is atomic and handles fd == newfd correctly
+
+  // Save the original FDs we need (they might be at any position)
+  int orig_client = sp->client_fd;
+  int orig_bootstrap = sp->bootstrap_fd;
+  int orig_exec_status = sp->exec_status_fd;
+  int orig_bridge = sp->bridge_fd;
+  int orig_reattach = sp->reattach_fd;
+
+  // First, move exec_status_fd, bridge_fd and the re-attach socket to high
+  // positions to avoid conflicts (in case any of them is already at 0-6).
+  // Plain dup() could hand back another slot in 0-6 that the steps below
+  // overwrite.
+  // Setup failures are reported on the exec-status pipe, wherever it is
+  int tmp_exec_status = -1, tmp_bridge = -1, tmp_reattach = orig_reattach;
+  int status_fd = orig_exec_status;
+
+  if (orig_exec_status >= 0 && orig_exec_status <= PROTO_REATTACH_FD)
+  {
+    tmp_exec_status = fcntl(orig_exec_status, F_DUPFD_CLOEXEC, PROTO_REATTACH_FD + 1);
+    if (tmp_exec_status < 0) bridge_child_fail(status_fd);
+    // Close original to avoid leaking extra copy of pipe write-end
+    close(orig_exec_status);
+    status_fd = tmp_exec_status;
+  }
+  else
+  {
+    tmp_exec_status = orig_exec_status;
+  }
+
+  if (orig_bridge >= 0 && orig_bridge <= PROTO_REATTACH_FD)
+  {
+    tmp_bridge = fcntl(orig_bridge, F_DUPFD, PROTO_REATTACH_FD + 1);
+    if (tmp_bridge < 0) bridge_child_fail(status_fd);
+    // Close original to avoid leaking extra FD
+    close(orig_bridge);
+  }
+  else
+  {
+    tmp_bridge = orig_bridge;
+  }
+
+  if (orig_reattach >= 0 && orig_reattach <= PROTO_REATTACH_FD)
+  {
+    tmp_reattach = fcntl(orig_reattach, F_DUPFD, PROTO_REATTACH_FD + 1);
+    if (tmp_reattach < 0) bridge_child_fail(status_fd);
+    close(orig_reattach);
+  }
+
+  // Step 2: Set up stdin (FD 0) from bootstrap pipe
+  // IMPORTANT: Do this before dup2'ing to FD 3, in case client_fd == 0
+  if (orig_client == STDIN_FILENO)
+  {
+    // client_fd is stdin - need to save it first
+    int saved_client = fcntl(orig_client, F_DUPFD, PROTO_REATTACH_FD + 1);
+    if (saved_client < 0) bridge_child_fail(status_fd);
+    orig_client = saved_client;
+  }
+
+  if (orig_bootstrap >= 0)
+  {
+    if (dup2(orig_bootstrap, STDIN_FILENO) < 0) bridge_child_fail(status_fd);
+    if (orig_bootstrap != STDIN_FILENO) close(orig_bootstrap);
+  }
+
+  // Step 3: Set up stdout (FD 1) as dup of stderr
+  if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0) bridge_child_fail(status_fd);
+
+  // Step 4: Set up client connection at FD 3
+  if (orig_client >= 0 && orig_client != CLIENT_CONN_FD)
+  {
+    if (dup2(orig_client, CLIENT_CONN_FD) < 0) bridge_child_fail(status_fd);
+    close(orig_client);
+  }
+
+  // Step 5: Set up exec_status_fd at FD 4 (keep CLOEXEC)
+  if (tmp_exec_status >= 0 && tmp_exec_status != EXEC_STATUS_FD)
+  {
+    if (dup2(tmp_exec_status, EXEC_STATUS_FD) < 0) bridge_child_fail(status_fd);
+    close(tmp_exec_status);
+    status_fd = EXEC_STATUS_FD;
+    // Restore CLOEXEC on the new FD
+    {
+      int fdflags = fcntl(EXEC_STATUS_FD, F_GETFD);
+      if (fdflags >= 0)
+        (void)fcntl(EXEC_STATUS_FD, F_SETFD, fdflags | FD_CLOEXEC);
+    }
+  }
+  else if (tmp_exec_status == EXEC_STATUS_FD)
+  {
+    // Already at right position, just ensure CLOEXEC
+    {
+      int fdflags = fcntl(EXEC_STATUS_FD, F_GETFD);
+      if (fdflags >= 0)
+        (void)fcntl(EXEC_STATUS_FD, F_SETFD, fdflags | FD_CLOEXEC);
+    }
+  }
+
+  // Step 6: Set up bridge_fd at FD 5
+  if (tmp_bridge >= 0 && tmp_bridge != BRIDGE_FD)
+  {
+    if (dup2(tmp_bridge, BRIDGE_FD) < 0) bridge_child_fail(status_fd);
+    close(tmp_bridge);
+  }
+
+  // Step 7: Set up the re-attach socket at FD 6 (dup2 clears CLOEXEC)
+  if (tmp_reattach >= 0)
+  {
+    if (dup2(tmp_reattach, PROTO_REATTACH_FD) < 0) bridge_child_fail(status_fd);
+    close(tmp_reattach);
+  }
+
+  // Now we have:
+  // 0 = stdin (bootstrap)
+  // 1 = stdout (-> stderr)
+  // 2 = stderr
+  // 3 = client connection
+  // 4 = exec_status_fd (CLOEXEC)
+  // 5 = bridge_fd
+  // 6 = re-attach socket, if any
+
+  // Clear socket timeouts on the client connection (FD 3)
+  // These were set for the auth request phase but would cause problems
+  // for the long-lived Yamux connection (idle timeouts, EAGAIN, etc.)
+  {
+    struct timeval tv_zero = {.tv_sec = 0, .tv_usec = 0};
+    (void)setsockopt(CLIENT_CONN_FD, SOL_SOCKET, SO_RCVTIMEO, &tv_zero, sizeof(tv_zero));
+    (void)setsockopt(CLIENT_CONN_FD, SOL_SOCKET, SO_SNDTIMEO, &tv_zero, sizeof(tv_zero));
+  }
+
+  // Application config is passed via binary bootstrap on stdin.
+  bridge_child_exec(sp);
+}
+
+// Start the bridge child for a login. Returns 0 with the child in *out once
+// it has exec'd (or failed to; see the exec-status pipe), -1 otherwise.
+static int spawn_bridge_process(
+    const struct auth_user *auth_user,
+    int want_privileged,
+    const struct spawn_cred *cred,  // root when privileged, else the user's
+    int bridge_fd,
+    int bootstrap_pipe_read,  // Pipe read end for bootstrap binary (will be stdin)
+    int client_fd,            // Client connection FD (will be dup'd to FD 3 for Yamux)
+    int exec_status_fd,       // Write end of exec-status pipe (CLOEXEC) - write on exec failure
+    int reattach_fd,          // Bridge end of the re-attach socket (FD 6), -1 if it has none
+    struct child_proc *out)
+{
+  struct spawn_env env;
+  int rc = -1;
+  int env_rc = bridge_environment(&env);
+  if (env_rc == 0 && reattach_fd >= 0 && g_reattach.ticket[0])
+  {
+    char grace[16];
+    (void)safe_snprintf(grace, sizeof(grace), "%d", g_reattach.grace_ms);
+    env_rc = spawn_env_set(&env, PROTO_REATTACH_ENV, grace);
+  }
+  if (env_rc == 0 && reattach_fd >= 0 && g_reattach.share_bridge)
+    env_rc = spawn_env_set(&env, PROTO_SHARED_ENV, "1");
+  if (env_rc == 0 && bridge_identity_env(auth_user, want_privileged, &env) == 0)
+  {
+    struct bridge_spawn sp = {
+        .bootstrap_fd = bootstrap_pipe_read,
+        .client_fd = client_fd,
+        .exec_status_fd = exec_status_fd,
+        .bridge_fd = bridge_fd,
+        .reattach_fd = reattach_fd,
+        .cred = cred,
+        .policy = &g_bridge_policy[want_privileged ? 1 : 0],
+        .home = want_privileged ? NULL : auth_user->dir,
+        .envp = env.vars,
+    };
+    rc = spawn_child(bridge_child_main, &sp, out);
+  }
+  return rc;
+}
+
+// -------- parked bridge (opt-in, daemon mode) --------
+// With LINUXIO_AUTH_PARK_BRIDGE=1 every idle daemon worker execs one bridge
+// ahead of time, so the Go binary is loaded and its runtime started before a
+// login arrives. The parked bridge runs as root with a SOCK_SEQPACKET socket
+// on stdin and no client connection. On login the worker validates that the
+// bridge binary is still the one parked, moves the bridge into its own (PAM
+// session) cgroup and sends the handoff described in linuxio_protocol.h with
+// the client connection attached. The bridge drops to the user before it
+// touches the connection and acknowledges with one status byte. Any failure
+// discards the parked bridge and falls back to fork+exec.
+struct parked_bridge
+{
+  struct child_proc proc;
+  int ctl_fd; // our end of the handoff socket, -1 when nothing is parked
+  dev_t dev;  // identity of the binary it was exec'd from
+  ino_t ino;
+};
+
+static struct parked_bridge g_parked = {.proc = {.pid = -1, .pidfd = -1}, .ctl_fd = -1};
+
+#define PARKED_HANDOFF_MAX_SIZE \
+  (BOOTSTRAP_MAX_SIZE + 2 + MAX_PATH_LEN + 4 + 2 + 4 * PROTO_PARKED_MAX_GROUPS)
+
+static void parked_bridge_discard(void)
+{
+  if (g_parked.ctl_fd >= 0)
+    close(g_parked.ctl_fd);
+  g_parked.ctl_fd = -1;
+  if (g_parked.proc.pid > 0)
+    child_kill_and_reap(&g_parked.proc);
+  child_release(&g_parked.proc);
+}
+
+static int parked_child_main(void *p)
+{
+  const struct bridge_spawn *sp = p;
+
+  // 0 = handoff socket, 1 = stdout (-> stderr), 2 = stderr, 5 = bridge_fd.
+  // FDs 3 and 4 stay empty; the bridge installs the client at FD 3 itself.
+  int ctl = fcntl(sp->bootstrap_fd, F_DUPFD, BRIDGE_FD + 1);
+  int bfd = fcntl(sp->bridge_fd, F_DUPFD, BRIDGE_FD + 1);
+  if (ctl < 0 || bfd < 0)
+    _exit(127);
+  if (dup2(ctl, STDIN_FILENO) < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 ||
+      dup2(bfd, BRIDGE_FD) < 0)
+    _exit(127);
+  (void)close(CLIENT_CONN_FD);
+  (void)close(EXEC_STATUS_FD);
+
+  bridge_child_exec(sp);
+}
+
+static void parked_bridge_spawn(void)
+{
+  int bridge_fd = -1;
+  if (acquire_bridge_fd(&bridge_fd) != 0)
+    return;
+
+  struct stat st;
+  int sv[2] = {-1, -1};
+  if (fstat(bridge_fd, &st) != 0 ||
+      socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0)
+  {
+    close(bridge_fd);
+    return;
+  }
+
+  struct spawn_env env;
+  struct spawn_cred cred;
+  spawn_cred_root(&cred);
+  int rc = -1;
+  // Whether a login brings a re-attach socket is only known at handoff
+  char grace[16];
+  (void)safe_snprintf(grace, sizeof(grace), "%d", g_reattach.grace_ms);
+  if (bridge_environment(&env) == 0 && spawn_env_set(&env, PROTO_PARKED_ENV, "1") == 0 &&
+      (g_reattach.grace_ms == 0 || spawn_env_set(&env, PROTO_REATTACH_ENV, grace) == 0) &&
+      (!g_reattach.share_bridge || spawn_env_set(&env, PROTO_SHARED_ENV, "1") == 0) &&
+      bridge_identity_env(NULL, 1, &env) == 0)
+  {
+    struct bridge_spawn sp = {
+        .bootstrap_fd = sv[1],
+        .client_fd = -1,
+        .exec_status_fd = -1,
+        .bridge_fd = bridge_fd,
+        .reattach_fd = -1,
+        .cred = &cred,
+        .policy = NULL,
+        .home = NULL,
+        .envp = env.vars,
+    };
+    rc = spawn_child(parked_child_main, &sp, &g_parked.proc);
+  }
+  spawn_cred_free(&cred);
+
+  close(sv[1]);
+  close(bridge_fd);
+  if (rc != 0)
+  {
+    close(sv[0]);
+    return;
+  }
+  g_parked.ctl_fd = sv[0];
+  g_parked.dev = st.st_dev;
+  g_parked.ino = st.st_ino;
+}
+
+// Audit login uid set by pam_loginuid for this process, or
+// PROTO_PARKED_NO_LOGINUID. A parked bridge was forked before the session
+// opened, so it has to be told.
+static uint32_t read_self_loginuid(void)
+{
+  char buf[16] = "";
+  int fd = open("/proc/self/loginuid", O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return PROTO_PARKED_NO_LOGINUID;
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return PROTO_PARKED_NO_LOGINUID;
+  buf[n] = '\0';
+  char *end = NULL;
+  unsigned long v = strtoul(buf, &end, 10);
+  if (end == buf || v > 0xFFFFFFFFul)
+    return PROTO_PARKED_NO_LOGINUID;
+  return (uint32_t)v;
+}
+
+// Move pid into this process's cgroup (the PAM session scope once
+// pam_open_session() ran), where a freshly forked bridge would have started.
+static void adopt_into_own_cgroup(pid_t pid)
+{
+  char line[PATH_MAX];
+  char path[PATH_MAX + 64];
+  FILE *f = fopen("/proc/self/cgroup", "re");
+  if (!f)
+    return;
+  int found = 0;
+  while (fgets(line, sizeof(line), f))
+  {
+    if (strncmp(line, "0::", 3) == 0)
+    {
+      line[strcspn(line, "\n")] = '\0';
+      found = safe_snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cgroup.procs", line + 3) > 0;
+      break;
+    }
+  }
+  fclose(f);
+  if (!found)
+    return;
+
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  char pidbuf[32];
+  int n = safe_snprintf(pidbuf, sizeof(pidbuf), "%ld", (long)pid);
+  if (n <= 0 || write_all(fd, pidbuf, (size_t)n) != 0)
+    journal_errorf("failed to move parked bridge into session cgroup: %m");
+  close(fd);
+}
+
+// Give the parked bridge our resource limits, which pam_open_session() (and
+// pam_limits in it) just set for the user: an exec'd bridge inherits them.
+// The soft RLIMIT_NOFILE goes up to the hard one, as the Go runtime of an
+// exec'd bridge raises it at start-up. Returns -1 if one could not be set.
+static int parked_bridge_copy_rlimits(pid_t pid)
+{
+  for (int r = 0; r < RLIMIT_NLIMITS; r++)
+  {
+    struct rlimit rl;
+    if (getrlimit(r, &rl) != 0)
+      continue; // unknown to this kernel
+    if (r == RLIMIT_NOFILE)
+      rl.rlim_cur = rl.rlim_max;
+    if (prlimit(pid, r, &rl, NULL) != 0)
+    {
+      journal_errorf("failed to set resource limit %d of parked bridge: %m", r);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Hand the login to the parked bridge. Returns 0 with the bridge in *out,
+// or -1 (nothing parked, or handoff failed) to fall back to fork+exec.
+static int parked_bridge_handoff(
+    const struct auth_user *auth_user,
+    int want_privileged,
+    int verbose_flag,
+    const char *session_id,
+    const struct bootstrap_ext *ext,
+    int bridge_fd,
+    int client_fd,
+    int reattach_fd,
+    struct child_proc *out)
+{
+  if (g_parked.ctl_fd < 0)
+    return -1;
+
+  // The binary must not have changed since the bridge was parked.
+  struct stat st;
+  if (fstat(bridge_fd, &st) != 0 || st.st_dev != g_parked.dev || st.st_ino != g_parked.ino)
+  {
+    parked_bridge_discard();
+    return -1;
+  }
+
+  static uint8_t msg[PARKED_HANDOFF_MAX_SIZE];
+  ssize_t n = encode_bootstrap_binary(msg, sizeof(msg), session_id, auth_user->name,
+                                      auth_user->uid, auth_user->gid, verbose_flag,
+                                      want_privileged, ext);
+  size_t pos = n < 0 ? 0 : (size_t)n;
+
+  gid_t *groups = NULL;
+  int ngroups = 0;
+  if (n >= 0 && !want_privileged)
+    ngroups = load_user_groups(auth_user->name, auth_user->gid, &groups);
+
+  int ok = n >= 0 && ngroups >= 0 && ngroups <= PROTO_PARKED_MAX_GROUPS &&
+           put_lenstr(msg, sizeof(msg), &pos, want_privileged ? "/root" : auth_user->dir) == 0;
+  if (ok)
+  {
+    write_u32_be(msg + pos, read_self_loginuid());
+    pos += 4;
+    write_u16_be(msg + pos, (uint16_t)ngroups);
+    pos += 2;
+    for (int i = 0; i < ngroups; i++, pos += 4)
+      write_u32_be(msg + pos, (uint32_t)groups[i]);
+  }
+  free(groups);
+  // No login may run under the daemon's limits instead of the user's
+  if (!ok || parked_bridge_copy_rlimits(g_parked.proc.pid) != 0)
+  {
+    parked_bridge_discard();
+    return -1;
+  }
+
+  // The bridge was parked before its mode was known
+  const struct bridge_policy *policy = &g_bridge_policy[want_privileged ? 1 : 0];
+  bridge_policy_apply_pid(policy, g_parked.proc.pid);
+  if (bridge_scope_start(policy, g_parked.proc.pid, session_id, auth_user->name) != 0)
+    adopt_into_own_cgroup(g_parked.proc.pid);
+
+  // The re-attach socket, if any, rides along as a second fd
+  int fds[2] = {client_fd, reattach_fd};
+  size_t nfds = reattach_fd >= 0 ? 2 : 1;
+  struct iovec iov = {.iov_base = msg, .iov_len = pos};
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } ctrl;
+  memset(&ctrl, 0, sizeof(ctrl));
+  struct msghdr mh = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = ctrl.buf,
+      .msg_controllen = CMSG_SPACE(sizeof(int) * nfds)};
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+  memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+
+  ssize_t sent;
+  do
+  {
+    sent = sendmsg(g_parked.ctl_fd, &mh, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+
+  uint8_t status = PROTO_PARKED_STATUS_FAILED;
+  ssize_t got = -1;
+  if (sent == (ssize_t)pos)
+  {
+    uint64_t deadline = login_deadline_clamp(monotonic_ms() + BRIDGE_START_TIMEOUT_MS);
+    struct pollfd pfd = {.fd = g_parked.ctl_fd, .events = POLLIN, .revents = 0};
+    int pr;
+    do
+    {
+      pr = poll(&pfd, 1, deadline_remaining_ms(deadline));
+    } while (pr < 0 && errno == EINTR);
+    if (pr > 0)
+      got = read(g_parked.ctl_fd, &status, 1);
+  }
+  secure_bzero(msg, pos);
+
+  if (got != 1 || status != PROTO_PARKED_STATUS_OK)
+  {
+    const struct journal_field fields[] = {
+        {"LINUXIO_USER", auth_user->name},
+    };
+    journal_error_fieldsf(fields, 1, "parked bridge handoff failed; spawning a fresh bridge");
+    parked_bridge_discard();
+    return -1;
+  }
+
+  close(g_parked.ctl_fd);
+  g_parked.ctl_fd = -1;
+  *out = g_parked.proc;
+  g_parked.proc.pid = -1;
+  g_parked.proc.pidfd = -1;
+  return 0;
+}
+
+// Create the exec-status pipe with CLOEXEC on the write end:
+// - On successful exec, CLOEXEC closes the write end -> parent sees EOF
+// - On exec failure, child writes error byte -> parent sees data
+static int exec_status_pipe_open(int exec_status_pipe[2])
+{
+  exec_status_pipe[0] = exec_status_pipe[1] = -1;
+#if defined(HAVE_PIPE2) || (defined(__linux__) && defined(O_CLOEXEC))
+  return pipe2(exec_status_pipe, O_CLOEXEC);
+#else
+  if (pipe(exec_status_pipe) != 0)
+    return -1;
+  // Set CLOEXEC on write end only (child writes on failure, exec closes it on success)
+  int fdflags = fcntl(exec_status_pipe[1], F_GETFD);
+  if (fdflags >= 0)
+    (void)fcntl(exec_status_pipe[1], F_SETFD, fdflags | FD_CLOEXEC);
+  return 0;
+#endif
+}
+
+// Start the bridge for this login: hand it to the parked bridge if there is
+// one, otherwise spawn it with the bootstrap on its stdin and wait for
+// the exec-status pipe. Takes ownership of bridge_fd and both pipes. Returns
+// 0 once the bridge is running (child in *out), or -1 with *err_msg set.
+static int launch_bridge(
+    const struct auth_user *auth_user,
+    int want_privileged,
+    int verbose_flag,
+    const char *session_id,
+    const char *priv_source,
+    int bridge_fd,
+    int bootstrap_pipe[2],
+    int exec_status_pipe[2],
+    int client_fd,
+    int reattach_fd,
+    struct child_proc *out,
+    const char **err_msg)
+{
+  // A spawned bridge also gets its group list below; a parked one receives
+  // it in the handoff
+  struct bootstrap_ext ext = {
+      .home = auth_user->dir,
+      .ngroups = -1,
+      .priv_source = priv_source,
+      .requested_us = g_timing.requested_us,
+      .authenticated_us = g_timing.authenticated_us,
+  };
+
+  // A parked handoff stands in for fork + exec; it is charged to exec
+  uint64_t t_phase = monotonic_us();
+  if (parked_bridge_handoff(auth_user, want_privileged, verbose_flag, session_id, &ext,
+                            bridge_fd, client_fd, reattach_fd, out) == 0)
+  {
+    login_timing_record(PROTO_PHASE_EXEC, t_phase);
+    close(bootstrap_pipe[0]);
+    close(bootstrap_pipe[1]);
+    close(exec_status_pipe[0]);
+    close(exec_status_pipe[1]);
+    close(bridge_fd);
+    return 0;
+  }
+
+  // The group list the bridge will run with also goes into the bootstrap
+  struct spawn_cred cred;
+  spawn_cred_root(&cred);
+  if (!want_privileged && spawn_cred_load(&cred, auth_user) != 0)
+  {
+    spawn_cred_free(&cred);
+    close(bootstrap_pipe[0]);
+    close(bootstrap_pipe[1]);
+    close(exec_status_pipe[0]);
+    close(exec_status_pipe[1]);
+    close(bridge_fd);
+    METRICS_ADD(bridge_exec_failures, 1);
+    *err_msg = "failed to spawn bridge";
+    return -1;
+  }
+  if (!want_privileged)
+  {
+    ext.groups = cred.groups;
+    ext.ngroups = cred.ngroups;
+  }
+
+  // Queue the binary bootstrap before spawning, then close to signal EOF. It
+  // is far below the pipe capacity, so this never blocks, and a child that
+  // dies during setup can't SIGPIPE us.
+  int rc_bootstrap = write_bootstrap_binary(
+      bootstrap_pipe[1],
+      session_id,
+      auth_user->name,
+      auth_user->uid,
+      auth_user->gid,
+      verbose_flag,
+      want_privileged,
+      &ext);
+  close(bootstrap_pipe[1]);
+
+  if (rc_bootstrap != 0)
+  {
+    spawn_cred_free(&cred);
+    const struct journal_field fields[] = {
+        {"LINUXIO_USER", auth_user->name},
+    };
+    journal_error_fieldsf(fields, 1, "failed to write bootstrap to pipe");
+    close(bootstrap_pipe[0]);
+    close(exec_status_pipe[0]);
+    close(exec_status_pipe[1]);
+    close(bridge_fd);
+    *err_msg = "bootstrap communication failed";
+    return -1;
+  }
+
+  t_phase = monotonic_us();
+  int rc_spawn = spawn_bridge_process(
+      auth_user,
+      want_privileged,
+      &cred,
+      bridge_fd,
+      bootstrap_pipe[0],    // Pass pipe read end to child (will be stdin)
+      client_fd,            // Pass client connection FD (will be dup'd to FD 3 for Yamux)
+      exec_status_pipe[1],  // Write end of exec-status pipe (CLOEXEC)
+      reattach_fd,          // Bridge end of the re-attach socket, -1 if it has none
+      out);
+  spawn_cred_free(&cred);
+
+  // Parent: close pipe read end and exec-status write end (child has them)
+  close(bootstrap_pipe[0]);
+  close(exec_status_pipe[1]);
+
+  if (rc_spawn != 0)
+  {
+    close(exec_status_pipe[0]);
+    close(bridge_fd);
+    METRICS_ADD(bridge_exec_failures, 1);
+    *err_msg = "failed to spawn bridge";
+    return -1;
+  }
+
+  login_timing_record(PROTO_PHASE_FORK, t_phase);
+
+  // Close bridge_fd - the child has its own copy
+  close(bridge_fd);
+
+  // Wait for exec-status: EOF means exec succeeded, data means exec failed.
+  // This ensures we don't send OK until the bridge binary has actually started.
+  int exec_status_fd = exec_status_pipe[0];
+  int exec_status_sel = -1;
+  uint64_t exec_deadline = login_deadline_clamp(monotonic_ms() + BRIDGE_START_TIMEOUT_MS);
+  t_phase = monotonic_us();
+  for (;;)
+  {
+    struct pollfd pfd = {
+        .fd = exec_status_fd,
+        .events = POLLIN,
+        .revents = 0};
+
+    exec_status_sel = poll(&pfd, 1, deadline_remaining_ms(exec_deadline));
+    if (exec_status_sel < 0 && errno == EINTR)
+      continue;
+    break;
+  }
+
+  if (exec_status_sel == 0)
+  {
+    const struct journal_field fields[] = {
+        {"LINUXIO_USER", auth_user->name},
+    };
+    if (login_deadline_passed())
+    {
+      journal_error_fieldsf(fields, 1, "bridge exec ran past the login deadline");
+    }
+    else
+    {
+      journal_error_fieldsf(fields, 1, "bridge exec timed out after %d ms", BRIDGE_START_TIMEOUT_MS);
+      METRICS_ADD(bridge_start_timeouts, 1);
+    }
+    close(exec_status_fd);
+    child_kill_and_reap(out);
+    child_release(out);
+    *err_msg = "bridge start timeout";
+    return -1;
+  }
+
+  if (exec_status_sel < 0)
+  {
+    const struct journal_field fields[] = {
+        {"LINUXIO_USER", auth_user->name},
+    };
+    journal_error_fieldsf(fields, 1, "exec-status wait failed: %m");
+    close(exec_status_fd);
+    child_kill_and_reap(out);
+    child_release(out);
+    *err_msg = "bridge exec status failed";
+    return -1;
+  }
+
+  uint8_t exec_status_byte = 0;
+  ssize_t exec_status_n = -1;
+  do
+  {
+    exec_status_n = read(exec_status_fd, &exec_status_byte, 1);
+  } while (exec_status_n < 0 && errno == EINTR);
+  close(exec_status_fd);
+  login_timing_record(PROTO_PHASE_EXEC, t_phase);
+
+  if (exec_status_n > 0)
+  {
+    // Child wrote the errno of its fd setup, privilege drop or exec
+    char status_buf[16];
+    (void)safe_snprintf(status_buf, sizeof(status_buf), "%u", (unsigned)exec_status_byte);
+    const struct journal_field fields[] = {
+        {"LINUXIO_USER", auth_user->name},
+        {"LINUXIO_STATUS", status_buf},
+    };
+    errno = exec_status_byte;
+    journal_error_fieldsf(fields, 2, "bridge exec failed: %m");
+    METRICS_ADD(bridge_exec_failures, 1);
+    *err_msg = "bridge exec failed";
+    // Child already exited, but wait to reap
+    {
+      int ignored = 0;
+      (void)child_wait_until(out, &ignored, 0);
+    }
+    child_release(out);
+    return -1;
+  }
+  // exec_status_n == 0 means EOF = exec succeeded (CLOEXEC closed the pipe)
+  // exec_status_n < 0 is read error, but exec likely succeeded anyway
+
+  (void)bridge_scope_start(&g_bridge_policy[want_privileged ? 1 : 0], out->pid, session_id,
+                           auth_user->name);
+  return 0;
+}
+
+// Log how a login's bridge ended. Returns the matching exit code (the
+// status of a clean exit, 128 + signal otherwise).
+static int log_bridge_exit(const char *user, pid_t pid, int status)
+{
+  char exit_buf[32];
+  char pid_buf[32];
+  (void)safe_snprintf(pid_buf, sizeof(pid_buf), "%ld", (long)pid);
+
+  if (WIFEXITED(status))
+  {
+    int exitcode = WEXITSTATUS(status);
+    if (exitcode != 0)
+    {
+      (void)safe_snprintf(exit_buf, sizeof(exit_buf), "%d", exitcode);
+      const struct journal_field fields[] = {
+          {"LINUXIO_USER", user},
+          {"LINUXIO_STATUS", exit_buf},
+          {"LINUXIO_CHILD_PID", pid_buf},
+      };
+      journal_error_fieldsf(fields, 3, "bridge pid %ld exited with status %d", (long)pid, exitcode);
+    }
+    return exitcode;
+  }
+  if (WIFSIGNALED(status))
+  {
+    int sig = WTERMSIG(status);
+    int exitcode = 128 + sig;
+    char signal_buf[32];
+    (void)safe_snprintf(exit_buf, sizeof(exit_buf), "%d", exitcode);
+    (void)safe_snprintf(signal_buf, sizeof(signal_buf), "%d", sig);
+    const struct journal_field fields[] = {
+        {"LINUXIO_USER", user},
+        {"LINUXIO_STATUS", exit_buf},
+        {"LINUXIO_SIGNAL", signal_buf},
+        {"LINUXIO_CHILD_PID", pid_buf},
+    };
+    journal_error_fieldsf(fields, 4, "bridge pid %ld killed by signal %d", (long)pid, sig);
+    return exitcode;
+  }
+  return 1;
+}
+
+// -------- session supervisor handoff (daemon mode) --------
+// With LINUXIO_AUTH_SUPERVISE=1 a daemon worker does not stay resident for
+// the lifetime of its login. Once the bridge runs it sends a session_record
+// to the daemon, together with the bridge pidfd and the FIFOs PAM modules
+// keep open for the session (pam_systemd's session reference), and exits
+// without closing the PAM session. The daemon is a child subreaper, so the
+// bridge becomes its child; when it exits the daemon records the logout
+// and closes the PAM session from a fresh handle. If the handoff can't be
+// sent the worker supervises the bridge itself, as before.
+//
+// The same socket carries re-attach requests: the worker sends the ticket
+// with a reply socket attached, and the daemon answers with the session's
+// identity, the next ticket and a copy of the bridge's re-attach socket.
+// The worker then hands the client over itself, so the daemon never waits
+// on a bridge. A session it attached to a shared bridge is announced with
+// the reply socket of that attach, which the bridge closes once the session
+// ended; the daemon lists the session in the session table until then.
+#define SESSION_MAX_HELD_FDS      8
+#define SESSION_MAX_XDG_ID        64
+#define REATTACH_REPLY_TIMEOUT_MS 2000
+
+enum supervisor_msg_kind
+{
+  SUPERVISOR_MSG_SESSION = 1, // session_record + pidfd, re-attach socket, FIFOs
+  SUPERVISOR_MSG_REATTACH,    // reattach_request + reply socket
+  SUPERVISOR_MSG_ATTACH,      // attach_query + reply socket
+  SUPERVISOR_MSG_ATTACHED,    // attached_session + the attach's reply socket
+};
+
+struct session_record
+{
+  int kind;        // SUPERVISOR_MSG_SESSION
+  pid_t bridge_pid;
+  pid_t login_pid; // the worker: utmp ut_id/ut_pid of the login
+  uid_t uid;
+  gid_t gid;
+  uint8_t mode;    // PROTO_MODE_*
+  int table_slot;  // the live session table slot, -1 if not listed
+  int has_pidfd;   // first attached fd is the bridge pidfd
+  int has_reattach; // next attached fd is the bridge's re-attach socket
+  char user[PROTO_MAX_USERNAME];
+  char remote_host[PROTO_MAX_REMOTE_HOST];
+  char xdg_session_id[SESSION_MAX_XDG_ID];
+  char session_id[PROTO_MAX_SESSION_ID];
+  char ticket[PROTO_TICKET_HEX_LEN + 1];
+};
+
+struct reattach_request
+{
+  int kind;    // SUPERVISOR_MSG_REATTACH
+  int release; // drop the ticket and re-attach socket instead
+  char user[PROTO_MAX_USERNAME];
+  char session_id[PROTO_MAX_SESSION_ID];
+  char ticket[PROTO_TICKET_HEX_LEN + 1];
+};
+
+struct reattach_reply
+{
+  int ok;
+  uid_t uid;
+  gid_t gid;
+  uint8_t mode;
+  char ticket[PROTO_TICKET_HEX_LEN + 1]; // replaces the one presented
+};
+
+// Which shared bridges of a user the daemon holds the re-attach socket of
+struct attach_query
+{
+  int kind; // SUPERVISOR_MSG_ATTACH
+  int mode; // PROTO_MODE_* of the bridge wanted; -1 to only ask for modes
+  uid_t uid;
+  char user[PROTO_MAX_USERNAME];
+};
+
+struct attach_reply
+{
+  unsigned modes;   // (1 << PROTO_MODE_*) for each mode there is a bridge in
+  pid_t bridge_pid; // of the bridge whose re-attach socket came along
+};
+
+// A session the worker attached to the shared bridge bridge_pid
+struct attached_session
+{
+  int kind; // SUPERVISOR_MSG_ATTACHED
+  pid_t bridge_pid;
+  char session_id[PROTO_MAX_SESSION_ID];
+};
+
+union supervisor_msg
+{
+  int kind;
+  struct session_record session;
+  struct reattach_request reattach;
+  struct attach_query attach;
+  struct attached_session attached;
+};
+
+static int g_supervisor_fd = -1; // worker end of the daemon's handoff socket
+
+// FIFOs opened by PAM modules during pam_open_session(). Closing the last
+// copy tells logind the session is going away, so they travel with it.
+static int collect_session_fifos(int *fds, int max, int skip_fd)
+{
+  DIR *d = opendir("/proc/self/fd");
+  if (!d)
+    return 0;
+  int n = 0;
+  const struct dirent *de;
+  while (n < max && (de = readdir(d)) != NULL)
+  {
+    char *end = NULL;
+    long fd = strtol(de->d_name, &end, 10);
+    if (!end || *end != '\0' || fd <= STDERR_FILENO || fd == dirfd(d) ||
+        fd == g_supervisor_fd || fd == skip_fd)
+      continue;
+    struct stat st;
+    if (fstat((int)fd, &st) == 0 && S_ISFIFO(st.st_mode))
+      fds[n++] = (int)fd;
+  }
+  closedir(d);
+  return n;
+}
+
+// Hand the running session to the daemon. Returns 0 if it took over.
+// reattach_fd is our end of the bridge's re-attach socket (-1 if the login
+// got no ticket); it is closed either way.
+static int supervisor_register(pam_handle_t *pamh, const struct auth_user *auth_user,
+                               const char *remote_host, const char *session_id, uint8_t mode,
+                               const struct child_proc *bridge, int reattach_fd)
+{
+  if (g_supervisor_fd < 0)
+  {
+    if (reattach_fd >= 0)
+      close(reattach_fd);
+    return -1;
+  }
+
+  struct session_record rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.kind = SUPERVISOR_MSG_SESSION;
+  rec.bridge_pid = bridge->pid;
+  rec.login_pid = getpid();
+  rec.uid = auth_user->uid;
+  rec.gid = auth_user->gid;
+  rec.mode = mode;
+  rec.table_slot = g_session_slot;
+  rec.has_pidfd = bridge->pidfd >= 0;
+  rec.has_reattach = reattach_fd >= 0;
+  copy_fixed_field(rec.user, sizeof(rec.user), auth_user->name);
+  copy_fixed_field(rec.remote_host, sizeof(rec.remote_host), remote_host);
+  copy_fixed_field(rec.session_id, sizeof(rec.session_id), session_id);
+  if (rec.has_reattach)
+    memcpy(rec.ticket, g_reattach.ticket, sizeof(rec.ticket));
+  const char *xdg_id = pam_getenv(pamh, "XDG_SESSION_ID");
+  if (xdg_id)
+    copy_fixed_field(rec.xdg_session_id, sizeof(rec.xdg_session_id), xdg_id);
+
+  int fds[2 + SESSION_MAX_HELD_FDS];
+  int nfds = 0;
+  if (rec.has_pidfd)
+    fds[nfds++] = bridge->pidfd;
+  if (rec.has_reattach)
+    fds[nfds++] = reattach_fd;
+  nfds += collect_session_fifos(fds + nfds, SESSION_MAX_HELD_FDS, bridge->pidfd);
+
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } ctrl;
+  memset(&ctrl, 0, sizeof(ctrl));
+  struct iovec iov = {.iov_base = &rec, .iov_len = sizeof(rec)};
+  struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1};
+  if (nfds > 0)
+  {
+    mh.msg_control = ctrl.buf;
+    mh.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)nfds);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)nfds);
+    memcpy(CMSG_DATA(cm), fds, sizeof(int) * (size_t)nfds);
+  }
+
+  ssize_t sent;
+  do
+  {
+    sent = sendmsg(g_supervisor_fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  secure_bzero(rec.ticket, sizeof(rec.ticket));
+  if (reattach_fd >= 0)
+    close(reattach_fd);
+  if (sent != (ssize_t)sizeof(rec))
+  {
+    const struct journal_field fields[] = {
+        {"LINUXIO_USER", auth_user->name},
+    };
+    journal_error_fieldsf(fields, 1, "session handoff to the auth daemon failed: %m");
+    return -1;
+  }
+  return 0;
+}
+
+// Send len bytes with nfds (at most 2) fds attached. Returns 0 if all of it
+// went out.
+static int send_with_fds(int sock, const void *buf, size_t len, const int *fds, size_t nfds)
+{
+  union
+  {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } ctrl;
+  memset(&ctrl, 0, sizeof(ctrl));
+  struct iovec iov = {.iov_base = (union { const void *in; void *out; }){.in = buf}.out,
+                      .iov_len = len};
+  struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1};
+  if (nfds > 0 && nfds <= 2)
+  {
+    mh.msg_control = ctrl.buf;
+    mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+  }
+  ssize_t sent;
+  do
+  {
+    sent = sendmsg(sock, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  return sent == (ssize_t)len ? 0 : -1;
+}
+
+// Send len bytes with fd (if >= 0) attached. Returns 0 if all of it went out.
+static int send_with_fd(int sock, const void *buf, size_t len, int fd)
+{
+  return send_with_fds(sock, buf, len, &fd, fd >= 0 ? 1 : 0);
+}
+
+// Wait up to timeout_ms for one message of exactly len bytes; an attached
+// fd is returned in *fd (-1 if none). Returns 0 on success.
+static int recv_with_fd(int sock, void *buf, size_t len, int timeout_ms, int *fd)
+{
+  *fd = -1;
+  uint64_t deadline = monotonic_ms() + (uint64_t)timeout_ms;
+  struct pollfd pfd = {.fd = sock, .events = POLLIN, .revents = 0};
+  int pr;
+  do
+  {
+    pr = poll(&pfd, 1, deadline_remaining_ms(deadline));
+  } while (pr < 0 && errno == EINTR);
+  if (pr <= 0)
+    return -1;
+
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } ctrl;
+  struct iovec iov = {.iov_base = buf, .iov_len = len};
+  struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1,
+                      .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)};
+  ssize_t n;
+  do
+  {
+    n = recvmsg(sock, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0)
+    return -1;
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+  if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS &&
+      cm->cmsg_len == CMSG_LEN(sizeof(int)))
+    memcpy(fd, CMSG_DATA(cm), sizeof(int));
+  return n == (ssize_t)len && !(mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ? 0 : -1;
+}
+
+// Set up the re-attach socket pair whose sv[1] becomes the bridge's
+// PROTO_REATTACH_FD: for a login that asked for a ticket (which is generated
+// here too), and for every bridge when bridges are shared. Only a
+// supervising daemon can route anything to it, so nothing happens
+// otherwise. Returns 0 if the bridge gets the socket.
+static int reattach_prepare(int sv[2])
+{
+  sv[0] = sv[1] = -1;
+  if (g_supervisor_fd < 0)
+    return -1;
+  int ticket = g_reattach.want_ticket && g_reattach.grace_ms > 0;
+  if (!ticket && !g_reattach.share_bridge)
+    return -1;
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0)
+  {
+    journal_errorf("failed to create re-attach socket: %m");
+    sv[0] = sv[1] = -1;
+    return -1;
+  }
+  if (ticket && ticket_generate(g_reattach.ticket) != 0)
+  {
+    journal_errorf("failed to generate re-attach ticket: %m");
+    g_reattach.ticket[0] = '\0';
+    if (!g_reattach.share_bridge)
+    {
+      close(sv[0]);
+      close(sv[1]);
+      sv[0] = sv[1] = -1;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Serve a PROTO_REQ_FLAG_REATTACH request: move the client on conn_fd to
+// the running bridge of session_id. No PAM, sudo or spawn. With release the
+// session's ticket is given up instead, so its bridge exits with its client.
+static int reattach_session(int conn_fd, int output_fd, const char *user, const char *ticket,
+                            const char *session_id, int release)
+{
+  if (g_reattach.grace_ms == 0 || g_supervisor_fd < 0)
+  {
+    send_error_response(output_fd, PROTO_RESULT_BAD_REQUEST, "session re-attach is not enabled");
+    return 1;
+  }
+
+  struct reattach_request req;
+  memset(&req, 0, sizeof(req));
+  req.kind = SUPERVISOR_MSG_REATTACH;
+  req.release = release;
+  copy_fixed_field(req.user, sizeof(req.user), user);
+  copy_fixed_field(req.session_id, sizeof(req.session_id), session_id);
+  copy_fixed_field(req.ticket, sizeof(req.ticket), ticket);
+
+  struct reattach_reply reply;
+  memset(&reply, 0, sizeof(reply));
+  int bridge_sock = -1;
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == 0)
+  {
+    int sent = send_with_fd(g_supervisor_fd, &req, sizeof(req), sv[1]);
+    close(sv[1]);
+    if (sent == 0 &&
+        recv_with_fd(sv[0], &reply, sizeof(reply), REATTACH_REPLY_TIMEOUT_MS, &bridge_sock) != 0)
+      reply.ok = 0;
+    close(sv[0]);
+  }
+  secure_bzero(&req, sizeof(req));
+  if (reply.ok && release)
+  {
+    send_ok_response(output_fd, reply.mode, user, reply.uid, reply.gid);
+    secure_bzero(&reply, sizeof(reply));
+    journal_info_fieldsf(NULL, 0, "session released");
+    return 0;
+  }
+  if (!reply.ok || bridge_sock < 0)
+  {
+    if (bridge_sock >= 0)
+      close(bridge_sock);
+    secure_bzero(&reply, sizeof(reply));
+    journal_info_fieldsf(NULL, 0, "session re-attach refused");
+    send_error_response(output_fd, PROTO_RESULT_AUTH_FAILED, "invalid re-attach ticket");
+    return 1;
+  }
+
+  // The bridge swaps the connection in and acknowledges with one byte
+  uint8_t msg = PROTO_ATTACH_REATTACH;
+  uint8_t status = PROTO_REATTACH_STATUS_FAILED;
+  int status_fd = -1;
+  if (send_with_fd(bridge_sock, &msg, 1, conn_fd) != 0 ||
+      recv_with_fd(bridge_sock, &status, 1, BRIDGE_START_TIMEOUT_MS, &status_fd) != 0)
+    status = PROTO_REATTACH_STATUS_FAILED;
+  if (status_fd >= 0)
+    close(status_fd);
+  close(bridge_sock);
+  if (status != PROTO_REATTACH_STATUS_OK)
+  {
+    secure_bzero(&reply, sizeof(reply));
+    journal_errorf("bridge did not take the re-attached connection");
+    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "bridge re-attach failed");
+    return 1;
+  }
+
+  if (g_reattach.want_ticket)
+    memcpy(g_reattach.ticket, reply.ticket, sizeof(g_reattach.ticket));
+  send_ok_response(output_fd, reply.mode, user, reply.uid, reply.gid);
+  secure_bzero(&reply, sizeof(reply));
+  secure_bzero(g_reattach.ticket, sizeof(g_reattach.ticket));
+  journal_info_fieldsf(NULL, 0, "session re-attached");
+  return 0;
+}
+
+// Ask the daemon which modes it has a shared bridge of auth_user in. With
+// mode >= 0, *bridge_sock gets a copy of the re-attach socket of one in that
+// mode (-1 if there is none) and *bridge_pid its pid. Returns the
+// (1 << PROTO_MODE_*) bitmask.
+static unsigned shared_bridge_query(const struct auth_user *auth_user, int mode, int *bridge_sock,
+                                    pid_t *bridge_pid)
+{
+  if (bridge_sock)
+    *bridge_sock = -1;
+  if (!g_reattach.share_bridge || g_supervisor_fd < 0)
+    return 0;
+
+  struct attach_query q;
+  memset(&q, 0, sizeof(q));
+  q.kind = SUPERVISOR_MSG_ATTACH;
+  q.mode = mode;
+  q.uid = auth_user->uid;
+  copy_fixed_field(q.user, sizeof(q.user), auth_user->name);
+
+  struct attach_reply reply = {.modes = 0, .bridge_pid = 0};
+  int fd = -1;
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0)
+    return 0;
+  int sent = send_with_fd(g_supervisor_fd, &q, sizeof(q), sv[1]);
+  close(sv[1]);
+  if (sent != 0 || recv_with_fd(sv[0], &reply, sizeof(reply), REATTACH_REPLY_TIMEOUT_MS, &fd) != 0)
+    reply.modes = 0;
+  close(sv[0]);
+  if (bridge_sock && reply.modes)
+  {
+    *bridge_sock = fd;
+    if (bridge_pid)
+      *bridge_pid = reply.bridge_pid;
+  }
+  else if (fd >= 0)
+  {
+    close(fd);
+  }
+  return reply.modes;
+}
+
+// Tell the daemon about a session just attached to the shared bridge
+// bridge_pid, passing on end_fd: the reply socket of the attach, which the
+// bridge closes once that session ended. end_fd is closed either way.
+static void supervisor_attached(pid_t bridge_pid, const char *session_id, int end_fd)
+{
+  struct attached_session msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.kind = SUPERVISOR_MSG_ATTACHED;
+  msg.bridge_pid = bridge_pid;
+  copy_fixed_field(msg.session_id, sizeof(msg.session_id), session_id);
+  if (send_with_fd(g_supervisor_fd, &msg, sizeof(msg), end_fd) != 0)
+    journal_errorf("failed to hand the attached session to the auth daemon; it is not listed: %m");
+  close(end_fd);
+}
+
+// Hand the client on conn_fd to a shared bridge of auth_user in mode, as
+// session session_id. Returns 0 once the bridge took it and -1 if there is
+// none or it turned the session down; the login then gets its own bridge.
+// -2 means the bridge may hold the connection without having confirmed it,
+// so it must not be given to another one.
+static int shared_bridge_attach(int conn_fd, const struct auth_user *auth_user, uint8_t mode,
+                                const char *session_id)
+{
+  int bridge_sock = -1;
+  pid_t bridge_pid = 0;
+  if (!(shared_bridge_query(auth_user, mode, &bridge_sock, &bridge_pid) & (1u << mode)) ||
+      bridge_sock < 0)
+  {
+    if (bridge_sock >= 0)
+      close(bridge_sock);
+    return -1;
+  }
+
+  uint8_t msg[1 + 2 + PROTO_MAX_SESSION_ID];
+  size_t len = 1;
+  msg[0] = PROTO_ATTACH_SESSION;
+  int rc = -1;
+  int sv[2];
+  if (put_lenstr(msg, sizeof(msg), &len, session_id) == 0 &&
+      socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == 0)
+  {
+    int fds[2] = {conn_fd, sv[1]};
+    int sent = send_with_fds(bridge_sock, msg, len, fds, 2);
+    close(sv[1]);
+    uint8_t status = PROTO_REATTACH_STATUS_FAILED;
+    int status_fd = -1;
+    if (sent == 0 && recv_with_fd(sv[0], &status, 1, BRIDGE_START_TIMEOUT_MS, &status_fd) == 0)
+      rc = status == PROTO_REATTACH_STATUS_OK ? 0 : -1;
+    else if (sent == 0)
+      rc = -2;
+    if (status_fd >= 0)
+      close(status_fd);
+    if (rc == 0)
+      supervisor_attached(bridge_pid, session_id, sv[0]);
+    else
+      close(sv[0]);
+  }
+  close(bridge_sock);
+  return rc;
+}
+
+// Join the sudo probe of a lazy login, answered unprivileged already, and
+// if sudo allows the user replace its bridge with a privileged one: the new
+// bridge connection goes out with a second response on output_fd, then the
+// old bridge is waited for. On success *bridge, *reattach_fd and *mode are the
+// privileged bridge's. Either way output_fd is shut down, which ends the
+// upgrade for the daemon.
+static void privilege_upgrade(int output_fd, struct sudo_probe *probe,
+                              const struct auth_user *auth_user, int verbose_flag,
+                              const char *session_id, struct child_proc *bridge,
+                              int *reattach_fd, uint8_t *mode)
+{
+  uint64_t t_phase = monotonic_us();
+  int nopasswd = 0;
+  int privileged = sudo_probe_finish(probe, auth_user, &nopasswd);
+  login_timing_record(PROTO_PHASE_SUDO, t_phase);
+  g_upgrade.pending = 0;
+  g_timing.send_trailer = 0;
+  if (!privileged)
+  {
+    (void)shutdown(output_fd, SHUT_WR);
+    return;
+  }
+
+  int bridge_fd = -1;
+  int bootstrap_pipe[2] = {-1, -1};
+  int exec_status_pipe[2] = {-1, -1};
+  int client[2] = {-1, -1};
+  if (acquire_bridge_fd(&bridge_fd) != 0 || pipe(bootstrap_pipe) != 0 ||
+      exec_status_pipe_open(exec_status_pipe) != 0 ||
+      socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, client) != 0)
+  {
+    journal_errorf("failed to prepare privileged bridge: %m");
+    int fds[] = {bridge_fd, bootstrap_pipe[0], bootstrap_pipe[1], exec_status_pipe[0],
+                 exec_status_pipe[1]};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+    {
+      if (fds[i] >= 0)
+        close(fds[i]);
+    }
+    (void)shutdown(output_fd, SHUT_WR);
+    return;
+  }
+
+  // The new bridge gets a ticket of its own; the old one keeps its ticket
+  // if the upgrade falls through
+  char old_ticket[sizeof(g_reattach.ticket)];
+  memcpy(old_ticket, g_reattach.ticket, sizeof(old_ticket));
+  int reattach_sv[2];
+  (void)reattach_prepare(reattach_sv);
+
+  struct child_proc upgraded;
+  const char *launch_err = NULL;
+  int launch_rc = launch_bridge(auth_user, 1, verbose_flag, session_id, probe->source, bridge_fd,
+                                bootstrap_pipe, exec_status_pipe, client[0], reattach_sv[1],
+                                &upgraded, &launch_err);
+  close(client[0]);
+  if (reattach_sv[1] >= 0)
+    close(reattach_sv[1]);
+  int sent = -1;
+  if (launch_rc == 0)
+  {
+    g_upgrade.attach_fd = client[1];
+    sent = send_response(output_fd, PROTO_STATUS_OK, PROTO_MODE_PRIVILEGED, PROTO_RESULT_OK, NULL,
+                         auth_user->name, auth_user->uid, auth_user->gid);
+    g_upgrade.attach_fd = -1;
+  }
+  close(client[1]);
+  (void)shutdown(output_fd, SHUT_WR);
+  if (sent != 0)
+  {
+    if (launch_rc == 0)
+    {
+      journal_errorf("failed to send privilege upgrade: %m");
+      child_kill_and_reap(&upgraded);
+      child_release(&upgraded);
+    }
+    else
+    {
+      journal_errorf("privilege upgrade failed: %s", launch_err);
+    }
+    if (reattach_sv[0] >= 0)
+      close(reattach_sv[0]);
+    memcpy(g_reattach.ticket, old_ticket, sizeof(old_ticket));
+    secure_bzero(old_ticket, sizeof(old_ticket));
+    return;
+  }
+  secure_bzero(old_ticket, sizeof(old_ticket));
+  if (reattach_sv[0] >= 0 && !g_reattach.ticket[0])
+  {
+    uint8_t release = PROTO_ATTACH_RELEASE;
+    (void)send_with_fd(reattach_sv[0], &release, 1, -1);
+  }
+
+  // The webserver drops the old bridge's connection once it moved over to
+  // the new one, which ends that bridge; one that lingers is stopped
+  if (*reattach_fd >= 0)
+    close(*reattach_fd);
+  int status = 0;
+  if (child_wait_until(bridge, &status, monotonic_ms() + BRIDGE_STOP_TIMEOUT_MS) != 0)
+  {
+    child_kill(bridge, SIGTERM);
+    if (child_wait_until(bridge, &status, monotonic_ms() + BRIDGE_STOP_TIMEOUT_MS) != 0)
+      child_kill_and_reap(bridge);
+  }
+  child_release(bridge);
+
+  *bridge = upgraded;
+  *reattach_fd = reattach_sv[0];
+  *mode = PROTO_MODE_PRIVILEGED;
+  METRICS_ADD(privilege_upgrades, 1);
+  const struct journal_field fields[] = {
+      {"LINUXIO_MODE", "privileged"},
+      {"LINUXIO_PRIV_SOURCE", probe->source},
+  };
+  journal_info_fieldsf(fields, 2, "bridge upgraded to privileged");
+}
+
+// Handle a single client request
+static int handle_client(int input_fd, int output_fd)
+{
+  uint64_t t_phase = monotonic_us();
+  memset(&g_timing, 0, sizeof(g_timing));
+  g_timing.requested_us = realtime_us();
+
+  // The password and the raw request carrying it live in the secret arena
+  char *password = secret_alloc(PROTO_MAX_PASSWORD);
+  uint8_t *req = secret_alloc(AUTH_REQ_MAX_SIZE);
+  if (!password || !req)
+  {
+    send_error_response(output_fd, PROTO_RESULT_INTERNAL_ERROR, "secure memory unavailable");
+    return 1;
+  }
+
+  // Read the whole binary request
+  const char *req_err = NULL;
+  if (read_auth_request(input_fd, req, &req_err) < 0)
+  {
+    send_error_response(output_fd, PROTO_RESULT_BAD_REQUEST, req_err);
+    secret_free(req, AUTH_REQ_MAX_SIZE);
+    return 1;
+  }
+
+  login_timing_record(PROTO_PHASE_REQUEST_READ, t_phase);
+
+  // Parse header fields
+  uint8_t req_flags = req[4];
+  int verbose_flag = (req_flags & PROTO_REQ_FLAG_VERBOSE) != 0;
+  g_timing.send_trailer = (req_flags & PROTO_REQ_FLAG_TIMING) != 0;
+  g_reattach.want_ticket = (req_flags & PROTO_REQ_FLAG_TICKET) != 0;
+  // The client's budget runs from when we started reading its request
+  uint32_t budget_ms = ((uint32_t)req[5] << 16) | ((uint32_t)req[6] << 8) | req[7];
+  g_deadline.at_ms = budget_ms ? t_phase / 1000 + budget_ms : 0;
+
+  // Variable-length fields
+  char user[PROTO_MAX_USERNAME] = "";
+  char session_id[PROTO_MAX_SESSION_ID] = "";
+  char remote_host[PROTO_MAX_REMOTE_HOST] = "";
+
+  size_t req_pos = PROTO_AUTH_REQ_HEADER_SIZE;
+  take_lenstr(req, &req_pos, user);
+  take_lenstr(req, &req_pos, password);
+  take_lenstr(req, &req_pos, session_id);
+  take_lenstr(req, &req_pos, remote_host);
+  secret_free(req, AUTH_REQ_MAX_SIZE);
+
+  // Validate required fields
+  if (!user[0] || !session_id[0])
+  {
+    send_error_response(output_fd, PROTO_RESULT_BAD_REQUEST, "missing required fields");
+    secure_bzero(password, PROTO_MAX_PASSWORD);
+    return 1;
+  }
+
+  // Validate session_id (defense against path injection)
+  if (!valid_session_id(session_id))
+  {
+    send_error_response(output_fd, PROTO_RESULT_BAD_REQUEST, "invalid session_id format");
+    secure_bzero(password, PROTO_MAX_PASSWORD);
+    return 1;
+  }
+
+  if (!valid_remote_host(remote_host))
+  {
+    send_error_response(output_fd, PROTO_RESULT_BAD_REQUEST, "invalid remote_host format");
+    secure_bzero(password, PROTO_MAX_PASSWORD);
+    return 1;
+  }
+
+  // Every journal entry from here on carries the login's user and host
+  journal_ctx_set("LINUXIO_USER", user);
+  if (remote_host[0])
+    journal_ctx_set("LINUXIO_REMOTE_HOST", remote_host);
+
+  // A re-attach carries its ticket in the password field
+  if (req_flags & PROTO_REQ_FLAG_REATTACH)
+  {
+    int reattach_rc = reattach_session(input_fd, output_fd, user, password, session_id,
+                                       (req_flags & PROTO_REQ_FLAG_RELEASE) != 0);
+    secure_bzero(password, PROTO_MAX_PASSWORD);
+    return reattach_rc;
+  }
+
+  // Hosts that keep failing are turned away before PAM spends any time
+  uint64_t blocked_ms = fail_blocked_ms(remote_host, user);
+  if (blocked_ms > 0)
+  {
+    char msg[96];
+    (void)safe_snprintf(msg, sizeof(msg), "too many failed login attempts; try again in %llu seconds",
+                        (unsigned long long)((blocked_ms + 999) / 1000));
+    journal_info_fieldsf(NULL, 0, "login rate limited");
+    send_error_response(output_fd, PROTO_RESULT_RATE_LIMITED, msg);
+    secure_bzero(password, PROTO_MAX_PASSWORD);
+    return 1;
+  }
+
+  // PAM authentication; until account checks are done the deadline timer
+  // answers for us
+  login_deadline_arm(output_fd);
+  struct pam_appdata appdata = {
+      .username = user,
+      .password = password};
+  struct pam_conv conv = {
+      (int (*)(int, const struct pam_message **, struct pam_response **, void *))pam_conv_func,
+      &appdata};
+  pam_handle_t *pamh = NULL;
+  int rc = auth_pam_start(user, &conv, &pamh);
+  int auth_rc;
+  if (rc != PAM_SUCCESS)
+  {
+    login_deadline_disarm();
+    send_error_response(output_fd, PROTO_RESULT_INTERNAL_ERROR, pam_strerror(NULL, rc));
+    secure_bzero(password, PROTO_MAX_PASSWORD);
+    return 1;
+  }
+
+  rc = pam_set_item(pamh, PAM_RHOST, remote_host);
+  if (rc == PAM_SUCCESS)
+    rc = pam_set_item(pamh, PAM_TTY, LINUXIO_WEB_TTY);
+  if (rc != PAM_SUCCESS)
+  {
+    login_deadline_disarm();
+    send_error_response(output_fd, PROTO_RESULT_INTERNAL_ERROR, pam_strerror(pamh, rc));
+    pam_end(pamh, rc);
+    secure_bzero(password, PROTO_MAX_PASSWORD);
+    return 1;
+  }
+  t_phase = monotonic_us();
+  auth_rc = pam_authenticate(pamh, 0);
+  login_timing_record(PROTO_PHASE_PAM_AUTH, t_phase);
+  rc = auth_rc;
+  if (rc == PAM_SUCCESS)
+  {
+    g_timing.authenticated_us = realtime_us();
+    fail_clear(remote_host, user);
+    t_phase = monotonic_us();
+    rc = pam_acct_mgmt(pamh, 0);
+    login_timing_record(PROTO_PHASE_PAM_ACCT, t_phase);
+  }
+  login_deadline_disarm();
+
+  // Handle password expiration
+  if (rc == PAM_NEW_AUTHTOK_REQD)
+  {
+    journal_info_fieldsf(NULL, 0, "password expired");
+    send_error_response(output_fd, PROTO_RESULT_PASSWORD_EXPIRED,
+                        "Password has expired. Please change it via SSH or console.");
+    pam_end(pamh, rc);
+    secure_bzero(password, PROTO_MAX_PASSWORD);
+    return 1;
+  }
+
+  if (rc == PAM_SUCCESS)
+  {
+    t_phase = monotonic_us();
+    rc = pam_setcred(pamh, PAM_ESTABLISH_CRED);
+    login_timing_record(PROTO_PHASE_PAM_SETCRED, t_phase);
+  }
+
+  if (rc != PAM_SUCCESS)
+  {
+    const char *err = pam_strerror(pamh, rc);
+    if (auth_rc != PAM_SUCCESS)
+      btmp_log(user, remote_host);
+    if (classify_pam_result(auth_rc) == PROTO_RESULT_AUTH_FAILED)
+      fail_record(remote_host, user);
+    send_error_response(output_fd, classify_pam_result(rc), err);
+    acct_flush();
+    login_timing_log(user);
+    pam_end(pamh, rc);
+    secure_bzero(password, PROTO_MAX_PASSWORD);
+    return 1;
+  }
+
+  // Get user info
+  struct auth_user auth_user;
+  int lookup_rc = nss_lookup_user(user, &auth_user);
+  if (lookup_rc == -1)
+  {
+    send_error_response(output_fd, PROTO_RESULT_INTERNAL_ERROR, "user lookup failed");
+    pam_setcred(pamh, PAM_DELETE_CRED);
+    pam_end(pamh, 0);
+    secure_bzero(password, PROTO_MAX_PASSWORD);
+    return 1;
+  }
+  if (lookup_rc != 0)
+  {
+    send_error_response(output_fd, PROTO_RESULT_INTERNAL_ERROR, "invalid passwd entry");
+    pam_setcred(pamh, PAM_DELETE_CRED);
+    pam_end(pamh, 0);
+    secure_bzero(password, PROTO_MAX_PASSWORD);
+    return 1;
+  }
+  if (login_deadline_passed())
+  {
+    send_deadline_response(output_fd);
+    pam_setcred(pamh, PAM_DELETE_CRED);
+    pam_end(pamh, 0);
+    secure_bzero(password, PROTO_MAX_PASSWORD);
+    return 1;
+  }
+
+  // Check sudo capability in the background. The probe only needs the
+  // password on its stdin, so it can be wiped right away, and bridge
+  // validation, pipe setup and pam_open_session() below run while sudo (and
+  // any LDAP/sssd sudoers lookup behind it) is working. We join before the
+  // privileged/unprivileged decision.
+  struct sudo_probe probe;
+  sudo_probe_start(&probe, &auth_user, password);
+
+  // Clear password from memory
+  secure_bzero(password, PROTO_MAX_PASSWORD);
+
+  {
+    char uid_buf[32];
+    (void)safe_snprintf(uid_buf, sizeof(uid_buf), "%u", (unsigned)auth_user.uid);
+    journal_ctx_set("LINUXIO_UID", uid_buf);
+  }
+  journal_info_deferf("pam auth success");
+
+  // A shared bridge of this user in the mode the sudo probe decides on
+  // takes the login as one more session: no PAM session, login record,
+  // ticket or spawn of its own. Only if there is one is the probe joined
+  // this early.
+  int want_privileged = -1;
+  int nopasswd = 0;
+  if (shared_bridge_query(&auth_user, -1, NULL, NULL) != 0)
+  {
+    t_phase = monotonic_us();
+    probe.validate_deadline_ms = login_deadline_clamp(probe.validate_deadline_ms);
+    want_privileged = sudo_probe_finish(&probe, &auth_user, &nopasswd) ? 1 : 0;
+    login_timing_record(PROTO_PHASE_SUDO, t_phase);
+    uint8_t shared_mode = want_privileged ? PROTO_MODE_PRIVILEGED : PROTO_MODE_UNPRIVILEGED;
+    int shared_rc = shared_bridge_attach(input_fd, &auth_user, shared_mode, session_id);
+    if (shared_rc == 0)
+    {
+      t_phase = monotonic_us();
+      send_ok_response(output_fd, shared_mode, auth_user.name, auth_user.uid, auth_user.gid);
+      login_timing_record(PROTO_PHASE_SEND_OK, t_phase);
+      METRICS_ADD(shared_bridge_logins, 1);
+      sudo_probe_cleanup(&probe);
+      const struct journal_field fields[] = {
+          {"LINUXIO_MODE", shared_mode == PROTO_MODE_PRIVILEGED ? "privileged" : "unprivileged"},
+          {"LINUXIO_PRIV_SOURCE", probe.source},
+      };
+      journal_info_fieldsf(fields, 2, "session attached to shared bridge");
+      login_timing_log(auth_user.name);
+      pam_setcred(pamh, PAM_DELETE_CRED);
+      pam_end(pamh, 0);
+      return 0;
+    }
+    if (shared_rc == -2)
+    {
+      journal_errorf("shared bridge did not confirm the attached session");
+      sudo_probe_cleanup(&probe);
+      send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "shared bridge attach failed");
+      pam_setcred(pamh, PAM_DELETE_CRED);
+      pam_end(pamh, 0);
+      return 1;
+    }
+  }
+
+  // Validate bridge binary and keep fd open (prevents TOCTOU)
+  int bridge_fd = -1;
+  t_phase = monotonic_us();
+  int bridge_rc = acquire_bridge_fd(&bridge_fd);
+  login_timing_record(PROTO_PHASE_BRIDGE_VALIDATE, t_phase);
+  if (bridge_rc != 0)
+  {
+    sudo_probe_cleanup(&probe);
+    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "bridge validation failed");
+    pam_setcred(pamh, PAM_DELETE_CRED);
+    pam_end(pamh, 0);
+    return 1;
+  }
+  // Keep bridge_fd open - we'll exec it directly to prevent TOCTOU
+
+  // Create pipe for bootstrap data (secrets never touch filesystem)
+  int bootstrap_pipe[2];
+  if (pipe(bootstrap_pipe) != 0)
+  {
+    journal_errorf("failed to create bootstrap pipe: %m");
+    sudo_probe_cleanup(&probe);
+    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "failed to prepare bootstrap");
+    close(bridge_fd);
+    pam_setcred(pamh, PAM_DELETE_CRED);
+    pam_end(pamh, 0);
+    return 1;
+  }
+
+  if (login_deadline_passed())
+  {
+    sudo_probe_cleanup(&probe);
+    close(bootstrap_pipe[0]);
+    close(bootstrap_pipe[1]);
+    close(bridge_fd);
+    send_deadline_response(output_fd);
+    pam_setcred(pamh, PAM_DELETE_CRED);
+    pam_end(pamh, 0);
+    return 1;
+  }
+
+  t_phase = monotonic_us();
+  rc = pam_open_session(pamh, 0);
+  login_timing_record(PROTO_PHASE_PAM_OPEN_SESSION, t_phase);
+  if (rc != PAM_SUCCESS)
+  {
+    const char *err = pam_strerror(pamh, rc);
+    sudo_probe_cleanup(&probe);
+    close(bootstrap_pipe[0]);
+    close(bootstrap_pipe[1]);
+    close(bridge_fd);
+    send_error_response(output_fd, classify_pam_result(rc), err);
+    pam_setcred(pamh, PAM_DELETE_CRED);
+    pam_end(pamh, 0);
+    return 1;
+  }
+  int exec_status_pipe[2];
+  if (exec_status_pipe_open(exec_status_pipe) != 0)
+  {
+    journal_errorf("failed to create exec-status pipe: %m");
+    sudo_probe_cleanup(&probe);
+    close(bootstrap_pipe[0]);
+    close(bootstrap_pipe[1]);
+    close(bridge_fd);
+    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "failed to prepare exec check");
+    pam_close_session(pamh, 0);
+    pam_setcred(pamh, PAM_DELETE_CRED);
+    pam_end(pamh, 0);
+    return 1;
+  }
+
+  // Join the sudo probe: this is the privileged/unprivileged fork decision.
+  // A lazy login does not wait for a sudo that is still running; it starts
+  // unprivileged and privilege_upgrade() joins the probe once it is answered.
+  int lazy = want_privileged < 0 && g_upgrade.enabled && (req_flags & PROTO_REQ_FLAG_UPGRADE) &&
+             probe.decided < 0 && probe.validate.pid > 0;
+  if (lazy)
+  {
+    want_privileged = 0;
+    g_upgrade.pending = 1;
+  }
+  else if (want_privileged < 0)
+  {
+    t_phase = monotonic_us();
+    probe.validate_deadline_ms = login_deadline_clamp(probe.validate_deadline_ms);
+    want_privileged = sudo_probe_finish(&probe, &auth_user, &nopasswd) ? 1 : 0;
+    login_timing_record(PROTO_PHASE_SUDO, t_phase);
+  }
+  uint8_t mode = want_privileged ? PROTO_MODE_PRIVILEGED : PROTO_MODE_UNPRIVILEGED;
+
+  // A sudo probe cut short by the deadline decided nothing
+  if (login_deadline_passed())
+  {
+    sudo_probe_cleanup(&probe);
+    g_upgrade.pending = 0;
+    close(bootstrap_pipe[0]);
+    close(bootstrap_pipe[1]);
+    close(exec_status_pipe[0]);
+    close(exec_status_pipe[1]);
+    close(bridge_fd);
+    send_deadline_response(output_fd);
+    pam_close_session(pamh, 0);
+    pam_setcred(pamh, PAM_DELETE_CRED);
+    pam_end(pamh, 0);
+    return 1;
+  }
+
+  int reattach_sv[2];
+  (void)reattach_prepare(reattach_sv);
+
+  struct child_proc bridge;
+  const char *launch_err = "failed to spawn bridge";
+  int launch_rc = launch_bridge(&auth_user, want_privileged, verbose_flag, session_id,
+                                probe.source, bridge_fd, bootstrap_pipe, exec_status_pipe,
+                                input_fd, reattach_sv[1], &bridge, &launch_err);
+  if (reattach_sv[1] >= 0)
+    close(reattach_sv[1]);
+  if (launch_rc == 0 && reattach_sv[0] >= 0 && !g_reattach.ticket[0])
+  {
+    // A shared bridge without a ticket has no re-attach to wait for
+    uint8_t release = PROTO_ATTACH_RELEASE;
+    (void)send_with_fd(reattach_sv[0], &release, 1, -1);
+  }
+  if (launch_rc != 0)
+  {
+    if (reattach_sv[0] >= 0)
+      close(reattach_sv[0]);
+    secure_bzero(g_reattach.ticket, sizeof(g_reattach.ticket));
+    sudo_probe_cleanup(&probe);
+    g_upgrade.pending = 0;
+    if (login_deadline_passed())
+      send_deadline_response(output_fd);
+    else
+      send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, launch_err);
+    pam_close_session(pamh, 0);
+    pam_setcred(pamh, PAM_DELETE_CRED);
+    pam_end(pamh, 0);
+    return 1;
+  }
+
+  // Now we know bridge exec'd successfully - send OK response
+  // Bridge inherits the connection via FD 3, server continues Yamux on same connection
+  record_login_start(&auth_user, remote_host);
+  g_session_slot = session_table_add(session_id, auth_user.uid, mode, bridge.pid);
+  t_phase = monotonic_us();
+  send_ok_response(output_fd, mode, auth_user.name, auth_user.uid, auth_user.gid);
+  login_timing_record(PROTO_PHASE_SEND_OK, t_phase);
+  acct_flush();
+
+  // The login is answered; now collect the background `sudo -k`.
+  if (!lazy)
+    sudo_probe_cleanup(&probe);
+
+  // Don't close input_fd/output_fd - the bridge (child) has the connection via FD 3
+  // The parent's copy will be closed when we exit, which is fine
+
+  {
+    char gid_buf[32];
+    const char *mode_name = mode == PROTO_MODE_PRIVILEGED ? "privileged" : "unprivileged";
+    (void)safe_snprintf(gid_buf, sizeof(gid_buf), "%u", (unsigned)auth_user.gid);
+    const struct journal_field fields[] = {
+        {"LINUXIO_GID", gid_buf},
+        {"LINUXIO_MODE", mode_name},
+        {"LINUXIO_PRIVILEGED", mode == PROTO_MODE_PRIVILEGED ? "true" : "false"},
+        {"LINUXIO_PRIV_SOURCE", probe.source},
+    };
+    journal_info_fieldsf(fields, 4, "bridge spawned");
+  }
+  login_timing_log(auth_user.name);
+
+  if (lazy)
+  {
+    privilege_upgrade(output_fd, &probe, &auth_user, verbose_flag, session_id, &bridge,
+                      &reattach_sv[0], &mode);
+    sudo_probe_cleanup(&probe);
+    session_table_update(g_session_slot, mode, bridge.pid);
+  }
+  pid_t child = bridge.pid;
+
+  // In supervisor mode the daemon takes the session over from here; leave
+  // without closing it.
+  int registered = supervisor_register(pamh, &auth_user, remote_host, session_id, mode, &bridge,
+                                       reattach_sv[0]);
+  secure_bzero(g_reattach.ticket, sizeof(g_reattach.ticket));
+  if (registered == 0)
+  {
+    child_release(&bridge);
+    return 0;
+  }
+
+  int status = 0;
+  int wait_rc = child_wait_until(&bridge, &status, 0);
+  if (wait_rc != 0)
+    journal_errorf("waiting for bridge pid %ld failed: %m", (long)child);
+  child_release(&bridge);
+
+  // On a failed wait status is meaningless; keep the generic failure exit code
+  int exitcode = wait_rc == 0 ? log_bridge_exit(auth_user.name, child, status) : 1;
+
+  record_login_end(getpid());
+  session_table_remove(g_session_slot);
+  acct_flush();
+  pam_close_session(pamh, 0);
+  pam_setcred(pamh, PAM_DELETE_CRED);
+  pam_end(pamh, 0);
+
+  return exitcode;
+}
+
+// Serve one accepted auth connection on stdin/stdout. This is the layout
+// systemd's Accept=yes hands us, and the one daemon workers recreate after
+// accept() so both modes share a single request path.
+static int serve_connection(void)
+{
+  // Best-effort socket timeouts (stdin/stdout are the accepted socket)
+  struct timeval tv_read = {.tv_sec = SOCKET_READ_TIMEOUT, .tv_usec = 0};
+  struct timeval tv_write = {.tv_sec = SOCKET_WRITE_TIMEOUT, .tv_usec = 0};
+  (void)setsockopt(STDIN_FILENO, SOL_SOCKET, SO_RCVTIMEO, &tv_read, sizeof(tv_read));
+  (void)setsockopt(STDOUT_FILENO, SOL_SOCKET, SO_SNDTIMEO, &tv_write, sizeof(tv_write));
+
+  // Defense-in-depth: verify peer credentials before processing
+  // This catches socket permission mistakes at the kernel level
+  if (check_peer_creds(STDIN_FILENO) != 0)
+  {
+    return 1;
+  }
+
+  secret_arena_init();
+  int rc = handle_client(STDIN_FILENO, STDOUT_FILENO);
+  journal_flush_deferred();
+  secret_arena_wipe();
+  return rc;
+}
+
+// ============================================================================
+// Daemon mode - persistent pre-forked worker pool (Accept=no)
+// ============================================================================
+//
+// systemd passes the listening socket via sd_listen_fds(). The daemon keeps
+// LINUXIO_AUTH_POOL_SIZE idle workers forked and blocked in accept(), so a
+// login no longer pays for service instance creation, the dynamic loader,
+// libpam/libsystemd relocation and NSS setup. Each worker serves exactly one
+// connection through serve_connection() and then exits, which keeps the
+// one-process-per-login privilege separation of the Accept=yes mode. Busy
+// workers (live logins) count against LINUXIO_AUTH_MAX_WORKERS, the daemon
+// equivalent of the socket unit's MaxConnections=.
+//
+// Logins also arrive over the control socket (protocol v4, see
+// linuxio_protocol.h): the daemon reads them off long-lived webserver
+// connections and hands each to an idle worker as if it had been accepted,
+// with a socketpair standing in for the client connection.
+
+#define DAEMON_POOL_SIZE_DEFAULT   4
+#define DAEMON_MAX_WORKERS_DEFAULT 16
+#define DAEMON_MAX_WORKERS_LIMIT   1024
+#define DAEMON_RESPAWN_BACKOFF_MS  1000
+#define CONTROL_SOCKET_DEFAULT     "/run/linuxio/auth-control.sock"
+#define CONTROL_MAX_CONNS          8
+#define CONTROL_MAX_PENDING        64
+#define DAEMON_SHED_MAX            256 // refused connections waiting for their request
+#define DAEMON_ATTACHED_MAX        256 // sessions attached to shared bridges
+#define PAM_WATCH_MAX              4
+
+#ifdef LINUXIO_PAM_CONFDIR
+#define PAM_WATCH_CONFDIR LINUXIO_PAM_CONFDIR
+#else
+#define PAM_WATCH_CONFDIR "/etc/pam.d"
+#endif
+
+// A connection answered BUSY by the daemon, kept until its request arrives
+struct daemon_shed
+{
+  int fd;
+  uint64_t deadline_ms;
+};
+
+// A session attached to a shared bridge, listed until the bridge closes fd
+struct daemon_attached
+{
+  int fd;
+  int table_slot;
+  pid_t bridge_pid;
+};
+
+enum daemon_worker_state {
+  WORKER_FREE = 0,
+  WORKER_IDLE,
+  WORKER_BUSY,
+  WORKER_RETIRED, // an idle worker told to exit (PAM reload, hot upgrade)
+};
+
+struct daemon_worker {
+  pid_t pid;
+  int state;
+};
+
+struct supervised_session {
+  struct session_record rec;
+  int pidfd; // -1 if the worker had none
+  int reattach_fd; // the bridge's re-attach socket, -1 if it has none
+  int held[SESSION_MAX_HELD_FDS];
+  int nheld;
+};
+
+// A login taken from a control connection (protocol v4) until its worker
+// answered: the daemon keeps the client side of the bridge connection and
+// passes it on with the response. A lazy login stays until its upgrade.
+struct control_pending {
+  int conn;           // control connection to answer, -1 once it closed
+  uint32_t request_id;
+  int client_fd;      // our end of the bridge connection socketpair, -1 once relayed
+  int reply_fd;       // the worker's response arrives here (SOCK_SEQPACKET)
+  int upgrade;        // answered with PROTO_RESP_FLAG_UPGRADE; PROTO_CTL_UPGRADE is next
+};
+
+struct daemon_state {
+  pid_t pid;
+  int listen_fd;
+  int busy_rd;        // workers write their pid here once they accepted a connection
+  int busy_wr;
+  int inotify_fd;     // watches BRIDGE_DIR to refresh g_bridge_cache, -1 if unavailable
+  int inotify_wd;
+  int pam_wd[PAM_WATCH_MAX]; // PAM_WATCH_CONFDIR and the directories of the preloaded modules
+  int npam_wd;
+  int pool_size;
+  int max_workers;
+  int park_bridge;    // LINUXIO_AUTH_PARK_BRIDGE: each idle worker keeps a parked bridge
+  int supervise;      // LINUXIO_AUTH_SUPERVISE: workers hand live sessions to us
+  int sup_rd;         // session handoffs from workers (SOCK_SEQPACKET), -1 if off
+  int sup_wr;
+  int acct_rd;        // accounting events for the writer (SOCK_SEQPACKET), -1 if off
+  int acct_wr;
+  pid_t acct_pid;     // the accounting writer, 0 while none runs
+  int btmp_coalesce_ms; // LINUXIO_AUTH_BTMP_COALESCE_MS
+  int metrics_fd;     // LINUXIO_AUTH_METRICS_SOCKET listener, -1 if off
+  const char *metrics_path;
+  int control_fd;     // LINUXIO_AUTH_CONTROL_SOCKET listener, -1 if off
+  const char *control_path;
+  int dispatch_rd;    // control logins for idle workers (SOCK_SEQPACKET), -1 if off
+  int dispatch_wr;
+  int lazy_privilege; // LINUXIO_AUTH_LAZY_PRIVILEGE: control logins may be upgraded later
+  int control_conns[CONTROL_MAX_CONNS];
+  int ncontrol;
+  struct control_pending pending[CONTROL_MAX_PENDING];
+  int npending;
+  struct daemon_shed shed[DAEMON_SHED_MAX];
+  int nshed;
+  struct daemon_attached attached[DAEMON_ATTACHED_MAX];
+  int nattached;
+  int idle;
+  int busy;
+  uint64_t respawn_after_ms;
+  struct daemon_worker *workers;
+  struct supervised_session *sessions;
+  int nsessions;
+  int sessions_cap;
+};
+
+static void daemon_notify_status(const struct daemon_state *ds)
+{
+  if (ds->supervise)
+    (void)sd_notifyf(0, "STATUS=%d idle, %d busy auth workers (max %d), %d sessions",
+                     ds->idle, ds->busy, ds->max_workers, ds->nsessions);
+  else
+    (void)sd_notifyf(0, "STATUS=%d idle, %d busy auth workers (max %d)",
+                     ds->idle, ds->busy, ds->max_workers);
+}
+
+static struct daemon_worker *daemon_find_worker(struct daemon_state *ds, pid_t pid)
+{
+  for (int i = 0; i < ds->max_workers; i++)
+  {
+    if (ds->workers[i].state != WORKER_FREE && ds->workers[i].pid == pid)
+      return &ds->workers[i];
+  }
+  return NULL;
+}
+
+// No idle worker and no room for another one: a login would wait for a
+// busy worker to finish its session.
+static int daemon_full(const struct daemon_state *ds)
+{
+  return ds->idle == 0 && ds->busy >= ds->max_workers;
+}
+
+// Supervised sessions end when their last FIFO copy closes; children that
+// are not about to tear one down drop their inherited copies.
+static void daemon_drop_session_fds(const struct daemon_state *ds)
+{
+  for (int i = 0; i < ds->nsessions; i++)
+  {
+    if (ds->sessions[i].pidfd >= 0)
+      close(ds->sessions[i].pidfd);
+    if (ds->sessions[i].reattach_fd >= 0)
+      close(ds->sessions[i].reattach_fd);
+    for (int j = 0; j < ds->sessions[i].nheld; j++)
+      close(ds->sessions[i].held[j]);
+  }
+  for (int i = 0; i < ds->nattached; i++)
+    close(ds->attached[i].fd);
+}
+
+// Children other than the one a control login is dispatched to have no
+// business with the control socket or the logins in flight on it.
+static void daemon_drop_control_fds(const struct daemon_state *ds)
+{
+  if (ds->control_fd >= 0)
+    close(ds->control_fd);
+  if (ds->dispatch_wr >= 0)
+    close(ds->dispatch_wr);
+  for (int i = 0; i < ds->ncontrol; i++)
+    close(ds->control_conns[i]);
+  for (int i = 0; i < ds->npending; i++)
+  {
+    if (ds->pending[i].client_fd >= 0)
+      close(ds->pending[i].client_fd);
+    close(ds->pending[i].reply_fd);
+  }
+  for (int i = 0; i < ds->nshed; i++)
+    close(ds->shed[i].fd);
+}
+
+// Take one dispatched control login: its bridge connection end and the
+// socket the response goes to. Returns -1 if another worker was faster.
+static int daemon_take_dispatch(int sock, int *conn, int *reply)
+{
+  uint8_t tag;
+  union
+  {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } ctrl;
+  struct iovec iov = {.iov_base = &tag, .iov_len = sizeof(tag)};
+  struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1,
+                      .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)};
+  ssize_t n;
+  do
+  {
+    n = recvmsg(sock, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0)
+    return -1;
+
+  int fds[2] = {-1, -1};
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+  if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+  {
+    size_t len = cm->cmsg_len - CMSG_LEN(0);
+    memcpy(fds, CMSG_DATA(cm), len < sizeof(fds) ? len : sizeof(fds));
+  }
+  if (n == 1 && fds[0] >= 0 && fds[1] >= 0 && !(mh.msg_flags & MSG_CTRUNC))
+  {
+    *conn = fds[0];
+    *reply = fds[1];
+    return 0;
+  }
+  for (int i = 0; i < 2; i++)
+  {
+    if (fds[i] >= 0)
+      close(fds[i]);
+  }
+  return -1;
+}
+
+// Wait for a connection on the listening socket or a dispatched control
+// login. Returns -1 if another worker was faster. SIGTERM, blocked by the
+// caller, can end the worker only while it waits here.
+static int daemon_take_login(const struct daemon_state *ds, int *conn, int *reply)
+{
+  struct pollfd pfds[2] = {
+      {.fd = ds->listen_fd, .events = POLLIN, .revents = 0},
+      {.fd = ds->dispatch_rd, .events = POLLIN, .revents = 0},
+  };
+  sigset_t none;
+  sigemptyset(&none);
+  if (ppoll(pfds, ds->dispatch_rd >= 0 ? 2 : 1, NULL, &none) < 0)
+  {
+    if (errno == EINTR)
+      return -1;
+    journal_errorf("auth worker poll failed: %m");
+    _exit(1);
+  }
+  if ((pfds[1].revents & POLLIN) && daemon_take_dispatch(ds->dispatch_rd, conn, reply) == 0)
+    return 0;
+  if (pfds[1].revents & (POLLHUP | POLLERR))
+    _exit(0); // the daemon is gone
+  if (!(pfds[0].revents & POLLIN))
+    return -1;
+
+  *conn = accept4(ds->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+  if (*conn >= 0)
+    return 0;
+  if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN)
+    return -1;
+  journal_errorf("auth worker accept failed: %m");
+  _exit(1);
+}
+
+static __attribute__((noreturn)) void daemon_worker_main(const struct daemon_state *ds)
+{
+  sigset_t none;
+  sigemptyset(&none);
+  (void)sigprocmask(SIG_SETMASK, &none, NULL);
+  close(ds->busy_rd);
+  if (ds->inotify_fd >= 0)
+    close(ds->inotify_fd);
+  if (ds->sup_rd >= 0)
+    close(ds->sup_rd);
+  if (ds->acct_rd >= 0)
+    close(ds->acct_rd);
+  if (ds->metrics_fd >= 0)
+    close(ds->metrics_fd);
+  g_supervisor_fd = ds->sup_wr;
+  daemon_drop_session_fds(ds);
+  daemon_drop_control_fds(ds);
+
+  // An idle worker has nothing to protect; follow the daemon down.
+  (void)prctl(PR_SET_PDEATHSIG, SIGTERM);
+  if (getppid() != ds->pid)
+    _exit(0);
+
+  if (ds->park_bridge)
+    parked_bridge_spawn();
+
+  // The daemon retires idle workers with SIGTERM. One that took a login the
+  // daemon has not seen in the busy pipe yet must not die with it, so the
+  // signal is held from the moment a login may be taken until the pid is
+  // written; such a worker serves its login and exits like any other.
+  sigset_t term;
+  sigemptyset(&term);
+  sigaddset(&term, SIGTERM);
+  (void)sigprocmask(SIG_BLOCK, &term, NULL);
+
+  // The listening socket is non-blocking: whichever of the idle workers gets
+  // to a connection or a dispatched login first takes it. One admission
+  // control has no room for is answered and the worker waits again.
+  int conn;
+  int reply = -1;
+  for (;;)
+  {
+    if (daemon_take_login(ds, &conn, &reply) != 0)
+      continue;
+    if (admission_claim() == 0)
+      break;
+    admission_refuse(conn, reply);
+    reply = -1;
+  }
+
+  // A busy worker owns a login (and, after it, the bridge session). Like an
+  // Accept=yes instance it must outlive a daemon restart.
+  (void)prctl(PR_SET_PDEATHSIG, 0);
+  pid_t self = getpid();
+  (void)write_all(ds->busy_wr, &self, sizeof(self));
+  close(ds->busy_wr);
+  close(ds->listen_fd);
+  if (ds->dispatch_rd >= 0)
+    close(ds->dispatch_rd);
+  // A retire that raced the login is void: the daemon counts us busy now
+  const struct timespec zero = {.tv_sec = 0, .tv_nsec = 0};
+  while (sigtimedwait(&term, NULL, &zero) == SIGTERM)
+    ;
+  (void)sigprocmask(SIG_SETMASK, &none, NULL);
+
+  // Recreate the inetd-style layout: the connection is both stdin and stdout.
+  // A control login reads its request from the bridge connection too, but
+  // answers on the daemon's reply socket, which can also carry an upgrade.
+  g_upgrade.enabled = ds->lazy_privilege && reply >= 0;
+  if (reply < 0)
+    reply = conn;
+  if (dup2(conn, STDIN_FILENO) < 0 || dup2(reply, STDOUT_FILENO) < 0)
+    _exit(1);
+  if (conn != STDIN_FILENO && conn != STDOUT_FILENO)
+    close(conn);
+  if (reply != conn && reply != STDIN_FILENO && reply != STDOUT_FILENO)
+    close(reply);
+
+  _exit(serve_connection());
+}
+
+static int daemon_spawn_worker(struct daemon_state *ds)
+{
+  struct daemon_worker *slot = NULL;
+  for (int i = 0; !slot && i < ds->max_workers; i++)
+  {
+    if (ds->workers[i].state == WORKER_FREE)
+      slot = &ds->workers[i];
+  }
+  if (!slot)
+    return -1;
+
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    journal_errorf("failed to fork auth worker: %m");
+    return -1;
+  }
+  if (pid == 0)
+  {
+    g_admission_slot = (int)(slot - ds->workers);
+    daemon_worker_main(ds);
+  }
+
+  slot->pid = pid;
+  slot->state = WORKER_IDLE;
+  ds->idle++;
+  return 0;
+}
+
+// -------- metrics socket (daemon mode) --------
+// LINUXIO_AUTH_METRICS_SOCKET (empty disables it) serves g_metrics in the
+// Prometheus text format: connect and read to EOF. It is owned like the
+// auth socket (root:linuxio-bridge-socket 0660) and applies the same peer
+// check, so the webserver can scrape it and re-export the series.
+#define METRICS_SOCKET_DEFAULT "/run/linuxio/auth-metrics.sock"
+#define METRICS_RENDER_MAX     32768
+
+static const char *const metrics_result_names[METRICS_RESULT_SLOTS] = {
+    [PROTO_RESULT_OK] = "ok",
+    [PROTO_RESULT_AUTH_FAILED] = "auth_failed",
+    [PROTO_RESULT_PASSWORD_EXPIRED] = "password_expired",
+    [PROTO_RESULT_ACCESS_DENIED] = "access_denied",
+    [PROTO_RESULT_BAD_REQUEST] = "bad_request",
+    [PROTO_RESULT_INTERNAL_ERROR] = "internal_error",
+    [PROTO_RESULT_BRIDGE_ERROR] = "bridge_error",
+    [PROTO_RESULT_RATE_LIMITED] = "rate_limited",
+    [PROTO_RESULT_DEADLINE_EXCEEDED] = "deadline_exceeded",
+    [PROTO_RESULT_BUSY] = "busy",
+};
+
+static const char *const metrics_phase_names[PROTO_PHASE_COUNT] = {
+    [PROTO_PHASE_REQUEST_READ] = "request_read",
+    [PROTO_PHASE_PAM_AUTH] = "pam_auth",
+    [PROTO_PHASE_PAM_ACCT] = "pam_acct",
+    [PROTO_PHASE_PAM_SETCRED] = "pam_setcred",
+    [PROTO_PHASE_SUDO] = "sudo",
+    [PROTO_PHASE_BRIDGE_VALIDATE] = "bridge_validate",
+    [PROTO_PHASE_PAM_OPEN_SESSION] = "pam_open_session",
+    [PROTO_PHASE_FORK] = "fork",
+    [PROTO_PHASE_EXEC] = "exec",
+    [PROTO_PHASE_SEND_OK] = "send_ok",
+};
+
+static const char *const metrics_priv_names[METRICS_PRIV_SOURCES] = {
+    [METRICS_PRIV_SUDO] = "sudo",
+    [METRICS_PRIV_GROUPS] = "groups",
+    [METRICS_PRIV_CACHE] = "cache",
+};
+
+// Bucket bounds as Prometheus `le` labels (seconds), matching metrics_bucket_us
+static const char *const metrics_bucket_le[METRICS_BUCKETS] = {
+    "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025",
+    "0.05", "0.1", "0.25", "0.5", "1", "2.5", "5", "+Inf",
+};
+
+struct metrics_buf
+{
+  char *p;
+  size_t len;
+  size_t cap;
+};
+
+static void metrics_printf(struct metrics_buf *b, const char *fmt, ...)
+{
+  if (b->len >= b->cap)
+    return;
+  va_list ap;
+  va_start(ap, fmt);
+  int n = safe_vsnprintf(b->p + b->len, b->cap - b->len, fmt, ap);
+  va_end(ap);
+  if (n > 0)
+    b->len = (size_t)n < b->cap - b->len ? b->len + (size_t)n : b->cap;
+}
+
+static uint64_t metrics_load(const uint64_t *v)
+{
+  return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+static void metrics_header(struct metrics_buf *b, const char *name, const char *type,
+                           const char *help)
+{
+  metrics_printf(b, "# HELP linuxio_auth_%s %s\n# TYPE linuxio_auth_%s %s\n",
+                 name, help, name, type);
+}
+
+static void metrics_render_histogram(struct metrics_buf *b, const char *name, const char *labels,
+                                     const struct metrics_histogram *h)
+{
+  const char *sep = labels[0] ? "," : "";
+  uint64_t cumulative = 0;
+  for (int i = 0; i < METRICS_BUCKETS; i++)
+  {
+    cumulative += metrics_load(&h->buckets[i]);
+    metrics_printf(b, "linuxio_auth_%s_bucket{%s%sle=\"%s\"} %llu\n", name, labels, sep,
+                   metrics_bucket_le[i], (unsigned long long)cumulative);
+  }
+  uint64_t sum_us = metrics_load(&h->sum_us);
+  const char *lbrace = labels[0] ? "{" : "";
+  const char *rbrace = labels[0] ? "}" : "";
+  metrics_printf(b, "linuxio_auth_%s_sum%s%s%s %llu.%06llu\n", name, lbrace, labels, rbrace,
+                 (unsigned long long)(sum_us / 1000000u), (unsigned long long)(sum_us % 1000000u));
+  metrics_printf(b, "linuxio_auth_%s_count%s%s%s %llu\n", name, lbrace, labels, rbrace,
+                 (unsigned long long)metrics_load(&h->count));
+}
+
+static size_t metrics_render(const struct daemon_state *ds, char *out, size_t cap)
+{
+  struct metrics_buf b = {.p = out, .len = 0, .cap = cap};
+  const struct auth_metrics *m = g_metrics;
+
+  metrics_header(&b, "requests_total", "counter", "Auth requests answered, by result.");
+  for (int i = 0; i < METRICS_RESULT_SLOTS; i++)
+  {
+    if (metrics_result_names[i])
+      metrics_printf(&b, "linuxio_auth_requests_total{result=\"%s\"} %llu\n",
+                     metrics_result_names[i], (unsigned long long)metrics_load(&m->results[i]));
+  }
+  metrics_header(&b, "logins_total", "counter", "Successful logins, by bridge mode.");
+  metrics_printf(&b, "linuxio_auth_logins_total{mode=\"privileged\"} %llu\n",
+                 (unsigned long long)metrics_load(&m->logins_privileged));
+  metrics_printf(&b, "linuxio_auth_logins_total{mode=\"unprivileged\"} %llu\n",
+                 (unsigned long long)metrics_load(&m->logins_unprivileged));
+  metrics_header(&b, "privilege_decisions_total", "counter",
+                 "Privilege decisions, by what made them.");
+  for (int i = 0; i < METRICS_PRIV_SOURCES; i++)
+    metrics_printf(&b, "linuxio_auth_privilege_decisions_total{source=\"%s\"} %llu\n",
+                   metrics_priv_names[i], (unsigned long long)metrics_load(&m->priv_decisions[i]));
+  metrics_header(&b, "sudo_probe_timeouts_total", "counter",
+                 "sudo -v probes killed at LINUXIO_SUDO_TIMEOUT_PASSWORD.");
+  metrics_printf(&b, "linuxio_auth_sudo_probe_timeouts_total %llu\n",
+                 (unsigned long long)metrics_load(&m->sudo_probe_timeouts));
+  metrics_header(&b, "sudo_probe_duration_seconds", "histogram", "Duration of sudo -v probes.");
+  metrics_render_histogram(&b, "sudo_probe_duration_seconds", "", &m->sudo_probe);
+  metrics_header(&b, "bridge_exec_failures_total", "counter",
+                 "Bridges that failed to spawn or exec.");
+  metrics_printf(&b, "linuxio_auth_bridge_exec_failures_total %llu\n",
+                 (unsigned long long)metrics_load(&m->bridge_exec_failures));
+  metrics_header(&b, "bridge_start_timeouts_total", "counter",
+                 "Bridges that did not exec within the start timeout.");
+  metrics_printf(&b, "linuxio_auth_bridge_start_timeouts_total %llu\n",
+                 (unsigned long long)metrics_load(&m->bridge_start_timeouts));
+  metrics_header(&b, "shared_bridge_logins_total", "counter",
+                 "Logins served by a shared bridge instead of a new one.");
+  metrics_printf(&b, "linuxio_auth_shared_bridge_logins_total %llu\n",
+                 (unsigned long long)metrics_load(&m->shared_bridge_logins));
+  metrics_header(&b, "privilege_upgrades_total", "counter",
+                 "Lazy logins whose unprivileged bridge was replaced by a privileged one.");
+  metrics_printf(&b, "linuxio_auth_privilege_upgrades_total %llu\n",
+                 (unsigned long long)metrics_load(&m->privilege_upgrades));
+
+  metrics_header(&b, "workers", "gauge", "Auth workers, by state.");
+  metrics_printf(&b, "linuxio_auth_workers{state=\"idle\"} %d\n", ds->idle);
+  metrics_printf(&b, "linuxio_auth_workers{state=\"busy\"} %d\n", ds->busy);
+  metrics_header(&b, "workers_max", "gauge", "LINUXIO_AUTH_MAX_WORKERS.");
+  metrics_printf(&b, "linuxio_auth_workers_max %d\n", ds->max_workers);
+  if (g_admission)
+  {
+    metrics_header(&b, "logins_in_flight", "gauge", "Logins taken by a worker and not yet answered.");
+    metrics_printf(&b, "linuxio_auth_logins_in_flight %d\n", admission_inflight());
+    metrics_header(&b, "logins_in_flight_max", "gauge", "LINUXIO_AUTH_MAX_INFLIGHT.");
+    metrics_printf(&b, "linuxio_auth_logins_in_flight_max %d\n", g_admission->limit);
+  }
+  if (ds->supervise)
+  {
+    metrics_header(&b, "sessions", "gauge", "Live sessions supervised by the daemon.");
+    metrics_printf(&b, "linuxio_auth_sessions %d\n", ds->nsessions);
+  }
+
+  metrics_header(&b, "phase_duration_seconds", "histogram", "Login latency, by phase.");
+  for (int i = 0; i < PROTO_PHASE_COUNT; i++)
+  {
+    char labels[48];
+    (void)safe_snprintf(labels, sizeof(labels), "phase=\"%s\"", metrics_phase_names[i]);
+    metrics_render_histogram(&b, "phase_duration_seconds", labels, &m->phases[i]);
+  }
+  return b.len;
+}
+
+// Listen on path, owned like the auth socket (root:linuxio-bridge-socket
+// 0660); connections get the same peer check. what names it in the journal.
+static int daemon_socket_open(const char *path, int type, const char *what)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  int n = safe_snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+  if (n < 0 || (size_t)n >= sizeof(addr.sun_path))
+  {
+    journal_errorf("%s socket path too long: %s", what, path);
+    return -1;
+  }
+  gid_t gid;
+  int have_gid = auth_socket_gid(0, &gid) == 0;
+  int fd = socket(AF_UNIX, type | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (fd < 0)
+  {
+    journal_errorf("failed to create %s socket: %m", what);
+    return -1;
+  }
+  (void)unlink(path);
+  mode_t old_umask = umask(0177);
+  int rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(old_umask);
+  if (rc != 0 || (have_gid && (chown(path, 0, gid) != 0 || chmod(path, 0660) != 0)) ||
+      listen(fd, 8) != 0)
+  {
+    journal_errorf("failed to set up %s socket %s: %m", what, path);
+    close(fd);
+    (void)unlink(path);
+    return -1;
+  }
+  return fd;
+}
+
+static void metrics_serve(const struct daemon_state *ds, int listen_fd)
+{
+  static char out[METRICS_RENDER_MAX];
+  for (;;)
+  {
+    int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (conn < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return;
+    }
+    if (check_peer_creds(conn) == 0)
+    {
+      // Far below the socket buffer; a scraper that stalls just gets less
+      size_t len = metrics_render(ds, out, sizeof(out));
+      (void)send(conn, out, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    close(conn);
+  }
+}
+
+// -------- control socket (daemon mode, protocol v4) --------
+// LINUXIO_AUTH_CONTROL_SOCKET (empty disables it) takes long-lived
+// SOCK_SEQPACKET connections from the webserver, each carrying any number
+// of logins tagged with request IDs (see linuxio_protocol.h). The daemon
+// only frames and routes: every login gets a stream socketpair for its
+// bridge connection, with the request already written into it, and a reply
+// socket. Both go to an idle worker over the dispatch socket, and the
+// worker serves the login exactly as an accepted connection. Its response
+// is relayed with the client end of the pair attached, so the webserver
+// never connects per login and logins finish in whatever order PAM lets
+// them.
+
+static void control_frame_header(uint8_t *frame, uint8_t type, uint32_t request_id)
+{
+  frame[0] = PROTO_MAGIC_0;
+  frame[1] = PROTO_MAGIC_1;
+  frame[2] = PROTO_MAGIC_2;
+  frame[3] = PROTO_CONTROL_VERSION;
+  frame[4] = type;
+  frame[5] = frame[6] = frame[7] = 0;
+  write_u32_be(frame + 8, request_id);
+}
+
+// Send one frame of type (PROTO_CTL_RESPONSE or PROTO_CTL_UPGRADE) with fd
+// (if >= 0) attached. A connection that cannot take it is shut down, so the
+// webserver learns that its answers are lost instead of waiting for them.
+static void control_send(int conn, uint8_t type, uint32_t request_id, const uint8_t *resp,
+                         size_t len, int fd)
+{
+  uint8_t frame[PROTO_CONTROL_MAX_FRAME];
+  if (len > sizeof(frame) - PROTO_CONTROL_HEADER_SIZE)
+  {
+    (void)shutdown(conn, SHUT_RDWR);
+    return;
+  }
+  control_frame_header(frame, type, request_id);
+  memcpy(frame + PROTO_CONTROL_HEADER_SIZE, resp, len);
+  if (send_with_fd(conn, frame, PROTO_CONTROL_HEADER_SIZE + len, fd) != 0)
+    (void)shutdown(conn, SHUT_RDWR);
+}
+
+// Answer a login the daemon could not hand to a worker.
+static void control_send_error(int conn, uint32_t request_id, uint8_t result_code,
+                               const char *error)
+{
+  uint8_t resp[PROTO_AUTH_RESP_HEADER_SIZE + 2 + PROTO_MAX_ERROR];
+  size_t len = strlen(error);
+  if (len > PROTO_MAX_ERROR)
+    len = PROTO_MAX_ERROR;
+  resp[0] = PROTO_MAGIC_0;
+  resp[1] = PROTO_MAGIC_1;
+  resp[2] = PROTO_MAGIC_2;
+  resp[3] = PROTO_VERSION;
+  resp[4] = PROTO_STATUS_ERROR;
+  resp[5] = 0;
+  resp[6] = result_code;
+  resp[7] = 0;
+  write_u16_be(resp + PROTO_AUTH_RESP_HEADER_SIZE, (uint16_t)len);
+  memcpy(resp + PROTO_AUTH_RESP_HEADER_SIZE + 2, error, len);
+  if (result_code < METRICS_RESULT_SLOTS)
+    METRICS_ADD(results[result_code], 1);
+  control_send(conn, PROTO_CTL_RESPONSE, request_id, resp, PROTO_AUTH_RESP_HEADER_SIZE + 2 + len,
+               -1);
+}
+
+static void control_accept(struct daemon_state *ds)
+{
+  for (;;)
+  {
+    int conn = accept4(ds->control_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (conn < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return;
+    }
+    if (ds->ncontrol >= CONTROL_MAX_CONNS)
+    {
+      journal_errorf("control connection refused: %d already open", ds->ncontrol);
+      close(conn);
+      continue;
+    }
+    if (check_peer_creds(conn) != 0)
+    {
+      close(conn);
+      continue;
+    }
+    ds->control_conns[ds->ncontrol++] = conn;
+  }
+}
+
+// Logins still in flight on a closed connection run to completion; their
+// bridge connection is closed instead of relayed, which ends the bridge.
+static void control_close(struct daemon_state *ds, int i)
+{
+  int conn = ds->control_conns[i];
+  for (int k = 0; k < ds->npending; k++)
+  {
+    if (ds->pending[k].conn == conn)
+      ds->pending[k].conn = -1;
+  }
+  close(conn);
+  ds->control_conns[i] = ds->control_conns[--ds->ncontrol];
+}
+
+// Hand one login to the worker pool. req is a complete auth request; the
+// worker validates it like any other.
+static void control_dispatch(struct daemon_state *ds, int conn, uint32_t request_id,
+                             const uint8_t *req, size_t len)
+{
+  if (ds->npending >= CONTROL_MAX_PENDING || daemon_full(ds) || admission_full())
+  {
+    uint8_t resp[ADMISSION_RESPONSE_SIZE];
+    size_t n = admission_busy_response(resp);
+    control_send(conn, PROTO_CTL_RESPONSE, request_id, resp, n, -1);
+    return;
+  }
+
+  int client[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, client) != 0)
+  {
+    journal_errorf("failed to create bridge connection for control login: %m");
+    control_send_error(conn, request_id, PROTO_RESULT_INTERNAL_ERROR,
+                       "failed to create bridge connection");
+    return;
+  }
+  int reply[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, reply) != 0)
+  {
+    journal_errorf("failed to create reply socket for control login: %m");
+    close(client[0]);
+    close(client[1]);
+    control_send_error(conn, request_id, PROTO_RESULT_INTERNAL_ERROR,
+                       "failed to create bridge connection");
+    return;
+  }
+
+  // Far below the socket buffer, so this never blocks
+  static const uint8_t tag = 0;
+  int worker_fds[2] = {client[0], reply[0]};
+  int ok = write_all(client[1], req, len) == 0 &&
+           send_with_fds(ds->dispatch_wr, &tag, sizeof(tag), worker_fds, 2) == 0;
+  close(client[0]);
+  close(reply[0]);
+  if (!ok)
+  {
+    journal_errorf("failed to dispatch control login: %m");
+    close(client[1]);
+    close(reply[1]);
+    control_send_error(conn, request_id, PROTO_RESULT_INTERNAL_ERROR, "failed to dispatch login");
+    return;
+  }
+  (void)fcntl(reply[1], F_SETFL, O_NONBLOCK);
+  ds->pending[ds->npending++] = (struct control_pending){
+      .conn = conn,
+      .request_id = request_id,
+      .client_fd = client[1],
+      .reply_fd = reply[1],
+  };
+}
+
+// Read the frames queued on control connection i.
+static void control_read(struct daemon_state *ds, int i)
+{
+  int conn = ds->control_conns[i];
+  uint8_t frame[PROTO_CONTROL_MAX_FRAME];
+  for (;;)
+  {
+    // MSG_TRUNC: the real size of an oversized frame, so it is not taken
+    // for a shorter one
+    ssize_t n = recv(conn, frame, sizeof(frame), MSG_DONTWAIT | MSG_TRUNC);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      break;
+    if (n < PROTO_CONTROL_HEADER_SIZE || (size_t)n > sizeof(frame) ||
+        frame[0] != PROTO_MAGIC_0 || frame[1] != PROTO_MAGIC_1 || frame[2] != PROTO_MAGIC_2 ||
+        frame[3] != PROTO_CONTROL_VERSION)
+    {
+      if (n > 0)
+        journal_errorf("malformed control frame, closing the connection");
+      control_close(ds, i);
+      break;
+    }
+    uint32_t request_id = read_u32_be(frame + 8);
+    if (frame[4] == PROTO_CTL_LOGIN)
+      control_dispatch(ds, conn, request_id, frame + PROTO_CONTROL_HEADER_SIZE,
+                       (size_t)n - PROTO_CONTROL_HEADER_SIZE);
+    else
+      control_send_error(conn, request_id, PROTO_RESULT_BAD_REQUEST, "unknown control frame type");
+  }
+  // The frame held a password
+  secure_bzero(frame, sizeof(frame));
+}
+
+// Relay the response of pending login k, with its bridge connection if the
+// login succeeded. A worker that exited without answering leaves EOF. After
+// a response announcing an upgrade, the next message (EOF: none) is relayed
+// as the PROTO_CTL_UPGRADE, with the privileged bridge's connection the
+// worker attached to it.
+static void control_relay(struct daemon_state *ds, int k)
+{
+  struct control_pending *p = &ds->pending[k];
+  uint8_t resp[PROTO_CONTROL_MAX_FRAME - PROTO_CONTROL_HEADER_SIZE];
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } ctrl;
+  struct iovec iov = {.iov_base = resp, .iov_len = sizeof(resp)};
+  struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1,
+                      .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)};
+  ssize_t n;
+  do
+  {
+    n = recvmsg(p->reply_fd, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0 && errno == EAGAIN)
+    return;
+  int fd = -1;
+  struct cmsghdr *cm = n > 0 ? CMSG_FIRSTHDR(&mh) : NULL;
+  if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS &&
+      cm->cmsg_len == CMSG_LEN(sizeof(int)))
+    memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+
+  int ok = n >= PROTO_AUTH_RESP_HEADER_SIZE && resp[4] == PROTO_STATUS_OK;
+  if (p->upgrade)
+  {
+    if (p->conn >= 0)
+    {
+      if (ok && fd >= 0)
+        control_send(p->conn, PROTO_CTL_UPGRADE, p->request_id, resp, (size_t)n, fd);
+      else
+        control_send(p->conn, PROTO_CTL_UPGRADE, p->request_id, resp, 0, -1);
+    }
+    p->upgrade = 0;
+  }
+  else
+  {
+    if (p->conn >= 0)
+    {
+      if (n >= PROTO_AUTH_RESP_HEADER_SIZE)
+        control_send(p->conn, PROTO_CTL_RESPONSE, p->request_id, resp, (size_t)n,
+                     ok ? p->client_fd : -1);
+      else
+        control_send_error(p->conn, p->request_id, PROTO_RESULT_INTERNAL_ERROR,
+                           "auth worker exited without a response");
+    }
+    close(p->client_fd);
+    p->client_fd = -1;
+    p->upgrade = ok && (resp[7] & PROTO_RESP_FLAG_UPGRADE) != 0;
+  }
+  if (fd >= 0)
+    close(fd);
+  if (p->upgrade)
+    return;
+  close(p->reply_fd);
+  ds->pending[k] = ds->pending[--ds->npending];
+}
+
+// Set up the control socket and the dispatch socket the workers share.
+static void control_open(struct daemon_state *ds)
+{
+  int disp[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, disp) != 0)
+  {
+    journal_errorf("control socket unavailable: %m");
+    return;
+  }
+  ds->control_fd = daemon_socket_open(ds->control_path, SOCK_SEQPACKET, "control");
+  if (ds->control_fd < 0)
+  {
+    close(disp[0]);
+    close(disp[1]);
+    return;
+  }
+  ds->dispatch_rd = disp[0];
+  ds->dispatch_wr = disp[1];
+}
 
-  if (preserve_lang && valid_locale(preserve_lang))
+static void control_shutdown(struct daemon_state *ds)
+{
+  if (ds->control_fd < 0)
+    return;
+  daemon_drop_control_fds(ds);
+  close(ds->dispatch_rd);
+  (void)unlink(ds->control_path);
+  ds->control_fd = ds->dispatch_rd = ds->dispatch_wr = -1;
+  ds->ncontrol = ds->npending = 0;
+}
+
+// -------- accounting writer (daemon mode) --------
+// One child of the daemon owns the accounting files for all workers (see
+// acct_flush()). It drains whatever events are queued, applies them as one
+// batch and sleeps again, so a login burst costs one lock round per file
+// rather than one per login. Failed logins may be held back for
+// LINUXIO_AUTH_BTMP_COALESCE_MS so a brute-force burst from one host
+// collapses into a few btmp records. On SIGTERM (or when the daemon dies)
+// it shuts the socket for reading, so late senders fall back to writing
+// themselves, and flushes what it already has.
+static size_t acct_drain(int fd, struct acct_event *ev, size_t *n, size_t max)
+{
+  size_t got = 0;
+  while (*n + ACCT_QUEUE_MAX <= max)
   {
-    safe_snprintf(safe_lang, sizeof(safe_lang), "%s", preserve_lang);
+    ssize_t r = recv(fd, ev + *n, ACCT_QUEUE_MAX * sizeof(*ev), MSG_DONTWAIT);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      break;
+    size_t count = (size_t)r / sizeof(*ev);
+    for (size_t i = 0; i < count; i++)
+    {
+      ev[*n + i].user[sizeof(ev->user) - 1] = '\0';
+      ev[*n + i].remote_host[sizeof(ev->remote_host) - 1] = '\0';
+    }
+    *n += count;
+    got += count;
   }
+  return got;
+}
 
-  if (preserve_term && *preserve_term)
+static __attribute__((noreturn)) void acct_writer_main(const struct daemon_state *ds)
+{
+  close(ds->listen_fd);
+  close(ds->busy_rd);
+  close(ds->busy_wr);
+  if (ds->inotify_fd >= 0)
+    close(ds->inotify_fd);
+  if (ds->sup_rd >= 0)
+    close(ds->sup_rd);
+  if (ds->sup_wr >= 0)
+    close(ds->sup_wr);
+  close(ds->acct_wr);
+  if (ds->metrics_fd >= 0)
+    close(ds->metrics_fd);
+  if (ds->dispatch_rd >= 0)
+    close(ds->dispatch_rd);
+  g_acct_fd = -1;
+  daemon_drop_session_fds(ds);
+  daemon_drop_control_fds(ds);
+  bridge_cache_clear();
+
+  // SIGTERM/SIGINT stay blocked from the daemon; take them via a signalfd
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGINT);
+  int sfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+  (void)prctl(PR_SET_PDEATHSIG, SIGTERM);
+  int stopping = sfd < 0 || getppid() != ds->pid;
+
+  struct acct_writer w;
+  acct_writer_open(&w);
+  struct acct_event batch[ACCT_BATCH_MAX];
+  struct acct_event failed[ACCT_BATCH_MAX];
+  size_t nbatch = 0;
+  size_t nfailed = 0;
+  uint64_t failed_due_ms = 0;
+
+  for (;;)
   {
-    // TERM should be simple and safe - just alphanumeric and dash
-    int valid = 1;
-    for (const char *p = preserve_term; *p && valid; p++)
+    if (!stopping)
     {
-      char c = *p;
-      if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
-            (c >= '0' && c <= '9') || c == '-'))
-        valid = 0;
+      int timeout = -1;
+      if (nfailed > 0)
+      {
+        uint64_t now = monotonic_ms();
+        timeout = failed_due_ms > now ? (int)(failed_due_ms - now) : 0;
+      }
+      struct pollfd pfds[2] = {
+          {.fd = ds->acct_rd, .events = POLLIN, .revents = 0},
+          {.fd = sfd, .events = POLLIN, .revents = 0},
+      };
+      if (poll(pfds, 2, timeout) < 0 && errno != EINTR)
+        stopping = 1;
+      if (pfds[1].revents & POLLIN)
+        stopping = 1;
     }
-    if (valid && strlen(preserve_term) < sizeof(safe_term))
-      safe_snprintf(safe_term, sizeof(safe_term), "%s", preserve_term);
+    if (stopping)
+      (void)shutdown(ds->acct_rd, SHUT_RD);
+
+    // Drain in rounds: a full batch is written before reading more
+    for (;;)
+    {
+      struct acct_event in[ACCT_BATCH_MAX];
+      size_t nin = 0;
+      if (acct_drain(ds->acct_rd, in, &nin, ACCT_BATCH_MAX) == 0)
+        break;
+      for (size_t i = 0; i < nin; i++)
+      {
+        if (in[i].kind == ACCT_FAILED && ds->btmp_coalesce_ms > 0)
+        {
+          if (nfailed == 0)
+            failed_due_ms = monotonic_ms() + (uint64_t)ds->btmp_coalesce_ms;
+          failed[nfailed++] = in[i];
+          if (nfailed == ACCT_BATCH_MAX)
+          {
+            acct_apply(&w, failed, nfailed, 1);
+            nfailed = 0;
+          }
+        }
+        else
+        {
+          batch[nbatch++] = in[i];
+          if (nbatch == ACCT_BATCH_MAX)
+          {
+            acct_apply(&w, batch, nbatch, 0);
+            nbatch = 0;
+          }
+        }
+      }
+    }
+    if (nbatch > 0)
+      acct_apply(&w, batch, nbatch, 0);
+    nbatch = 0;
+    if (nfailed > 0 && (stopping || monotonic_ms() >= failed_due_ms))
+    {
+      acct_apply(&w, failed, nfailed, 1);
+      nfailed = 0;
+    }
+    if (stopping)
+      break;
+  }
+  acct_writer_close(&w);
+  _exit(0);
+}
+
+static void daemon_spawn_acct_writer(struct daemon_state *ds)
+{
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    journal_errorf("failed to fork accounting writer; workers write login records themselves: %m");
+    return;
+  }
+  if (pid == 0)
+    acct_writer_main(ds);
+  ds->acct_pid = pid;
+}
+
+#define BRIDGE_WATCH_MASK \
+  (IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+   IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static void daemon_refresh_bridge(void)
+{
+  if (bridge_cache_refresh() != 0)
+    journal_errorf("bridge validation failed; workers will validate on every login");
+}
+
+static void daemon_watch_bridge(struct daemon_state *ds)
+{
+  ds->inotify_wd = -1;
+  ds->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (ds->inotify_fd < 0)
+    return;
+  // The PAM watches share the fd; without the bridge watch,
+  // daemon_replenish() falls back to its cheap check.
+  ds->inotify_wd = inotify_add_watch(ds->inotify_fd, BRIDGE_DIR, BRIDGE_WATCH_MASK);
+}
+
+#define PAM_WATCH_MASK \
+  (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+   IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static void daemon_add_pam_watch(struct daemon_state *ds, const char *dir)
+{
+  if (ds->npam_wd >= PAM_WATCH_MAX)
+    return;
+  int wd = inotify_add_watch(ds->inotify_fd, dir, PAM_WATCH_MASK);
+  if (wd < 0)
+    return;
+  // Watching a directory twice returns the same descriptor
+  for (int i = 0; i < ds->npam_wd; i++)
+  {
+    if (ds->pam_wd[i] == wd)
+      return;
+  }
+  ds->pam_wd[ds->npam_wd++] = wd;
+}
+
+static int pam_module_dir_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+  (void)size;
+  const char *slash = info->dlpi_name ? strrchr(info->dlpi_name, '/') : NULL;
+  if (!slash || strncmp(slash + 1, "pam_", 4) != 0)
+    return 0;
+  char dir[PATH_MAX];
+  size_t len = (size_t)(slash - info->dlpi_name);
+  if (len == 0 || len >= sizeof(dir))
+    return 0;
+  memcpy(dir, info->dlpi_name, len);
+  dir[len] = '\0';
+  daemon_add_pam_watch(data, dir);
+  return 0;
+}
+
+// Watch the PAM configuration and, so that a module upgrade is picked up as
+// well, every directory a preloaded module was loaded from.
+static void daemon_watch_pam(struct daemon_state *ds)
+{
+  ds->npam_wd = 0;
+  if (ds->inotify_fd < 0 || !g_pam_preload)
+    return;
+  daemon_add_pam_watch(ds, PAM_WATCH_CONFDIR);
+  (void)dl_iterate_phdr(pam_module_dir_cb, ds);
+}
+
+static int daemon_is_pam_wd(const struct daemon_state *ds, int wd)
+{
+  for (int i = 0; i < ds->npam_wd; i++)
+  {
+    if (ds->pam_wd[i] == wd)
+      return 1;
+  }
+  return 0;
+}
+
+static void daemon_mark_busy(struct daemon_state *ds)
+{
+  pid_t pids[64];
+  ssize_t n;
+  do
+  {
+    n = read(ds->busy_rd, pids, sizeof(pids));
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0)
+    return;
+
+  for (size_t i = 0; i < (size_t)n / sizeof(pid_t); i++)
+  {
+    struct daemon_worker *w = daemon_find_worker(ds, pids[i]);
+    // The worker may already have been reaped if it finished very quickly.
+    // A retired one took its login before it saw the SIGTERM and serves it;
+    // it no longer counts as idle.
+    if (!w || (w->state != WORKER_IDLE && w->state != WORKER_RETIRED))
+      continue;
+    if (w->state == WORKER_IDLE)
+      ds->idle--;
+    w->state = WORKER_BUSY;
+    ds->busy++;
+  }
+}
+
+// Stop the idle workers; daemon_replenish() forks fresh ones. Workers that
+// took a login since the last poll are counted busy first. One that took a
+// login only now keeps it: it holds SIGTERM until its pid is in the busy
+// pipe (see daemon_worker_main()).
+static void daemon_retire_idle_workers(struct daemon_state *ds)
+{
+  struct pollfd pfd = {.fd = ds->busy_rd, .events = POLLIN, .revents = 0};
+  while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN))
+    daemon_mark_busy(ds);
+
+  for (int i = 0; i < ds->max_workers; i++)
+  {
+    struct daemon_worker *w = &ds->workers[i];
+    if (w->state != WORKER_IDLE)
+      continue;
+    (void)kill(w->pid, SIGTERM);
+    w->state = WORKER_RETIRED;
+    ds->idle--;
+  }
+}
+
+// Reload the preloaded PAM stack, then retire the idle workers forked with
+// the old one: dlopen() would hand them the stale modules they inherited.
+static void daemon_reload_pam(struct daemon_state *ds)
+{
+  if (!g_pam_preload || pam_preload() != 0)
+    return;
+  daemon_watch_pam(ds);
+  daemon_retire_idle_workers(ds);
+  const struct journal_field fields[] = {{"LINUXIO_PAM_CONFDIR", PAM_WATCH_CONFDIR}};
+  journal_info_fieldsf(fields, 1, "PAM stack reloaded");
+}
+
+// Drain inotify. Refresh the bridge cache if the binary or its directory
+// changed; idle workers keep their inherited copy, its cheap check fails on
+// their next login and they fall back to full validation. Reload the PAM
+// stack if its configuration or a module directory changed.
+static void daemon_inotify_events(struct daemon_state *ds)
+{
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int changed = 0;
+  int rewatch = 0;
+  int pam_changed = 0;
+  for (;;)
+  {
+    ssize_t n = read(ds->inotify_fd, buf, sizeof(buf));
+    if (n <= 0)
+      break;
+    for (char *p = buf; p < buf + n;)
+    {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW)
+      {
+        changed = 1;
+        pam_changed = 1;
+        continue;
+      }
+      if (daemon_is_pam_wd(ds, ev->wd))
+      {
+        pam_changed = 1;
+        continue;
+      }
+      if (ev->wd != ds->inotify_wd)
+        continue;
+      if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+        changed = 1;
+      if (ev->mask & IN_IGNORED)
+        rewatch = 1;
+      if (ev->len == 0 || strcmp(ev->name, BRIDGE_BASENAME) == 0)
+        changed = 1;
+    }
+  }
+
+  if (rewatch)
+    ds->inotify_wd = inotify_add_watch(ds->inotify_fd, BRIDGE_DIR, BRIDGE_WATCH_MASK);
+  if (changed)
+    daemon_refresh_bridge();
+  if (pam_changed)
+    daemon_reload_pam(ds);
+}
+
+static void daemon_replenish(struct daemon_state *ds)
+{
+  if (ds->respawn_after_ms != 0 && monotonic_ms() < ds->respawn_after_ms)
+    return;
+  ds->respawn_after_ms = 0;
+
+  // Without inotify, fall back to a cheap check before handing the cache to
+  // new workers.
+  if (ds->idle < ds->pool_size && (ds->inotify_fd < 0 || ds->inotify_wd < 0) &&
+      bridge_cache_check() != 0)
+    daemon_refresh_bridge();
+
+  if (ds->acct_rd >= 0 && ds->acct_pid == 0)
+    daemon_spawn_acct_writer(ds);
+
+  while (ds->idle < ds->pool_size && ds->idle + ds->busy < ds->max_workers)
+  {
+    if (daemon_spawn_worker(ds) != 0)
+    {
+      ds->respawn_after_ms = monotonic_ms() + DAEMON_RESPAWN_BACKOFF_MS;
+      break;
+    }
+  }
+}
+
+// While the daemon is full it watches the listening socket itself and
+// answers every connection there with PROTO_RESULT_BUSY, without blocking.
+// One whose request is still on its way lingers in ds->shed; with no room
+// left there the one closest to giving up makes room.
+static void daemon_shed_logins(struct daemon_state *ds)
+{
+  for (;;)
+  {
+    int conn = accept4(ds->listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (conn < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return;
+    }
+    if (admission_shed(conn) == 0)
+      continue;
+    struct daemon_shed *sh = &ds->shed[ds->nshed];
+    if (ds->nshed == DAEMON_SHED_MAX)
+    {
+      sh = &ds->shed[0];
+      for (int i = 1; i < ds->nshed; i++)
+      {
+        if (ds->shed[i].deadline_ms < sh->deadline_ms)
+          sh = &ds->shed[i];
+      }
+      close(sh->fd);
+    }
+    else
+    {
+      ds->nshed++;
+    }
+    *sh = (struct daemon_shed){.fd = conn, .deadline_ms = monotonic_ms() + ADMISSION_DRAIN_MS};
+  }
+}
+
+// Close lingering connections whose request arrived (revents set) or whose
+// wait is over; all of them when all is set.
+static void daemon_shed_expire(struct daemon_state *ds, const struct pollfd *pfds, int all)
+{
+  uint64_t now = monotonic_ms();
+  for (int i = ds->nshed - 1; i >= 0; i--)
+  {
+    struct daemon_shed *sh = &ds->shed[i];
+    if (!all && !(pfds && pfds[i].revents) && now < sh->deadline_ms)
+      continue;
+    (void)admission_drain(sh->fd);
+    close(sh->fd);
+    *sh = ds->shed[--ds->nshed];
+  }
+}
+
+// Poll timeout that wakes the loop for the first lingering connection due.
+static int daemon_shed_timeout(const struct daemon_state *ds, int timeout)
+{
+  uint64_t now = monotonic_ms();
+  for (int i = 0; i < ds->nshed; i++)
+  {
+    int left = ds->shed[i].deadline_ms > now ? (int)(ds->shed[i].deadline_ms - now) : 0;
+    if (timeout < 0 || left < timeout)
+      timeout = left;
+  }
+  return timeout;
+}
+
+// -------- supervised sessions (LINUXIO_AUTH_SUPERVISE) --------
+// Sessions handed over by workers (see supervisor_register()). The bridge is
+// our child once its worker has exited, so its exit shows up in
+// daemon_reap() with a status. The teardown runs in a short-lived child so
+// PAM modules are never loaded into the daemon itself.
+static int daemon_find_session(const struct daemon_state *ds, pid_t bridge_pid)
+{
+  for (int i = 0; i < ds->nsessions; i++)
+  {
+    if (ds->sessions[i].rec.bridge_pid == bridge_pid)
+      return i;
+  }
+  return -1;
+}
+
+static void session_release_fds(struct supervised_session *s)
+{
+  if (s->pidfd >= 0)
+    close(s->pidfd);
+  s->pidfd = -1;
+  if (s->reattach_fd >= 0)
+    close(s->reattach_fd);
+  s->reattach_fd = -1;
+  for (int i = 0; i < s->nheld; i++)
+    close(s->held[i]);
+  s->nheld = 0;
+}
+
+// A worker asks to move a client to session req->session_id. The ticket is
+// single-use: a match rotates it, and the reply carries the next one with a
+// copy of the bridge's re-attach socket. A matching release instead closes
+// our end of that socket, which ends the bridge's wait for a re-attach; a
+// shared bridge keeps the socket for further sessions and is told with
+// PROTO_ATTACH_RELEASE. Anything else gets ok = 0.
+static void daemon_reattach(struct daemon_state *ds, struct reattach_request *req, int reply_fd)
+{
+  req->user[sizeof(req->user) - 1] = '\0';
+  req->session_id[sizeof(req->session_id) - 1] = '\0';
+  req->ticket[sizeof(req->ticket) - 1] = '\0';
+
+  struct supervised_session *s = NULL;
+  for (int i = 0; i < ds->nsessions; i++)
+  {
+    if (strcmp(ds->sessions[i].rec.session_id, req->session_id) == 0)
+    {
+      s = &ds->sessions[i];
+      break;
+    }
+  }
+
+  struct reattach_reply reply;
+  memset(&reply, 0, sizeof(reply));
+  int bridge_sock = -1;
+  int match = s && s->reattach_fd >= 0 && strcmp(s->rec.user, req->user) == 0 &&
+              ticket_matches(req->ticket, s->rec.ticket);
+  if (match && req->release)
+  {
+    reply.ok = 1;
+    reply.uid = s->rec.uid;
+    reply.gid = s->rec.gid;
+    reply.mode = s->rec.mode;
+    if (g_reattach.share_bridge)
+    {
+      uint8_t release = PROTO_ATTACH_RELEASE;
+      (void)send_with_fd(s->reattach_fd, &release, 1, -1);
+    }
+    else
+    {
+      close(s->reattach_fd);
+      s->reattach_fd = -1;
+    }
+    secure_bzero(s->rec.ticket, sizeof(s->rec.ticket));
+  }
+  else if (match && ticket_generate(s->rec.ticket) == 0)
+  {
+    reply.ok = 1;
+    reply.uid = s->rec.uid;
+    reply.gid = s->rec.gid;
+    reply.mode = s->rec.mode;
+    memcpy(reply.ticket, s->rec.ticket, sizeof(reply.ticket));
+    bridge_sock = s->reattach_fd;
+    // The session stays listed under its id across re-attaches, even if
+    // its login found the table full
+    if (session_table_holds(s->rec.table_slot, s->rec.session_id))
+      session_table_touch(s->rec.table_slot);
+    else
+      s->rec.table_slot = session_table_add(s->rec.session_id, s->rec.uid, s->rec.mode,
+                                            s->rec.bridge_pid);
+  }
+  if (send_with_fd(reply_fd, &reply, sizeof(reply), bridge_sock) != 0)
+    journal_errorf("failed to answer re-attach request: %m");
+  secure_bzero(&reply, sizeof(reply));
+  secure_bzero(req->ticket, sizeof(req->ticket));
+}
+
+// A worker looks for a shared bridge of q->user. Every live bridge we hold
+// the re-attach socket of qualifies while there is room to list one more
+// attached session; the bridge itself turns a session down once it is
+// shutting down.
+static void daemon_attach_query(const struct daemon_state *ds, struct attach_query *q, int reply_fd)
+{
+  q->user[sizeof(q->user) - 1] = '\0';
+  struct attach_reply reply = {.modes = 0, .bridge_pid = 0};
+  int bridge_sock = -1;
+  int room = ds->nattached < DAEMON_ATTACHED_MAX;
+  for (int i = 0; room && g_reattach.share_bridge && i < ds->nsessions; i++)
+  {
+    const struct supervised_session *s = &ds->sessions[i];
+    if (s->reattach_fd < 0 || s->rec.uid != q->uid || strcmp(s->rec.user, q->user) != 0)
+      continue;
+    reply.modes |= 1u << s->rec.mode;
+    if (bridge_sock < 0 && q->mode == (int)s->rec.mode)
+    {
+      bridge_sock = s->reattach_fd;
+      reply.bridge_pid = s->rec.bridge_pid;
+    }
+  }
+  if (send_with_fd(reply_fd, &reply, sizeof(reply), bridge_sock) != 0)
+    journal_errorf("failed to answer shared bridge query: %m");
+}
+
+// A worker attached session a->session_id to the shared bridge
+// a->bridge_pid: list it until the bridge closes end_fd, which we keep.
+static void daemon_add_attached(struct daemon_state *ds, struct attached_session *a, int end_fd)
+{
+  a->session_id[sizeof(a->session_id) - 1] = '\0';
+  int idx = daemon_find_session(ds, a->bridge_pid);
+  if (idx < 0 || ds->nattached == DAEMON_ATTACHED_MAX)
+  {
+    close(end_fd);
+    return;
+  }
+  const struct supervised_session *s = &ds->sessions[idx];
+  ds->attached[ds->nattached++] = (struct daemon_attached){
+      .fd = end_fd,
+      .table_slot = session_table_add(a->session_id, s->rec.uid, s->rec.mode, a->bridge_pid),
+      .bridge_pid = a->bridge_pid,
+  };
+}
+
+static void daemon_drop_attached(struct daemon_state *ds, int i)
+{
+  session_table_remove(ds->attached[i].table_slot);
+  close(ds->attached[i].fd);
+  ds->attached[i] = ds->attached[--ds->nattached];
+}
+
+// Unlist the attached sessions that ended (revents set on their socket).
+static void daemon_attached_expire(struct daemon_state *ds, const struct pollfd *pfds, int n)
+{
+  for (int i = n - 1; i >= 0; i--)
+  {
+    if (pfds[i].revents)
+      daemon_drop_attached(ds, i);
+  }
+}
+
+// Logout accounting for a finished session, from a fresh PAM handle.
+// XDG_SESSION_ID lets pam_systemd release the logind session cleanly.
+static void session_close(const struct session_record *rec)
+{
+  record_login_end(rec->login_pid);
+  acct_flush();
+
+  struct pam_appdata appdata = {.username = rec->user, .password = NULL};
+  struct pam_conv conv = {
+      (int (*)(int, const struct pam_message **, struct pam_response **, void *))pam_conv_func,
+      &appdata};
+  pam_handle_t *pamh = NULL;
+  int rc = auth_pam_start(rec->user, &conv, &pamh);
+  if (rc != PAM_SUCCESS)
+  {
+    journal_errorf("pam_start for session close of %s failed: %s", rec->user,
+                   pam_strerror(NULL, rc));
+    return;
+  }
+  (void)pam_set_item(pamh, PAM_RHOST, rec->remote_host);
+  (void)pam_set_item(pamh, PAM_TTY, LINUXIO_WEB_TTY);
+  if (rec->xdg_session_id[0])
+  {
+    char env[sizeof("XDG_SESSION_ID=") + SESSION_MAX_XDG_ID];
+    (void)safe_snprintf(env, sizeof(env), "XDG_SESSION_ID=%s", rec->xdg_session_id);
+    (void)pam_putenv(pamh, env);
+  }
+  pam_close_session(pamh, 0);
+  pam_setcred(pamh, PAM_DELETE_CRED);
+  pam_end(pamh, 0);
+}
+
+// The bridge of session idx is gone: log it, run the teardown (in a child
+// unless inline) and drop the entry, closing our copies of the session FIFOs.
+static void daemon_finish_session(struct daemon_state *ds, int idx, int have_status, int status,
+                                  int inline_teardown)
+{
+  struct supervised_session *s = &ds->sessions[idx];
+  if (have_status)
+  {
+    (void)log_bridge_exit(s->rec.user, s->rec.bridge_pid, status);
+  }
+  else
+  {
+    const struct journal_field fields[] = {
+        {"LINUXIO_USER", s->rec.user},
+    };
+    journal_info_fieldsf(fields, 1, "bridge pid %ld exited", (long)s->rec.bridge_pid);
+  }
+  session_table_remove(s->rec.table_slot);
+  // The sessions attached to it ended with it
+  for (int i = ds->nattached - 1; i >= 0; i--)
+  {
+    if (ds->attached[i].bridge_pid == s->rec.bridge_pid)
+      daemon_drop_attached(ds, i);
   }
 
-  if (preserve_journal_stream && *preserve_journal_stream)
+  pid_t pid = inline_teardown ? -1 : fork();
+  if (pid == 0)
   {
-    int valid = 1;
-    for (const char *p = preserve_journal_stream; *p && valid; p++)
-    {
-      char c = *p;
-      if (!((c >= '0' && c <= '9') || c == ':'))
-        valid = 0;
-    }
-    if (valid && strlen(preserve_journal_stream) < sizeof(safe_journal_stream))
-      safe_snprintf(safe_journal_stream, sizeof(safe_journal_stream), "%s", preserve_journal_stream);
+    sigset_t none;
+    sigemptyset(&none);
+    (void)sigprocmask(SIG_SETMASK, &none, NULL);
+    session_close(&s->rec);
+    _exit(0);
   }
+  if (pid < 0)
+    session_close(&s->rec);
 
-  clearenv();
-  setenv("PATH", "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin", 1);
-  setenv("LANG", safe_lang, 1);
-  setenv("LC_ALL", safe_lang, 1);
-  setenv("TERM", safe_term, 1);
-
-  // Restore JOURNAL_STREAM if present - child processes may still emit stderr output
-  if (safe_journal_stream[0] != '\0')
-    setenv("JOURNAL_STREAM", safe_journal_stream, 1);
+  session_release_fds(s);
+  ds->sessions[idx] = ds->sessions[ds->nsessions - 1];
+  ds->nsessions--;
+}
 
-  if (want_privileged)
-  {
-    setenv("HOME", "/root", 1);
-    setenv("USER", "root", 1);
-    setenv("LOGNAME", "root", 1);
-    if (setgroups(0, NULL) != 0)
-      _exit(127);
-    if (setresgid(0, 0, 0) != 0)
-      _exit(127);
-    if (setresuid(0, 0, 0) != 0)
-      _exit(127);
-  }
-  else
+static int daemon_add_session(struct daemon_state *ds, const struct supervised_session *s)
+{
+  if (ds->nsessions == ds->sessions_cap)
   {
-    drop_to_user(auth_user);
-    if (auth_user)
-    {
-      setenv("HOME", auth_user->dir, 1);
-      setenv("USER", auth_user->name, 1);
-      setenv("LOGNAME", auth_user->name, 1);
-      char xdg[64];
-      safe_snprintf(xdg, sizeof(xdg), "/run/user/%u", (unsigned)auth_user->uid);
-      setenv("XDG_RUNTIME_DIR", xdg, 1);
-      if (chdir(auth_user->dir) != 0)
-        _exit(127);
-    }
+    int cap = ds->sessions_cap ? ds->sessions_cap * 2 : 16;
+    struct supervised_session *grown = realloc(ds->sessions, (size_t)cap * sizeof(*grown));
+    if (!grown)
+      return -1;
+    ds->sessions = grown;
+    ds->sessions_cap = cap;
   }
+  ds->sessions[ds->nsessions++] = *s;
+  return 0;
+}
 
-  // Application config is passed via binary bootstrap on stdin.
+// Drain session handoffs from workers. Called before every reap: a worker
+// sends its handoff before it exits, and only its exit makes the bridge ours.
+static void daemon_receive_sessions(struct daemon_state *ds)
+{
+  for (;;)
+  {
+    union supervisor_msg msg;
+    memset(&msg, 0, sizeof(msg));
 
-  // Close all file descriptors >= 6 (keeping 0-5 as set up above)
-  // Uses close_range() syscall (Linux 5.9+) with fallback for older kernels
-#ifndef __NR_close_range
-  #define __NR_close_range 436
-#endif
+    union
+    {
+      char buf[CMSG_SPACE(sizeof(int) * (2 + SESSION_MAX_HELD_FDS))];
+      struct cmsghdr align;
+    } ctrl;
+    struct iovec iov = {.iov_base = &msg, .iov_len = sizeof(msg)};
+    struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1,
+                        .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)};
+    ssize_t n = recvmsg(ds->sup_rd, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
 
-  if (syscall(__NR_close_range, BRIDGE_FD + 1, ~0U, 0) == -1 && errno == ENOSYS)
-  {
-    // Fallback: manual loop for older kernels without close_range
-    struct rlimit rl;
-    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    int fds[2 + SESSION_MAX_HELD_FDS];
+    int nfds = 0;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm))
     {
-      int max_fd = (rl.rlim_cur < 4096) ? (int)rl.rlim_cur : 4096;
-      for (int fd = BRIDGE_FD + 1; fd < max_fd; fd++)
+      if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+        continue;
+      size_t count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (size_t i = 0; i < count; i++)
       {
-        (void)close(fd);
+        int fd;
+        memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+        if (nfds < (int)(sizeof(fds) / sizeof(fds[0])))
+          fds[nfds++] = fd;
+        else
+          close(fd);
       }
     }
-  }
 
-  // Application config passed via binary bootstrap on stdin - minimal argv
-  const char *argv_child[] = {"linuxio-bridge", NULL};
+    int truncated = (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0;
+    if (!truncated && msg.kind == SUPERVISOR_MSG_REATTACH && n == (ssize_t)sizeof(msg.reattach) &&
+        nfds == 1)
+    {
+      daemon_reattach(ds, &msg.reattach, fds[0]);
+      close(fds[0]);
+      continue;
+    }
+    if (!truncated && msg.kind == SUPERVISOR_MSG_ATTACH && n == (ssize_t)sizeof(msg.attach) &&
+        nfds == 1)
+    {
+      daemon_attach_query(ds, &msg.attach, fds[0]);
+      close(fds[0]);
+      continue;
+    }
+    if (!truncated && msg.kind == SUPERVISOR_MSG_ATTACHED && n == (ssize_t)sizeof(msg.attached) &&
+        nfds == 1)
+    {
+      daemon_add_attached(ds, &msg.attached, fds[0]);
+      continue;
+    }
+    if (truncated || msg.kind != SUPERVISOR_MSG_SESSION || n != (ssize_t)sizeof(msg.session))
+    {
+      journal_errorf("malformed session handoff from auth worker");
+      secure_bzero(&msg, sizeof(msg));
+      for (int i = 0; i < nfds; i++)
+        close(fds[i]);
+      continue;
+    }
 
-  // Mark BRIDGE_FD as close-on-exec so it doesn't leak into the bridge process
-  // (prevents "text file busy" on binary updates and avoids unnecessary FD leak)
-  // CLOEXEC only closes after successful exec, so execveat() still works.
+    struct supervised_session s;
+    memset(&s, 0, sizeof(s));
+    s.rec = msg.session;
+    s.pidfd = -1;
+    s.reattach_fd = -1;
+    secure_bzero(&msg, sizeof(msg));
+    s.rec.user[sizeof(s.rec.user) - 1] = '\0';
+    s.rec.remote_host[sizeof(s.rec.remote_host) - 1] = '\0';
+    s.rec.xdg_session_id[sizeof(s.rec.xdg_session_id) - 1] = '\0';
+    s.rec.session_id[sizeof(s.rec.session_id) - 1] = '\0';
+
+    int first = 0;
+    if (s.rec.has_pidfd && nfds > first)
+      s.pidfd = fds[first++];
+    if (s.rec.has_reattach && nfds > first)
+      s.reattach_fd = fds[first++];
+    for (int i = first; i < nfds; i++)
+      s.held[s.nheld++] = fds[i];
+
+    if (daemon_add_session(ds, &s) != 0)
+    {
+      journal_errorf("no memory to supervise bridge pid %ld; its logout will not be recorded",
+                     (long)s.rec.bridge_pid);
+      session_release_fds(&s);
+    }
+  }
+}
+
+// Stopping the daemon must not end live sessions or lose their logout
+// (KillMode=process). If any are left, a keeper child inherits them and
+// waits on their pidfds; the bridges themselves are reparented to systemd,
+// so exit statuses are no longer known.
+static void daemon_hand_sessions_to_keeper(struct daemon_state *ds)
+{
+  if (ds->nsessions == 0)
+    return;
+  pid_t pid = fork();
+  if (pid < 0)
   {
-    int fdflags = fcntl(BRIDGE_FD, F_GETFD);
-    if (fdflags >= 0)
-      (void)fcntl(BRIDGE_FD, F_SETFD, fdflags | FD_CLOEXEC);
+    journal_errorf("failed to fork session keeper; %d logouts will not be recorded: %m",
+                   ds->nsessions);
+    return;
   }
+  if (pid > 0)
+    return;
 
-  // Execute the validated bridge binary via fd (prevents TOCTOU)
-  // Try execveat first (Linux 3.19+); fallback to execv on ENOSYS
-#ifndef __NR_execveat
-  #define __NR_execveat 322
-#endif
-  long ret = syscall(__NR_execveat, BRIDGE_FD, "", ARGV_UNCONST(argv_child), environ, AT_EMPTY_PATH);
+  sigset_t none;
+  sigemptyset(&none);
+  (void)sigprocmask(SIG_SETMASK, &none, NULL);
+  if (ds->metrics_fd >= 0)
+    close(ds->metrics_fd);
 
-  // Fallback for kernels without execveat (< 3.19)
-  if (ret == -1 && errno == ENOSYS)
+  // Nobody routes re-attaches any more; bridges see their socket close and
+  // stop waiting for one
+  for (int i = 0; i < ds->nsessions; i++)
   {
-    // Read the real path from /proc/self/fd/BRIDGE_FD
-    char fdpath[64], realpath_buf[PATH_MAX];
-    safe_snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%d", BRIDGE_FD);
-    ssize_t len = readlink(fdpath, realpath_buf, sizeof(realpath_buf) - 1);
-    if (len > 0)
+    if (ds->sessions[i].reattach_fd >= 0)
+      close(ds->sessions[i].reattach_fd);
+    ds->sessions[i].reattach_fd = -1;
+  }
+
+  for (int i = ds->nsessions - 1; i >= 0; i--)
+  {
+    if (ds->sessions[i].pidfd < 0)
     {
-      realpath_buf[len] = '\0';
-      // Close bridge_fd before exec (no longer needed)
-      close(BRIDGE_FD);
-      // Use the real path we validated earlier
-      execv(realpath_buf, ARGV_UNCONST(argv_child));
+      journal_errorf("cannot watch bridge pid %ld without a pidfd; its logout will not be recorded",
+                     (long)ds->sessions[i].rec.bridge_pid);
+      session_release_fds(&ds->sessions[i]);
+      ds->sessions[i] = ds->sessions[--ds->nsessions];
     }
   }
 
-  // Exec failed - write error byte to status pipe before exiting
-  // (if exec succeeded, CLOEXEC on FD 4 would have closed it)
+  struct pollfd *pfds = calloc((size_t)(ds->nsessions ? ds->nsessions : 1), sizeof(*pfds));
+  while (pfds && ds->nsessions > 0)
   {
-    uint8_t err_byte = 1;
-    ssize_t wr = write(EXEC_STATUS_FD, &err_byte, 1);
-    (void)wr; // Best-effort, we're exiting anyway
+    for (int i = 0; i < ds->nsessions; i++)
+    {
+      pfds[i].fd = ds->sessions[i].pidfd;
+      pfds[i].events = POLLIN;
+      pfds[i].revents = 0;
+    }
+    if (poll(pfds, (nfds_t)ds->nsessions, -1) < 0 && errno != EINTR)
+      break;
+    // Backwards: finishing swaps the last entry into the freed slot
+    for (int i = ds->nsessions - 1; i >= 0; i--)
+    {
+      if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+        daemon_finish_session(ds, i, 0, 0, 1);
+    }
   }
-
-  _exit(127);
+  _exit(0);
 }
 
-// Handle a single client request
-static int handle_client(int input_fd, int output_fd)
+static void daemon_reap(struct daemon_state *ds)
 {
-  // Read binary request header
-  uint8_t header[PROTO_AUTH_REQ_HEADER_SIZE];
-  if (read_all(input_fd, header, PROTO_AUTH_REQ_HEADER_SIZE) != 0)
+  for (;;)
   {
-    send_error_response(output_fd, PROTO_RESULT_BAD_REQUEST, "failed to read request header");
-    return 1;
+    int status = 0;
+    pid_t pid = waitpid(-1, &status, WNOHANG);
+    if (pid <= 0)
+      break;
+
+    if (pid == ds->acct_pid)
+    {
+      // Until it is back, acct_flush() callers write their records themselves
+      journal_errorf("accounting writer pid %ld exited unexpectedly", (long)pid);
+      ds->acct_pid = 0;
+      ds->respawn_after_ms = monotonic_ms() + DAEMON_RESPAWN_BACKOFF_MS;
+      continue;
+    }
+
+    struct daemon_worker *w = daemon_find_worker(ds, pid);
+    if (!w)
+    {
+      // A supervised bridge; anything else is a teardown child or an orphan
+      int idx = ds->supervise ? daemon_find_session(ds, pid) : -1;
+      if (idx >= 0)
+        daemon_finish_session(ds, idx, 1, status, 0);
+      continue;
+    }
+
+    if (w->state == WORKER_IDLE)
+    {
+      // An idle worker should only exit when told to; if it died on its own
+      // (accept failure, fd exhaustion) don't respawn in a tight loop.
+      ds->idle--;
+      ds->respawn_after_ms = monotonic_ms() + DAEMON_RESPAWN_BACKOFF_MS;
+    }
+    else if (w->state == WORKER_BUSY)
+    {
+      ds->busy--;
+    }
+    // One that died before answering (its login deadline, a crash) still
+    // holds its admission claim
+    admission_release((int)(w - ds->workers));
+    w->pid = 0;
+    w->state = WORKER_FREE;
   }
+}
 
-  // Validate magic
-  if (header[0] != PROTO_MAGIC_0 || header[1] != PROTO_MAGIC_1 ||
-      header[2] != PROTO_MAGIC_2 || header[3] != PROTO_VERSION)
+static void daemon_stop_idle_workers(const struct daemon_state *ds)
+{
+  for (int i = 0; i < ds->max_workers; i++)
   {
-    send_error_response(output_fd, PROTO_RESULT_BAD_REQUEST, "invalid request magic");
-    return 1;
+    if (ds->workers[i].state == WORKER_IDLE)
+      (void)kill(ds->workers[i].pid, SIGTERM);
   }
+}
 
-  // Parse header fields
-  uint8_t req_flags = header[4];
-  int verbose_flag = (req_flags & PROTO_REQ_FLAG_VERBOSE) != 0;
+// -------- hot upgrade (daemon mode) --------
+// SIGUSR2 makes the daemon re-exec LINUXIO_AUTH_PATH in place, normally
+// right after a package upgrade replaced it. The pid stays, so systemd keeps
+// tracking the service and every child stays ours to reap: busy workers,
+// supervised bridges, the accounting writer. Descriptors are inherited
+// across execve() (only CLOEXEC is cleared first): the listening socket,
+// the worker, handoff and accounting channels, the control socket with its
+// connections and pending logins, each session's pidfd, re-attach socket and
+// FIFOs, the sockets of attached sessions, and the memfds behind the shared
+// tables. A memfd named in REEXEC_ENV carries the daemon_state, worker table
+// and supervised sessions that refer to them. The new image takes them over
+// in run_daemon() instead of creating its own, so clients keep their
+// connections and the caches stay warm. Idle workers were forked from the
+// old image and are retired; the bridge binary is revalidated, since an
+// upgrade usually replaced it too.
+//
+// The state is a raw copy of these structs: bump REEXEC_VERSION whenever one
+// of them changes. A new image that doesn't understand the state execs back
+// to the old binary (which it was handed as an O_PATH fd), and a failed
+// exec leaves the daemon running as it was.
+#define REEXEC_ENV     "LINUXIO_AUTH_REEXEC_FD"
+#define REEXEC_MAGIC   0x5845494cu // "LIEX" on little-endian hosts
+#define REEXEC_VERSION 1
+
+struct reexec_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t state_size; // sizeof of the structs below, as a second check
+  uint32_t worker_size;
+  uint32_t session_size;
+  int self_fd; // the binary the state came from, -1 if unknown
+  int shared_fd[SHARED_TABLES];
+  int nworkers;
+  int nsessions;
+};
+// followed by struct daemon_state, nworkers daemon_worker, nsessions supervised_session
 
-  // Read variable-length fields
-  char user[PROTO_MAX_USERNAME] = "";
-  char password[PROTO_MAX_PASSWORD] = "";
-  char session_id[PROTO_MAX_SESSION_ID] = "";
-  char remote_host[PROTO_MAX_REMOTE_HOST] = "";
+static void fd_set_cloexec(int fd, int on)
+{
+  if (fd < 0)
+    return;
+  int flags = fcntl(fd, F_GETFD);
+  if (flags >= 0)
+    (void)fcntl(fd, F_SETFD, on ? flags | FD_CLOEXEC : flags & ~FD_CLOEXEC);
+}
 
-  if (read_lenstr(input_fd, user, sizeof(user)) != 0 ||
-      read_lenstr(input_fd, password, sizeof(password)) != 0 ||
-      read_lenstr(input_fd, session_id, sizeof(session_id)) != 0 ||
-      read_lenstr(input_fd, remote_host, sizeof(remote_host)) != 0)
+// Set or clear CLOEXEC on every descriptor the daemon state refers to.
+static void reexec_mark_fds(const struct daemon_state *ds, int on)
+{
+  const int fds[] = {ds->listen_fd, ds->busy_rd,    ds->busy_wr,     ds->sup_rd,
+                     ds->sup_wr,    ds->acct_rd,    ds->acct_wr,     ds->metrics_fd,
+                     ds->control_fd, ds->dispatch_rd, ds->dispatch_wr};
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+    fd_set_cloexec(fds[i], on);
+  for (int i = 0; i < ds->ncontrol; i++)
+    fd_set_cloexec(ds->control_conns[i], on);
+  for (int i = 0; i < ds->npending; i++)
   {
-    send_error_response(output_fd, PROTO_RESULT_BAD_REQUEST, "failed to read request fields");
-    secure_bzero(password, sizeof(password));
-    return 1;
+    fd_set_cloexec(ds->pending[i].client_fd, on);
+    fd_set_cloexec(ds->pending[i].reply_fd, on);
   }
-
-  // Validate required fields
-  if (!user[0] || !session_id[0])
+  for (int i = 0; i < ds->nsessions; i++)
   {
-    send_error_response(output_fd, PROTO_RESULT_BAD_REQUEST, "missing required fields");
-    secure_bzero(password, sizeof(password));
-    return 1;
+    const struct supervised_session *s = &ds->sessions[i];
+    fd_set_cloexec(s->pidfd, on);
+    fd_set_cloexec(s->reattach_fd, on);
+    for (int j = 0; j < s->nheld; j++)
+      fd_set_cloexec(s->held[j], on);
   }
+  for (int i = 0; i < ds->nattached; i++)
+    fd_set_cloexec(ds->attached[i].fd, on);
+  for (int t = 0; t < SHARED_TABLES; t++)
+    fd_set_cloexec(g_shared[t].fd, on);
+}
 
-  // Validate session_id (defense against path injection)
-  if (!valid_session_id(session_id))
-  {
-    send_error_response(output_fd, PROTO_RESULT_BAD_REQUEST, "invalid session_id format");
-    secure_bzero(password, sizeof(password));
-    return 1;
-  }
+static int reexec_save(const struct daemon_state *ds, int fd, int self_fd)
+{
+  struct reexec_header h = {
+      .magic = REEXEC_MAGIC,
+      .version = REEXEC_VERSION,
+      .state_size = sizeof(struct daemon_state),
+      .worker_size = sizeof(struct daemon_worker),
+      .session_size = sizeof(struct supervised_session),
+      .self_fd = self_fd,
+      .nworkers = ds->max_workers,
+      .nsessions = ds->nsessions,
+  };
+  for (int t = 0; t < SHARED_TABLES; t++)
+    h.shared_fd[t] = g_shared[t].fd;
+  if (write_all(fd, &h, sizeof(h)) != 0 || write_all(fd, ds, sizeof(*ds)) != 0 ||
+      write_all(fd, ds->workers, (size_t)ds->max_workers * sizeof(*ds->workers)) != 0)
+    return -1;
+  if (ds->nsessions > 0 &&
+      write_all(fd, ds->sessions, (size_t)ds->nsessions * sizeof(*ds->sessions)) != 0)
+    return -1;
+  return 0;
+}
 
-  if (!valid_remote_host(remote_host))
-  {
-    send_error_response(output_fd, PROTO_RESULT_BAD_REQUEST, "invalid remote_host format");
-    secure_bzero(password, sizeof(password));
-    return 1;
-  }
+// Environment of the next image: the state fd, and the listening socket
+// that sd_listen_fds() took out of ours
+static int reexec_env_set(const char *fd_env)
+{
+  char pid_buf[16];
+  (void)safe_snprintf(pid_buf, sizeof(pid_buf), "%ld", (long)getpid());
+  fd_set_cloexec(SD_LISTEN_FDS_START, 0);
+  if (setenv(REEXEC_ENV, fd_env, 1) != 0 || setenv("LISTEN_FDS", "1", 1) != 0 ||
+      setenv("LISTEN_PID", pid_buf, 1) != 0)
+    return -1;
+  return 0;
+}
 
-  // PAM authentication
-  struct pam_appdata appdata = {
-      .username = user,
-      .password = password};
-  struct pam_conv conv = {
-      (int (*)(int, const struct pam_message **, struct pam_response **, void *))pam_conv_func,
-      &appdata};
-  pam_handle_t *pamh = NULL;
-  int rc = pam_start("linuxio", user, &conv, &pamh);
-  int auth_rc;
-  if (rc != PAM_SUCCESS)
-  {
-    send_error_response(output_fd, PROTO_RESULT_INTERNAL_ERROR, pam_strerror(NULL, rc));
-    secure_bzero(password, sizeof(password));
-    return 1;
-  }
+static void reexec_env_clear(void)
+{
+  fd_set_cloexec(SD_LISTEN_FDS_START, 1);
+  (void)unsetenv(REEXEC_ENV);
+  (void)unsetenv("LISTEN_FDS");
+  (void)unsetenv("LISTEN_PID");
+}
 
-  rc = pam_set_item(pamh, PAM_RHOST, remote_host);
-  if (rc == PAM_SUCCESS)
-    rc = pam_set_item(pamh, PAM_TTY, LINUXIO_WEB_TTY);
-  if (rc != PAM_SUCCESS)
-  {
-    send_error_response(output_fd, PROTO_RESULT_INTERNAL_ERROR, pam_strerror(pamh, rc));
-    pam_end(pamh, rc);
-    secure_bzero(password, sizeof(password));
-    return 1;
-  }
-  auth_rc = pam_authenticate(pamh, 0);
-  rc = auth_rc;
-  if (rc == PAM_SUCCESS)
-    rc = pam_acct_mgmt(pamh, 0);
+static void reexec_exec(int exe_fd)
+{
+  const char *const argv[] = {LINUXIO_AUTH_PATH, "--daemon", NULL};
+  (void)syscall(__NR_execveat, exe_fd, "", ARGV_UNCONST(argv), environ, AT_EMPTY_PATH);
+}
 
-  // Handle password expiration
-  if (rc == PAM_NEW_AUTHTOK_REQD)
+// SIGUSR2: hand the running daemon to a fresh exec of LINUXIO_AUTH_PATH.
+// Returns only if the exec failed; the daemon then carries on.
+static void daemon_reexec(struct daemon_state *ds)
+{
+  int exe_fd = -1;
+  if (open_and_validate_bridge(LINUXIO_AUTH_PATH, 0, &exe_fd, NULL) != 0)
   {
-    const struct journal_field fields[] = {
-        {"LINUXIO_USER", user},
-    };
-    journal_info_fieldsf(fields, 1, "password expired");
-    send_error_response(output_fd, PROTO_RESULT_PASSWORD_EXPIRED,
-                        "Password has expired. Please change it via SSH or console.");
-    pam_end(pamh, rc);
-    secure_bzero(password, sizeof(password));
-    return 1;
+    journal_errorf("hot upgrade refused: %s is not a root-owned executable", LINUXIO_AUTH_PATH);
+    return;
   }
-
-  if (rc == PAM_SUCCESS)
-    rc = pam_setcred(pamh, PAM_ESTABLISH_CRED);
-
-  if (rc != PAM_SUCCESS)
+  int self_fd = open("/proc/self/exe", O_PATH | O_CLOEXEC);
+  int state_fd = memfd_create("linuxio-auth-reexec", MFD_CLOEXEC);
+  if (state_fd < 0)
   {
-    const char *err = pam_strerror(pamh, rc);
-    if (auth_rc != PAM_SUCCESS)
-      btmp_log(user, remote_host);
-    send_error_response(output_fd, classify_pam_result(rc), err);
-    pam_end(pamh, rc);
-    secure_bzero(password, sizeof(password));
-    return 1;
+    journal_errorf("hot upgrade failed, no memfd for the daemon state: %m");
+    close(exe_fd);
+    if (self_fd >= 0)
+      close(self_fd);
+    return;
   }
 
-  // Get user info
-  const struct passwd *pw = getpwnam(user);
-  if (!pw)
+  // Logins taken by now are counted busy or, if their worker is only
+  // getting to the busy pipe, go along in it with the handoff socket;
+  // refused ones are let go
+  daemon_retire_idle_workers(ds);
+  daemon_shed_expire(ds, NULL, 1);
+  if (reexec_save(ds, state_fd, self_fd) != 0)
   {
-    send_error_response(output_fd, PROTO_RESULT_INTERNAL_ERROR, "user lookup failed");
-    pam_setcred(pamh, PAM_DELETE_CRED);
-    pam_end(pamh, 0);
-    secure_bzero(password, sizeof(password));
-    return 1;
+    journal_errorf("hot upgrade failed, could not save the daemon state: %m");
+    close(state_fd);
+    close(exe_fd);
+    if (self_fd >= 0)
+      close(self_fd);
+    return;
   }
 
-  // Copy libc-owned passwd data before PAM session hooks can overwrite NSS static storage.
-  struct auth_user auth_user;
-  if (copy_auth_user(pw, &auth_user) != 0)
+  char fd_buf[16];
+  (void)safe_snprintf(fd_buf, sizeof(fd_buf), "%d", state_fd);
+  if (reexec_env_set(fd_buf) != 0)
   {
-    send_error_response(output_fd, PROTO_RESULT_INTERNAL_ERROR, "invalid passwd entry");
-    pam_setcred(pamh, PAM_DELETE_CRED);
-    pam_end(pamh, 0);
-    secure_bzero(password, sizeof(password));
-    return 1;
+    journal_errorf("hot upgrade failed: %m");
   }
-
+  else
   {
-    char uid_buf[32];
-    (void)safe_snprintf(uid_buf, sizeof(uid_buf), "%u", (unsigned)auth_user.uid);
-    const struct journal_field fields[] = {
-        {"LINUXIO_USER", user},
-        {"LINUXIO_UID", uid_buf},
-    };
-    journal_info_fieldsf(fields, 2, "pam auth success");
+    const struct journal_field fields[] = {{"LINUXIO_AUTH_PATH", LINUXIO_AUTH_PATH}};
+    journal_info_fieldsf(fields, 1, "hot upgrade: re-executing with %d busy workers and %d sessions",
+                         ds->busy, ds->nsessions);
+    (void)sd_notifyf(0, "RELOADING=1\nMONOTONIC_USEC=%llu\nSTATUS=Re-executing %s",
+                     (unsigned long long)monotonic_us(), LINUXIO_AUTH_PATH);
+    reexec_mark_fds(ds, 0);
+    fd_set_cloexec(state_fd, 0);
+    fd_set_cloexec(self_fd, 0);
+    reexec_exec(exe_fd);
+
+    int saved = errno;
+    reexec_mark_fds(ds, 1);
+    errno = saved;
+    journal_errorf("hot upgrade failed, exec of %s: %m", LINUXIO_AUTH_PATH);
+    (void)sd_notify(0, "READY=1");
   }
+  reexec_env_clear();
+  close(state_fd);
+  close(exe_fd);
+  if (self_fd >= 0)
+    close(self_fd);
+}
 
-  // Check sudo capability
-  int nopasswd = 0;
-  int want_privileged = user_has_sudo(pw, password, &nopasswd) ? 1 : 0;
-
-  // Clear password from memory
-  secure_bzero(password, sizeof(password));
-
-  uint8_t mode = want_privileged ? PROTO_MODE_PRIVILEGED : PROTO_MODE_UNPRIVILEGED;
-
-  // Validate bridge binary and keep fd open (prevents TOCTOU)
-  int bridge_fd = -1;
-  if (open_and_validate_bridge("/usr/local/bin/linuxio-bridge", 0, &bridge_fd) != 0)
-  {
-    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "bridge validation failed");
-    pam_setcred(pamh, PAM_DELETE_CRED);
-    pam_end(pamh, 0);
-    return 1;
+// A state we can't read: go back to the binary that wrote it, keeping
+// REEXEC_ENV for it. Returns if that is not possible.
+static void reexec_fall_back(const struct reexec_header *h, const char *fd_env)
+{
+  if (h->self_fd < 0)
+    return;
+  journal_errorf("hot upgrade state version %u is not supported here; returning to the previous binary",
+                 h->version);
+  if (reexec_env_set(fd_env) == 0)
+    reexec_exec(h->self_fd);
+  reexec_env_clear();
+  journal_errorf("failed to return to the previous binary: %m");
+}
+
+// Start afresh after all. Whatever the previous image passed on stays open,
+// but must not leak into the children.
+static void reexec_abandon(int state_fd)
+{
+  if (state_fd >= 0)
+    close(state_fd);
+  DIR *d = opendir("/proc/self/fd");
+  const struct dirent *de;
+  while (d && (de = readdir(d)) != NULL)
+  {
+    char *end = NULL;
+    long fd = strtol(de->d_name, &end, 10);
+    if (end && *end == '\0' && fd > STDERR_FILENO && fd != dirfd(d))
+      fd_set_cloexec((int)fd, 1);
   }
-  // Keep bridge_fd open - we'll exec it directly to prevent TOCTOU
+  if (d)
+    closedir(d);
+  journal_errorf("hot upgrade: daemon state unusable, starting afresh; busy workers and "
+                 "sessions of the previous binary are no longer tracked");
+}
 
-  // Create pipe for bootstrap data (secrets never touch filesystem)
-  int bootstrap_pipe[2];
-  if (pipe(bootstrap_pipe) != 0)
+// Take over the daemon handed over by daemon_reexec(), if any. Returns 0 if
+// *ds (with its worker and session tables) now is that daemon, -1 for a
+// fresh start.
+static int reexec_restore(struct daemon_state *ds)
+{
+  const char *env = getenv(REEXEC_ENV);
+  if (!env)
+    return -1;
+  char fd_env[16];
+  (void)safe_snprintf(fd_env, sizeof(fd_env), "%s", env);
+  (void)unsetenv(REEXEC_ENV);
+  char *end = NULL;
+  long fd = strtol(fd_env, &end, 10);
+  if (!end || *end || fd <= STDERR_FILENO || fd > INT_MAX)
   {
-    journal_errorf("failed to create bootstrap pipe: %m");
-    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "failed to prepare bootstrap");
-    close(bridge_fd);
-    pam_setcred(pamh, PAM_DELETE_CRED);
-    pam_end(pamh, 0);
-    return 1;
+    reexec_abandon(-1);
+    return -1;
   }
 
-  rc = pam_open_session(pamh, 0);
-  if (rc != PAM_SUCCESS)
+  struct reexec_header h;
+  if (pread((int)fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || h.magic != REEXEC_MAGIC)
   {
-    const char *err = pam_strerror(pamh, rc);
-    close(bootstrap_pipe[0]);
-    close(bootstrap_pipe[1]);
-    close(bridge_fd);
-    send_error_response(output_fd, classify_pam_result(rc), err);
-    pam_setcred(pamh, PAM_DELETE_CRED);
-    pam_end(pamh, 0);
-    return 1;
+    reexec_abandon((int)fd);
+    return -1;
   }
-  // Create exec-status pipe with CLOEXEC on write end
-  // - On successful exec, CLOEXEC closes the write end -> parent sees EOF
-  // - On exec failure, child writes error byte -> parent sees data
-  int exec_status_pipe[2] = {-1, -1};
-#if defined(HAVE_PIPE2) || (defined(__linux__) && defined(O_CLOEXEC))
-  if (pipe2(exec_status_pipe, O_CLOEXEC) != 0)
+  if (h.version != REEXEC_VERSION || h.state_size != sizeof(struct daemon_state) ||
+      h.worker_size != sizeof(struct daemon_worker) ||
+      h.session_size != sizeof(struct supervised_session))
   {
-    journal_errorf("failed to create exec-status pipe: %m");
-    close(bootstrap_pipe[0]);
-    close(bootstrap_pipe[1]);
-    close(bridge_fd);
-    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "failed to prepare exec check");
-    pam_close_session(pamh, 0);
-    pam_setcred(pamh, PAM_DELETE_CRED);
-    pam_end(pamh, 0);
-    return 1;
+    reexec_fall_back(&h, fd_env);
+    reexec_abandon((int)fd);
+    return -1;
   }
-#else
-  if (pipe(exec_status_pipe) != 0)
+  if (h.self_fd >= 0)
+    close(h.self_fd);
+
+  struct daemon_state carried;
+  off_t off = (off_t)sizeof(h);
+  int ok = pread((int)fd, &carried, sizeof(carried), off) == (ssize_t)sizeof(carried) &&
+           h.nworkers == carried.max_workers && h.nworkers > 0 &&
+           h.nworkers <= DAEMON_MAX_WORKERS_LIMIT && h.nsessions == carried.nsessions &&
+           h.nsessions >= 0;
+  off += (off_t)sizeof(carried);
+  struct daemon_worker *workers = NULL;
+  struct supervised_session *sessions = NULL;
+  if (ok)
   {
-    journal_errorf("failed to create exec-status pipe: %m");
-    close(bootstrap_pipe[0]);
-    close(bootstrap_pipe[1]);
-    close(bridge_fd);
-    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "failed to prepare exec check");
-    pam_close_session(pamh, 0);
-    pam_setcred(pamh, PAM_DELETE_CRED);
-    pam_end(pamh, 0);
-    return 1;
+    size_t wlen = (size_t)h.nworkers * sizeof(*workers);
+    size_t slen = (size_t)h.nsessions * sizeof(*sessions);
+    workers = calloc((size_t)h.nworkers, sizeof(*workers));
+    sessions = h.nsessions > 0 ? calloc((size_t)h.nsessions, sizeof(*sessions)) : NULL;
+    ok = workers && (h.nsessions == 0 || sessions) &&
+         pread((int)fd, workers, wlen, off) == (ssize_t)wlen &&
+         (slen == 0 || pread((int)fd, sessions, slen, off + (off_t)wlen) == (ssize_t)slen);
   }
-  // Set CLOEXEC on write end only (child writes on failure, exec closes it on success)
+  if (!ok)
   {
-    int fdflags = fcntl(exec_status_pipe[1], F_GETFD);
-    if (fdflags >= 0)
-      (void)fcntl(exec_status_pipe[1], F_SETFD, fdflags | FD_CLOEXEC);
+    free(workers);
+    free(sessions);
+    reexec_abandon((int)fd);
+    return -1;
   }
-#endif
-
-  pid_t child = spawn_bridge_process(
-      &auth_user,
-      want_privileged,
-      bridge_fd,
-      bootstrap_pipe[0],    // Pass pipe read end to child (will be stdin)
-      input_fd,             // Pass client connection FD (will be dup'd to FD 3 for Yamux)
-      exec_status_pipe[1]); // Write end of exec-status pipe (CLOEXEC)
-
-  // Parent: close pipe read end and exec-status write end (child has them)
-  close(bootstrap_pipe[0]);
-  close(exec_status_pipe[1]);
+  close((int)fd);
+
+  // What this image sets up itself
+  carried.inotify_fd = -1;
+  carried.inotify_wd = -1;
+  carried.npam_wd = 0;
+  carried.metrics_path = ds->metrics_path;
+  carried.control_path = ds->control_path;
+  carried.respawn_after_ms = 0;
+  carried.workers = workers;
+  carried.sessions = sessions;
+  carried.sessions_cap = carried.nsessions;
+  *ds = carried;
+  for (int t = 0; t < SHARED_TABLES; t++)
+    g_shared[t].fd = h.shared_fd[t];
+  reexec_mark_fds(ds, 1);
+  journal_info_fieldsf(NULL, 0, "hot upgrade: took over %d busy workers and %d sessions",
+                       ds->busy, ds->nsessions);
+  return 0;
+}
 
-  if (child < 0)
+static int run_daemon(void)
+{
+  int nfds = sd_listen_fds(1);
+  if (nfds != 1)
   {
-    close(bootstrap_pipe[1]);
-    close(exec_status_pipe[0]);
-    close(bridge_fd);
-    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "failed to spawn bridge");
-    pam_close_session(pamh, 0);
-    pam_setcred(pamh, PAM_DELETE_CRED);
-    pam_end(pamh, 0);
+    journal_errorf("daemon mode expects exactly one listening socket from systemd (got %d)", nfds);
     return 1;
   }
-
-  // Parent: write binary bootstrap to pipe, then close to signal EOF
-  int rc_bootstrap = write_bootstrap_binary(
-      bootstrap_pipe[1],
-      session_id,
-      auth_user.name,
-      auth_user.uid,
-      auth_user.gid,
-      verbose_flag,
-      want_privileged);
-  close(bootstrap_pipe[1]);
-
-  if (rc_bootstrap != 0)
+  if (sd_is_socket_unix(SD_LISTEN_FDS_START, SOCK_STREAM, 1, NULL, 0) <= 0)
   {
-    const struct journal_field fields[] = {
-        {"LINUXIO_USER", auth_user.name},
-    };
-    journal_error_fieldsf(fields, 1, "failed to write bootstrap to pipe");
-    close(exec_status_pipe[0]);
-    close(bridge_fd);
-    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "bootstrap communication failed");
-    kill(child, SIGTERM);
-    (void)waitpid(child, NULL, 0);
-    pam_close_session(pamh, 0);
-    pam_setcred(pamh, PAM_DELETE_CRED);
-    pam_end(pamh, 0);
+    journal_errorf("daemon mode requires a listening unix stream socket (Accept=no)");
     return 1;
   }
 
-  // Close bridge_fd - child has it via fork
-  close(bridge_fd);
+  struct daemon_state ds = {
+      .pid = getpid(),
+      .listen_fd = SD_LISTEN_FDS_START,
+      .busy_rd = -1,
+      .busy_wr = -1,
+      .inotify_fd = -1,
+      .inotify_wd = -1,
+      .sup_rd = -1,
+      .sup_wr = -1,
+      .acct_rd = -1,
+      .acct_wr = -1,
+      .metrics_fd = -1,
+      .control_fd = -1,
+      .dispatch_rd = -1,
+      .dispatch_wr = -1,
+  };
+  ds.max_workers = env_get_int("LINUXIO_AUTH_MAX_WORKERS", DAEMON_MAX_WORKERS_DEFAULT,
+                               1, DAEMON_MAX_WORKERS_LIMIT);
+  ds.pool_size = env_get_int("LINUXIO_AUTH_POOL_SIZE", DAEMON_POOL_SIZE_DEFAULT,
+                             1, ds.max_workers);
+  ds.park_bridge = env_get_int("LINUXIO_AUTH_PARK_BRIDGE", 0, 0, 1);
+  ds.supervise = env_get_int("LINUXIO_AUTH_SUPERVISE", 0, 0, 1);
+  ds.btmp_coalesce_ms = env_get_int("LINUXIO_AUTH_BTMP_COALESCE_MS", 0, 0, 60000);
+  ds.metrics_path = getenv("LINUXIO_AUTH_METRICS_SOCKET");
+  if (!ds.metrics_path)
+    ds.metrics_path = METRICS_SOCKET_DEFAULT;
+  ds.control_path = getenv("LINUXIO_AUTH_CONTROL_SOCKET");
+  if (!ds.control_path)
+    ds.control_path = CONTROL_SOCKET_DEFAULT;
+  // After a hot upgrade the running daemon is handed to us (see daemon_reexec())
+  int reexeced = reexec_restore(&ds) == 0;
+  if (!reexeced)
+    ds.workers = calloc((size_t)ds.max_workers, sizeof(*ds.workers));
+  if (!ds.workers)
+  {
+    journal_errorf("failed to allocate worker table");
+    return 1;
+  }
 
-  // Wait for exec-status: EOF means exec succeeded, data means exec failed.
-  // This ensures we don't send OK until the bridge binary has actually started.
-  int exec_status_fd = exec_status_pipe[0];
-  int exec_status_sel = -1;
-  for (;;)
   {
-    struct pollfd pfd = {
-        .fd = exec_status_fd,
-        .events = POLLIN,
-        .revents = 0};
+    int fdflags = fcntl(ds.listen_fd, F_GETFD);
+    if (fdflags >= 0)
+      (void)fcntl(ds.listen_fd, F_SETFD, fdflags | FD_CLOEXEC);
+  }
 
-    exec_status_sel = poll(&pfd, 1, BRIDGE_START_TIMEOUT_MS);
-    if (exec_status_sel < 0 && errno == EINTR)
-      continue;
-    break;
+  if (ds.busy_rd < 0)
+  {
+    int busy_pipe[2];
+    if (pipe2(busy_pipe, O_CLOEXEC) != 0)
+    {
+      journal_errorf("failed to create worker status pipe: %m");
+      free(ds.workers);
+      return 1;
+    }
+    ds.busy_rd = busy_pipe[0];
+    ds.busy_wr = busy_pipe[1];
   }
 
-  if (exec_status_sel == 0)
+  if (ds.supervise && ds.sup_rd < 0)
   {
-    const struct journal_field fields[] = {
-        {"LINUXIO_USER", auth_user.name},
-    };
-    journal_error_fieldsf(fields, 1, "bridge exec timed out after %d ms", BRIDGE_START_TIMEOUT_MS);
-    close(exec_status_fd);
-    kill(child, SIGKILL);
-    while (waitpid(child, NULL, 0) < 0 && errno == EINTR)
+    // Bridges of workers that handed their session over get reparented here
+    int sup[2];
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) != 0 ||
+        socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sup) != 0)
     {
+      journal_errorf("session supervision unavailable, workers keep their sessions: %m");
+      ds.supervise = 0;
     }
-    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "bridge start timeout");
-    pam_close_session(pamh, 0);
-    pam_setcred(pamh, PAM_DELETE_CRED);
-    pam_end(pamh, 0);
-    return 1;
+    else
+    {
+      (void)fcntl(sup[0], F_SETFL, O_NONBLOCK);
+      ds.sup_rd = sup[0];
+      ds.sup_wr = sup[1];
+    }
+  }
+  if (ds.supervise)
+  {
+    // How long a bridge waits for a re-attach after its client dropped
+    g_reattach.grace_ms = env_get_int("LINUXIO_AUTH_REATTACH_GRACE_MS", 30000, 0, 600000);
+    // Further logins of a user join the bridge already serving them
+    g_reattach.share_bridge = env_get_int("LINUXIO_AUTH_SHARE_BRIDGE", 0, 0, 1);
   }
 
-  if (exec_status_sel < 0)
+  if (ds.acct_rd < 0)
   {
-    const struct journal_field fields[] = {
-        {"LINUXIO_USER", auth_user.name},
-    };
-    journal_error_fieldsf(fields, 1, "exec-status wait failed: %m");
-    close(exec_status_fd);
-    kill(child, SIGKILL);
-    while (waitpid(child, NULL, 0) < 0 && errno == EINTR)
+    int acct[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, acct) != 0)
     {
+      journal_errorf("accounting writer unavailable, workers write login records themselves: %m");
+    }
+    else
+    {
+      ds.acct_rd = acct[0];
+      ds.acct_wr = acct[1];
     }
-    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "bridge exec status failed");
-    pam_close_session(pamh, 0);
-    pam_setcred(pamh, PAM_DELETE_CRED);
-    pam_end(pamh, 0);
-    return 1;
   }
+  g_acct_fd = ds.acct_wr;
 
-  uint8_t exec_status_byte = 0;
-  ssize_t exec_status_n = -1;
-  do
+  fail_table_init();
+  nss_cache_init();
+  auth_socket_gid_init();
+  if (ds.metrics_path[0])
   {
-    exec_status_n = read(exec_status_fd, &exec_status_byte, 1);
-  } while (exec_status_n < 0 && errno == EINTR);
-  close(exec_status_fd);
+    metrics_init();
+    if (g_metrics && ds.metrics_fd < 0)
+      ds.metrics_fd = daemon_socket_open(ds.metrics_path, SOCK_STREAM, "metrics");
+  }
+  if (ds.control_path[0] && ds.control_fd < 0)
+    control_open(&ds);
+  if (ds.dispatch_rd >= 0)
+    ds.lazy_privilege = env_get_int("LINUXIO_AUTH_LAZY_PRIVILEGE", 0, 0, 1);
+  admission_init(ds.max_workers);
+  session_table_open();
+  shared_tables_drop_unmapped();
+  {
+    // Workers (and the daemon, while it sheds logins) must not block in
+    // accept() on a connection someone else took
+    int flflags = fcntl(ds.listen_fd, F_GETFL);
+    if (flflags >= 0)
+      (void)fcntl(ds.listen_fd, F_SETFL, flflags | O_NONBLOCK);
+  }
 
-  if (exec_status_n > 0)
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGUSR2);
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0)
   {
-    // Child wrote error byte - exec failed
-    char status_buf[16];
-    (void)safe_snprintf(status_buf, sizeof(status_buf), "%u", (unsigned)exec_status_byte);
-    const struct journal_field fields[] = {
-        {"LINUXIO_USER", auth_user.name},
-        {"LINUXIO_STATUS", status_buf},
-    };
-    journal_error_fieldsf(fields, 2, "bridge exec failed");
-    send_error_response(output_fd, PROTO_RESULT_BRIDGE_ERROR, "bridge exec failed");
-    // Child already exited, but wait to reap
-    (void)waitpid(child, NULL, 0);
-    pam_close_session(pamh, 0);
-    pam_setcred(pamh, PAM_DELETE_CRED);
-    pam_end(pamh, 0);
+    journal_errorf("failed to block daemon signals: %m");
+    return 1;
+  }
+  int sfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+  if (sfd < 0)
+  {
+    journal_errorf("failed to create signalfd: %m");
     return 1;
   }
-  // exec_status_n == 0 means EOF = exec succeeded (CLOEXEC closed the pipe)
-  // exec_status_n < 0 is read error, but exec likely succeeded anyway
-
-  // Now we know bridge exec'd successfully - send OK response
-  // Bridge inherits the connection via FD 3, server continues Yamux on same connection
-  record_login_start(&auth_user, remote_host);
-  send_ok_response(output_fd, mode, auth_user.name, auth_user.uid, auth_user.gid);
 
-  // Don't close input_fd/output_fd - the bridge (child) has the connection via FD 3
-  // The parent's copy will be closed when we exit, which is fine
+  daemon_watch_bridge(&ds);
+  daemon_refresh_bridge();
+  // Loaded before the first fork so every worker starts with it
+  if (env_get_int("LINUXIO_AUTH_PAM_PRELOAD", 1, 0, 1))
+    (void)pam_preload();
+  daemon_watch_pam(&ds);
 
+  daemon_replenish(&ds);
+  (void)sd_notify(0, "READY=1");
+  daemon_notify_status(&ds);
   {
-    char uid_buf[32];
-    char gid_buf[32];
-    const char *mode_name = mode == PROTO_MODE_PRIVILEGED ? "privileged" : "unprivileged";
-    (void)safe_snprintf(uid_buf, sizeof(uid_buf), "%u", (unsigned)auth_user.uid);
-    (void)safe_snprintf(gid_buf, sizeof(gid_buf), "%u", (unsigned)auth_user.gid);
+    char pool_buf[16];
+    char max_buf[16];
+    char inflight_buf[16];
+    (void)safe_snprintf(pool_buf, sizeof(pool_buf), "%d", ds.pool_size);
+    (void)safe_snprintf(max_buf, sizeof(max_buf), "%d", ds.max_workers);
+    (void)safe_snprintf(inflight_buf, sizeof(inflight_buf), "%d",
+                        g_admission ? g_admission->limit : ds.max_workers);
     const struct journal_field fields[] = {
-        {"LINUXIO_USER", auth_user.name},
-        {"LINUXIO_UID", uid_buf},
-        {"LINUXIO_GID", gid_buf},
-        {"LINUXIO_MODE", mode_name},
-        {"LINUXIO_PRIVILEGED", mode == PROTO_MODE_PRIVILEGED ? "true" : "false"},
+        {"LINUXIO_POOL_SIZE", pool_buf},
+        {"LINUXIO_MAX_WORKERS", max_buf},
+        {"LINUXIO_MAX_INFLIGHT", inflight_buf},
+        {"LINUXIO_PARK_BRIDGE", ds.park_bridge ? "true" : "false"},
+        {"LINUXIO_SUPERVISE", ds.supervise ? "true" : "false"},
+        {"LINUXIO_REEXEC", reexeced ? "true" : "false"},
     };
-    journal_info_fieldsf(fields, 5, "bridge spawned");
+    journal_info_fieldsf(fields, 6, "auth daemon ready");
   }
 
-  int status = 0;
-  while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+  int running = 1;
+  while (running)
   {
-  }
+    int last_idle = ds.idle;
+    int last_busy = ds.busy;
+    int last_sessions = ds.nsessions;
+    // Control connections, pending control logins, refused connections and
+    // attached sessions follow the fixed slots
+    struct pollfd pfds[7 + CONTROL_MAX_CONNS + CONTROL_MAX_PENDING + DAEMON_SHED_MAX +
+                       DAEMON_ATTACHED_MAX] = {
+        {.fd = sfd, .events = POLLIN, .revents = 0},
+        {.fd = ds.busy_rd, .events = POLLIN, .revents = 0},
+        {.fd = ds.inotify_fd, .events = POLLIN, .revents = 0},
+        {.fd = ds.sup_rd, .events = POLLIN, .revents = 0},
+        {.fd = ds.metrics_fd, .events = POLLIN, .revents = 0},
+        {.fd = ds.control_fd, .events = POLLIN, .revents = 0},
+        {.fd = daemon_full(&ds) ? ds.listen_fd : -1, .events = POLLIN, .revents = 0},
+    };
+    int nctl = ds.ncontrol;
+    int npend = ds.npending;
+    for (int i = 0; i < nctl; i++)
+      pfds[7 + i] = (struct pollfd){.fd = ds.control_conns[i], .events = POLLIN, .revents = 0};
+    for (int k = 0; k < npend; k++)
+      pfds[7 + nctl + k] = (struct pollfd){.fd = ds.pending[k].reply_fd, .events = POLLIN,
+                                           .revents = 0};
+    struct pollfd *shed_pfds = &pfds[7 + nctl + npend];
+    int nshed = ds.nshed;
+    for (int i = 0; i < nshed; i++)
+      shed_pfds[i] = (struct pollfd){.fd = ds.shed[i].fd, .events = POLLIN, .revents = 0};
+    struct pollfd *attached_pfds = &shed_pfds[nshed];
+    int nattached = ds.nattached;
+    for (int i = 0; i < nattached; i++)
+      attached_pfds[i] = (struct pollfd){.fd = ds.attached[i].fd, .events = POLLIN, .revents = 0};
+    int timeout = ds.idle < ds.pool_size || (ds.acct_rd >= 0 && ds.acct_pid == 0)
+                      ? DAEMON_RESPAWN_BACKOFF_MS
+                      : -1;
+    timeout = daemon_shed_timeout(&ds, timeout);
+    int pr = poll(pfds, 7 + (nfds_t)nctl + (nfds_t)npend + (nfds_t)nshed + (nfds_t)nattached,
+                  timeout);
+    if (pr < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      journal_errorf("daemon poll failed: %m");
+      break;
+    }
 
-  int exitcode = 1;
-  if (WIFEXITED(status))
-  {
-    exitcode = WEXITSTATUS(status);
-    if (exitcode != 0)
+    if (pfds[1].revents & POLLIN)
+      daemon_mark_busy(&ds);
+
+    if (pfds[2].revents & POLLIN)
+      daemon_inotify_events(&ds);
+
+    if (pfds[4].revents & POLLIN)
+      metrics_serve(&ds, ds.metrics_fd);
+
+    // Both tables are compacted by moving their last entry down, so walk them
+    // from the end; responses first, as reading frames adds pending logins.
+    for (int k = npend - 1; k >= 0; k--)
     {
-      char exit_buf[32];
-      char pid_buf[32];
-      (void)safe_snprintf(exit_buf, sizeof(exit_buf), "%d", exitcode);
-      (void)safe_snprintf(pid_buf, sizeof(pid_buf), "%ld", (long)child);
-      const struct journal_field fields[] = {
-          {"LINUXIO_USER", auth_user.name},
-          {"LINUXIO_STATUS", exit_buf},
-          {"LINUXIO_CHILD_PID", pid_buf},
-      };
-      journal_error_fieldsf(fields, 3, "bridge pid %ld exited with status %d", (long)child, exitcode);
+      if (pfds[7 + nctl + k].revents)
+        control_relay(&ds, k);
+    }
+    for (int i = nctl - 1; i >= 0; i--)
+    {
+      if (pfds[7 + i].revents)
+        control_read(&ds, i);
+    }
+    if (pfds[5].revents & POLLIN)
+      control_accept(&ds);
+
+    // Before accepting more: the table is in poll order only until then
+    daemon_shed_expire(&ds, shed_pfds, 0);
+    if (pfds[6].revents & POLLIN)
+      daemon_shed_logins(&ds);
+
+    // Before taking handoffs, which add attached sessions, and reaping,
+    // which drops those of a bridge
+    daemon_attached_expire(&ds, attached_pfds, nattached);
+
+    // Before reaping: a handed-over bridge may already have exited
+    if ((pfds[3].revents & POLLIN) || (ds.supervise && (pfds[0].revents & POLLIN)))
+      daemon_receive_sessions(&ds);
+
+    if (pfds[0].revents & POLLIN)
+    {
+      struct signalfd_siginfo si;
+      int reload = 0;
+      int reexec = 0;
+      while (read(sfd, &si, sizeof(si)) == (ssize_t)sizeof(si))
+      {
+        if (si.ssi_signo == SIGTERM || si.ssi_signo == SIGINT)
+          running = 0;
+        else if (si.ssi_signo == SIGHUP)
+          reload = 1;
+        else if (si.ssi_signo == SIGUSR2)
+          reexec = 1;
+      }
+      daemon_reap(&ds);
+      if (reload && running)
+      {
+        nss_cache_flush();
+        daemon_reload_pam(&ds);
+      }
+      if (reexec && running)
+        daemon_reexec(&ds);
     }
+
+    if (running)
+      daemon_replenish(&ds);
+    if (ds.idle != last_idle || ds.busy != last_busy || ds.nsessions != last_sessions)
+      daemon_notify_status(&ds);
   }
-  else if (WIFSIGNALED(status))
+
+  (void)sd_notify(0, "STOPPING=1");
+  // Busy workers hold live sessions and are left running (KillMode=process),
+  // matching how stopping the socket leaves Accept=yes instances alone.
+  daemon_stop_idle_workers(&ds);
+  control_shutdown(&ds);
+  if (ds.supervise)
   {
-    int sig = WTERMSIG(status);
-    exitcode = 128 + WTERMSIG(status);
-    char exit_buf[32];
-    char signal_buf[32];
-    char pid_buf[32];
-    (void)safe_snprintf(exit_buf, sizeof(exit_buf), "%d", exitcode);
-    (void)safe_snprintf(signal_buf, sizeof(signal_buf), "%d", sig);
-    (void)safe_snprintf(pid_buf, sizeof(pid_buf), "%ld", (long)child);
-    const struct journal_field fields[] = {
-        {"LINUXIO_USER", auth_user.name},
-        {"LINUXIO_STATUS", exit_buf},
-        {"LINUXIO_SIGNAL", signal_buf},
-        {"LINUXIO_CHILD_PID", pid_buf},
-    };
-    journal_error_fieldsf(fields, 4, "bridge pid %ld killed by signal %d", (long)child, sig);
+    daemon_receive_sessions(&ds);
+    daemon_reap(&ds);
+    daemon_hand_sessions_to_keeper(&ds);
+    close(ds.sup_rd);
+    close(ds.sup_wr);
+    free(ds.sessions);
   }
-
-  record_login_end();
-  pam_close_session(pamh, 0);
-  pam_setcred(pamh, PAM_DELETE_CRED);
-  pam_end(pamh, 0);
-
-  return exitcode;
+  if (ds.acct_pid > 0)
+  {
+    // Let the writer flush; late logouts fall back to writing themselves
+    (void)kill(ds.acct_pid, SIGTERM);
+    (void)waitpid(ds.acct_pid, NULL, 0);
+  }
+  if (ds.acct_rd >= 0)
+  {
+    close(ds.acct_rd);
+    close(ds.acct_wr);
+    g_acct_fd = -1;
+  }
+  if (ds.metrics_fd >= 0)
+  {
+    close(ds.metrics_fd);
+    (void)unlink(ds.metrics_path);
+  }
+  close(sfd);
+  close(ds.busy_rd);
+  close(ds.busy_wr);
+  if (ds.inotify_fd >= 0)
+    close(ds.inotify_fd);
+  bridge_cache_clear();
+  free(ds.workers);
+  return 0;
 }
 
 // -------- main ----------
@@ -1965,23 +8947,16 @@ int main(int argc, char *argv[])
     return 2;
   }
 
-  // Best-effort socket timeouts (stdin/stdout are the accepted socket)
-  struct timeval tv_read = {.tv_sec = SOCKET_READ_TIMEOUT, .tv_usec = 0};
-  struct timeval tv_write = {.tv_sec = SOCKET_WRITE_TIMEOUT, .tv_usec = 0};
-  (void)setsockopt(STDIN_FILENO, SOL_SOCKET, SO_RCVTIMEO, &tv_read, sizeof(tv_read));
-  (void)setsockopt(STDOUT_FILENO, SOL_SOCKET, SO_SNDTIMEO, &tv_write, sizeof(tv_write));
+  bridge_policy_init();
 
-  // Defense-in-depth: verify peer credentials before processing
-  // This catches socket permission mistakes at the kernel level
-  if (check_peer_creds(STDIN_FILENO) != 0)
-  {
-    return 1;
-  }
+  // Daemon mode: Accept=no, the listening socket comes from sd_listen_fds()
+  if (argc == 2 && strcmp(argv[1], "--daemon") == 0)
+    return run_daemon();
 
-  return handle_client(STDIN_FILENO, STDOUT_FILENO);
+  return serve_connection();
 }
 
-// write_all - needed by log_stderrf and send_response
+// write_all - needed by log_stderrf
 static int write_all(int fd, const void *buf, size_t len)
 {
   const unsigned char *p = (const unsigned char *)buf;
@@ -1999,3 +8974,31 @@ static int write_all(int fd, const void *buf, size_t len)
   }
   return 0;
 }
+
+// writev_all - needed by send_response; advances iov in place on short writes
+static int writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+  while (iovcnt > 0)
+  {
+    ssize_t n = writev(fd, iov, iovcnt);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    size_t done = (size_t)n;
+    while (iovcnt > 0 && done >= iov->iov_len)
+    {
+      done -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0)
+    {
+      iov->iov_base = (uint8_t *)iov->iov_base + done;
+      iov->iov_len -= done;
+    }
+  }
+  return 0;
+}
@@ -24,33 +24,74 @@
  * Auth Request Protocol (Server -> Auth via Unix socket)
  *
  * Format:
- *   [magic:4][flags:1][reserved:3]  (8 bytes fixed header)
+ *   [magic:4][flags:1][deadline_ms:3]  (8 bytes fixed header)
  *   [len:2][user]
  *   [len:2][password]
  *   [len:2][session_id]
  *   [len:2][remote_host]
+ *
+ * With PROTO_REQ_FLAG_REATTACH the password field carries a re-attach
+ * ticket instead (see "Session re-attach" below).
+ *
+ * deadline_ms is how long the client will wait for the response, counted
+ * from when it sent the request (0 = no deadline). Waits inside the login
+ * are cut to what is left of it; a login that runs past it is answered
+ * with PROTO_RESULT_DEADLINE_EXCEEDED.
  *
  * All multi-byte integers are big-endian.
  * ========================================================================== */
 
 #define PROTO_AUTH_REQ_HEADER_SIZE   8
+#define PROTO_REQ_DEADLINE_MAX_MS    0xFFFFFF
 
 /* Request flags byte */
 #define PROTO_REQ_FLAG_VERBOSE       0x01
+#define PROTO_REQ_FLAG_TIMING        0x02  /* ask for the timing trailer */
+#define PROTO_REQ_FLAG_REATTACH      0x04  /* re-attach to a running bridge */
+#define PROTO_REQ_FLAG_TICKET        0x08  /* ask for a re-attach ticket */
+#define PROTO_REQ_FLAG_RELEASE       0x10  /* with REATTACH: give up the ticket */
+#define PROTO_REQ_FLAG_UPGRADE       0x20  /* control login: take a privilege upgrade */
 
 /* ==========================================================================
  * Auth Response Protocol (Auth -> Server via Unix socket)
  *
  * Format:
- *   [magic:4][status:1][mode:1][result:1][reserved:1]  (8 bytes fixed header)
+ *   [magic:4][status:1][mode:1][result:1][flags:1]  (8 bytes fixed header)
  *   [uid:4][gid:4][len:2][username]    (only if status == ok)
  *   [len:2][error]                     (only if status == error)
+ *   [count:1]([phase:1][usec:4])*count (only if flags & TIMING)
+ *   [len:2][ticket]                    (only if flags & TICKET)
+ *   [retry_after_ms:4]                 (only if flags & RETRY)
+ *
+ * A daemon that has no room for another login answers it at once with
+ * PROTO_RESULT_BUSY and the RETRY trailer: how long the client should
+ * wait before trying again.
  *
  * All multi-byte integers are big-endian.
  * ========================================================================== */
 
 #define PROTO_AUTH_RESP_HEADER_SIZE  8
 
+/* Response flags byte; the timing and ticket trailers are only sent if the
+ * request asked */
+#define PROTO_RESP_FLAG_TIMING       0x01
+#define PROTO_RESP_FLAG_TICKET       0x02
+#define PROTO_RESP_FLAG_UPGRADE      0x04  /* a PROTO_CTL_UPGRADE frame follows */
+#define PROTO_RESP_FLAG_RETRY        0x08  /* BUSY: retry-after trailer */
+
+/* Login phases in the timing trailer (microseconds, saturating) */
+#define PROTO_PHASE_REQUEST_READ     0
+#define PROTO_PHASE_PAM_AUTH         1
+#define PROTO_PHASE_PAM_ACCT         2
+#define PROTO_PHASE_PAM_SETCRED      3
+#define PROTO_PHASE_SUDO             4  /* time blocked joining the probe */
+#define PROTO_PHASE_BRIDGE_VALIDATE  5
+#define PROTO_PHASE_PAM_OPEN_SESSION 6
+#define PROTO_PHASE_FORK             7
+#define PROTO_PHASE_EXEC             8  /* until exec-status EOF */
+#define PROTO_PHASE_SEND_OK          9  /* journal only */
+#define PROTO_PHASE_COUNT            10
+
 /* Status byte values */
 #define PROTO_STATUS_OK              0
 #define PROTO_STATUS_ERROR           1
@@ -63,6 +104,9 @@
 #define PROTO_RESULT_BAD_REQUEST     4
 #define PROTO_RESULT_INTERNAL_ERROR  5
 #define PROTO_RESULT_BRIDGE_ERROR    6
+#define PROTO_RESULT_RATE_LIMITED    7
+#define PROTO_RESULT_DEADLINE_EXCEEDED 8
+#define PROTO_RESULT_BUSY            9
 
 /* Mode byte values */
 #define PROTO_MODE_UNPRIVILEGED      0
@@ -75,6 +119,18 @@
  *   [magic:4][uid:4][gid:4][flags:1]  (13 bytes fixed header)
  *   [len:2][session_id]
  *   [len:2][username]
+ *   [len:2][extension]                (only with PROTO_FLAG_EXTENDED)
+ *
+ * The extension is a sequence of [type:1][len:2][value] entries carrying
+ * what linuxio-auth already resolved, so the bridge need not look it up
+ * again. Entries may come in any order; a reader skips types it does not
+ * know, and an entry that is absent means "not known":
+ *   PROTO_BOOT_HOME         the user's home directory (passwd entry)
+ *   PROTO_BOOT_GROUPS       [gid:4]* the user's group list, primary included
+ *   PROTO_BOOT_PRIV_SOURCE  what decided the mode: "sudo", "groups", "cache"
+ *   PROTO_BOOT_LOGIN_TIME   [requested_us:8][authenticated_us:8] wall clock
+ *                           (microseconds since the epoch) of the request
+ *                           and of the successful PAM authentication
  *
  * All multi-byte integers are big-endian.
  * ========================================================================== */
@@ -84,6 +140,149 @@
 /* Bootstrap flags byte (bit field) */
 #define PROTO_FLAG_VERBOSE           0x01
 #define PROTO_FLAG_PRIVILEGED        0x02
+#define PROTO_FLAG_EXTENDED          0x04
+
+/* Bootstrap extension entry types */
+#define PROTO_BOOT_HOME              1
+#define PROTO_BOOT_GROUPS            2
+#define PROTO_BOOT_PRIV_SOURCE       3
+#define PROTO_BOOT_LOGIN_TIME        4
+#define PROTO_BOOT_ENTRY_HEADER      3
+#define PROTO_BOOT_MAX_GROUPS        1024
+
+/* ==========================================================================
+ * Parked bridge handoff (Auth -> pre-started Bridge, opt-in)
+ *
+ * A parked bridge is exec'd as root with LINUXIO_BRIDGE_PARKED=1 and a
+ * SOCK_SEQPACKET socket on stdin instead of the bootstrap pipe. A login is
+ * handed over as one message:
+ *   [bootstrap]                        (as above; the group list is only
+ *                                       sent below)
+ *   [len:2][home]
+ *   [loginuid:4]                       (PROTO_PARKED_NO_LOGINUID if unset)
+ *   [ngroups:2][gid:4]*ngroups         (supplementary groups for the user)
+ * with the client connection attached as SCM_RIGHTS. The bridge installs it
+ * at FD 3, drops privileges (unless privileged) and replies with one status
+ * byte; PROTO_PARKED_STATUS_OK takes the place of exec-status EOF.
+ *
+ * All multi-byte integers are big-endian.
+ * ========================================================================== */
+
+#define PROTO_PARKED_ENV             "LINUXIO_BRIDGE_PARKED"
+#define PROTO_PARKED_MAX_GROUPS      1024
+#define PROTO_PARKED_NO_LOGINUID     0xFFFFFFFFu
+#define PROTO_PARKED_STATUS_OK       0
+#define PROTO_PARKED_STATUS_FAILED   1
+
+/* ==========================================================================
+ * Session re-attach (Auth -> running Bridge, supervised daemon mode)
+ *
+ * A login that set PROTO_REQ_FLAG_TICKET may get a re-attach ticket in its
+ * OK response. Its bridge then runs with PROTO_REATTACH_ENV=<grace ms> and
+ * a SOCK_SEQPACKET socket at PROTO_REATTACH_FD. A later request with
+ * PROTO_REQ_FLAG_REATTACH, the same user and session_id and the ticket as
+ * password skips PAM: linuxio-auth sends the bridge a PROTO_ATTACH_REATTACH
+ * message with the new client connection attached as SCM_RIGHTS, the bridge
+ * swaps it in for its current one and replies with one status byte. The OK
+ * response carries the next ticket; each ticket is good for one re-attach.
+ * A bridge whose client connection dropped waits up to the grace period for
+ * one before it exits.
+ *
+ * REATTACH with PROTO_REQ_FLAG_RELEASE hands no connection over: the ticket
+ * is dropped and the bridge's re-attach socket closed (a shared bridge is
+ * sent PROTO_ATTACH_RELEASE instead), so a bridge whose client logged out
+ * exits without waiting out the grace period.
+ *
+ * With LINUXIO_AUTH_SHARE_BRIDGE every supervised bridge has the socket and
+ * runs with PROTO_SHARED_ENV=1. A further login of the same user in the same
+ * mode is then served by that bridge as one more session instead of a new
+ * bridge: PROTO_ATTACH_SESSION carries [len:2][session_id] with the client
+ * connection and a reply socket as SCM_RIGHTS, and the status byte comes
+ * back on the reply socket. The bridge keeps the reply socket of a session
+ * it took open until that session ended; linuxio-auth lists the session in
+ * the session table until then. The bridge exits once all its sessions
+ * ended.
+ *
+ * Messages are [kind:1] followed by the kind's payload; only
+ * PROTO_ATTACH_REATTACH is answered on the re-attach socket itself.
+ * ========================================================================== */
+
+#define PROTO_REATTACH_ENV           "LINUXIO_BRIDGE_REATTACH"
+#define PROTO_SHARED_ENV             "LINUXIO_BRIDGE_SHARED"
+#define PROTO_REATTACH_FD            6
+#define PROTO_REATTACH_STATUS_OK     0
+#define PROTO_REATTACH_STATUS_FAILED 1
+#define PROTO_TICKET_HEX_LEN         64  /* lowercase hex of 32 random bytes */
+
+#define PROTO_ATTACH_REATTACH        0  /* + client conn */
+#define PROTO_ATTACH_SESSION         1  /* [len:2][session_id] + client conn, reply socket */
+#define PROTO_ATTACH_RELEASE         2  /* no re-attach will come; no reply */
+
+/* ==========================================================================
+ * Control channel, protocol v4 (Server -> Auth daemon, daemon mode)
+ *
+ * Besides the single-shot auth socket, the daemon listens on a
+ * SOCK_SEQPACKET socket for long-lived connections that carry many logins.
+ * Every frame is one packet:
+ *   [magic:3][version:1][type:1][reserved:3][request_id:4]  (12 bytes)
+ *   [payload]
+ * with version PROTO_CONTROL_VERSION. PROTO_CTL_LOGIN carries a complete
+ * auth request (as above, version PROTO_VERSION) as payload. It is answered
+ * by one PROTO_CTL_RESPONSE frame with the same request_id and an auth
+ * response as payload; answers come in completion order, not request order.
+ * On status ok the bridge connection, one end of a socketpair whose other
+ * end the bridge serves, is attached as SCM_RIGHTS.
+ *
+ * A login with PROTO_REQ_FLAG_UPGRADE may be answered before its sudo probe
+ * finished (LINUXIO_AUTH_LAZY_PRIVILEGE): the response is ok in
+ * unprivileged mode with PROTO_RESP_FLAG_UPGRADE set, and exactly one
+ * PROTO_CTL_UPGRADE frame with the same request_id follows. If sudo
+ * allowed the user, its payload is an ok response in privileged mode with
+ * the connection of a new, privileged bridge attached, and the webserver
+ * closes the unprivileged one, which ends it. An empty payload means the
+ * login stays unprivileged.
+ *
+ * A malformed frame closes the connection.
+ *
+ * All multi-byte integers are big-endian.
+ * ========================================================================== */
+
+#define PROTO_CONTROL_VERSION        4
+#define PROTO_CONTROL_HEADER_SIZE    12
+#define PROTO_CONTROL_MAX_FRAME      4096
+
+#define PROTO_CTL_LOGIN              1
+#define PROTO_CTL_RESPONSE           2
+#define PROTO_CTL_UPGRADE            3
+
+/* ==========================================================================
+ * Live session table (linuxio-auth -> webserver/CLI via shared memory)
+ *
+ * linuxio-auth keeps one slot per live session in a file it maps shared
+ * (LINUXIO_AUTH_SESSION_TABLE, default /run/linuxio/sessions.shm, owned
+ * root:linuxio-bridge-socket 0640). Readers map it read-only and walk the
+ * slots without syscalls or locks.
+ *
+ * Format (native byte order, fixed size):
+ *   header: [magic:4][version:4][slots:4][slot_size:4] (64 bytes, rest reserved)
+ *   slot:   [seq:4][owner:4][uid:4][mode:1][pad:3][bridge_pid:4][pad:4]
+ *           [started_us:8][last_activity_us:8][session_id:64]
+ *           (slot_size bytes, rest reserved; slot i at 64 + i * slot_size)
+ *
+ * Each slot is a seqlock: a writer makes seq odd, updates the slot and
+ * makes seq even again. A reader copies the slot between two loads of seq
+ * and keeps the copy only if both are the same even value. A slot holds a
+ * session while owner (the pid that claimed it) and bridge_pid are non-zero.
+ * A session attached to a shared bridge has a slot of its own with that
+ * bridge's pid.
+ * Times are CLOCK_REALTIME microseconds; last_activity_us is the last login
+ * or re-attach. session_id is NUL-padded.
+ * ========================================================================== */
+
+#define PROTO_SESSION_TABLE_MAGIC        0x534f494cu  /* "LIOS" */
+#define PROTO_SESSION_TABLE_VERSION      1
+#define PROTO_SESSION_TABLE_HEADER_SIZE  64
+#define PROTO_SESSION_TABLE_SLOT_SIZE    128
 
 /* ==========================================================================
  * Max lengths for variable fields
@@ -39,10 +39,16 @@ func readBootstrap() *authipc.Bootstrap {
 	return b
 }
 
-// initializeBridgeSession reads bootstrap data and constructs the session
-// object shared by handlers, routing, and audit metadata.
+// initializeBridgeSession reads bootstrap data (from the stdin pipe, or from
+// the handoff socket of a parked bridge) and constructs the session object
+// shared by handlers, routing, and audit metadata.
 func initializeBridgeSession() {
-	bootCfg = readBootstrap()
+	if isParkedBridge() {
+		bootCfg = awaitParkedHandoff()
+	} else {
+		bootCfg = readBootstrap()
+		initReattach(authipc.ReattachFD)
+	}
 	if bootCfg.Verbose {
 		if configureErr := logging.Configure("linuxio-bridge", true); configureErr != nil {
 			fmt.Fprintf(os.Stderr, "failed to reconfigure logger: %v\n", configureErr)
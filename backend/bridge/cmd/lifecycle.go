@@ -13,6 +13,7 @@ import (
 	"github.com/mordilloSan/LinuxIO/backend/bridge/handlers"
 	"github.com/mordilloSan/LinuxIO/backend/bridge/internal/runtime"
 	bridgeipc "github.com/mordilloSan/LinuxIO/backend/common/ipc/bridge"
+	"github.com/mordilloSan/LinuxIO/backend/common/session"
 )
 
 const clientConnFD = 3
@@ -48,13 +49,21 @@ func runBridge(clientConn net.Conn, rt runtime.Runtime) {
 	router := handlers.RegisterAllHandlers(rt)
 	startBridgeSignalHandler(shutdownCh)
 
-	closeClientConn := newClientConnCloser(clientConn)
-	startMainRequestLoop(sessionCtx, rt, router, clientConn, shutdownCh)
+	clients := newClientConns(clientConn)
+	attached := newAttachedSessions()
+	reattached := startReattachListener(clients, func(sessionID string, conn net.Conn, ended func()) bool {
+		return attached.serve(sessionCtx, rt, router, sessionID, conn, ended)
+	})
+	startMainRequestLoop(sessionCtx, rt, router, clientConn, clients, reattached, attached, shutdownCh)
 	sessionID := ""
 	if rt.Session != nil {
 		sessionID = rt.Session.SessionID
 	}
-	<-startBridgeCleanup(shutdownCh, closeClientConn, router.Registry(), sessionID, sessionCancel)
+	closeClients := func() {
+		clients.close()
+		attached.close()
+	}
+	<-startBridgeCleanup(shutdownCh, closeClients, router.Registry(), sessionID, sessionCancel)
 }
 
 // startBridgeSignalHandler forwards SIGINT/SIGTERM into the bridge shutdown
@@ -71,24 +80,153 @@ func startBridgeSignalHandler(shutdownCh chan<- string) {
 	}()
 }
 
-// newClientConnCloser returns an idempotent closer for the inherited client
-// connection so multiple shutdown paths can safely request closure.
-func newClientConnCloser(clientConn net.Conn) func() {
-	var closeOnce sync.Once
-	return func() {
-		closeOnce.Do(func() {
-			if err := clientConn.Close(); err != nil {
-				slog.Debug("client conn close", "error", err)
-			}
-		})
+// clientConns tracks the client connection being served. A re-attach
+// replaces it; close is idempotent so multiple shutdown paths can safely
+// request closure. done is closed by close.
+type clientConns struct {
+	mu      sync.Mutex
+	current net.Conn
+	closed  bool
+	done    chan struct{}
+}
+
+func newClientConns(clientConn net.Conn) *clientConns {
+	return &clientConns{current: clientConn, done: make(chan struct{})}
+}
+
+// replace makes conn the served connection and closes the previous one.
+// Once shutdown closed the connections it closes conn and returns false.
+func (c *clientConns) replace(conn net.Conn) bool {
+	c.mu.Lock()
+	if c.closed {
+		c.mu.Unlock()
+		closeClientConn(conn)
+		return false
 	}
+	prev := c.current
+	c.current = conn
+	c.mu.Unlock()
+	closeClientConn(prev)
+	return true
 }
 
-// startMainRequestLoop runs the yamux serving loop and reports client
-// disconnects as bridge shutdown reasons.
-func startMainRequestLoop(ctx context.Context, rt runtime.Runtime, router *bridgeipc.Router, clientConn net.Conn, shutdownCh chan<- string) {
+func (c *clientConns) close() {
+	c.mu.Lock()
+	conn := c.current
+	already := c.closed
+	c.closed = true
+	c.mu.Unlock()
+	if !already {
+		close(c.done)
+		closeClientConn(conn)
+	}
+}
+
+func closeClientConn(conn net.Conn) {
+	if err := conn.Close(); err != nil {
+		slog.Debug("client conn close", "error", err)
+	}
+}
+
+// attachedSessions tracks the further sessions a shared bridge serves
+// besides the one it was started for. Once that one is over the bridge
+// stays up until the last of them ended, and takes no new ones after that.
+type attachedSessions struct {
+	mu       sync.Mutex
+	conns    map[net.Conn]struct{}
+	draining bool
+	closed   bool
+	idle     chan struct{} // closed together with closed
+}
+
+func newAttachedSessions() *attachedSessions {
+	return &attachedSessions{conns: make(map[net.Conn]struct{}), idle: make(chan struct{})}
+}
+
+// serve runs session sessionID on conn with its own session identity and
+// the shared router, and calls ended once it is over. It returns false, and
+// closes conn, once the bridge no longer takes sessions.
+func (a *attachedSessions) serve(ctx context.Context, rt runtime.Runtime, router *bridgeipc.Router, sessionID string, conn net.Conn, ended func()) bool {
+	a.mu.Lock()
+	if a.closed {
+		a.mu.Unlock()
+		closeClientConn(conn)
+		return false
+	}
+	a.conns[conn] = struct{}{}
+	a.mu.Unlock()
+
+	attachedSess := &session.Session{
+		SessionID:  sessionID,
+		Privileged: rt.Session.Privileged,
+		Timing:     session.Timing{CreatedAt: time.Now()},
+		User:       rt.Session.User,
+	}
+	slog.Info("session attached to shared bridge", "session_id", sessionID, "bridge_session_id", rt.Session.SessionID)
 	wg.Go(func() {
-		handleYamuxSession(ctx, rt, router, clientConn)
+		handleYamuxSession(ctx, runtime.New(attachedSess, rt.Store), router, conn)
+		if registry := router.Registry(); registry != nil {
+			registry.CancelForSession(sessionID)
+		}
+		closeClientConn(conn)
+		ended()
+		a.mu.Lock()
+		delete(a.conns, conn)
+		if a.draining {
+			a.closeIfIdleLocked()
+		}
+		a.mu.Unlock()
+	})
+	return true
+}
+
+// wait blocks until no attached session is left, refusing new ones from
+// then on.
+func (a *attachedSessions) wait() {
+	a.mu.Lock()
+	a.draining = true
+	a.closeIfIdleLocked()
+	a.mu.Unlock()
+	<-a.idle
+}
+
+func (a *attachedSessions) closeIfIdleLocked() {
+	if a.closed || len(a.conns) > 0 {
+		return
+	}
+	a.closed = true
+	close(a.idle)
+}
+
+// close refuses further sessions and closes those being served.
+func (a *attachedSessions) close() {
+	a.mu.Lock()
+	conns := make([]net.Conn, 0, len(a.conns))
+	for conn := range a.conns {
+		conns = append(conns, conn)
+	}
+	if !a.closed {
+		a.closed = true
+		close(a.idle)
+	}
+	a.mu.Unlock()
+	for _, conn := range conns {
+		closeClientConn(conn)
+	}
+}
+
+// startMainRequestLoop runs the yamux serving loop, again for every
+// re-attached connection, and reports the end of the bridge's sessions as
+// a bridge shutdown reason.
+func startMainRequestLoop(ctx context.Context, rt runtime.Runtime, router *bridgeipc.Router, clientConn net.Conn, clients *clientConns, reattached <-chan net.Conn, attached *attachedSessions, shutdownCh chan<- string) {
+	wg.Go(func() {
+		for conn := clientConn; conn != nil; conn = awaitReattach(ctx, reattached) {
+			handleYamuxSession(ctx, rt, router, conn)
+		}
+		// No re-attach from here on; a shared bridge still serves the
+		// sessions attached to it.
+		clients.close()
+		attached.wait()
 		select {
 		case shutdownCh <- "client disconnected":
 		default:
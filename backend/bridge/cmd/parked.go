@@ -0,0 +1,202 @@
+package cmd
+
+import (
+	"errors"
+	"fmt"
+	"log/slog"
+	"os"
+	"strconv"
+	"syscall"
+
+	authipc "github.com/mordilloSan/LinuxIO/backend/common/ipc/auth"
+	"golang.org/x/sys/unix"
+)
+
+// parkedHandoffFD is the SOCK_SEQPACKET socket a parked bridge receives its
+// login on (stdin, in place of the bootstrap pipe).
+const parkedHandoffFD = 0
+
+// isParkedBridge reports whether linuxio-auth started this bridge ahead of a
+// login (LINUXIO_AUTH_PARK_BRIDGE=1 in daemon mode).
+func isParkedBridge() bool {
+	return os.Getenv(authipc.ParkedEnv) == "1"
+}
+
+// awaitParkedHandoff blocks until linuxio-auth hands this parked bridge a
+// login, then takes on the same state a freshly exec'd bridge starts with:
+// the session identity (privileges dropped unless privileged), its
+// environment and working directory, and the client connection on FD 3.
+// The client connection is only installed after the privilege drop.
+// FAIL-FAST: any error is reported to linuxio-auth, which then falls back to
+// spawning a fresh bridge, and the process exits.
+func awaitParkedHandoff() *authipc.Bootstrap {
+	handoff, clientFD, reattachSock, err := receiveParkedHandoff()
+	if err != nil {
+		if errors.Is(err, errParkedClosed) {
+			// The auth worker went away without a login for us.
+			os.Exit(0)
+		}
+		failParkedHandoff("failed to receive parked bridge handoff", err)
+	}
+
+	b := handoff.Bootstrap
+	if b.SessionID == "" || b.Username == "" {
+		failParkedHandoff("parked bridge handoff missing session_id or username", nil)
+	}
+
+	if handoff.LoginUID != authipc.ParkedNoLoginUID {
+		// Best effort: only possible while still root with an unset loginuid.
+		loginUID := strconv.FormatUint(uint64(handoff.LoginUID), 10)
+		if writeErr := os.WriteFile("/proc/self/loginuid", []byte(loginUID), 0); writeErr != nil {
+			slog.Debug("failed to set audit loginuid", "error", writeErr)
+		}
+	}
+
+	if !b.Privileged {
+		if dropErr := dropParkedPrivileges(handoff); dropErr != nil {
+			failParkedHandoff("failed to drop privileges", dropErr)
+		}
+	}
+
+	if installErr := installParkedClient(clientFD); installErr != nil {
+		failParkedHandoff("failed to install client connection", installErr)
+	}
+	initReattach(reattachSock)
+
+	if _, writeErr := syscall.Write(parkedHandoffFD, []byte{authipc.ParkedStatusOK}); writeErr != nil {
+		slog.Error("failed to acknowledge parked bridge handoff", "error", writeErr)
+		os.Exit(1)
+	}
+	releaseParkedHandoffFD()
+	return b
+}
+
+var errParkedClosed = errors.New("handoff socket closed")
+
+// receiveParkedHandoff reads the single handoff message and its SCM_RIGHTS
+// fds: the client connection and, if the login can be re-attached, the
+// re-attach socket (-1 otherwise).
+func receiveParkedHandoff() (*authipc.ParkedHandoff, int, int, error) {
+	buf := make([]byte, authipc.ParkedMaxMessage)
+	oob := make([]byte, syscall.CmsgSpace(2*4))
+	var n, oobn int
+	var err error
+	for {
+		n, oobn, _, _, err = syscall.Recvmsg(parkedHandoffFD, buf, oob, 0)
+		if !errors.Is(err, syscall.EINTR) {
+			break
+		}
+	}
+	if err != nil {
+		return nil, -1, -1, fmt.Errorf("recvmsg: %w", err)
+	}
+	if n == 0 {
+		return nil, -1, -1, errParkedClosed
+	}
+
+	msgs, err := syscall.ParseSocketControlMessage(oob[:oobn])
+	if err != nil || len(msgs) != 1 {
+		return nil, -1, -1, fmt.Errorf("expected one control message: %v", err)
+	}
+	fds, err := syscall.ParseUnixRights(&msgs[0])
+	handoff, decodeErr := authipc.DecodeParkedHandoff(buf[:n])
+	if err != nil || len(fds) < 1 || len(fds) > 2 || decodeErr != nil {
+		for _, fd := range fds {
+			_ = syscall.Close(fd)
+		}
+		if decodeErr != nil {
+			return nil, -1, -1, decodeErr
+		}
+		return nil, -1, -1, fmt.Errorf("expected a client fd and at most a re-attach fd: %v", err)
+	}
+
+	reattachSock := -1
+	if len(fds) == 2 {
+		reattachSock = fds[1]
+	}
+	return handoff, fds[0], reattachSock, nil
+}
+
+// dropParkedPrivileges mirrors drop_to_user() and the unprivileged branch of
+// spawn_bridge_process() in linuxio-auth. Go applies the set*id calls to all
+// threads of the process.
+func dropParkedPrivileges(h *authipc.ParkedHandoff) error {
+	b := h.Bootstrap
+	groups := make([]int, len(h.Groups))
+	for i, g := range h.Groups {
+		groups[i] = int(g)
+	}
+	if err := syscall.Setgroups(groups); err != nil {
+		return fmt.Errorf("setgroups: %w", err)
+	}
+	if err := syscall.Setresgid(int(b.GID), int(b.GID), int(b.GID)); err != nil {
+		return fmt.Errorf("setresgid: %w", err)
+	}
+	if err := syscall.Setresuid(int(b.UID), int(b.UID), int(b.UID)); err != nil {
+		return fmt.Errorf("setresuid: %w", err)
+	}
+	if b.UID != 0 && syscall.Setuid(0) == nil {
+		return errors.New("privileges could be regained after drop")
+	}
+	// The uid change made the process non-dumpable (fs.suid_dumpable), which
+	// an exec'd bridge is not: /proc/self would stay root-owned and no core
+	// dump would be written. Restore what execve() leaves a bridge with.
+	if err := unix.Prctl(unix.PR_SET_DUMPABLE, 1, 0, 0, 0); err != nil {
+		return fmt.Errorf("prctl(PR_SET_DUMPABLE): %w", err)
+	}
+
+	env := map[string]string{
+		"HOME":            h.Home,
+		"USER":            b.Username,
+		"LOGNAME":         b.Username,
+		"XDG_RUNTIME_DIR": fmt.Sprintf("/run/user/%d", b.UID),
+	}
+	for k, v := range env {
+		if err := os.Setenv(k, v); err != nil {
+			return fmt.Errorf("setenv %s: %w", k, err)
+		}
+	}
+	if err := os.Chdir(h.Home); err != nil {
+		return fmt.Errorf("chdir: %w", err)
+	}
+	return nil
+}
+
+// installParkedClient moves the received connection to clientConnFD and
+// clears the auth-phase socket timeouts, as spawn_bridge_process() does.
+func installParkedClient(fd int) error {
+	if fd != clientConnFD {
+		if err := syscall.Dup3(fd, clientConnFD, 0); err != nil {
+			_ = syscall.Close(fd)
+			return fmt.Errorf("dup3: %w", err)
+		}
+		_ = syscall.Close(fd)
+	}
+	zero := syscall.Timeval{}
+	_ = syscall.SetsockoptTimeval(clientConnFD, syscall.SOL_SOCKET, syscall.SO_RCVTIMEO, &zero)
+	_ = syscall.SetsockoptTimeval(clientConnFD, syscall.SOL_SOCKET, syscall.SO_SNDTIMEO, &zero)
+	return nil
+}
+
+// releaseParkedHandoffFD replaces the handoff socket on stdin with /dev/null,
+// matching the drained bootstrap pipe a fresh bridge is left with.
+func releaseParkedHandoffFD() {
+	devNull, err := syscall.Open(os.DevNull, syscall.O_RDONLY|syscall.O_CLOEXEC, 0)
+	if err != nil {
+		_ = syscall.Close(parkedHandoffFD)
+		return
+	}
+	_ = syscall.Dup3(devNull, parkedHandoffFD, 0)
+	_ = syscall.Close(devNull)
+}
+
+// failParkedHandoff reports a failed handoff to linuxio-auth and exits.
+func failParkedHandoff(msg string, err error) {
+	if err != nil {
+		slog.Error(msg, "error", err)
+	} else {
+		slog.Error(msg)
+	}
+	_, _ = syscall.Write(parkedHandoffFD, []byte{authipc.ParkedStatusFailed})
+	os.Exit(1)
+}
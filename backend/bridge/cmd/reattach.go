@@ -0,0 +1,271 @@
+package cmd
+
+import (
+	"context"
+	"errors"
+	"fmt"
+	"log/slog"
+	"net"
+	"os"
+	"strconv"
+	"sync"
+	"syscall"
+	"time"
+
+	authipc "github.com/mordilloSan/LinuxIO/backend/common/ipc/auth"
+)
+
+// reattachFD is the SOCK_SEQPACKET socket linuxio-auth hands re-attached
+// client connections and, for a shared bridge, further sessions on (see
+// "Session re-attach" in linuxio_protocol.h), or -1 when it has none.
+var reattachFD = -1
+
+// reattachGrace is how long the bridge outlives a dropped client
+// connection while it waits for a re-attach; 0 when none can come.
+var reattachGrace time.Duration
+
+// sharedBridge is set when linuxio-auth may attach further sessions of
+// this user to the bridge.
+var sharedBridge bool
+
+// reattachReleased is closed once linuxio-auth said no re-attach will come.
+var (
+	reattachReleased    = make(chan struct{})
+	reattachReleaseOnce sync.Once
+)
+
+var errReattachClosed = errors.New("re-attach socket closed")
+
+// initReattach takes on the re-attach socket linuxio-auth set up for this
+// session: authipc.ReattachFD of an exec'd bridge, or the second fd of a
+// parked handoff (-1 if it had none). linuxio-auth sets ReattachEnv or
+// SharedEnv for an exec'd bridge only when that fd is open, and sends a
+// parked bridge the second fd only when its environment has one of them.
+func initReattach(fd int) {
+	ms, err := strconv.Atoi(os.Getenv(authipc.ReattachEnv))
+	if err != nil || ms < 0 {
+		ms = 0
+	}
+	shared := os.Getenv(authipc.SharedEnv) == "1"
+	if fd < 0 || (ms == 0 && !shared) {
+		return
+	}
+	// Processes the bridge starts must never see re-attached connections.
+	syscall.CloseOnExec(fd)
+	reattachFD = fd
+	reattachGrace = time.Duration(ms) * time.Millisecond
+	sharedBridge = shared
+}
+
+// attachMessage is one message from the re-attach socket with the fds
+// that came along with it.
+type attachMessage struct {
+	kind    byte
+	payload []byte
+	fds     []int
+}
+
+func (m attachMessage) closeFDs() {
+	for _, fd := range m.fds {
+		_ = syscall.Close(fd)
+	}
+}
+
+// attachFunc starts serving a further session on conn and calls ended once
+// it is over. It returns false, having closed conn, if the bridge turned
+// the session down; ended is not called then.
+type attachFunc func(sessionID string, conn net.Conn, ended func()) bool
+
+// startReattachListener serves the re-attach socket: re-attached client
+// connections are delivered on the returned channel, after closing the one
+// being served so its yamux session ends, and further sessions go to
+// attach. The channel is closed when linuxio-auth stops routing
+// re-attaches; it is nil if this bridge has no re-attach socket.
+func startReattachListener(clients *clientConns, attach attachFunc) <-chan net.Conn {
+	if reattachFD < 0 {
+		return nil
+	}
+	reattached := make(chan net.Conn)
+	go func() {
+		defer close(reattached)
+		for {
+			msg, err := receiveAttachMessage()
+			if errors.Is(err, errReattachClosed) {
+				slog.Debug("re-attach socket closed", "session_id", sess.SessionID)
+				return
+			}
+			if err != nil {
+				slog.Warn("failed to read re-attach message", "session_id", sess.SessionID, "error", err)
+				continue
+			}
+			switch msg.kind {
+			case authipc.AttachReattach:
+				conn := takeReattach(clients, msg)
+				if conn == nil {
+					continue
+				}
+				select {
+				case reattached <- conn:
+				case <-clients.done:
+				}
+			case authipc.AttachSession:
+				takeAttachedSession(msg, attach)
+			case authipc.AttachRelease:
+				msg.closeFDs()
+				reattachReleaseOnce.Do(func() { close(reattachReleased) })
+			default:
+				msg.closeFDs()
+				slog.Warn("unknown re-attach message", "session_id", sess.SessionID, "kind", msg.kind)
+			}
+		}
+	}()
+	return reattached
+}
+
+// takeReattach swaps a re-attached connection in and acknowledges it to
+// linuxio-auth. It returns nil if the bridge did not take it.
+func takeReattach(clients *clientConns, msg attachMessage) net.Conn {
+	var conn net.Conn
+	var err error
+	switch {
+	case len(msg.fds) != 1:
+		msg.closeFDs()
+		err = fmt.Errorf("expected one client fd, got %d", len(msg.fds))
+	case reattachGrace == 0:
+		msg.closeFDs()
+		err = errors.New("bridge cannot be re-attached")
+	default:
+		if conn, err = fdConn(msg.fds[0]); err == nil && !clients.replace(conn) {
+			// replace closed conn: the bridge stopped waiting for a re-attach
+			conn, err = nil, errors.New("bridge no longer waits for a re-attach")
+		}
+	}
+	status := byte(authipc.ReattachStatusOK)
+	if err != nil {
+		status = authipc.ReattachStatusFailed
+		slog.Warn("failed to take re-attached connection", "session_id", sess.SessionID, "error", err)
+	}
+	if _, writeErr := syscall.Write(reattachFD, []byte{status}); writeErr != nil && err == nil {
+		slog.Warn("failed to acknowledge re-attach", "session_id", sess.SessionID, "error", writeErr)
+	}
+	return conn
+}
+
+// takeAttachedSession hands a further session of this user to attach,
+// which closes the connection if it turns the session down, and answers
+// linuxio-auth on the reply socket that came with it. A session taken keeps
+// the reply socket open until it ended: linuxio-auth lists it in the
+// session table until the socket closes.
+func takeAttachedSession(msg attachMessage, attach attachFunc) {
+	if len(msg.fds) != 2 {
+		msg.closeFDs()
+		slog.Warn("attached session without client and reply fds", "session_id", sess.SessionID)
+		return
+	}
+	replyFD := msg.fds[1]
+	answered := make(chan struct{})
+	ended := func() {
+		<-answered
+		_ = syscall.Close(replyFD)
+	}
+
+	status := byte(authipc.ReattachStatusFailed)
+	sessionID, err := authipc.DecodeAttachSession(msg.payload)
+	if err == nil && !sharedBridge {
+		err = errors.New("bridge is not shared")
+	}
+	if err != nil {
+		_ = syscall.Close(msg.fds[0])
+	} else if conn, connErr := fdConn(msg.fds[0]); connErr != nil {
+		err = connErr
+	} else if attach(sessionID, conn, ended) {
+		status = authipc.ReattachStatusOK
+	}
+	if err != nil {
+		slog.Warn("failed to take attached session", "session_id", sess.SessionID, "error", err)
+	}
+	if _, writeErr := syscall.Write(replyFD, []byte{status}); writeErr != nil {
+		slog.Warn("failed to acknowledge attached session", "session_id", sessionID, "error", writeErr)
+	}
+	close(answered)
+	if status != authipc.ReattachStatusOK {
+		_ = syscall.Close(replyFD)
+	}
+}
+
+// awaitReattach waits up to the grace period for a re-attached connection
+// after the served one ended. It returns nil when there is none to serve.
+func awaitReattach(ctx context.Context, reattached <-chan net.Conn) net.Conn {
+	if reattached == nil || reattachGrace == 0 {
+		return nil
+	}
+	select {
+	case <-reattachReleased:
+		return nil
+	default:
+	}
+	slog.Info("client disconnected, waiting for re-attach", "session_id", sess.SessionID, "grace_period", reattachGrace)
+	timer := time.NewTimer(reattachGrace)
+	defer timer.Stop()
+	select {
+	case conn, ok := <-reattached:
+		if !ok {
+			return nil
+		}
+		slog.Info("client re-attached", "session_id", sess.SessionID)
+		return conn
+	case <-reattachReleased:
+		return nil
+	case <-timer.C:
+		return nil
+	case <-ctx.Done():
+		return nil
+	}
+}
+
+// receiveAttachMessage reads one message and its SCM_RIGHTS fds from the
+// re-attach socket.
+func receiveAttachMessage() (attachMessage, error) {
+	buf := make([]byte, authipc.AttachMaxMessage)
+	oob := make([]byte, syscall.CmsgSpace(2*4))
+	var n, oobn, flags int
+	var err error
+	for {
+		n, oobn, flags, _, err = syscall.Recvmsg(reattachFD, buf, oob, syscall.MSG_CMSG_CLOEXEC)
+		if !errors.Is(err, syscall.EINTR) {
+			break
+		}
+	}
+	if err != nil || n == 0 {
+		return attachMessage{}, errReattachClosed
+	}
+
+	msg := attachMessage{kind: buf[0], payload: buf[1:n]}
+	if msgs, parseErr := syscall.ParseSocketControlMessage(oob[:oobn]); parseErr == nil {
+		for i := range msgs {
+			if fds, rightsErr := syscall.ParseUnixRights(&msgs[i]); rightsErr == nil {
+				msg.fds = append(msg.fds, fds...)
+			}
+		}
+	}
+	if flags&(syscall.MSG_TRUNC|syscall.MSG_CTRUNC) != 0 {
+		msg.closeFDs()
+		return attachMessage{}, errors.New("truncated re-attach message")
+	}
+	return msg, nil
+}
+
+// fdConn turns a received client fd into a net.Conn, clearing the
+// auth-phase socket timeouts as installParkedClient() does.
+func fdConn(fd int) (net.Conn, error) {
+	zero := syscall.Timeval{}
+	_ = syscall.SetsockoptTimeval(fd, syscall.SOL_SOCKET, syscall.SO_RCVTIMEO, &zero)
+	_ = syscall.SetsockoptTimeval(fd, syscall.SOL_SOCKET, syscall.SO_SNDTIMEO, &zero)
+	clientFile := os.NewFile(uintptr(fd), "client-conn")
+	conn, err := net.FileConn(clientFile)
+	clientFile.Close()
+	if err != nil {
+		return nil, fmt.Errorf("client connection: %w", err)
+	}
+	return conn, nil
+}
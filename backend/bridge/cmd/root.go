@@ -5,6 +5,7 @@ import (
 	"log/slog"
 	"os"
 	"syscall"
+	"time"
 
 	"github.com/mordilloSan/LinuxIO/backend/bridge/internal/config"
 	"github.com/mordilloSan/LinuxIO/backend/bridge/internal/runtime"
@@ -36,7 +37,11 @@ func RunBridgeProcess() {
 		"privileged", sess.Privileged,
 		"uid", sess.User.UID,
 		"gid", sess.User.GID,
+		"priv_source", bootCfg.PrivSource,
 	)
+	if !bootCfg.AuthenticatedAt.IsZero() {
+		slog.Debug("bridge started after authentication", "elapsed", time.Since(bootCfg.AuthenticatedAt))
+	}
 	logBridgeResourceLimits()
 
 	syscall.Umask(0o077)
@@ -45,6 +50,10 @@ func RunBridgeProcess() {
 	clientConn := openClientConnection()
 	slog.Info("bridge connected to inherited client fd", "fd", clientConnFD)
 
+	// linuxio-auth already resolved the passwd entry; don't look it up again
+	if bootCfg.Home != "" {
+		config.UseResolvedUser(sess.User.Username, bootCfg.Home, sess.User.UID, sess.User.GID)
+	}
 	userConfig, err := config.OpenUserStore(sess.User.Username)
 	if err != nil {
 		slog.Error("failed to open config store", "user", sess.User.Username, "error", err)
@@ -22,11 +22,11 @@ var streamCounter atomic.Uint64
 func handleYamuxSession(ctx context.Context, rt runtime.Runtime, router *bridgeipc.Router, conn net.Conn) {
 	ymuxSession, err := relay.NewYamuxServer(conn)
 	if err != nil {
-		slog.Error("failed to create yamux session", "session_id", sess.SessionID, "error", err)
+		slog.Error("failed to create yamux session", "session_id", rt.Session.SessionID, "error", err)
 		return
 	}
 	defer ymuxSession.Close()
-	slog.Info("yamux session started", "session_id", sess.SessionID)
+	slog.Info("yamux session started", "session_id", rt.Session.SessionID)
 
 	// Track active streams for graceful shutdown.
 	var streamWg sync.WaitGroup
@@ -38,9 +38,9 @@ func handleYamuxSession(ctx context.Context, rt runtime.Runtime, router *bridgei
 		stream, err := ymuxSession.Accept()
 		if err != nil {
 			if ymuxSession.IsClosed() {
-				slog.Debug("yamux session closed", "session_id", sess.SessionID)
+				slog.Debug("yamux session closed", "session_id", rt.Session.SessionID)
 			} else {
-				slog.Warn("yamux accept error", "session_id", sess.SessionID, "error", err)
+				slog.Warn("yamux accept error", "session_id", rt.Session.SessionID, "error", err)
 			}
 			break
 		}
@@ -57,7 +57,7 @@ func handleYamuxSession(ctx context.Context, rt runtime.Runtime, router *bridgei
 
 	// Wait for all streams to complete.
 	streamWg.Wait()
-	slog.Info("yamux session ended", "session_id", sess.SessionID)
+	slog.Info("yamux session ended", "session_id", rt.Session.SessionID)
 }
 
 // handleYamuxStream handles a single stream within a yamux session.
@@ -15,15 +15,47 @@ import (
 	"github.com/mordilloSan/LinuxIO/backend/common/utils"
 )
 
+// resolvedUser is the passwd entry of the session user as linuxio-auth
+// resolved it for the login, so startup does not look it up again.
+var resolvedUser struct {
+	username string
+	home     string
+	uid, gid int
+}
+
+// UseResolvedUser records the session user's home directory and ids from
+// the bootstrap; Homedir and the config file ownership then use them
+// instead of a passwd lookup.
+func UseResolvedUser(username, home string, uid, gid uint32) {
+	resolvedUser.username = username
+	resolvedUser.home = home
+	resolvedUser.uid = int(uid)
+	resolvedUser.gid = int(gid)
+}
+
+// lookupUser returns the home directory and ids of username.
+func lookupUser(username string) (home string, uid, gid int, err error) {
+	if username == resolvedUser.username && resolvedUser.home != "" {
+		return resolvedUser.home, resolvedUser.uid, resolvedUser.gid, nil
+	}
+	u, err := user.Lookup(username)
+	if err != nil {
+		return "", 0, 0, err
+	}
+	uid, _ = strconv.Atoi(u.Uid)
+	gid, _ = strconv.Atoi(u.Gid)
+	return u.HomeDir, uid, gid, nil
+}
+
 // Homedir determines the user's home folder
 func Homedir(username string) (string, error) {
 	if strings.TrimSpace(username) == "" {
 		return "", errors.New("empty username")
 	}
 	// 1) Prefer the target user's passwd entry (correct when running as root)
-	if u, err := user.Lookup(username); err == nil && u.HomeDir != "" {
-		if fi, err2 := os.Stat(u.HomeDir); err2 == nil && fi.IsDir() {
-			return u.HomeDir, nil
+	if home, _, _, err := lookupUser(username); err == nil && home != "" {
+		if fi, err2 := os.Stat(home); err2 == nil && fi.IsDir() {
+			return home, nil
 		} else if err2 != nil {
 			return "", err2
 		}
@@ -152,12 +184,10 @@ func chownIfRoot(path, username string) error {
 	if os.Geteuid() != 0 {
 		return nil // Nothing to do if not root
 	}
-	u, err := user.Lookup(username)
+	_, uid, gid, err := lookupUser(username)
 	if err != nil {
 		return err
 	}
-	uid, _ := strconv.Atoi(u.Uid)
-	gid, _ := strconv.Atoi(u.Gid)
 
 	info, err := os.Lstat(path)
 	if err != nil {
@@ -7,6 +7,7 @@ import (
 	"errors"
 	"fmt"
 	"io"
+	"time"
 
 	"github.com/mordilloSan/LinuxIO/backend/common/session"
 )
@@ -28,29 +29,74 @@ const (
 	AuthRespHeaderSize = 8
 
 	// Request flags
-	ReqFlagVerbose = 0x01
+	ReqFlagVerbose  = 0x01
+	ReqFlagTiming   = 0x02 // ask for the login phase timing trailer
+	ReqFlagReattach = 0x04 // re-attach to a running bridge; Password is the ticket
+	ReqFlagTicket   = 0x08 // ask for a re-attach ticket
+	ReqFlagRelease  = 0x10 // with ReqFlagReattach: give up the ticket instead
+	ReqFlagUpgrade  = 0x20 // control login: may be answered unprivileged and upgraded later
+
+	// MaxDeadline is the longest AuthRequest.Deadline the header can carry
+	MaxDeadline = 0xFFFFFF * time.Millisecond
+
+	// Response flags (header byte 7)
+	RespFlagTiming  = 0x01
+	RespFlagTicket  = 0x02
+	RespFlagUpgrade = 0x04 // a CtlUpgrade frame follows on the control connection
+	RespFlagRetry   = 0x08 // ResultBusy: a retry-after trailer follows
 
 	// Status values
 	StatusOK    = 0
 	StatusError = 1
 
 	// Structured result codes
-	ResultOK              AuthResultCode = 0
-	ResultAuthFailed      AuthResultCode = 1
-	ResultPasswordExpired AuthResultCode = 2
-	ResultAccessDenied    AuthResultCode = 3
-	ResultBadRequest      AuthResultCode = 4
-	ResultInternalError   AuthResultCode = 5
-	ResultBridgeError     AuthResultCode = 6
+	ResultOK               AuthResultCode = 0
+	ResultAuthFailed       AuthResultCode = 1
+	ResultPasswordExpired  AuthResultCode = 2
+	ResultAccessDenied     AuthResultCode = 3
+	ResultBadRequest       AuthResultCode = 4
+	ResultInternalError    AuthResultCode = 5
+	ResultBridgeError      AuthResultCode = 6
+	ResultRateLimited      AuthResultCode = 7
+	ResultDeadlineExceeded AuthResultCode = 8
+	ResultBusy             AuthResultCode = 9
 
 	// Mode values
 	ModeUnprivileged = 0
 	ModePrivileged   = 1
 )
 
+// AuthPhase identifies a login phase in the response timing trailer.
+type AuthPhase uint8
+
+const (
+	PhaseRequestRead    AuthPhase = 0
+	PhasePAMAuth        AuthPhase = 1
+	PhasePAMAcct        AuthPhase = 2
+	PhasePAMSetcred     AuthPhase = 3
+	PhaseSudo           AuthPhase = 4 // time blocked joining the sudo probe
+	PhaseBridgeValidate AuthPhase = 5
+	PhasePAMOpenSession AuthPhase = 6
+	PhaseFork           AuthPhase = 7
+	PhaseExec           AuthPhase = 8 // until exec-status EOF
+	PhaseSendOK         AuthPhase = 9 // journal only, never in the trailer
+)
+
+// PhaseTiming is how long one login phase took inside linuxio-auth.
+type PhaseTiming struct {
+	Phase    AuthPhase
+	Duration time.Duration
+}
+
 // AuthRequest is the binary request sent to the auth daemon (Server -> Auth)
 type AuthRequest struct {
 	Verbose    bool
+	Timing     bool          // ask for AuthResponse.Timings
+	Reattach   bool          // Password carries a re-attach ticket instead
+	WantTicket bool          // ask for AuthResponse.Ticket
+	Release    bool          // with Reattach: drop the ticket so the bridge exits with its client
+	Upgrade    bool          // take a later privilege upgrade (control connection only)
+	Deadline   time.Duration // how long the client waits for the response (0: no limit); capped at MaxDeadline
 	User       string
 	Password   string
 	SessionID  string
@@ -64,45 +110,68 @@ type AuthResponse struct {
 	ResultCode AuthResultCode
 	User       session.User
 	Error      string
+	Timings    []PhaseTiming // only if the request set Timing
+	Ticket     string        // re-attach ticket; only if the request set WantTicket
+	Upgrade    bool          // a privilege upgrade follows; only if the request set Upgrade
+	RetryAfter time.Duration // how long to back off; only with ResultBusy
 }
 
-// WriteAuthRequest writes a binary auth request to the writer.
+// WriteAuthRequest writes a binary auth request to the writer in a single
+// Write, so the auth daemon can read the whole request with one recv.
 func WriteAuthRequest(w io.Writer, req *AuthRequest) error {
-	// Write header
-	var header [AuthReqHeaderSize]byte
-	header[0] = ProtoMagic0
-	header[1] = ProtoMagic1
-	header[2] = ProtoMagic2
-	header[3] = ProtoVersion
+	buf := EncodeAuthRequest(req)
+	defer clear(buf) // holds the password
+
+	if _, err := w.Write(buf); err != nil {
+		return fmt.Errorf("write request: %w", err)
+	}
+	return nil
+}
+
+// EncodeAuthRequest returns the wire encoding of req: header followed by the
+// user, password, session_id and remote_host length-prefixed strings.
+func EncodeAuthRequest(req *AuthRequest) []byte {
+	size := AuthReqHeaderSize + 4*2 +
+		len(req.User) + len(req.Password) + len(req.SessionID) + len(req.RemoteHost)
+	buf := make([]byte, AuthReqHeaderSize, size)
+	buf[0] = ProtoMagic0
+	buf[1] = ProtoMagic1
+	buf[2] = ProtoMagic2
+	buf[3] = ProtoVersion
 
 	var flags uint8
 	if req.Verbose {
 		flags |= ReqFlagVerbose
 	}
-	header[4] = flags
-	header[5] = 0 // reserved
-	header[6] = 0 // reserved
-	header[7] = 0 // reserved
-
-	if _, err := w.Write(header[:]); err != nil {
-		return fmt.Errorf("write header: %w", err)
+	if req.Timing {
+		flags |= ReqFlagTiming
 	}
-
-	// Write variable-length fields
-	if err := writeLenStr(w, req.User); err != nil {
-		return fmt.Errorf("write user: %w", err)
+	if req.Reattach {
+		flags |= ReqFlagReattach
+	}
+	if req.WantTicket {
+		flags |= ReqFlagTicket
 	}
-	if err := writeLenStr(w, req.Password); err != nil {
-		return fmt.Errorf("write password: %w", err)
+	if req.Release {
+		flags |= ReqFlagRelease
 	}
-	if err := writeLenStr(w, req.SessionID); err != nil {
-		return fmt.Errorf("write session_id: %w", err)
+	if req.Upgrade {
+		flags |= ReqFlagUpgrade
 	}
-	if err := writeLenStr(w, req.RemoteHost); err != nil {
-		return fmt.Errorf("write remote_host: %w", err)
+	buf[4] = flags
+	deadline := min(req.Deadline, MaxDeadline)
+	if deadline > 0 {
+		ms := max(uint32(deadline/time.Millisecond), 1)
+		buf[5] = byte(ms >> 16)
+		buf[6] = byte(ms >> 8)
+		buf[7] = byte(ms)
 	}
 
-	return nil
+	buf = appendLenStr(buf, req.User)
+	buf = appendLenStr(buf, req.Password)
+	buf = appendLenStr(buf, req.SessionID)
+	buf = appendLenStr(buf, req.RemoteHost)
+	return buf
 }
 
 // ReadAuthResponse reads a binary auth response from the reader.
@@ -124,6 +193,7 @@ func ReadAuthResponse(r io.Reader) (*AuthResponse, error) {
 		Status:     header[4],
 		Mode:       header[5],
 		ResultCode: AuthResultCode(header[6]),
+		Upgrade:    header[4] == StatusOK && header[7]&RespFlagUpgrade != 0,
 	}
 
 	if resp.Status == StatusOK {
@@ -155,9 +225,53 @@ func ReadAuthResponse(r io.Reader) (*AuthResponse, error) {
 		resp.Error = errStr
 	}
 
+	if header[7]&RespFlagTiming != 0 {
+		timings, err := readTimings(r)
+		if err != nil {
+			return nil, fmt.Errorf("read timings: %w", err)
+		}
+		resp.Timings = timings
+	}
+
+	if header[7]&RespFlagTicket != 0 {
+		ticket, err := readLenStr(r)
+		if err != nil {
+			return nil, fmt.Errorf("read ticket: %w", err)
+		}
+		resp.Ticket = ticket
+	}
+
+	if header[7]&RespFlagRetry != 0 {
+		retryMs, err := readU32(r)
+		if err != nil {
+			return nil, fmt.Errorf("read retry-after: %w", err)
+		}
+		resp.RetryAfter = time.Duration(retryMs) * time.Millisecond
+	}
+
 	return resp, nil
 }
 
+// readTimings reads the timing trailer: [count:1]([phase:1][usec:4])*count.
+func readTimings(r io.Reader) ([]PhaseTiming, error) {
+	var count [1]byte
+	if _, err := io.ReadFull(r, count[:]); err != nil {
+		return nil, err
+	}
+	buf := make([]byte, 5*int(count[0]))
+	if _, err := io.ReadFull(r, buf); err != nil {
+		return nil, err
+	}
+	timings := make([]PhaseTiming, 0, count[0])
+	for i := 0; i < len(buf); i += 5 {
+		timings = append(timings, PhaseTiming{
+			Phase:    AuthPhase(buf[i]),
+			Duration: time.Duration(binary.BigEndian.Uint32(buf[i+1:i+5])) * time.Microsecond,
+		})
+	}
+	return timings, nil
+}
+
 func readU32(r io.Reader) (uint32, error) {
 	var buf [4]byte
 	if _, err := io.ReadFull(r, buf[:]); err != nil {
@@ -183,6 +297,13 @@ func readLenStr(r io.Reader) (string, error) {
 	return string(data), nil
 }
 
+// appendLenStr appends a length-prefixed string (2-byte length + data).
+func appendLenStr(dst []byte, s string) []byte {
+	length := min(len(s), 0xFFFF)
+	dst = binary.BigEndian.AppendUint16(dst, uint16(length))
+	return append(dst, s[:length]...)
+}
+
 // writeLenStr writes a length-prefixed string (2-byte length + data).
 func writeLenStr(w io.Writer, s string) error {
 	length := min(len(s), 0xFFFF)
@@ -209,6 +330,35 @@ func (r *AuthResponse) IsOK() bool {
 	return r.Status == StatusOK
 }
 
+// Name returns the snake_case phase name, matching the LINUXIO_T_<NAME>_US
+// journal fields of linuxio-auth.
+func (p AuthPhase) Name() string {
+	switch p {
+	case PhaseRequestRead:
+		return "request_read"
+	case PhasePAMAuth:
+		return "pam_auth"
+	case PhasePAMAcct:
+		return "pam_acct"
+	case PhasePAMSetcred:
+		return "pam_setcred"
+	case PhaseSudo:
+		return "sudo"
+	case PhaseBridgeValidate:
+		return "bridge_validate"
+	case PhasePAMOpenSession:
+		return "pam_open_session"
+	case PhaseFork:
+		return "fork"
+	case PhaseExec:
+		return "exec"
+	case PhaseSendOK:
+		return "send_ok"
+	default:
+		return fmt.Sprintf("phase_%d", uint8(p))
+	}
+}
+
 func (c AuthResultCode) IsUnauthorized() bool {
 	switch c {
 	case ResultAuthFailed, ResultPasswordExpired, ResultAccessDenied:
@@ -234,6 +384,12 @@ func (c AuthResultCode) DefaultMessage() string {
 		return "internal auth error"
 	case ResultBridgeError:
 		return "failed to start bridge"
+	case ResultRateLimited:
+		return "too many failed login attempts"
+	case ResultDeadlineExceeded:
+		return "login timed out"
+	case ResultBusy:
+		return "auth daemon busy"
 	default:
 		return "authentication failed"
 	}
@@ -255,6 +411,12 @@ func (c AuthResultCode) APIName() string {
 		return "internal_error"
 	case ResultBridgeError:
 		return "bridge_error"
+	case ResultRateLimited:
+		return "rate_limited"
+	case ResultDeadlineExceeded:
+		return "login_timeout"
+	case ResultBusy:
+		return "auth_busy"
 	default:
 		return "login_failed"
 	}
@@ -2,7 +2,9 @@ package auth
 
 import (
 	"bytes"
+	"strings"
 	"testing"
+	"time"
 )
 
 func TestReadAuthResponse_DecodesSuccessUser(t *testing.T) {
@@ -82,6 +84,34 @@ func TestWriteAuthRequest_EncodesRemoteHost(t *testing.T) {
 	}
 }
 
+type countingWriter struct {
+	bytes.Buffer
+	writes int
+}
+
+func (w *countingWriter) Write(p []byte) (int, error) {
+	w.writes++
+	return w.Buffer.Write(p)
+}
+
+func TestWriteAuthRequest_SingleWrite(t *testing.T) {
+	var w countingWriter
+	req := &AuthRequest{User: "miguel", Password: "pw", SessionID: "session-1"}
+
+	if err := WriteAuthRequest(&w, req); err != nil {
+		t.Fatalf("WriteAuthRequest: %v", err)
+	}
+	if w.writes != 1 {
+		t.Fatalf("writes = %d, want 1", w.writes)
+	}
+	if want := EncodeAuthRequest(req); !bytes.Equal(w.Bytes(), want) {
+		t.Fatalf("wire = %v, want %v", w.Bytes(), want)
+	}
+	if got, want := w.Len(), AuthReqHeaderSize+4*2+len("miguel")+len("pw")+len("session-1"); got != want {
+		t.Fatalf("request len = %d, want %d", got, want)
+	}
+}
+
 func TestReadAuthResponse_DecodesStructuredResultCode(t *testing.T) {
 	var buf bytes.Buffer
 	buf.Write([]byte{
@@ -117,6 +147,38 @@ func TestReadAuthResponse_DecodesStructuredResultCode(t *testing.T) {
 	}
 }
 
+func TestReadAuthResponse_DecodesBusyRetryAfter(t *testing.T) {
+	var buf bytes.Buffer
+	buf.Write([]byte{
+		ProtoMagic0,
+		ProtoMagic1,
+		ProtoMagic2,
+		ProtoVersion,
+		StatusError,
+		ModeUnprivileged,
+		byte(ResultBusy),
+		RespFlagRetry,
+	})
+	if err := writeLenStr(&buf, "auth daemon busy"); err != nil {
+		t.Fatalf("writeLenStr: %v", err)
+	}
+	buf.Write([]byte{0, 0, 0x05, 0xdc}) // 1500 ms
+
+	resp, err := ReadAuthResponse(&buf)
+	if err != nil {
+		t.Fatalf("ReadAuthResponse: %v", err)
+	}
+	if buf.Len() != 0 {
+		t.Fatalf("%d trailing bytes left unread", buf.Len())
+	}
+	if resp.ResultCode != ResultBusy {
+		t.Fatalf("result code = %d, want %d", resp.ResultCode, ResultBusy)
+	}
+	if resp.RetryAfter != 1500*time.Millisecond {
+		t.Fatalf("retry after = %v, want 1.5s", resp.RetryAfter)
+	}
+}
+
 func TestAuthResultCodeHelpers(t *testing.T) {
 	if !ResultAuthFailed.IsUnauthorized() {
 		t.Fatal("ResultAuthFailed should be unauthorized")
@@ -133,4 +195,180 @@ func TestAuthResultCodeHelpers(t *testing.T) {
 	if got := ResultPasswordExpired.APIName(); got != "password_expired" {
 		t.Fatalf("api name = %q, want %q", got, "password_expired")
 	}
+	if ResultRateLimited.IsUnauthorized() {
+		t.Fatal("ResultRateLimited should not be unauthorized")
+	}
+	if got := ResultRateLimited.APIName(); got != "rate_limited" {
+		t.Fatalf("api name = %q, want %q", got, "rate_limited")
+	}
+}
+
+func TestReadAuthResponse_DecodesTimingTrailer(t *testing.T) {
+	var buf bytes.Buffer
+	buf.Write([]byte{
+		ProtoMagic0,
+		ProtoMagic1,
+		ProtoMagic2,
+		ProtoVersion,
+		StatusOK,
+		ModeUnprivileged,
+		byte(ResultOK),
+		RespFlagTiming,
+	})
+	buf.Write([]byte{0, 0, 3, 232}) // uid 1000
+	buf.Write([]byte{0, 0, 3, 232}) // gid 1000
+	if err := writeLenStr(&buf, "miguel"); err != nil {
+		t.Fatalf("writeLenStr: %v", err)
+	}
+	buf.Write([]byte{2})
+	buf.Write([]byte{byte(PhasePAMAuth), 0, 0, 0x30, 0x39}) // 12345us
+	buf.Write([]byte{byte(PhaseExec), 0, 0, 0, 7})
+
+	resp, err := ReadAuthResponse(&buf)
+	if err != nil {
+		t.Fatalf("ReadAuthResponse: %v", err)
+	}
+	if buf.Len() != 0 {
+		t.Fatalf("%d trailing bytes left unread", buf.Len())
+	}
+	want := []PhaseTiming{
+		{Phase: PhasePAMAuth, Duration: 12345 * time.Microsecond},
+		{Phase: PhaseExec, Duration: 7 * time.Microsecond},
+	}
+	if len(resp.Timings) != len(want) {
+		t.Fatalf("timings = %v, want %v", resp.Timings, want)
+	}
+	for i := range want {
+		if resp.Timings[i] != want[i] {
+			t.Fatalf("timings[%d] = %v, want %v", i, resp.Timings[i], want[i])
+		}
+	}
+	if got := resp.Timings[0].Phase.Name(); got != "pam_auth" {
+		t.Fatalf("phase name = %q, want %q", got, "pam_auth")
+	}
+}
+
+func TestWriteAuthRequest_TimingFlag(t *testing.T) {
+	buf := EncodeAuthRequest(&AuthRequest{User: "miguel", SessionID: "session-1", Timing: true})
+	if buf[4]&ReqFlagTiming == 0 {
+		t.Fatalf("timing flag not set: %v", buf[:AuthReqHeaderSize])
+	}
+	if buf[4]&ReqFlagVerbose != 0 {
+		t.Fatalf("verbose flag set: %v", buf[:AuthReqHeaderSize])
+	}
+}
+
+func TestReadAuthResponse_DecodesTicketAfterTimings(t *testing.T) {
+	ticket := strings.Repeat("ab", TicketHexLen/2)
+	var buf bytes.Buffer
+	buf.Write([]byte{
+		ProtoMagic0,
+		ProtoMagic1,
+		ProtoMagic2,
+		ProtoVersion,
+		StatusOK,
+		ModeUnprivileged,
+		byte(ResultOK),
+		RespFlagTiming | RespFlagTicket,
+	})
+	buf.Write([]byte{0, 0, 3, 232}) // uid 1000
+	buf.Write([]byte{0, 0, 3, 232}) // gid 1000
+	if err := writeLenStr(&buf, "miguel"); err != nil {
+		t.Fatalf("writeLenStr: %v", err)
+	}
+	buf.Write([]byte{1, byte(PhasePAMAuth), 0, 0, 0, 9})
+	if err := writeLenStr(&buf, ticket); err != nil {
+		t.Fatalf("writeLenStr: %v", err)
+	}
+
+	resp, err := ReadAuthResponse(&buf)
+	if err != nil {
+		t.Fatalf("ReadAuthResponse: %v", err)
+	}
+	if buf.Len() != 0 {
+		t.Fatalf("%d trailing bytes left unread", buf.Len())
+	}
+	if len(resp.Timings) != 1 {
+		t.Fatalf("timings = %v, want one entry", resp.Timings)
+	}
+	if resp.Ticket != ticket {
+		t.Fatalf("ticket = %q, want %q", resp.Ticket, ticket)
+	}
+}
+
+func TestWriteAuthRequest_ReattachFlags(t *testing.T) {
+	buf := EncodeAuthRequest(&AuthRequest{
+		User:       "miguel",
+		Password:   "ticket",
+		SessionID:  "session-1",
+		Reattach:   true,
+		WantTicket: true,
+	})
+	if buf[4]&ReqFlagReattach == 0 || buf[4]&ReqFlagTicket == 0 {
+		t.Fatalf("re-attach flags not set: %v", buf[:AuthReqHeaderSize])
+	}
+
+	buf = EncodeAuthRequest(&AuthRequest{User: "miguel", SessionID: "session-1"})
+	if buf[4]&(ReqFlagReattach|ReqFlagTicket|ReqFlagRelease) != 0 {
+		t.Fatalf("re-attach flags set: %v", buf[:AuthReqHeaderSize])
+	}
+
+	buf = EncodeAuthRequest(&AuthRequest{User: "miguel", Password: "ticket", SessionID: "session-1", Reattach: true, Release: true})
+	if buf[4] != ReqFlagReattach|ReqFlagRelease {
+		t.Fatalf("release flags = %#x, want %#x", buf[4], ReqFlagReattach|ReqFlagRelease)
+	}
+}
+
+func TestAuthRequestAndResponse_UpgradeFlags(t *testing.T) {
+	buf := EncodeAuthRequest(&AuthRequest{User: "miguel", SessionID: "session-1", Upgrade: true})
+	if buf[4] != ReqFlagUpgrade {
+		t.Fatalf("request flags = %#x, want %#x", buf[4], ReqFlagUpgrade)
+	}
+
+	for _, tc := range []struct {
+		status byte
+		want   bool
+	}{
+		{StatusOK, true},
+		{StatusError, false}, // only an ok response announces an upgrade
+	} {
+		var resp bytes.Buffer
+		resp.Write([]byte{ProtoMagic0, ProtoMagic1, ProtoMagic2, ProtoVersion, tc.status, ModeUnprivileged, 0, RespFlagUpgrade})
+		if tc.status == StatusOK {
+			resp.Write([]byte{0, 0, 3, 232, 0, 0, 3, 232})
+		}
+		if err := writeLenStr(&resp, "miguel"); err != nil {
+			t.Fatalf("writeLenStr: %v", err)
+		}
+		got, err := ReadAuthResponse(&resp)
+		if err != nil {
+			t.Fatalf("ReadAuthResponse: %v", err)
+		}
+		if got.Upgrade != tc.want {
+			t.Fatalf("status %d: Upgrade = %v, want %v", tc.status, got.Upgrade, tc.want)
+		}
+	}
+}
+
+func TestWriteAuthRequest_EncodesDeadline(t *testing.T) {
+	for _, tc := range []struct {
+		deadline time.Duration
+		want     [3]byte
+	}{
+		{0, [3]byte{0, 0, 0}},
+		{29 * time.Second, [3]byte{0x00, 0x71, 0x48}},
+		{time.Microsecond, [3]byte{0, 0, 1}}, // never rounds down to "no deadline"
+		{24 * time.Hour, [3]byte{0xff, 0xff, 0xff}},
+	} {
+		buf := EncodeAuthRequest(&AuthRequest{User: "miguel", SessionID: "session-1", Deadline: tc.deadline})
+		if got := [3]byte(buf[5:8]); got != tc.want {
+			t.Fatalf("deadline %v encoded as %v, want %v", tc.deadline, got, tc.want)
+		}
+	}
+	if ResultDeadlineExceeded.IsUnauthorized() {
+		t.Fatal("ResultDeadlineExceeded should not be unauthorized")
+	}
+	if got := ResultDeadlineExceeded.APIName(); got != "login_timeout" {
+		t.Fatalf("api name = %q, want %q", got, "login_timeout")
+	}
 }
@@ -7,6 +7,8 @@ import (
 	"errors"
 	"fmt"
 	"io"
+	"math"
+	"time"
 )
 
 // Binary bootstrap protocol constants
@@ -23,6 +25,16 @@ const (
 	// Flags byte
 	ProtoFlagVerbose    = 0x01
 	ProtoFlagPrivileged = 0x02
+	ProtoFlagExtended   = 0x04
+
+	// Bootstrap extension entry types: [type:1][len:2][value]
+	BootHome       = 1
+	BootGroups     = 2
+	BootPrivSource = 3
+	BootLoginTime  = 4
+
+	BootEntryHeader = 3
+	BootMaxGroups   = 1024
 )
 
 // Bootstrap is the configuration passed from auth daemon to bridge via stdin.
@@ -34,10 +46,19 @@ type Bootstrap struct {
 	Privileged bool
 	SessionID  string
 	Username   string
+
+	// What linuxio-auth resolved during the login (the bootstrap
+	// extension). Each is the zero value, Groups nil, when it was not sent.
+	Home            string   // home directory from the user's passwd entry
+	Groups          []uint32 // the user's group list, primary group included
+	PrivSource      string   // what decided the mode: "sudo", "groups" or "cache"
+	RequestedAt     time.Time
+	AuthenticatedAt time.Time
 }
 
 // ReadBootstrap reads a binary bootstrap from the given reader.
-// Format: [magic:4][uid:4][gid:4][flags:1][len:2][session_id]...
+// Format: [magic:4][uid:4][gid:4][flags:1][len:2][session_id][len:2][username]
+// and, with ProtoFlagExtended, [len:2][extension].
 func ReadBootstrap(r io.Reader) (*Bootstrap, error) {
 	// Read fixed header
 	var hdr [ProtoHeaderSize]byte
@@ -68,6 +89,62 @@ func ReadBootstrap(r io.Reader) (*Bootstrap, error) {
 	if b.Username, err = readLenStr(r); err != nil {
 		return nil, fmt.Errorf("read username: %w", err)
 	}
+	if hdr[12]&ProtoFlagExtended != 0 {
+		ext, extErr := readLenStr(r)
+		if extErr != nil {
+			return nil, fmt.Errorf("read extension: %w", extErr)
+		}
+		if err = b.decodeExtension([]byte(ext)); err != nil {
+			return nil, err
+		}
+	}
 
 	return b, nil
 }
+
+// decodeExtension fills in the entries of a bootstrap extension. Entry types
+// it does not know are skipped.
+func (b *Bootstrap) decodeExtension(ext []byte) error {
+	for len(ext) > 0 {
+		if len(ext) < BootEntryHeader {
+			return errors.New("truncated bootstrap extension entry")
+		}
+		typ := ext[0]
+		n := int(binary.BigEndian.Uint16(ext[1:3]))
+		if len(ext) < BootEntryHeader+n {
+			return fmt.Errorf("bootstrap extension entry %d overruns the extension", typ)
+		}
+		value := ext[BootEntryHeader : BootEntryHeader+n]
+		ext = ext[BootEntryHeader+n:]
+
+		switch typ {
+		case BootHome:
+			b.Home = string(value)
+		case BootGroups:
+			if n%4 != 0 || n/4 > BootMaxGroups {
+				return fmt.Errorf("invalid bootstrap group list length: %d", n)
+			}
+			b.Groups = make([]uint32, n/4)
+			for i := range b.Groups {
+				b.Groups[i] = binary.BigEndian.Uint32(value[4*i:])
+			}
+		case BootPrivSource:
+			b.PrivSource = string(value)
+		case BootLoginTime:
+			if n != 16 {
+				return fmt.Errorf("invalid bootstrap login time length: %d", n)
+			}
+			b.RequestedAt = unixMicro(binary.BigEndian.Uint64(value[0:8]))
+			b.AuthenticatedAt = unixMicro(binary.BigEndian.Uint64(value[8:16]))
+		}
+	}
+	return nil
+}
+
+// unixMicro converts microseconds since the epoch; 0 stays the zero time.
+func unixMicro(us uint64) time.Time {
+	if us == 0 || us > math.MaxInt64 {
+		return time.Time{}
+	}
+	return time.UnixMicro(int64(us))
+}
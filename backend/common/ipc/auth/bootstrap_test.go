@@ -2,7 +2,9 @@ package auth
 
 import (
 	"bytes"
+	"encoding/binary"
 	"testing"
+	"time"
 )
 
 func TestReadBootstrap_DecodesHeaderAndStrings(t *testing.T) {
@@ -37,3 +39,79 @@ func TestReadBootstrap_DecodesHeaderAndStrings(t *testing.T) {
 		t.Fatalf("session/user = %q/%q", bootstrap.SessionID, bootstrap.Username)
 	}
 }
+
+func appendBootEntry(dst []byte, typ byte, value []byte) []byte {
+	dst = append(dst, typ)
+	dst = binary.BigEndian.AppendUint16(dst, uint16(len(value)))
+	return append(dst, value...)
+}
+
+func buildExtendedBootstrap(t *testing.T, ext []byte) *bytes.Buffer {
+	t.Helper()
+	var buf bytes.Buffer
+	buf.Write([]byte{
+		ProtoMagic0,
+		ProtoMagic1,
+		ProtoMagic2,
+		ProtoVersion,
+		0, 0, 3, 232, // uid 1000
+		0, 0, 3, 232, // gid 1000
+		ProtoFlagExtended,
+	})
+	for _, s := range []string{"session-1", "miguel", string(ext)} {
+		if err := writeLenStr(&buf, s); err != nil {
+			t.Fatalf("writeLenStr %q: %v", s, err)
+		}
+	}
+	return &buf
+}
+
+func TestReadBootstrap_DecodesExtension(t *testing.T) {
+	requested := time.UnixMicro(1_700_000_000_123_456)
+	authenticated := requested.Add(150 * time.Millisecond)
+	var ext []byte
+	ext = appendBootEntry(ext, BootHome, []byte("/home/miguel"))
+	ext = appendBootEntry(ext, 0xEE, []byte("from a newer linuxio-auth"))
+	ext = appendBootEntry(ext, BootGroups, []byte{0, 0, 3, 232, 0, 0, 0, 27})
+	ext = appendBootEntry(ext, BootPrivSource, []byte("cache"))
+	times := binary.BigEndian.AppendUint64(nil, uint64(requested.UnixMicro()))
+	times = binary.BigEndian.AppendUint64(times, uint64(authenticated.UnixMicro()))
+	ext = appendBootEntry(ext, BootLoginTime, times)
+
+	b, err := ReadBootstrap(buildExtendedBootstrap(t, ext))
+	if err != nil {
+		t.Fatalf("ReadBootstrap: %v", err)
+	}
+	if b.Username != "miguel" || b.Home != "/home/miguel" || b.PrivSource != "cache" {
+		t.Fatalf("user/home/source = %q/%q/%q", b.Username, b.Home, b.PrivSource)
+	}
+	if len(b.Groups) != 2 || b.Groups[0] != 1000 || b.Groups[1] != 27 {
+		t.Fatalf("groups = %v", b.Groups)
+	}
+	if !b.RequestedAt.Equal(requested) || !b.AuthenticatedAt.Equal(authenticated) {
+		t.Fatalf("times = %v/%v", b.RequestedAt, b.AuthenticatedAt)
+	}
+}
+
+func TestReadBootstrap_LeavesMissingEntriesUnset(t *testing.T) {
+	b, err := ReadBootstrap(buildExtendedBootstrap(t, nil))
+	if err != nil {
+		t.Fatalf("ReadBootstrap: %v", err)
+	}
+	if b.Home != "" || b.Groups != nil || b.PrivSource != "" || !b.RequestedAt.IsZero() {
+		t.Fatalf("unexpected entries: %+v", b)
+	}
+}
+
+func TestReadBootstrap_RejectsMalformedExtension(t *testing.T) {
+	for name, ext := range map[string][]byte{
+		"truncated header": {BootHome, 0},
+		"overrun":          {BootHome, 0, 10, '/'},
+		"odd groups":       appendBootEntry(nil, BootGroups, []byte{0, 0, 3}),
+		"short login time": appendBootEntry(nil, BootLoginTime, []byte{0, 0, 0, 0, 0, 0, 0, 1}),
+	} {
+		if _, err := ReadBootstrap(buildExtendedBootstrap(t, ext)); err == nil {
+			t.Errorf("%s: ReadBootstrap accepted a malformed extension", name)
+		}
+	}
+}
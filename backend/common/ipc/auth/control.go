@@ -0,0 +1,75 @@
+// Control channel (protocol v4) for LinuxIO auth communication.
+// Keep in sync with backend/auth/linuxio_protocol.h
+package auth
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+)
+
+// Control channel protocol constants
+const (
+	// ControlVersion is the version byte of every control frame. The auth
+	// request and response carried inside keep ProtoVersion.
+	ControlVersion    = 4
+	ControlHeaderSize = 12
+
+	// ControlMaxFrame bounds one frame (one SOCK_SEQPACKET packet).
+	ControlMaxFrame = 4096
+
+	// Frame types
+	CtlLogin    = 1 // payload: auth request
+	CtlResponse = 2 // payload: auth response; bridge conn as SCM_RIGHTS if ok
+	CtlUpgrade  = 3 // after a response with Upgrade: the privileged bridge, or empty for none
+)
+
+// ControlFrame is one packet on a control connection. Responses carry the
+// RequestID of the login they answer and may arrive in any order.
+type ControlFrame struct {
+	Type      uint8
+	RequestID uint32
+	Payload   []byte
+}
+
+// EncodeControlLogin returns the CtlLogin frame for req. The caller should
+// clear it once sent: it holds the password.
+func EncodeControlLogin(requestID uint32, req *AuthRequest) ([]byte, error) {
+	payload := EncodeAuthRequest(req)
+	defer clear(payload)
+	if ControlHeaderSize+len(payload) > ControlMaxFrame {
+		return nil, fmt.Errorf("auth request too large for a control frame: %d bytes", len(payload))
+	}
+	return EncodeControlFrame(ControlFrame{Type: CtlLogin, RequestID: requestID, Payload: payload}), nil
+}
+
+// EncodeControlFrame returns the wire encoding of f.
+func EncodeControlFrame(f ControlFrame) []byte {
+	buf := make([]byte, ControlHeaderSize, ControlHeaderSize+len(f.Payload))
+	buf[0] = ProtoMagic0
+	buf[1] = ProtoMagic1
+	buf[2] = ProtoMagic2
+	buf[3] = ControlVersion
+	buf[4] = f.Type
+	// buf[5:8] reserved
+	binary.BigEndian.PutUint32(buf[8:12], f.RequestID)
+	return append(buf, f.Payload...)
+}
+
+// DecodeControlFrame parses one received packet. Payload aliases msg.
+func DecodeControlFrame(msg []byte) (ControlFrame, error) {
+	if len(msg) < ControlHeaderSize {
+		return ControlFrame{}, errors.New("control frame too short")
+	}
+	if msg[0] != ProtoMagic0 || msg[1] != ProtoMagic1 || msg[2] != ProtoMagic2 {
+		return ControlFrame{}, errors.New("invalid control frame magic")
+	}
+	if msg[3] != ControlVersion {
+		return ControlFrame{}, fmt.Errorf("unsupported control frame version: %d", msg[3])
+	}
+	return ControlFrame{
+		Type:      msg[4],
+		RequestID: binary.BigEndian.Uint32(msg[8:12]),
+		Payload:   msg[ControlHeaderSize:],
+	}, nil
+}
@@ -0,0 +1,54 @@
+package auth
+
+import (
+	"bytes"
+	"strings"
+	"testing"
+)
+
+func TestEncodeControlLogin_RoundTrip(t *testing.T) {
+	req := &AuthRequest{User: "miguel", Password: "secret", SessionID: "session-1", Timing: true}
+	msg, err := EncodeControlLogin(0x01020304, req)
+	if err != nil {
+		t.Fatalf("EncodeControlLogin: %v", err)
+	}
+	if msg[3] != ControlVersion {
+		t.Fatalf("version byte = %d, want %d", msg[3], ControlVersion)
+	}
+
+	f, err := DecodeControlFrame(msg)
+	if err != nil {
+		t.Fatalf("DecodeControlFrame: %v", err)
+	}
+	if f.Type != CtlLogin || f.RequestID != 0x01020304 {
+		t.Fatalf("type/request_id = %d/%#x", f.Type, f.RequestID)
+	}
+	if !bytes.Equal(f.Payload, EncodeAuthRequest(req)) {
+		t.Fatalf("payload = %x, want the v3 auth request", f.Payload)
+	}
+}
+
+func TestEncodeControlLogin_RejectsOversizedRequest(t *testing.T) {
+	req := &AuthRequest{User: "miguel", Password: strings.Repeat("x", ControlMaxFrame), SessionID: "session-1"}
+	if _, err := EncodeControlLogin(1, req); err == nil {
+		t.Fatal("expected error for a request that does not fit one frame")
+	}
+}
+
+func TestDecodeControlFrame_RejectsMalformedFrames(t *testing.T) {
+	msg := EncodeControlFrame(ControlFrame{Type: CtlResponse, RequestID: 7})
+
+	if _, err := DecodeControlFrame(msg[:ControlHeaderSize-1]); err == nil {
+		t.Fatal("expected error for short frame")
+	}
+	badMagic := append([]byte(nil), msg...)
+	badMagic[0] = 'X'
+	if _, err := DecodeControlFrame(badMagic); err == nil {
+		t.Fatal("expected error for bad magic")
+	}
+	v3 := append([]byte(nil), msg...)
+	v3[3] = ProtoVersion
+	if _, err := DecodeControlFrame(v3); err == nil {
+		t.Fatal("expected error for a v3 version byte")
+	}
+}
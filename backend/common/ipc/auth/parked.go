@@ -0,0 +1,85 @@
+// Parked bridge handoff for LinuxIO auth/bridge communication.
+// Keep in sync with backend/auth/linuxio_protocol.h
+package auth
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+)
+
+// Parked bridge protocol constants
+const (
+	// ParkedEnv is set to "1" in the environment of a bridge that linuxio-auth
+	// started ahead of a login. Its stdin is a SOCK_SEQPACKET socket that
+	// carries one handoff message instead of the bootstrap pipe.
+	ParkedEnv = "LINUXIO_BRIDGE_PARKED"
+
+	ParkedMaxGroups  = 1024
+	ParkedNoLoginUID = 0xFFFFFFFF
+
+	// Status byte the bridge replies with once it is ready to serve.
+	ParkedStatusOK     = 0
+	ParkedStatusFailed = 1
+
+	// ParkedMaxMessage bounds one handoff message: bootstrap (header,
+	// session_id, username, extension without the group list), home,
+	// loginuid and the group list.
+	ParkedMaxMessage = ProtoHeaderSize + 2 + 64 + 2 + 256 + parkedMaxExtension + 2 + 4096 + 4 + 2 + 4*ParkedMaxGroups
+
+	// home, privilege source and login time entries
+	parkedMaxExtension = 2 + BootEntryHeader + 4096 + BootEntryHeader + 16 + BootEntryHeader + 16
+)
+
+// ParkedHandoff is the login a parked bridge receives from linuxio-auth.
+// The client connection arrives alongside it as SCM_RIGHTS.
+type ParkedHandoff struct {
+	Bootstrap *Bootstrap
+	Home      string
+	LoginUID  uint32 // ParkedNoLoginUID when the session has none
+	Groups    []uint32
+}
+
+// DecodeParkedHandoff parses one handoff message.
+// Format: [bootstrap][len:2][home][loginuid:4][ngroups:2][gid:4]*ngroups
+func DecodeParkedHandoff(msg []byte) (*ParkedHandoff, error) {
+	r := bytes.NewReader(msg)
+	b, err := ReadBootstrap(r)
+	if err != nil {
+		return nil, err
+	}
+
+	h := &ParkedHandoff{Bootstrap: b}
+	if h.Home, err = readLenStr(r); err != nil {
+		return nil, fmt.Errorf("read home: %w", err)
+	}
+	if h.LoginUID, err = readU32(r); err != nil {
+		return nil, fmt.Errorf("read loginuid: %w", err)
+	}
+
+	var countBuf [2]byte
+	if _, err = io.ReadFull(r, countBuf[:]); err != nil {
+		return nil, fmt.Errorf("read group count: %w", err)
+	}
+	count := int(binary.BigEndian.Uint16(countBuf[:]))
+	if count > ParkedMaxGroups {
+		return nil, fmt.Errorf("too many groups: %d", count)
+	}
+	h.Groups = make([]uint32, count)
+	for i := range h.Groups {
+		if h.Groups[i], err = readU32(r); err != nil {
+			return nil, fmt.Errorf("read group %d: %w", i, err)
+		}
+	}
+
+	if r.Len() != 0 {
+		return nil, errors.New("trailing data in parked handoff")
+	}
+	// The group list rides in the handoff rather than in the extension
+	if b.Groups == nil && !b.Privileged {
+		b.Groups = h.Groups
+	}
+	return h, nil
+}
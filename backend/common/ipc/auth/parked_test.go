@@ -0,0 +1,104 @@
+package auth
+
+import (
+	"bytes"
+	"encoding/binary"
+	"testing"
+)
+
+func buildParkedHandoff(t *testing.T, home string, loginUID uint32, groups []uint32) []byte {
+	t.Helper()
+	var buf bytes.Buffer
+	buf.Write([]byte{
+		ProtoMagic0,
+		ProtoMagic1,
+		ProtoMagic2,
+		ProtoVersion,
+		0, 0, 3, 232, // uid 1000
+		0, 0, 3, 232, // gid 1000
+		ProtoFlagVerbose,
+	})
+	for _, s := range []string{"session-1", "miguel", home} {
+		if err := writeLenStr(&buf, s); err != nil {
+			t.Fatalf("writeLenStr %q: %v", s, err)
+		}
+	}
+	_ = binary.Write(&buf, binary.BigEndian, loginUID)
+	_ = binary.Write(&buf, binary.BigEndian, uint16(len(groups)))
+	for _, g := range groups {
+		_ = binary.Write(&buf, binary.BigEndian, g)
+	}
+	return buf.Bytes()
+}
+
+func TestDecodeParkedHandoff_DecodesAllFields(t *testing.T) {
+	msg := buildParkedHandoff(t, "/home/miguel", 1000, []uint32{1000, 27, 100})
+
+	h, err := DecodeParkedHandoff(msg)
+	if err != nil {
+		t.Fatalf("DecodeParkedHandoff: %v", err)
+	}
+	if h.Bootstrap.Username != "miguel" || h.Bootstrap.SessionID != "session-1" {
+		t.Fatalf("session/user = %q/%q", h.Bootstrap.SessionID, h.Bootstrap.Username)
+	}
+	if !h.Bootstrap.Verbose || h.Bootstrap.Privileged {
+		t.Fatalf("flags = verbose:%v privileged:%v, want true/false", h.Bootstrap.Verbose, h.Bootstrap.Privileged)
+	}
+	if h.Home != "/home/miguel" || h.LoginUID != 1000 {
+		t.Fatalf("home/loginuid = %q/%d", h.Home, h.LoginUID)
+	}
+	if len(h.Groups) != 3 || h.Groups[0] != 1000 || h.Groups[1] != 27 || h.Groups[2] != 100 {
+		t.Fatalf("groups = %v", h.Groups)
+	}
+}
+
+func TestDecodeParkedHandoff_AllowsNoGroupsAndNoLoginUID(t *testing.T) {
+	h, err := DecodeParkedHandoff(buildParkedHandoff(t, "/root", ParkedNoLoginUID, nil))
+	if err != nil {
+		t.Fatalf("DecodeParkedHandoff: %v", err)
+	}
+	if h.LoginUID != ParkedNoLoginUID || len(h.Groups) != 0 {
+		t.Fatalf("loginuid/groups = %d/%v", h.LoginUID, h.Groups)
+	}
+}
+
+func TestDecodeParkedHandoff_RejectsTruncatedAndTrailingData(t *testing.T) {
+	msg := buildParkedHandoff(t, "/home/miguel", 1000, []uint32{1000, 27})
+
+	if _, err := DecodeParkedHandoff(msg[:len(msg)-2]); err == nil {
+		t.Fatal("expected error for truncated group list")
+	}
+	if _, err := DecodeParkedHandoff(append(msg, 0)); err == nil {
+		t.Fatal("expected error for trailing byte")
+	}
+}
+
+func TestDecodeParkedHandoff_RejectsTooManyGroups(t *testing.T) {
+	msg := buildParkedHandoff(t, "/home/miguel", 1000, nil)
+	binary.BigEndian.PutUint16(msg[len(msg)-2:], ParkedMaxGroups+1)
+
+	if _, err := DecodeParkedHandoff(msg); err == nil {
+		t.Fatal("expected error for oversized group count")
+	}
+}
+
+func TestDecodeParkedHandoff_TakesGroupsIntoBootstrap(t *testing.T) {
+	buf := buildExtendedBootstrap(t, appendBootEntry(nil, BootHome, []byte("/home/miguel")))
+	if err := writeLenStr(buf, "/home/miguel"); err != nil {
+		t.Fatalf("writeLenStr home: %v", err)
+	}
+	_ = binary.Write(buf, binary.BigEndian, uint32(1000))
+	_ = binary.Write(buf, binary.BigEndian, uint16(2))
+	_ = binary.Write(buf, binary.BigEndian, []uint32{1000, 27})
+
+	h, err := DecodeParkedHandoff(buf.Bytes())
+	if err != nil {
+		t.Fatalf("DecodeParkedHandoff: %v", err)
+	}
+	if h.Bootstrap.Home != "/home/miguel" {
+		t.Fatalf("bootstrap home = %q", h.Bootstrap.Home)
+	}
+	if len(h.Bootstrap.Groups) != 2 || h.Bootstrap.Groups[1] != 27 {
+		t.Fatalf("bootstrap groups = %v", h.Bootstrap.Groups)
+	}
+}
@@ -0,0 +1,55 @@
+// Session re-attach for LinuxIO auth/bridge communication.
+// Keep in sync with backend/auth/linuxio_protocol.h
+package auth
+
+import (
+	"bytes"
+	"errors"
+	"fmt"
+)
+
+// Session re-attach protocol constants
+const (
+	// ReattachEnv carries the grace period in milliseconds for a bridge that
+	// can be re-attached. Its re-attach socket (SOCK_SEQPACKET) is at
+	// ReattachFD, or arrives as the second SCM_RIGHTS fd of a parked handoff.
+	ReattachEnv = "LINUXIO_BRIDGE_REATTACH"
+	ReattachFD  = 6
+
+	// SharedEnv is set to "1" for a bridge that has the re-attach socket so
+	// further sessions of its user can be attached to it.
+	SharedEnv = "LINUXIO_BRIDGE_SHARED"
+
+	// Status byte the bridge replies with once it took the new connection.
+	ReattachStatusOK     = 0
+	ReattachStatusFailed = 1
+
+	// TicketHexLen is the length of a re-attach ticket: lowercase hex of 32
+	// random bytes.
+	TicketHexLen = 64
+
+	// First byte of every message on the re-attach socket.
+	AttachReattach = 0 // + client conn; status byte on the re-attach socket
+	AttachSession  = 1 // [len:2][session_id] + client conn, reply socket; open while the session lasts
+	AttachRelease  = 2 // no re-attach will come; no reply
+
+	// AttachMaxMessage bounds one message on the re-attach socket.
+	AttachMaxMessage = 1 + 2 + MaxSessionID
+)
+
+// DecodeAttachSession parses the payload of an AttachSession message (the
+// bytes after the kind) and returns the session ID of the new session.
+func DecodeAttachSession(payload []byte) (string, error) {
+	r := bytes.NewReader(payload)
+	sessionID, err := readLenStr(r)
+	if err != nil {
+		return "", fmt.Errorf("read session_id: %w", err)
+	}
+	if sessionID == "" || len(sessionID) > MaxSessionID {
+		return "", fmt.Errorf("invalid session_id length: %d", len(sessionID))
+	}
+	if r.Len() != 0 {
+		return "", errors.New("trailing data in attach message")
+	}
+	return sessionID, nil
+}
@@ -0,0 +1,42 @@
+package auth
+
+import (
+	"bytes"
+	"testing"
+)
+
+func buildAttachSession(t *testing.T, sessionID string) []byte {
+	t.Helper()
+	var buf bytes.Buffer
+	if err := writeLenStr(&buf, sessionID); err != nil {
+		t.Fatalf("writeLenStr %q: %v", sessionID, err)
+	}
+	return buf.Bytes()
+}
+
+func TestDecodeAttachSession_DecodesSessionID(t *testing.T) {
+	sessionID, err := DecodeAttachSession(buildAttachSession(t, "session-2"))
+	if err != nil {
+		t.Fatalf("DecodeAttachSession: %v", err)
+	}
+	if sessionID != "session-2" {
+		t.Fatalf("session_id = %q, want session-2", sessionID)
+	}
+}
+
+func TestDecodeAttachSession_RejectsMalformedPayloads(t *testing.T) {
+	msg := buildAttachSession(t, "session-2")
+
+	if _, err := DecodeAttachSession(msg[:len(msg)-1]); err == nil {
+		t.Fatal("expected error for truncated session_id")
+	}
+	if _, err := DecodeAttachSession(append(msg, 0)); err == nil {
+		t.Fatal("expected error for trailing byte")
+	}
+	if _, err := DecodeAttachSession(buildAttachSession(t, "")); err == nil {
+		t.Fatal("expected error for empty session_id")
+	}
+	if _, err := DecodeAttachSession(buildAttachSession(t, string(make([]byte, MaxSessionID+1)))); err == nil {
+		t.Fatal("expected error for oversized session_id")
+	}
+}
@@ -0,0 +1,160 @@
+// Live session table shared by linuxio-auth.
+// Keep in sync with backend/auth/linuxio_protocol.h
+package auth
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"os"
+	"sync/atomic"
+	"syscall"
+	"time"
+	"unsafe"
+)
+
+// Live session table constants
+const (
+	DefaultSessionTablePath = "/run/linuxio/sessions.shm"
+
+	SessionTableMagic      = 0x534f494c // "LIOS" on little-endian hosts
+	SessionTableVersion    = 1
+	SessionTableHeaderSize = 64
+	SessionTableSlotSize   = 128
+
+	// A slot still being written after this many tries is skipped
+	sessionSlotReadTries = 8
+)
+
+// LiveSession is one session listed in the live session table.
+type LiveSession struct {
+	SessionID    string
+	UID          uint32
+	Mode         uint8 // ModeUnprivileged or ModePrivileged
+	BridgePID    int
+	Started      time.Time
+	LastActivity time.Time // last login or re-attach
+}
+
+func (s LiveSession) IsPrivileged() bool {
+	return s.Mode == ModePrivileged
+}
+
+// SessionTable is a read-only mapping of the live session table. Sessions
+// reads it in place, without syscalls or locks.
+type SessionTable struct {
+	data  []byte
+	slots int
+}
+
+// OpenSessionTable maps the live session table at path.
+func OpenSessionTable(path string) (*SessionTable, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+
+	fi, err := f.Stat()
+	if err != nil {
+		return nil, err
+	}
+	size := fi.Size()
+	if size < SessionTableHeaderSize {
+		return nil, errors.New("session table too short")
+	}
+	data, err := syscall.Mmap(int(f.Fd()), 0, int(size), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		return nil, fmt.Errorf("map session table: %w", err)
+	}
+
+	magic := atomic.LoadUint32((*uint32)(unsafe.Pointer(&data[0])))
+	version := binary.NativeEndian.Uint32(data[4:8])
+	slots := int(binary.NativeEndian.Uint32(data[8:12]))
+	slotSize := binary.NativeEndian.Uint32(data[12:16])
+	switch {
+	case magic != SessionTableMagic:
+		err = errors.New("not a session table")
+	case version != SessionTableVersion:
+		err = fmt.Errorf("unsupported session table version %d", version)
+	case slotSize != SessionTableSlotSize:
+		err = fmt.Errorf("unexpected session table slot size %d", slotSize)
+	case int64(SessionTableHeaderSize)+int64(slots)*SessionTableSlotSize > size:
+		err = errors.New("session table truncated")
+	}
+	if err != nil {
+		_ = syscall.Munmap(data)
+		return nil, err
+	}
+	return &SessionTable{data: data, slots: slots}, nil
+}
+
+// Close unmaps the table.
+func (t *SessionTable) Close() error {
+	if t.data == nil {
+		return nil
+	}
+	err := syscall.Munmap(t.data)
+	t.data = nil
+	return err
+}
+
+// Sessions lists the live sessions.
+func (t *SessionTable) Sessions() []LiveSession {
+	var out []LiveSession
+	for i := 0; i < t.slots; i++ {
+		if s, ok := t.readSlot(i); ok {
+			out = append(out, s)
+		}
+	}
+	return out
+}
+
+// readSlot takes a consistent copy of slot i under its seqlock: it is kept
+// only if seq is the same even value before and after. Every word is loaded
+// atomically so the copy is ordered between the two loads of seq.
+func (t *SessionTable) readSlot(i int) (LiveSession, bool) {
+	base := SessionTableHeaderSize + i*SessionTableSlotSize
+	words := unsafe.Slice((*uint64)(unsafe.Pointer(&t.data[base])), SessionTableSlotSize/8)
+	seqp := (*uint32)(unsafe.Pointer(&t.data[base]))
+
+	var slot [SessionTableSlotSize]byte
+	for try := 0; try < sessionSlotReadTries; try++ {
+		seq := atomic.LoadUint32(seqp)
+		if seq&1 != 0 {
+			continue
+		}
+		for w := range words {
+			binary.NativeEndian.PutUint64(slot[w*8:], atomic.LoadUint64(&words[w]))
+		}
+		if atomic.LoadUint32(seqp) != seq {
+			continue
+		}
+		return decodeSessionSlot(slot[:])
+	}
+	return LiveSession{}, false
+}
+
+// decodeSessionSlot parses a slot copy:
+// [seq:4][owner:4][uid:4][mode:1][pad:3][bridge_pid:4][pad:4]
+// [started_us:8][last_activity_us:8][session_id:64]
+func decodeSessionSlot(slot []byte) (LiveSession, bool) {
+	owner := int32(binary.NativeEndian.Uint32(slot[4:8]))
+	bridgePID := int32(binary.NativeEndian.Uint32(slot[16:20]))
+	if owner == 0 || bridgePID == 0 {
+		return LiveSession{}, false
+	}
+	id := slot[40 : 40+64]
+	if n := bytes.IndexByte(id, 0); n >= 0 {
+		id = id[:n]
+	}
+	return LiveSession{
+		SessionID:    string(id),
+		UID:          binary.NativeEndian.Uint32(slot[8:12]),
+		Mode:         slot[12],
+		BridgePID:    int(bridgePID),
+		Started:      time.UnixMicro(int64(binary.NativeEndian.Uint64(slot[24:32]))),
+		LastActivity: time.UnixMicro(int64(binary.NativeEndian.Uint64(slot[32:40]))),
+	}, true
+}
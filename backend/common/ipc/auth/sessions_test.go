@@ -0,0 +1,80 @@
+package auth
+
+import (
+	"encoding/binary"
+	"os"
+	"path/filepath"
+	"testing"
+	"time"
+)
+
+type testSessionSlot struct {
+	seq       uint32
+	owner     int32
+	uid       uint32
+	mode      uint8
+	bridgePID int32
+	started   time.Time
+	sessionID string
+}
+
+func writeSessionTable(t *testing.T, magic uint32, slots []testSessionSlot) string {
+	t.Helper()
+	buf := make([]byte, SessionTableHeaderSize+len(slots)*SessionTableSlotSize)
+	binary.NativeEndian.PutUint32(buf[0:], magic)
+	binary.NativeEndian.PutUint32(buf[4:], SessionTableVersion)
+	binary.NativeEndian.PutUint32(buf[8:], uint32(len(slots)))
+	binary.NativeEndian.PutUint32(buf[12:], SessionTableSlotSize)
+	for i, s := range slots {
+		b := buf[SessionTableHeaderSize+i*SessionTableSlotSize:]
+		binary.NativeEndian.PutUint32(b[0:], s.seq)
+		binary.NativeEndian.PutUint32(b[4:], uint32(s.owner))
+		binary.NativeEndian.PutUint32(b[8:], s.uid)
+		b[12] = s.mode
+		binary.NativeEndian.PutUint32(b[16:], uint32(s.bridgePID))
+		binary.NativeEndian.PutUint64(b[24:], uint64(s.started.UnixMicro()))
+		binary.NativeEndian.PutUint64(b[32:], uint64(s.started.UnixMicro()))
+		copy(b[40:104], s.sessionID)
+	}
+	path := filepath.Join(t.TempDir(), "sessions.shm")
+	if err := os.WriteFile(path, buf, 0o600); err != nil {
+		t.Fatalf("write table: %v", err)
+	}
+	return path
+}
+
+func TestSessionTable_ListsLiveSlotsOnly(t *testing.T) {
+	started := time.UnixMicro(1_700_000_000_123_456)
+	path := writeSessionTable(t, SessionTableMagic, []testSessionSlot{
+		{}, // free
+		{seq: 2, owner: 100, uid: 1000, mode: ModePrivileged, bridgePID: 4242, started: started, sessionID: "sess-a"},
+		{seq: 3, owner: 101, uid: 1001, bridgePID: 4343, started: started, sessionID: "sess-b"}, // being written
+		{seq: 4, owner: 102}, // claimed, not filled in yet
+	})
+
+	table, err := OpenSessionTable(path)
+	if err != nil {
+		t.Fatalf("OpenSessionTable: %v", err)
+	}
+	defer table.Close()
+
+	sessions := table.Sessions()
+	if len(sessions) != 1 {
+		t.Fatalf("sessions = %+v, want one", sessions)
+	}
+	s := sessions[0]
+	if s.SessionID != "sess-a" || s.UID != 1000 || s.BridgePID != 4242 || !s.IsPrivileged() {
+		t.Fatalf("unexpected session %+v", s)
+	}
+	if !s.Started.Equal(started) || !s.LastActivity.Equal(started) {
+		t.Fatalf("started = %v, last activity = %v, want %v", s.Started, s.LastActivity, started)
+	}
+}
+
+func TestOpenSessionTable_RejectsBadMagic(t *testing.T) {
+	path := writeSessionTable(t, 0x12345678, []testSessionSlot{{}})
+	if table, err := OpenSessionTable(path); err == nil {
+		table.Close()
+		t.Fatal("expected an error for a file that is not a session table")
+	}
+}
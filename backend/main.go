@@ -303,6 +303,7 @@ func journalTermsForMode(mode string) []string {
 		"_SYSTEMD_UNIT=linuxio-bridge-socket-user.service",
 		"_SYSTEMD_UNIT=linuxio-auth.socket",
 		"_SYSTEMD_UNIT=linuxio-auth@.service",
+		"_SYSTEMD_UNIT=linuxio-auth.service",
 		"_SYSTEMD_UNIT=linuxio-issue.service",
 	}
 
@@ -320,6 +321,7 @@ func journalTermsForMode(mode string) []string {
 			"SYSLOG_IDENTIFIER=linuxio-auth",
 			"_SYSTEMD_UNIT=linuxio-auth.socket",
 			"_SYSTEMD_UNIT=linuxio-auth@.service",
+			"_SYSTEMD_UNIT=linuxio-auth.service",
 		}
 	}
 	return journalTerms
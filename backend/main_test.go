@@ -37,6 +37,7 @@ func TestJournalTermsForMode(t *testing.T) {
 				"SYSLOG_IDENTIFIER=linuxio-auth",
 				"_SYSTEMD_UNIT=linuxio-auth.socket",
 				"_SYSTEMD_UNIT=linuxio-auth@.service",
+				"_SYSTEMD_UNIT=linuxio-auth.service",
 			},
 		},
 		{
@@ -5,6 +5,8 @@ import (
 	"errors"
 	"log/slog"
 	"net/http"
+	"strconv"
+	"time"
 
 	authipc "github.com/mordilloSan/LinuxIO/backend/common/ipc/auth"
 	"github.com/mordilloSan/LinuxIO/backend/common/session"
@@ -45,6 +47,16 @@ func writeLoginError(w http.ResponseWriter, status int, code, message string) {
 	})
 }
 
+// retryAfterSeconds renders d as a Retry-After value: whole seconds, rounded
+// up, at least one.
+func retryAfterSeconds(d time.Duration) string {
+	secs := int64((d + time.Second - 1) / time.Second)
+	if secs < 1 {
+		secs = 1
+	}
+	return strconv.FormatInt(secs, 10)
+}
+
 func (h *Handlers) Login(w http.ResponseWriter, r *http.Request) {
 	select {
 	case h.authSem <- struct{}{}:
@@ -90,6 +102,39 @@ func (h *Handlers) Login(w http.ResponseWriter, r *http.Request) {
 				return
 			}
 		}
+		if errors.As(err, &authErr) && authErr.Code == authipc.ResultRateLimited {
+			slog.Warn("login rate limited",
+				"component", "auth",
+				"subsystem", "login",
+				"user", req.Username,
+				"remote_host", remoteHost)
+			msg := authErr.Message
+			if msg == "" {
+				msg = authErr.Code.DefaultMessage()
+			}
+			writeLoginError(w, http.StatusTooManyRequests, authErr.Code.APIName(), msg)
+			return
+		}
+		if errors.As(err, &authErr) && authErr.Code == authipc.ResultDeadlineExceeded {
+			slog.Warn("login timed out in the auth daemon",
+				"component", "auth",
+				"subsystem", "login",
+				"user", req.Username,
+				"remote_host", remoteHost)
+			writeLoginError(w, http.StatusGatewayTimeout, authErr.Code.APIName(), authErr.Code.DefaultMessage())
+			return
+		}
+		if errors.As(err, &authErr) && authErr.Code == authipc.ResultBusy {
+			slog.Warn("auth daemon busy, login shed",
+				"component", "auth",
+				"subsystem", "login",
+				"user", req.Username,
+				"remote_host", remoteHost,
+				"retry_after", authErr.RetryAfter)
+			w.Header().Set("Retry-After", retryAfterSeconds(authErr.RetryAfter))
+			writeLoginError(w, http.StatusServiceUnavailable, authErr.Code.APIName(), authErr.Code.DefaultMessage())
+			return
+		}
 		slog.Error("failed to start bridge",
 			"component", "auth",
 			"subsystem", "login",
@@ -421,3 +421,94 @@ func TestLogout_ClearsCookie_AndDeletesSession(t *testing.T) {
 		t.Fatalf("expected session deleted after logout")
 	}
 }
+
+func TestLogin_RateLimited_MapsTo429(t *testing.T) {
+	oldStart := startBridge
+	defer func() { startBridge = oldStart }()
+
+	startBridge = func(context.Context, *session.Manager, string, string, string, string, bool) (*session.Session, error) {
+		return nil, &bridge.AuthError{
+			Code:    authipc.ResultRateLimited,
+			Message: "too many failed login attempts; try again in 4 seconds",
+		}
+	}
+	cfg := session.DefaultConfig
+	sm := session.NewManager(session.New(), cfg)
+	h := &Handlers{SM: sm, authSem: make(chan struct{}, maxConcurrentLogins)}
+	r := newRouterForTests(h)
+
+	w := doJSON(r, "POST", "/auth/login", LoginRequest{Username: "miguel", Password: "bad"})
+	if w.Code != http.StatusTooManyRequests {
+		t.Fatalf("want 429, got %d: %s", w.Code, w.Body.String())
+	}
+	var resp map[string]any
+	if err := json.Unmarshal(w.Body.Bytes(), &resp); err != nil {
+		t.Fatalf("unmarshal response: %v", err)
+	}
+	if got := resp["code"]; got != "rate_limited" {
+		t.Fatalf("unexpected error code: %v", got)
+	}
+	if got := resp["error"]; got != "too many failed login attempts; try again in 4 seconds" {
+		t.Fatalf("unexpected error message: %v", got)
+	}
+}
+
+func TestLogin_DeadlineExceeded_MapsTo504(t *testing.T) {
+	oldStart := startBridge
+	defer func() { startBridge = oldStart }()
+
+	startBridge = func(context.Context, *session.Manager, string, string, string, string, bool) (*session.Session, error) {
+		return nil, &bridge.AuthError{
+			Code:    authipc.ResultDeadlineExceeded,
+			Message: "login deadline exceeded",
+		}
+	}
+	cfg := session.DefaultConfig
+	sm := session.NewManager(session.New(), cfg)
+	h := &Handlers{SM: sm, authSem: make(chan struct{}, maxConcurrentLogins)}
+	r := newRouterForTests(h)
+
+	w := doJSON(r, "POST", "/auth/login", LoginRequest{Username: "miguel", Password: "secret"})
+	if w.Code != http.StatusGatewayTimeout {
+		t.Fatalf("want 504, got %d: %s", w.Code, w.Body.String())
+	}
+	var resp map[string]any
+	if err := json.Unmarshal(w.Body.Bytes(), &resp); err != nil {
+		t.Fatalf("unmarshal response: %v", err)
+	}
+	if got := resp["code"]; got != "login_timeout" {
+		t.Fatalf("unexpected error code: %v", got)
+	}
+}
+
+func TestLogin_Busy_MapsTo503WithRetryAfter(t *testing.T) {
+	oldStart := startBridge
+	defer func() { startBridge = oldStart }()
+
+	startBridge = func(context.Context, *session.Manager, string, string, string, string, bool) (*session.Session, error) {
+		return nil, &bridge.AuthError{
+			Code:       authipc.ResultBusy,
+			Message:    "auth daemon busy",
+			RetryAfter: 1500 * time.Millisecond,
+		}
+	}
+	cfg := session.DefaultConfig
+	sm := session.NewManager(session.New(), cfg)
+	h := &Handlers{SM: sm, authSem: make(chan struct{}, maxConcurrentLogins)}
+	r := newRouterForTests(h)
+
+	w := doJSON(r, "POST", "/auth/login", LoginRequest{Username: "miguel", Password: "secret"})
+	if w.Code != http.StatusServiceUnavailable {
+		t.Fatalf("want 503, got %d: %s", w.Code, w.Body.String())
+	}
+	if got := w.Header().Get("Retry-After"); got != "2" {
+		t.Fatalf("want Retry-After 2, got %q", got)
+	}
+	var resp map[string]any
+	if err := json.Unmarshal(w.Body.Bytes(), &resp); err != nil {
+		t.Fatalf("unmarshal response: %v", err)
+	}
+	if got := resp["code"]; got != "auth_busy" {
+		t.Fatalf("unexpected error code: %v", got)
+	}
+}
@@ -2,7 +2,9 @@
 package bridge
 
 import (
+	"errors"
 	"fmt"
+	"log/slog"
 	"net"
 	"time"
 
@@ -18,19 +20,30 @@ const (
 	authDialTimeout  = 5 * time.Second
 	authReadTimeout  = 30 * time.Second // sudo check can take time
 	authWriteTimeout = 5 * time.Second
+
+	// The deadline logins carry, short of authReadTimeout so the auth daemon
+	// gives up and frees its worker before we do
+	authLoginDeadline = authReadTimeout - time.Second
 )
 
 // AuthResult contains the result of a successful authentication
 type AuthResult struct {
-	Conn       net.Conn // Connection to bridge (same socket, now connected to forked bridge)
+	Conn       net.Conn // Connection to the bridge
 	User       session.User
 	Privileged bool
+	Timings    []authipc.PhaseTiming // per-phase login latency inside linuxio-auth
+	Ticket     string                // re-attach ticket, empty if the auth daemon issued none
+
+	// upgrade delivers the privileged bridge of a login answered before its
+	// sudo probe finished (an empty reply if there is none); nil otherwise
+	upgrade <-chan controlReply
 }
 
 // AuthError carries a structured auth result from the auth daemon.
 type AuthError struct {
-	Code    authipc.AuthResultCode
-	Message string
+	Code       authipc.AuthResultCode
+	Message    string
+	RetryAfter time.Duration // how long the auth daemon asks us to back off, 0 if it did not
 }
 
 func (e *AuthError) Error() string {
@@ -44,11 +57,22 @@ func (e *AuthError) IsUnauthorized() bool {
 	return e != nil && e.Code.IsUnauthorized()
 }
 
-// Authenticate sends an auth request to the auth daemon.
-// On success, returns the connection which is now connected to the forked bridge
-// process (the auth daemon passed our FD to the bridge via dup2).
-// The caller owns the connection and must close it.
+// Authenticate sends an auth request to the auth daemon, on its control
+// connection when the daemon offers one and on a connection of its own
+// otherwise. On success, returns the connection to the bridge; the caller
+// owns it and must close it.
 func Authenticate(req *authipc.AuthRequest) (*AuthResult, error) {
+	result, err := authControl.authenticate(req)
+	if !errors.Is(err, errControlUnavailable) {
+		return result, err
+	}
+	return authenticateSingleShot(req)
+}
+
+// authenticateSingleShot sends req on a new connection to the auth socket
+// (protocol v3). On success that connection is now connected to the forked
+// bridge process (the auth daemon passed our FD to the bridge via dup2).
+func authenticateSingleShot(req *authipc.AuthRequest) (*AuthResult, error) {
 	// Connect to daemon
 	conn, err := net.DialTimeout("unix", DefaultAuthSocketPath, authDialTimeout)
 	if err != nil {
@@ -81,28 +105,52 @@ func Authenticate(req *authipc.AuthRequest) (*AuthResult, error) {
 
 	if !resp.IsOK() {
 		conn.Close()
-		errMsg := resp.Error
-		if errMsg == "" {
-			errMsg = resp.ResultCode.DefaultMessage()
-		}
-		return nil, &AuthError{
-			Code:    resp.ResultCode,
-			Message: errMsg,
-		}
+		return nil, authResponseError(resp)
 	}
 
 	// Clear deadlines for Yamux use
-	privileged := resp.IsPrivileged()
 	if err = conn.SetDeadline(time.Time{}); err != nil {
 		conn.Close()
 		return nil, fmt.Errorf("failed to clear deadlines: %w", err)
 	}
 
+	return newAuthResult(conn, resp), nil
+}
+
+// authResponseError is the error for a response that is not ok.
+func authResponseError(resp *authipc.AuthResponse) error {
+	errMsg := resp.Error
+	if errMsg == "" {
+		errMsg = resp.ResultCode.DefaultMessage()
+	}
+	return &AuthError{
+		Code:       resp.ResultCode,
+		Message:    errMsg,
+		RetryAfter: resp.RetryAfter,
+	}
+}
+
+func newAuthResult(conn net.Conn, resp *authipc.AuthResponse) *AuthResult {
 	return &AuthResult{
 		Conn:       conn,
 		User:       resp.User,
-		Privileged: privileged,
-	}, nil
+		Privileged: resp.IsPrivileged(),
+		Timings:    resp.Timings,
+		Ticket:     resp.Ticket,
+	}
+}
+
+// logLoginTimings reports how long each login phase took inside linuxio-auth.
+func logLoginTimings(username string, timings []authipc.PhaseTiming) {
+	if len(timings) == 0 {
+		return
+	}
+	attrs := make([]any, 0, 2+2*len(timings))
+	attrs = append(attrs, "user", username)
+	for _, t := range timings {
+		attrs = append(attrs, t.Phase.Name(), t.Duration)
+	}
+	slog.Debug("auth daemon login timings", attrs...)
 }
 
 // BuildRequest creates a Request from auth parameters.
@@ -113,5 +161,35 @@ func BuildRequest(username, sessionID, password, remoteHost string, verbose bool
 		SessionID:  sessionID,
 		RemoteHost: remoteHost,
 		Verbose:    verbose,
+		Timing:     true,
+		WantTicket: true,
+		Upgrade:    true,
+		Deadline:   authLoginDeadline,
+	}
+}
+
+// BuildReattachRequest creates a Request that re-attaches a new connection
+// to the running bridge of sessionID.
+func BuildReattachRequest(username, sessionID, ticket, remoteHost string) *authipc.AuthRequest {
+	return &authipc.AuthRequest{
+		User:       username,
+		Password:   ticket,
+		SessionID:  sessionID,
+		RemoteHost: remoteHost,
+		Reattach:   true,
+		WantTicket: true,
+	}
+}
+
+// BuildReleaseRequest creates a Request that gives up the re-attach ticket
+// of sessionID, letting its bridge exit once its connection is closed.
+func BuildReleaseRequest(username, sessionID, ticket, remoteHost string) *authipc.AuthRequest {
+	return &authipc.AuthRequest{
+		User:       username,
+		Password:   ticket,
+		SessionID:  sessionID,
+		RemoteHost: remoteHost,
+		Reattach:   true,
+		Release:    true,
 	}
 }
@@ -18,12 +18,24 @@ import (
 	"github.com/mordilloSan/LinuxIO/backend/common/version"
 )
 
-// yamuxSessions manages persistent yamux sessions per session ID
+// yamuxSessions manages persistent yamux sessions per session ID, with the
+// re-attach ticket of each bridge that has one.
 var yamuxSessions = struct {
 	sync.RWMutex
 	sessions map[string]*relay.YamuxSession
+	tickets  map[string]reattachTicket
 }{
 	sessions: make(map[string]*relay.YamuxSession),
+	tickets:  make(map[string]reattachTicket),
+}
+
+// reattachTicket lets a dropped bridge connection be re-attached without
+// the password. linuxio-auth issues one per login and a new one on every
+// re-attach; it only does so when it supervises sessions.
+type reattachTicket struct {
+	ticket     string
+	username   string
+	remoteHost string
 }
 
 // validateBridgeHash computes SHA256 of the bridge binary and compares to expected.
@@ -156,7 +168,8 @@ func StartBridge(ctx context.Context, sm *session.Manager, sessionID, username,
 		return nil, fmt.Errorf("failed to create session: %w", err)
 	}
 
-	if attachErr := attachBridgeSession(sess, result.Conn); attachErr != nil {
+	ticket := reattachTicket{ticket: result.Ticket, username: sess.User.Username, remoteHost: remoteHost}
+	if attachErr := attachBridgeSession(sess, result.Conn, ticket); attachErr != nil {
 		if delErr := sm.DeleteSession(sess.SessionID, session.ReasonManual); delErr != nil {
 			slog.Warn("failed to cleanup session after bridge setup failure",
 				"session_id", sess.SessionID,
@@ -184,11 +197,63 @@ func StartBridge(ctx context.Context, sm *session.Manager, sessionID, username,
 	slog.Debug("bridge launch via daemon acknowledged",
 		"user", sess.User.Username,
 		"privileged", result.Privileged)
+	logLoginTimings(sess.User.Username, result.Timings)
+	if result.upgrade != nil {
+		go awaitPrivilegeUpgrade(sm, sess.SessionID, sess.User.Username, remoteHost, result.upgrade)
+	}
 
 	return sess, nil
 }
 
-func attachBridgeSession(sess *session.Session, conn net.Conn) error {
+// awaitPrivilegeUpgrade moves a session that linuxio-auth answered before
+// its sudo probe finished over to the privileged bridge it starts once sudo
+// allowed the user. Streams still open on the unprivileged bridge fail with
+// its connection; the session itself carries on.
+func awaitPrivilegeUpgrade(sm *session.Manager, sessionID, username, remoteHost string, upgrade <-chan controlReply) {
+	reply, ok := <-upgrade
+	if !ok || len(reply.payload) == 0 {
+		slog.Debug("session stays unprivileged", "session_id", sessionID)
+		return
+	}
+	result, err := controlResult(reply)
+	if err == nil && !result.Privileged {
+		result.Conn.Close()
+		err = fmt.Errorf("upgrade is not privileged")
+	}
+	if err != nil {
+		slog.Warn("privilege upgrade failed", "session_id", sessionID, "error", err)
+		return
+	}
+
+	sess, err := sm.GetSession(sessionID)
+	if err == nil {
+		_, err = GetYamuxSession(sessionID)
+	}
+	if err != nil {
+		// The session ended while sudo was deciding
+		result.Conn.Close()
+		return
+	}
+	ticket := reattachTicket{ticket: result.Ticket, username: username, remoteHost: remoteHost}
+	if err := attachBridgeSession(sess, result.Conn, ticket); err != nil {
+		slog.Warn("privilege upgrade failed", "session_id", sessionID, "error", err)
+		return
+	}
+	if err := sm.SetPrivileged(sessionID, true); err != nil {
+		slog.Warn("failed to persist privilege upgrade", "session_id", sessionID, "error", err)
+	}
+	caps, err := fetchSessionCapabilities(context.Background(), sessionID)
+	if err != nil {
+		slog.Warn("failed to fetch session capabilities after privilege upgrade",
+			"session_id", sessionID,
+			"error", err)
+	} else if err := sm.SetCapabilities(sessionID, caps); err != nil {
+		slog.Warn("failed to persist session capabilities", "session_id", sessionID, "error", err)
+	}
+	slog.Info("session upgraded to privileged bridge", "session_id", sessionID, "user", username)
+}
+
+func attachBridgeSession(sess *session.Session, conn net.Conn, ticket reattachTicket) error {
 	// Create yamux client session from the connection
 	// (auth daemon forked bridge and passed our FD to it via dup2)
 	yamuxSession, err := relay.NewYamuxClient(conn)
@@ -197,25 +262,29 @@ func attachBridgeSession(sess *session.Session, conn net.Conn) error {
 		return fmt.Errorf("failed to create yamux session: %w", err)
 	}
 
-	var old *relay.YamuxSession
-	yamuxSessions.Lock()
-	if existing, exists := yamuxSessions.sessions[sess.SessionID]; exists {
-		delete(yamuxSessions.sessions, sess.SessionID)
-		old = existing
-	}
-	yamuxSessions.Unlock()
-
-	if old != nil {
-		old.Close()
-	}
-
+	// The new connection is in place before the one it replaces closes, so
+	// the old one's OnClose leaves the session alone
 	yamuxSessions.Lock()
 	yamuxSession.SetOnClose(func() {
 		yamuxSessions.Lock()
+		current, exists := yamuxSessions.sessions[sess.SessionID]
+		if exists && current != yamuxSession {
+			// Replaced by a newer bridge connection; the session lives on there
+			yamuxSessions.Unlock()
+			return
+		}
 		delete(yamuxSessions.sessions, sess.SessionID)
+		stored, canReattach := yamuxSessions.tickets[sess.SessionID]
+		delete(yamuxSessions.tickets, sess.SessionID)
 		yamuxSessions.Unlock()
 		slog.Debug("yamux session closed and removed", "session_id", sess.SessionID)
 
+		// The connection may have dropped while the bridge lives on
+		if canReattach {
+			go reattachBridgeSession(sess, stored)
+			return
+		}
+
 		// Terminate the session when bridge dies
 		// This triggers session deletion which closes the WebSocket
 		if err := sess.Terminate(session.ReasonBridgeFailure); err != nil {
@@ -224,12 +293,56 @@ func attachBridgeSession(sess *session.Session, conn net.Conn) error {
 				"error", err)
 		}
 	})
+	old := yamuxSessions.sessions[sess.SessionID]
 	yamuxSessions.sessions[sess.SessionID] = yamuxSession
+	if ticket.ticket != "" {
+		yamuxSessions.tickets[sess.SessionID] = ticket
+	} else {
+		delete(yamuxSessions.tickets, sess.SessionID)
+	}
 	yamuxSessions.Unlock()
 
+	if old != nil {
+		old.Close()
+	}
+
 	return nil
 }
 
+// reattachBridgeSession connects sess to its running bridge again after
+// its connection dropped. If the bridge is gone too, the session ends as it
+// always has.
+func reattachBridgeSession(sess *session.Session, ticket reattachTicket) {
+	req := BuildReattachRequest(ticket.username, sess.SessionID, ticket.ticket, ticket.remoteHost)
+	result, err := Authenticate(req)
+	if err == nil {
+		next := reattachTicket{ticket: result.Ticket, username: ticket.username, remoteHost: ticket.remoteHost}
+		err = attachBridgeSession(sess, result.Conn, next)
+	}
+	if err != nil {
+		slog.Debug("bridge re-attach failed", "session_id", sess.SessionID, "error", err)
+		if termErr := sess.Terminate(session.ReasonBridgeFailure); termErr != nil {
+			slog.Warn("failed to terminate session after bridge closure",
+				"session_id", sess.SessionID,
+				"error", termErr)
+		}
+		return
+	}
+	slog.Info("bridge connection re-attached", "session_id", sess.SessionID, "user", sess.User.Username)
+}
+
+// releaseBridgeSession gives up the ticket of a session that was closed on
+// purpose, so its bridge exits now instead of waiting out the grace period.
+func releaseBridgeSession(sessionID string, ticket reattachTicket) {
+	req := BuildReleaseRequest(ticket.username, sessionID, ticket.ticket, ticket.remoteHost)
+	result, err := Authenticate(req)
+	if err != nil {
+		slog.Debug("bridge release failed", "session_id", sessionID, "error", err)
+		return
+	}
+	result.Conn.Close()
+}
+
 // ============================================================================
 // Communication with the bridge
 // ============================================================================
@@ -260,15 +373,21 @@ func GetYamuxSession(sessionID string) (*relay.YamuxSession, error) {
 func CloseYamuxSession(sessionID string) {
 	// Remove from map first, then close OUTSIDE the lock.
 	// This prevents deadlock: Close() triggers OnClose callback which tries to Lock().
+	// Dropping the ticket first keeps the close from being re-attached.
 	yamuxSessions.Lock()
 	session, exists := yamuxSessions.sessions[sessionID]
 	if exists {
 		delete(yamuxSessions.sessions, sessionID)
 	}
+	ticket, hasTicket := yamuxSessions.tickets[sessionID]
+	delete(yamuxSessions.tickets, sessionID)
 	yamuxSessions.Unlock()
 
 	if exists {
 		session.Close()
 		slog.Debug("yamux session closed", "session_id", sessionID)
 	}
+	if hasTicket {
+		go releaseBridgeSession(sessionID, ticket)
+	}
 }
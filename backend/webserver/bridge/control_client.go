@@ -0,0 +1,287 @@
+package bridge
+
+import (
+	"bytes"
+	"errors"
+	"fmt"
+	"log/slog"
+	"net"
+	"os"
+	"sync"
+	"syscall"
+	"time"
+
+	authipc "github.com/mordilloSan/LinuxIO/backend/common/ipc/auth"
+)
+
+const (
+	// DefaultAuthControlSocketPath is where the linuxio-auth daemon takes
+	// long-lived control connections (protocol v4)
+	DefaultAuthControlSocketPath = "/run/linuxio/auth-control.sock"
+
+	// How long logins use the single-shot socket after the control socket
+	// could not be reached (Accept=yes mode, or the daemon has it disabled)
+	controlRedialInterval = 30 * time.Second
+)
+
+// errControlUnavailable means the login was not sent on the control
+// connection, so it can go to the single-shot socket instead.
+var errControlUnavailable = errors.New("auth control socket unavailable")
+
+// controlReply is the response to one login with the bridge connection fd
+// that came along with it, -1 if none. A response that announces a
+// privilege upgrade gets the channel the CtlUpgrade is delivered on.
+type controlReply struct {
+	payload []byte
+	fd      int
+	upgrade chan controlReply
+}
+
+// controlClient pipelines logins over one persistent connection to the
+// auth daemon. Each login waits for the response carrying its request ID;
+// the daemon answers them as they finish, in any order.
+type controlClient struct {
+	mu       sync.Mutex
+	conn     *net.UnixConn
+	nextID   uint32
+	pending  map[uint32]chan controlReply
+	upgrades map[uint32]chan controlReply // answered logins whose upgrade is still to come
+	retryAt  time.Time
+}
+
+var authControl = &controlClient{}
+
+// authenticate runs req on the control connection, dialing it first if
+// needed. It returns errControlUnavailable if req was never sent.
+func (c *controlClient) authenticate(req *authipc.AuthRequest) (*AuthResult, error) {
+	id, ch, err := c.send(req)
+	if err != nil {
+		return nil, err
+	}
+
+	timer := time.NewTimer(authReadTimeout)
+	defer timer.Stop()
+	select {
+	case reply, ok := <-ch:
+		if !ok {
+			return nil, errors.New("auth daemon control connection lost")
+		}
+		return controlResult(reply)
+	case <-timer.C:
+		c.forget(id, ch)
+		return nil, errors.New("failed to read auth response: timed out")
+	}
+}
+
+func (c *controlClient) send(req *authipc.AuthRequest) (uint32, chan controlReply, error) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	if c.conn == nil {
+		if time.Now().Before(c.retryAt) {
+			return 0, nil, errControlUnavailable
+		}
+		conn, err := net.DialTimeout("unixpacket", DefaultAuthControlSocketPath, authDialTimeout)
+		if err != nil {
+			slog.Debug("auth control socket unavailable, using single-shot logins", "error", err)
+			c.retryAt = time.Now().Add(controlRedialInterval)
+			return 0, nil, errControlUnavailable
+		}
+		c.conn = conn.(*net.UnixConn)
+		c.pending = make(map[uint32]chan controlReply)
+		c.upgrades = make(map[uint32]chan controlReply)
+		go c.readLoop(c.conn)
+	}
+
+	c.nextID++
+	id := c.nextID
+	frame, err := authipc.EncodeControlLogin(id, req)
+	if err != nil {
+		return 0, nil, err
+	}
+	defer clear(frame) // holds the password
+
+	if err := c.conn.SetWriteDeadline(time.Now().Add(authWriteTimeout)); err != nil {
+		c.dropLocked(c.conn)
+		return 0, nil, errControlUnavailable
+	}
+	// One packet: it is either sent whole or not at all
+	if _, err := c.conn.Write(frame); err != nil {
+		slog.Debug("auth control connection failed, using single-shot login", "error", err)
+		c.dropLocked(c.conn)
+		return 0, nil, errControlUnavailable
+	}
+	ch := make(chan controlReply, 1)
+	c.pending[id] = ch
+	return id, ch, nil
+}
+
+// forget gives up on the login id after a timeout, closing the bridge
+// connection of a response that raced in.
+func (c *controlClient) forget(id uint32, ch chan controlReply) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	if _, waiting := c.pending[id]; waiting {
+		delete(c.pending, id)
+		return
+	}
+	// readLoop delivers or closes ch while holding mu, so this cannot block
+	reply, ok := <-ch
+	if !ok {
+		return
+	}
+	if reply.fd >= 0 {
+		_ = syscall.Close(reply.fd)
+	}
+	if reply.upgrade != nil {
+		delete(c.upgrades, id)
+		select {
+		case up := <-reply.upgrade:
+			if up.fd >= 0 {
+				_ = syscall.Close(up.fd)
+			}
+		default:
+		}
+	}
+}
+
+// dropLocked closes conn and fails the logins still waiting on it. The
+// caller holds mu.
+func (c *controlClient) dropLocked(conn *net.UnixConn) {
+	if c.conn != conn {
+		return
+	}
+	c.conn = nil
+	for _, ch := range c.pending {
+		close(ch)
+	}
+	for _, ch := range c.upgrades {
+		close(ch)
+	}
+	c.pending = nil
+	c.upgrades = nil
+	conn.Close()
+}
+
+func (c *controlClient) readLoop(conn *net.UnixConn) {
+	buf := make([]byte, authipc.ControlMaxFrame)
+	oob := make([]byte, syscall.CmsgSpace(4))
+	for {
+		n, oobn, flags, _, err := conn.ReadMsgUnix(buf, oob)
+		if err != nil || n == 0 {
+			slog.Debug("auth control connection closed", "error", err)
+			c.mu.Lock()
+			c.dropLocked(conn)
+			c.mu.Unlock()
+			return
+		}
+
+		fd := -1
+		if msgs, parseErr := syscall.ParseSocketControlMessage(oob[:oobn]); parseErr == nil {
+			for i := range msgs {
+				fds, rightsErr := syscall.ParseUnixRights(&msgs[i])
+				if rightsErr != nil {
+					continue
+				}
+				for _, f := range fds {
+					if fd < 0 {
+						fd = f
+					} else {
+						_ = syscall.Close(f)
+					}
+				}
+			}
+		}
+		if fd >= 0 {
+			syscall.CloseOnExec(fd)
+		}
+
+		frame, err := authipc.DecodeControlFrame(buf[:n])
+		if err == nil && flags&(syscall.MSG_TRUNC|syscall.MSG_CTRUNC) != 0 {
+			err = errors.New("truncated control frame")
+		}
+		if err == nil && frame.Type != authipc.CtlResponse && frame.Type != authipc.CtlUpgrade {
+			err = fmt.Errorf("unexpected control frame type %d", frame.Type)
+		}
+		if err != nil {
+			slog.Warn("dropping auth control frame", "error", err)
+			if fd >= 0 {
+				_ = syscall.Close(fd)
+			}
+			continue
+		}
+
+		reply := controlReply{payload: append([]byte(nil), frame.Payload...), fd: fd}
+		c.mu.Lock()
+		var ch chan controlReply
+		var waiting bool
+		if frame.Type == authipc.CtlUpgrade {
+			ch, waiting = c.upgrades[frame.RequestID]
+			delete(c.upgrades, frame.RequestID)
+		} else if ch, waiting = c.pending[frame.RequestID]; waiting {
+			delete(c.pending, frame.RequestID)
+			if announcesUpgrade(reply.payload) {
+				reply.upgrade = make(chan controlReply, 1)
+				c.upgrades[frame.RequestID] = reply.upgrade
+			}
+		}
+		if waiting {
+			ch <- reply
+		}
+		c.mu.Unlock()
+		if !waiting && fd >= 0 {
+			_ = syscall.Close(fd) // the login timed out
+		}
+	}
+}
+
+// announcesUpgrade reports whether payload is an ok response with
+// authipc.RespFlagUpgrade, after which the daemon sends a CtlUpgrade.
+func announcesUpgrade(payload []byte) bool {
+	return len(payload) >= authipc.AuthRespHeaderSize && payload[4] == authipc.StatusOK &&
+		payload[7]&authipc.RespFlagUpgrade != 0
+}
+
+// controlResult turns a relayed response into an AuthResult; on success
+// the attached fd is the bridge connection.
+func controlResult(reply controlReply) (*AuthResult, error) {
+	var conn net.Conn
+	if reply.fd >= 0 {
+		f := os.NewFile(uintptr(reply.fd), "bridge-conn")
+		var err error
+		conn, err = net.FileConn(f)
+		f.Close()
+		if err != nil {
+			return nil, fmt.Errorf("bridge connection: %w", err)
+		}
+	}
+
+	resp, err := authipc.ReadAuthResponse(bytes.NewReader(reply.payload))
+	if err != nil || !resp.IsOK() || conn == nil {
+		if conn != nil {
+			conn.Close()
+		}
+		if reply.upgrade != nil {
+			go discardUpgrade(reply.upgrade)
+		}
+		switch {
+		case err != nil:
+			return nil, fmt.Errorf("failed to read auth response: %w", err)
+		case !resp.IsOK():
+			return nil, authResponseError(resp)
+		default:
+			return nil, errors.New("auth daemon sent no bridge connection")
+		}
+	}
+	result := newAuthResult(conn, resp)
+	result.upgrade = reply.upgrade
+	return result, nil
+}
+
+// discardUpgrade waits for a privilege upgrade nobody will take and closes
+// its bridge connection, which ends that bridge.
+func discardUpgrade(upgrade <-chan controlReply) {
+	if reply, ok := <-upgrade; ok && reply.fd >= 0 {
+		_ = syscall.Close(reply.fd)
+	}
+}
@@ -68,6 +68,12 @@ const loginErrorMessage = (
       return "This account is not allowed to sign in from the web interface.";
     case "bridge_error":
       return "LinuxIO authenticated you, but could not start the session bridge. Please try again.";
+    case "rate_limited":
+      return "Too many failed sign-in attempts from this address. Wait a moment and try again.";
+    case "login_timeout":
+      return "Sign-in took too long to complete. Please try again.";
+    case "auth_busy":
+      return "LinuxIO is handling too many sign-ins right now. Wait a moment and try again.";
     case "internal_error":
       return "LinuxIO could not complete sign-in. Please try again.";
     default:
@@ -111,6 +111,9 @@ export type LoginErrorCode =
   | "password_expired"
   | "access_denied"
   | "bridge_error"
+  | "rate_limited"
+  | "login_timeout"
+  | "auth_busy"
   | "internal_error"
   | "login_failed";
 
@@ -353,7 +353,7 @@ install_systemd_files() {
     Show 2 "Installing systemd service files..."
 
     for file in linuxio.target linuxio-webserver.socket linuxio-webserver.service \
-        linuxio-auth.socket linuxio-auth@.service \
+        linuxio-auth.socket linuxio-auth@.service linuxio-auth.service \
         linuxio-bridge-socket-user.service \
         linuxio-issue.service ; do
         Show 2 "Downloading ${file}..."
@@ -82,7 +82,7 @@ Show 0 "Binaries installed to /usr/local/bin"
 # Systemd
 Show 2 "Installing systemd service files..."
 for file in linuxio.target linuxio-webserver.service linuxio-webserver.socket \
-            linuxio-auth.socket linuxio-auth@.service \
+            linuxio-auth.socket linuxio-auth@.service linuxio-auth.service \
             linuxio-bridge-socket-user.service \
             linuxio-issue.service; do
     if [[ -f "$REPO_ROOT/packaging/systemd/$file" ]]; then